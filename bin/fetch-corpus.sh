@@ -0,0 +1,19 @@
+#!/usr/bin/env sh
+
+# Downloads the corpora listed in README.md into $1 for use with mmc-bench.
+
+set -e
+
+DIRECTORY=${1:-corpus}
+mkdir -p ${DIRECTORY}
+cd ${DIRECTORY}
+
+curl -fsSL http://corpus.canterbury.ac.nz/resources/cantrbry.tar.gz | tar -xzf -
+
+curl -fsSLO http://sun.aei.polsl.pl/~sdeor/corpus/silesia.zip
+unzip -oq silesia.zip
+rm silesia.zip
+
+curl -fsSLO http://mattmahoney.net/dc/enwik8.zip
+unzip -oq enwik8.zip
+rm enwik8.zip
@@ -0,0 +1,30 @@
+# cmake -DSOURCE_DIR=<mmc source directory> -DOUTPUT=<file> -P TrainingCorpus.cmake
+#
+# writes the corpus that pgo-train runs mmc-bench over when MMC_PGO_CORPUS is
+# empty: mmc's own sources and README, repeated to 4MB. each repeat is further
+# back than a deflate window reaches, and a corpus of small files would leave
+# the loops that large files spend their time in, like mmap-inflate's fast
+# path, looking cold
+
+file(GLOB MMC_CORPUS_FILES
+    ${SOURCE_DIR}/README.md
+    ${SOURCE_DIR}/include/*/*.h
+    ${SOURCE_DIR}/src/*.c
+    ${SOURCE_DIR}/src/*.h
+)
+
+set(MMC_CORPUS_CONTENTS "")
+
+foreach(MMC_CORPUS_FILE IN LISTS MMC_CORPUS_FILES)
+    file(READ ${MMC_CORPUS_FILE} MMC_CORPUS_FILE_CONTENTS)
+    string(APPEND MMC_CORPUS_CONTENTS "${MMC_CORPUS_FILE_CONTENTS}")
+endforeach()
+
+string(LENGTH "${MMC_CORPUS_CONTENTS}" MMC_CORPUS_LENGTH)
+set(MMC_CORPUS_SIZE 0)
+file(WRITE ${OUTPUT} "")
+
+while(MMC_CORPUS_SIZE LESS 4000000)
+    file(APPEND ${OUTPUT} "${MMC_CORPUS_CONTENTS}")
+    math(EXPR MMC_CORPUS_SIZE "${MMC_CORPUS_SIZE} + ${MMC_CORPUS_LENGTH}")
+endwhile()
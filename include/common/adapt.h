@@ -0,0 +1,69 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_ADAPT_H
+#define COMMON_ADAPT_H
+
+#include <common/error.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// uncompressed bytes between level adjustments
+#define ADAPT_CHUNK_SIZE ((size_t)1 << 20)
+
+// picks a compression level once per chunk of input. writeback of each
+// chunk's output is started once it has been compressed and waited for after
+// the next chunk has been. any wait means the output drains slower than the
+// codec fills it and the CPU sat idle, so the level goes up. no wait means the
+// codec is the bottleneck, so the level goes down
+typedef struct LevelAdapter {
+  int min_level;
+  int max_level;
+  int level;
+  // for codecs like zstd where 0 selects the default level
+  bool skip_zero;
+
+  bool is_in_chunk;
+  // input left before the end of the current chunk
+  size_t chunk_remaining;
+  double chunk_start_seconds;
+
+  // offsets into the output file. writeback of everything before
+  // writeback_offset has been started and waited for up to synced_offset
+  size_t synced_offset;
+  size_t writeback_offset;
+} LevelAdapter;
+
+// level is clamped to [min_level, max_level]
+LevelAdapter make_level_adapter(int min_level, int max_level, int level,
+                                bool skip_zero);
+// starts a chunk if none is in progress and returns how much of available
+// input belongs to it. callers subtract what they consume from
+// chunk_remaining and end the chunk once it reaches zero
+size_t begin_adapter_chunk(LevelAdapter *adapter, size_t available);
+// waits for the previous chunk's output to be written back, starts writeback
+// for this one's, and updates level. output_end is the offset of the first
+// unused byte in the mapping
+Error end_adapter_chunk(LevelAdapter *adapter,
+                        const FileAndMapping *output_file, size_t output_end);
+
+#endif
@@ -22,17 +22,10 @@
 #define COMMON_APP_H
 
 #include <common/argparse.h>
-#include <common/file.h>
+#include <common/codec.h>
 
 #include <stddef.h>
 
-typedef struct AppIOState AppIOState;
-
-typedef size_t(AppSizeFunc)(size_t input_file_size, void *arg);
-typedef Error(AppInitFunc)(AppIOState *app_state, void *arg);
-typedef Error(AppRunFunc)(AppIOState *app_state, bool *finished, void *arg);
-typedef void(AppCleanupFunc)(AppIOState *app_state, void *arg);
-
 typedef struct AppParams {
   const char *executable_name;
   const char *version;
@@ -46,19 +39,24 @@ typedef struct AppParams {
   AppInitFunc *init;
   AppRunFunc *run;
   AppCleanupFunc *cleanup;
+  // compression only, called after size with --max-memory. NULL if the
+  // codec's memory is negligible
+  AppFitMemoryFunc *fit_memory;
+  // compression only, called after size with --threads. NULL if the codec
+  // can't compress chunks of the input on their own
+  AppChunkCodecFunc *chunk_codec;
+  // decompression only, called after size with --threads. NULL if the codec
+  // can only decompress on one thread
+  AppParallelRunFunc *parallel_run;
+  // decompression only, called after size. NULL if streams never have one
+  AppHasChecksumFunc *has_checksum;
+  // decompression only, called after size. bytes of history that the input
+  // refers back to, or NULL if unknown
+  AppSizeFunc *window_size;
 
   void *arg;
 } AppParams;
 
-struct AppIOState {
-  FileAndMapping input_file;
-  FileAndMapping output_file;
-
-  size_t input_mapping_first_unused_offset;
-  size_t output_mapping_first_unused_offset;
-  size_t output_bytes_written;
-};
-
 int run_compression_app(int argc, const char *const argv[argc],
                         const AppParams *params);
 int run_decompression_app(int argc, const char *const argv[argc],
@@ -0,0 +1,53 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_ARENA_H
+#define COMMON_ARENA_H
+
+#include <common/error.h>
+
+#include <stddef.h>
+
+// reserved up front, but only touched pages are backed by memory
+#define ARENA_DEFAULT_RESERVE_SIZE ((size_t)256 << 20)
+
+// bump allocator for codec working memory, backed by one anonymous mapping
+// that is aligned for and advised to use transparent huge pages unless it is
+// smaller than one. requests that don't fit fall back to malloc
+typedef struct Arena {
+  char *base;
+  size_t size;
+
+  size_t used;
+  // start of the newest allocation, which is the only one free gives back
+  size_t last_offset;
+} Arena;
+
+Error create_arena(size_t reserve_size, Arena *arena);
+void *arena_allocate(Arena *arena, size_t size);
+// a no-op unless pointer came from malloc or is the newest allocation
+void arena_free(Arena *arena, void *pointer);
+void free_arena(Arena arena);
+// memory that allocating size bytes from an arena of that size keeps
+// resident, which is whole huge pages if transparent huge pages are in use and
+// the arena is at least one
+size_t arena_resident_size(size_t size);
+
+#endif
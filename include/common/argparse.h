@@ -40,6 +40,16 @@ typedef struct IntegerArgumentParser {
   long long value;
 } IntegerArgumentParser;
 
+// parses MIN:MAX, where both ends are in [min_value, max_value] and MIN <= MAX
+typedef struct RangeArgumentParser {
+  ArgumentParser argument_parser;
+  long long min_value;
+  long long max_value;
+
+  long long low;
+  long long high;
+} RangeArgumentParser;
+
 typedef struct StringArgumentParser {
   ArgumentParser argument_parser;
   const char *const *possible_values;
@@ -58,13 +68,22 @@ typedef struct PositionalArgument {
   const char *name;
   const char *help_text;
   ArgumentParser *parser;
+  // only allowed after every required positional argument. if missing, parser
+  // is not called
+  bool is_optional;
 } PositionalArgument;
 
 typedef struct KeywordArgument {
   char short_name;
   const char *long_name;
+  // accepted in place of long_name but left out of the help text, for options
+  // that have been renamed. may be NULL
+  const char *long_name_alias;
   const char *help_text;
   ArgumentParser *parser;
+  // if set, the value must be attached (--key=value or -kvalue) and the
+  // option may be given without one, in which case parser is not called
+  bool has_optional_value;
 
   bool was_found;
 } KeywordArgument;
@@ -89,6 +108,9 @@ IntegerArgumentParser make_integer_parser(const char *name,
                                           const char *metavariable,
                                           long long min_value,
                                           long long max_value);
+RangeArgumentParser make_range_parser(const char *name,
+                                      const char *metavariable,
+                                      long long min_value, long long max_value);
 StringArgumentParser
 make_string_parser(const char *name, const char *metavariable,
                    size_t num_possible_values,
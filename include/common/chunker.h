@@ -0,0 +1,47 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_CHUNKER_H
+#define COMMON_CHUNKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bounds and cut-point masks for content-defined chunking with FastCDC, a Gear
+// rolling hash that cuts where the hash has enough zero bits. chunks shorter
+// than the average need more zero bits and longer ones fewer, which keeps
+// chunk sizes close to the average
+typedef struct ChunkSizes {
+  size_t min_size;
+  size_t average_size;
+  size_t max_size;
+
+  uint64_t small_mask;
+  uint64_t large_mask;
+} ChunkSizes;
+
+// average_size must be a power of two of at least 64 bytes. chunks are
+// between a quarter of and eight times as long as average_size
+ChunkSizes make_chunk_sizes(size_t average_size);
+// length of the chunk at the start of data. cut points only depend on the
+// bytes just before them, so an edit only changes the chunks around it
+size_t find_chunk_size(const ChunkSizes *sizes, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_CODEC_H
+#define COMMON_CODEC_H
+
+#include <common/error.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// most input that a compressor consumes per call to run, so that the driver
+// can unmap what has been consumed before more is touched and resident memory
+// stays at a few slices no matter how large the input is
+#define CODEC_SLICE_SIZE ((size_t)4 << 20)
+
+// longest description of a codec's memory parameters, including the null
+#define CODEC_PARAMETERS_SIZE 64
+
+typedef struct AppIOState AppIOState;
+
+// what a codec settled on to fit in a memory budget
+typedef struct CodecMemoryPlan {
+  // bytes that the codec allocates with these parameters
+  size_t size;
+  // the parameters that its memory use depends on, as space-separated
+  // name=value pairs
+  char parameters[CODEC_PARAMETERS_SIZE];
+} CodecMemoryPlan;
+
+typedef size_t(AppSizeFunc)(const FileAndMapping *input_file, void *arg);
+typedef Error(AppInitFunc)(AppIOState *app_state, void *arg);
+typedef Error(AppRunFunc)(AppIOState *app_state, bool *finished, void *arg);
+// prepares a state that init has already set up for another stream, as a
+// cheaper alternative to cleanup followed by init
+typedef Error(AppResetFunc)(AppIOState *app_state, void *arg);
+typedef void(AppCleanupFunc)(AppIOState *app_state, void *arg);
+// lowers the parameters that the codec's memory use depends on until it needs
+// at most budget bytes or they can go no lower, whichever comes first
+typedef CodecMemoryPlan(AppFitMemoryFunc)(const FileAndMapping *input_file,
+                                          size_t budget, void *arg);
+// whether a compressed stream carries a checksum of its uncompressed contents
+typedef bool(AppHasChecksumFunc)(const FileAndMapping *input_file, void *arg);
+
+// a codec's own callbacks and the state they run on, which drivers copy once
+// per thread to compress chunks of the input into streams of their own that
+// decompress as one once concatenated
+typedef struct AppChunkCodec {
+  // configured by the frontend, but not yet initialized
+  const void *state;
+  size_t state_size;
+
+  // called with each chunk before it is compressed
+  AppSizeFunc *size;
+  AppInitFunc *init;
+  AppRunFunc *run;
+  // NULL if the state must be cleaned up and initialized again instead
+  AppResetFunc *reset;
+  AppCleanupFunc *cleanup;
+} AppChunkCodec;
+
+// fills in codec, or fails if the options given make streams that can't be
+// concatenated
+typedef Error(AppChunkCodecFunc)(AppChunkCodec *codec, void *arg);
+// see common/numa.h, which isn't installed
+struct NumaTopology;
+
+// decompresses as much of the input as it can on num_threads threads, split
+// into num_chunks pieces of work. finished is set if that was all of it;
+// otherwise init and run carry on from where it left off. maybe_numa is NULL
+// unless --numa was given
+typedef Error(AppParallelRunFunc)(AppIOState *app_state, size_t num_threads,
+                                  const struct NumaTopology *maybe_numa,
+                                  size_t *num_chunks, bool *finished,
+                                  void *arg);
+
+struct AppIOState {
+  FileAndMapping input_file;
+  FileAndMapping output_file;
+
+  size_t input_mapping_first_unused_offset;
+  size_t output_mapping_first_unused_offset;
+  size_t output_bytes_written;
+
+  // set when more input will follow once the mapped input is consumed.
+  // compressors then consume what they can without ending the stream
+  bool input_is_partial;
+};
+
+#endif
@@ -0,0 +1,47 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_COMMITTER_H
+#define COMMON_COMMITTER_H
+
+#include <common/codec.h>
+#include <common/error.h>
+
+#include <stddef.h>
+
+// writes pieces of a compressor's output that are finished out of order, such
+// as the chunks of a --threads run, from any number of threads at once. writers
+// copy straight into the output mapping, and only a thread of the committer's
+// own grows it, once the writers have stepped out of the way
+typedef struct OutputCommitter OutputCommitter;
+
+// takes over io_state->output_file until freed, and starts the thread that
+// grows it
+Error create_output_committer(AppIOState *io_state,
+                              OutputCommitter **committer);
+// stops the thread and leaves io_state's output offsets just past the end of
+// the furthest piece committed
+void free_output_committer(OutputCommitter *committer);
+// copies size bytes to offset in the output, then drops the pages they filled
+// from the resident set. blocks only while the output is grown to fit them
+Error commit_output(OutputCommitter *committer, size_t offset,
+                    const void *data, size_t size);
+
+#endif
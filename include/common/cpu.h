@@ -0,0 +1,46 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_CPU_H
+#define COMMON_CPU_H
+
+#include <common/error.h>
+
+// instruction sets that mmc has kernels for, each a superset of the one
+// before it. AVX2 also implies PCLMULQDQ and SSE4.2; AVX-512 means F, BW,
+// VL, and VPCLMULQDQ, so Ice Lake and Zen 4 have it but Skylake-SP doesn't
+typedef enum CpuLevel {
+  CPU_LEVEL_GENERIC,
+  CPU_LEVEL_AVX2,
+  CPU_LEVEL_AVX512,
+} CpuLevel;
+
+extern const char *const CPU_LEVEL_NAMES[3];
+
+// the best level this CPU and kernel support, found with cpuid once. always
+// CPU_LEVEL_GENERIC if mmc was built without its x86 kernels
+CpuLevel detect_cpu_level(void);
+// the level that kernels are picked for: the detected one unless overridden
+CpuLevel cpu_level(void);
+// fails if the CPU doesn't support level. kernels are picked the first time
+// they're called, so this must come before then
+Error override_cpu_level(CpuLevel level);
+
+#endif
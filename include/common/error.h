@@ -49,5 +49,7 @@ extern const char *executable_name;
 Error eformat(const char *format, ...);
 int print_error(Error error);
 int print_warning(Error error);
+// frees an error without printing it
+void discard_error(Error error);
 
 #endif
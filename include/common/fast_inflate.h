@@ -0,0 +1,69 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef COMMON_FAST_INFLATE_H
+#define COMMON_FAST_INFLATE_H
+
+#include <common/huffman.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// output that fast_inflate_block needs past the end of what it writes, for
+// the longest match and the bytes its copies overshoot by
+#define FAST_INFLATE_MIN_OUTPUT ((size_t)258 + 32)
+
+// inflates whole DEFLATE blocks straight into a large contiguous output,
+// copying matches 16 bytes at a time without checking each write against the
+// end of the output. blocks that don't fit, run out of input, or aren't valid
+// are left for zlib to inflate, and to report
+typedef struct FastInflater {
+  // distances past this are invalid
+  size_t max_distance;
+
+  HuffmanCode fixed_lengths;
+  HuffmanCode fixed_distances;
+  HuffmanCode lengths;
+  HuffmanCode distances;
+
+  // the last history_size bytes hold the output before the output_start
+  // given to fast_inflate_block
+  unsigned char history[DEFLATE_WINDOW_SIZE];
+  size_t history_size;
+} FastInflater;
+
+void init_fast_inflater(FastInflater *inflater, size_t max_distance);
+// the next block is the first of a new stream, with no history before it
+void reset_fast_inflater(FastInflater *inflater, size_t max_distance);
+void append_fast_inflater_history(FastInflater *inflater,
+                                  const unsigned char *data, size_t size);
+
+// inflates the block at the reader's position to *output, which is no further
+// than output_end, and sets is_final if it was the stream's last. output
+// between output_start and *output comes after the inflater's history.
+// false, leaving the reader and *output as they were, if the block couldn't
+// be inflated, though bytes up to output_end may have been written to
+bool fast_inflate_block(FastInflater *inflater, BitReader *reader,
+                        const unsigned char *output_start,
+                        unsigned char **output, unsigned char *output_end,
+                        bool *is_final);
+
+#endif
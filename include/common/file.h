@@ -23,11 +23,13 @@
 
 #include <common/error.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef struct FileAndMapping {
   const char *filename;
 
+  // -1 for anonymous mappings
   int fd;
   size_t file_size;
 
@@ -36,11 +38,42 @@ typedef struct FileAndMapping {
   size_t mapping_offset;
 } FileAndMapping;
 
+// number of memory-management system calls made by the functions below, counted
+// per thread so that concurrent transformations don't race on them. Stats
+// reports them
+typedef struct FileSyscallCounts {
+  size_t num_mmaps;
+  size_t num_munmaps;
+  size_t num_mremaps;
+  size_t num_ftruncates;
+} FileSyscallCounts;
+
 Error open_and_map_file(const char *filename, FileAndMapping *file);
+// opens a file for reading without mapping any of it, for callers that map it
+// piece by piece with map_file_range
+Error open_file(const char *filename, FileAndMapping *file);
 Error create_and_map_file(const char *filename, size_t size,
                           FileAndMapping *file);
+Error create_anonymous_mapping(const char *name, size_t size,
+                               FileAndMapping *file);
+// maps [offset, offset + size) of an open file without taking ownership of
+// fd. the mapping starts at the page boundary at or before offset, so the
+// range begins offset - mapping_offset bytes into it
+Error map_file_range(const char *filename, int fd, size_t offset, size_t size,
+                     bool is_writable, FileAndMapping *file);
 Error unmap_unused_pages(FileAndMapping *file, size_t *first_unused_offset);
 Error expand_output_mapping(FileAndMapping *file, size_t first_unused_offset);
+Error reserve_output_space(FileAndMapping *file, size_t first_unused_offset,
+                           size_t size);
+// the same as reserve_output_space, but only grows by what is missing so that
+// the mapping stays close to size bytes past first_unused_offset
+Error reserve_bounded_output_space(FileAndMapping *file,
+                                   size_t first_unused_offset, size_t size);
+// drops the pages that lie wholly within [address, address + size) from the
+// resident set without unmapping them, unlike unmap_unused_pages, so that
+// other threads can keep using the rest of the mapping. pages of a file keep
+// their contents
+void release_pages(void *address, size_t size);
 Error free_file(FileAndMapping file);
 
 #endif
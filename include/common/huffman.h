@@ -0,0 +1,155 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef COMMON_HUFFMAN_H
+#define COMMON_HUFFMAN_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// see RFC 1951 section 3.2
+#define MAX_CODE_BITS 15
+#define NUM_LENGTH_SYMBOLS 288
+#define NUM_DISTANCE_SYMBOLS 32
+#define NUM_CODE_LENGTH_SYMBOLS 19
+#define END_OF_BLOCK 256
+// furthest back that DEFLATE refers, see RFC 1951 section 3.2.5
+#define DEFLATE_WINDOW_SIZE ((size_t)1 << 15)
+// codes up to this long are decoded with one table lookup
+#define FAST_BITS 10
+
+// indexed by length symbol - 257 and distance symbol, see RFC 1951 section
+// 3.2.5
+extern const uint16_t DEFLATE_LENGTH_BASES[29];
+extern const uint8_t DEFLATE_LENGTH_EXTRA_BITS[29];
+extern const uint16_t DEFLATE_DISTANCE_BASES[30];
+extern const uint8_t DEFLATE_DISTANCE_EXTRA_BITS[30];
+
+typedef struct BitReader {
+  const unsigned char *data;
+  size_t size;
+  // in bits, which may be past the end of data once a read overruns it
+  size_t position;
+} BitReader;
+
+// a canonical Huffman code, decoded as in zlib's puff.c for codes that are
+// too long for the fast table
+typedef struct HuffmanCode {
+  // indexed by the next FAST_BITS bits of input, holds a symbol shifted left
+  // by four and or'd with the length of its code, or zero if it is longer
+  uint16_t fast[1 << FAST_BITS];
+  // number of codes of each length
+  uint16_t counts[MAX_CODE_BITS + 1];
+  // ordered by code
+  uint16_t symbols[NUM_LENGTH_SYMBOLS];
+} HuffmanCode;
+
+// the code for each symbol is assigned in order of length, then symbol, as in
+// RFC 1951 section 3.2.2. incomplete codes are accepted only if there is one
+// code of one bit or none at all, like zlib does
+bool build_huffman_code(HuffmanCode *code, const uint8_t *lengths,
+                        size_t num_symbols, bool must_be_complete);
+// see RFC 1951 section 3.2.6
+void make_fixed_huffman_codes(HuffmanCode *lengths, HuffmanCode *distances);
+// reads the header of a dynamic Huffman block after its type, see RFC 1951
+// section 3.2.7. false if the codes it describes aren't valid
+bool read_dynamic_huffman_codes(BitReader *reader, HuffmanCode *lengths,
+                                HuffmanCode *distances);
+
+// at least 57 bits, padded with zeros past the end of the input
+static inline uint64_t peek_bits(const BitReader *reader) {
+  assert(reader);
+
+  const size_t next_byte = reader->position / 8;
+  uint64_t bits = 0;
+
+  if (next_byte + 8 <= reader->size) {
+    const unsigned char *const next = reader->data + next_byte;
+
+    bits = (uint64_t)next[0] | (uint64_t)next[1] << 8 |
+           (uint64_t)next[2] << 16 | (uint64_t)next[3] << 24 |
+           (uint64_t)next[4] << 32 | (uint64_t)next[5] << 40 |
+           (uint64_t)next[6] << 48 | (uint64_t)next[7] << 56;
+  } else {
+    for (size_t i = next_byte; i < reader->size; ++i) {
+      bits |= (uint64_t)reader->data[i] << (8 * (i - next_byte));
+    }
+  }
+
+  return bits >> (reader->position % 8);
+}
+
+static inline size_t read_bits(BitReader *reader, unsigned num_bits) {
+  assert(reader);
+  assert(num_bits <= 32);
+
+  const uint64_t bits = peek_bits(reader);
+  reader->position += num_bits;
+
+  return (size_t)(bits & (((uint64_t)1 << num_bits) - 1));
+}
+
+// decodes a symbol from bits, which were peeked at the reader's position,
+// and advances past its code. -1 if the input doesn't match any code
+static inline int decode_huffman_bits(BitReader *reader,
+                                      const HuffmanCode *code,
+                                      uint64_t bits) {
+  assert(reader);
+  assert(code);
+
+  const unsigned entry = code->fast[bits & ((1u << FAST_BITS) - 1)];
+
+  if (entry != 0) {
+    reader->position += entry & 15;
+
+    return (int)(entry >> 4);
+  }
+
+  int value = 0;
+  int first = 0;
+  int index = 0;
+
+  for (unsigned length = 1; length <= MAX_CODE_BITS; ++length) {
+    value |= (int)((bits >> (length - 1)) & 1);
+    const int count = code->counts[length];
+
+    if (value - count < first) {
+      reader->position += length;
+
+      return code->symbols[index + (value - first)];
+    }
+
+    index += count;
+    first = (first + count) << 1;
+    value <<= 1;
+  }
+
+  return -1;
+}
+
+static inline int decode_huffman_symbol(BitReader *reader,
+                                        const HuffmanCode *code) {
+  return decode_huffman_bits(reader, code, peek_bits(reader));
+}
+
+#endif
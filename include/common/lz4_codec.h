@@ -0,0 +1,63 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_LZ4_CODEC_H
+#define COMMON_LZ4_CODEC_H
+
+#include <common/codec.h>
+#include <common/error.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <lz4frame.h>
+
+typedef struct Lz4CompressState {
+  LZ4F_preferences_t preferences;
+
+  LZ4F_cctx *context;
+  // the frame header has been written, but not the end mark
+  bool has_begun;
+} Lz4CompressState;
+
+typedef struct Lz4DecompressState {
+  LZ4F_dctx *context;
+} Lz4DecompressState;
+
+size_t lz4_compress_size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan lz4_compress_fit_memory(const FileAndMapping *input_file,
+                                        size_t budget, void *state_v);
+Error lz4_compress_init(AppIOState *io_state, void *state_v);
+Error lz4_compress_run(AppIOState *io_state, bool *finished, void *state_v);
+Error lz4_compress_reset(AppIOState *io_state, void *state_v);
+void lz4_compress_cleanup(AppIOState *io_state, void *state_v);
+
+size_t lz4_decompress_size(const FileAndMapping *input_file, void *state_v);
+Error lz4_decompress_init(AppIOState *io_state, void *state_v);
+Error lz4_decompress_run(AppIOState *io_state, bool *finished, void *state_v);
+Error lz4_decompress_reset(AppIOState *io_state, void *state_v);
+void lz4_decompress_cleanup(AppIOState *io_state, void *state_v);
+bool lz4_decompress_has_checksum(const FileAndMapping *input_file,
+                                 void *state_v);
+size_t lz4_decompress_window_size(const FileAndMapping *input_file,
+                                  void *state_v);
+
+#endif
@@ -24,4 +24,21 @@
 #define MMC_VERSION "0.3.1"
 #define MMC_AUTHOR "Gregory Meyer <me@gregjm.dev>"
 
+// what mmc-archive and mmc-dedup compress with if not told otherwise, the
+// first of zstd, zlib, and LZ4 that mmc was built with
+#if defined(MMC_HAVE_ZSTD)
+#define MMC_DEFAULT_CODEC MMC_CODEC_ZSTD
+#define MMC_DEFAULT_CODEC_NAME "zstd"
+#elif defined(MMC_HAVE_ZLIB)
+#define MMC_DEFAULT_CODEC MMC_CODEC_ZLIB
+#define MMC_DEFAULT_CODEC_NAME "zlib"
+#elif defined(MMC_HAVE_LZ4)
+#define MMC_DEFAULT_CODEC MMC_CODEC_LZ4
+#define MMC_DEFAULT_CODEC_NAME "lz4"
+#else
+// mmc_check_options rejects it, as it would any other codec
+#define MMC_DEFAULT_CODEC MMC_CODEC_ZSTD
+#define MMC_DEFAULT_CODEC_NAME "zstd"
+#endif
+
 #endif
@@ -0,0 +1,92 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_NUMA_H
+#define COMMON_NUMA_H
+
+#include <common/error.h>
+
+#include <stddef.h>
+
+#include <sched.h>
+
+// node ids at or above this are ignored
+#define NUMA_MAX_NODES 64
+
+typedef enum NumaMode {
+  // leave placement to the kernel, but still count remote accesses
+  NUMA_MODE_OFF,
+  // spread the process's memory, including the page cache it reads into,
+  // evenly across nodes
+  NUMA_MODE_INTERLEAVE,
+  // run each worker on the CPUs of one node and keep its memory there
+  NUMA_MODE_LOCAL,
+  NUM_NUMA_MODES,
+} NumaMode;
+
+typedef struct NumaNode {
+  int id;
+  cpu_set_t cpus;
+} NumaNode;
+
+typedef struct NumaTopology {
+  NumaMode mode;
+  // only nodes with CPUs that this process may run on
+  NumaNode nodes[NUMA_MAX_NODES];
+  size_t num_nodes;
+} NumaTopology;
+
+// of a sample of resident pages, how many were on the node of the thread that
+// read them
+typedef struct NumaAccessCounts {
+  size_t local_pages;
+  size_t remote_pages;
+} NumaAccessCounts;
+
+extern const char *const NUMA_MODE_NAMES[NUM_NUMA_MODES];
+
+// reads the nodes from sysfs, falling back to one node with every CPU on
+// kernels without NUMA support. with NUMA_MODE_INTERLEAVE, the process's
+// memory policy is set to interleave across them
+Error make_numa_topology(NumaMode mode, NumaTopology *topology);
+// index of the node that the worker_index-th of several workers runs on
+size_t get_numa_worker_node(const NumaTopology *topology, size_t worker_index);
+// index of the node that the calling thread is running on
+size_t get_numa_current_node(const NumaTopology *topology);
+// with NUMA_MODE_LOCAL, restricts the calling thread to the CPUs of a node.
+// a no-op otherwise
+Error bind_thread_to_numa_node(const NumaTopology *topology, size_t node_index);
+// places pages of an anonymous range that haven't been touched yet: on a node
+// with NUMA_MODE_LOCAL, across all of them with NUMA_MODE_INTERLEAVE. a no-op
+// with NUMA_MODE_OFF
+Error place_numa_range(const NumaTopology *topology, size_t node_index,
+                       void *address, size_t size);
+// index of the node that holds most of a sample of the range's resident
+// pages, or of the calling thread's node if none are resident
+size_t find_numa_range_node(const NumaTopology *topology, const void *address,
+                            size_t size);
+// samples the resident pages of a range and counts them as local if they are
+// on the node that the calling thread is running on
+void count_numa_accesses(const NumaTopology *topology, const void *address,
+                         size_t size, NumaAccessCounts *counts);
+void add_numa_access_counts(NumaAccessCounts *total, NumaAccessCounts counts);
+Error print_numa_stats(const NumaTopology *topology, NumaAccessCounts counts);
+
+#endif
@@ -0,0 +1,45 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_PARALLEL_INFLATE_H
+#define COMMON_PARALLEL_INFLATE_H
+
+#include <common/codec.h>
+#include <common/error.h>
+#include <common/numa.h>
+#include <common/zlib_codec.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// decompresses the first stream of the input on num_threads threads, even
+// though it is one DEFLATE stream. the input is split into chunks, and each is
+// inflated from the first thing that looks like a block header in it before
+// the history it refers back to is known, leaving markers where that history
+// goes. chunks are then committed in order, replacing the markers with the
+// history from the chunk before or, if the guessed block header turned out
+// to be wrong, inflating the chunk with zlib from where the chunk before
+// ended. the rest of a gzip file's members are left to the caller, as is the
+// output mapping's size, which is grown as it fills
+Error parallel_inflate(AppIOState *io_state, const InflateOptions *options,
+                       size_t num_threads, const NumaTopology *maybe_numa,
+                       size_t *num_chunks, bool *finished);
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_PERF_H
+#define COMMON_PERF_H
+
+#include <common/error.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum PerfEvent {
+  PERF_EVENT_CYCLES,
+  PERF_EVENT_INSTRUCTIONS,
+  PERF_EVENT_BRANCH_MISSES,
+  PERF_EVENT_LLC_MISSES,
+  PERF_EVENT_DTLB_MISSES,
+  PERF_EVENT_PAGE_FAULTS,
+  NUM_PERF_EVENTS,
+} PerfEvent;
+
+// counters for this thread, counting only while enabled and only in user mode
+typedef struct PerfCounters {
+  // -1 if the event couldn't be opened
+  int fds[NUM_PERF_EVENTS];
+  size_t num_open;
+} PerfCounters;
+
+typedef struct PerfCounts {
+  bool is_available[NUM_PERF_EVENTS];
+  // scaled up if the kernel had to multiplex counters
+  uint64_t values[NUM_PERF_EVENTS];
+} PerfCounts;
+
+// snake_case, as they are also the keys of --stats=json
+extern const char *const PERF_EVENT_NAMES[NUM_PERF_EVENTS];
+
+// counters that can't be opened are skipped; an error is returned only if no
+// counters are available, in which case the other functions do nothing
+Error open_perf_counters(PerfCounters *counters);
+void close_perf_counters(PerfCounters *counters);
+void reset_perf_counters(const PerfCounters *counters);
+void enable_perf_counters(const PerfCounters *counters);
+void disable_perf_counters(const PerfCounters *counters);
+PerfCounts read_perf_counters(const PerfCounters *counters);
+PerfCounts make_perf_counts(void);
+void add_perf_counts(PerfCounts *total, PerfCounts counts);
+void divide_perf_counts(PerfCounts *counts, uint64_t divisor);
+// false if the required counters are unavailable
+bool get_ipc(const PerfCounts *counts, double *ipc);
+bool get_cycles_per_byte(const PerfCounts *counts, size_t num_bytes,
+                         double *cycles_per_byte);
+
+#endif
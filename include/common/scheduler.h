@@ -0,0 +1,89 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_SCHEDULER_H
+#define COMMON_SCHEDULER_H
+
+#include <common/error.h>
+#include <common/numa.h>
+
+#include <stddef.h>
+
+// most workers that a scheduler runs
+#define SCHEDULER_MAX_WORKERS 256
+// tasks that may be taken before an earlier one has been committed, per
+// worker. bounds the output buffered while a slow task holds up the rest
+#define SCHEDULER_SLOTS_PER_WORKER 2
+
+// sets up anything a worker keeps between tasks, on the worker's thread
+typedef Error(SchedulerWorkerInitFunc)(size_t worker_index, void *arg);
+// runs task task_index on worker worker_index, writing at most
+// max_output_size bytes to output
+typedef Error(SchedulerTaskFunc)(size_t worker_index, size_t task_index,
+                                 void *output, size_t *output_size, void *arg);
+// called for each task in order, one at a time, once it has finished and the
+// task before it has been ordered. may change the task's output and its size,
+// for tasks whose output depends on what came before them, before the size is
+// added to the offsets of the tasks after it
+typedef Error(SchedulerOrderFunc)(size_t task_index, void *output,
+                                  size_t *output_size, void *arg);
+// called for each task once it and every task before it has finished, where
+// offset is the sum of the output sizes of the tasks before it. runs on the
+// worker that completed the prefix, possibly alongside the commits of other
+// tasks on other workers
+typedef Error(SchedulerCommitFunc)(size_t task_index, const void *output,
+                                   size_t output_size, size_t offset,
+                                   void *arg);
+typedef void(SchedulerWorkerCleanupFunc)(size_t worker_index, void *arg);
+
+typedef struct SchedulerParams {
+  size_t num_workers;
+  size_t num_tasks;
+  // of any one task
+  size_t max_output_size;
+
+  // NULL if workers keep nothing between tasks
+  SchedulerWorkerInitFunc *init_worker;
+  SchedulerTaskFunc *run_task;
+  // NULL if a task's output size is settled once it finishes
+  SchedulerOrderFunc *order;
+  SchedulerCommitFunc *commit;
+  // NULL if workers keep nothing between tasks. called on every worker whose
+  // init succeeded, even if a task failed
+  SchedulerWorkerCleanupFunc *cleanup_worker;
+
+  // NULL to leave placement to the kernel. otherwise each worker is bound to
+  // its node before init_worker, and the slots of the tasks dealt to it are
+  // placed there
+  const NumaTopology *maybe_numa;
+
+  void *arg;
+} SchedulerParams;
+
+// deals tasks out round-robin to a queue per worker, which each worker takes
+// from in order. a worker whose queue runs dry, or whose next task is too far
+// ahead of the oldest uncommitted one, steals the oldest task of another
+// queue, so that uneven tasks don't leave workers idle. offsets are handed
+// from each task to the next with atomics rather than under a lock, so
+// commits don't wait on one another. stops at the first error, which is
+// returned
+Error run_scheduler(const SchedulerParams *params);
+
+#endif
@@ -0,0 +1,96 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_STATS_H
+#define COMMON_STATS_H
+
+#include <common/codec.h>
+#include <common/file.h>
+#include <common/perf.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum StatsPhase {
+  STATS_PHASE_ARGPARSE,
+  // opening and mapping the input and output files
+  STATS_PHASE_MAP,
+  // the codec's init, run, and cleanup callbacks
+  STATS_PHASE_RUN,
+  // unmapping consumed pages, truncating and closing the files
+  STATS_PHASE_UNMAP,
+  // growing the output file and its mapping
+  STATS_PHASE_EXPAND,
+  NUM_STATS_PHASES,
+} StatsPhase;
+
+typedef enum StatsFormat { STATS_FORMAT_TEXT, STATS_FORMAT_JSON } StatsFormat;
+
+// a point in time as seen by this process
+typedef struct StatsTimestamp {
+  double wall_seconds;
+  double user_seconds;
+  double system_seconds;
+  size_t minor_page_faults;
+  size_t major_page_faults;
+} StatsTimestamp;
+
+// how a compressor split --max-memory between its codec and mappings
+typedef struct StatsMemoryPlan {
+  // zero if there was no limit
+  size_t limit;
+  // resident before the codec or any mapping was set up
+  size_t process_size;
+  CodecMemoryPlan codec;
+  size_t input_window_size;
+  // room in the output for everything an input window compresses to
+  size_t output_window_size;
+} StatsMemoryPlan;
+
+typedef struct Stats {
+  // each is the sum of differences between pairs of timestamps
+  StatsTimestamp phases[NUM_STATS_PHASES];
+
+  size_t bytes_in;
+  size_t bytes_out;
+  // bytes_in when compressing, bytes_out when decompressing
+  size_t uncompressed_bytes;
+  size_t num_runs;
+
+  FileSyscallCounts syscalls;
+  // counted during the codec's run callbacks only
+  PerfCounts perf_counts;
+  StatsMemoryPlan memory_plan;
+} Stats;
+
+extern const char *const STATS_FORMAT_NAMES[2];
+extern const char *const STATS_PHASE_NAMES[NUM_STATS_PHASES];
+
+Stats make_stats(void);
+StatsTimestamp stats_now(void);
+// the current time if maybe_stats is non-NULL, avoiding the system calls
+// otherwise
+StatsTimestamp stats_start(const Stats *maybe_stats);
+StatsTimestamp stats_elapsed(StatsTimestamp since);
+// no-op if maybe_stats is NULL, so callers can record unconditionally
+void stats_record(Stats *maybe_stats, StatsPhase phase, StatsTimestamp since);
+Error print_stats(const Stats *stats, StatsFormat format);
+
+#endif
@@ -0,0 +1,150 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_ZLIB_CODEC_H
+#define COMMON_ZLIB_CODEC_H
+
+#include <common/adapt.h>
+#include <common/arena.h>
+#include <common/chunker.h>
+#include <common/codec.h>
+#include <common/error.h>
+#include <common/fast_inflate.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+// zlib 1.2.9 and newer refuse 8 for raw streams and silently use 9 otherwise
+#define DEFLATE_MIN_WINDOW_BITS 9
+#define INFLATE_MIN_WINDOW_BITS 8
+#define DEFLATE_DEFAULT_MEM_LEVEL 8
+
+typedef enum ZlibFormat {
+  ZLIB_FORMAT_ZLIB,
+  ZLIB_FORMAT_GZIP,
+  ZLIB_FORMAT_RAW,
+} ZlibFormat;
+
+typedef enum ZlibDecoder {
+  // FastInflater for the blocks it can inflate, zlib for the rest
+  ZLIB_DECODER_FAST,
+  ZLIB_DECODER_ZLIB,
+} ZlibDecoder;
+
+// where the fast decoder is in the current stream
+typedef enum FastInflatePhase {
+  FAST_INFLATE_PHASE_HEADER,
+  FAST_INFLATE_PHASE_BLOCK,
+  // zlib has been primed to inflate the current block
+  FAST_INFLATE_PHASE_ZLIB_BLOCK,
+  FAST_INFLATE_PHASE_TRAILER,
+} FastInflatePhase;
+
+typedef struct DeflateOptions {
+  int level;
+  int strategy;
+  ZlibFormat format;
+  int window_bits;
+  int mem_level;
+  // fully flush at content-defined chunk boundaries so that a local change
+  // to the input only changes the output around it, like gzip --rsyncable
+  bool rsyncable;
+  // adjust the level between adapt_min_level and adapt_max_level as the
+  // stream is compressed, see LevelAdapter
+  bool adapt;
+  int adapt_min_level;
+  int adapt_max_level;
+} DeflateOptions;
+
+typedef struct DeflateState {
+  DeflateOptions options;
+
+  z_stream stream;
+  Arena arena;
+  // zlib requires Z_FINISH on every call once it has been passed
+  bool is_finishing;
+
+  // only used with rsyncable
+  ChunkSizes chunk_sizes;
+  // input left before the end of the current chunk
+  size_t chunk_remaining;
+  // if the current chunk ends at a cut point rather than the end of the input
+  bool chunk_is_cut;
+  // a full flush ran out of output space and has to be called again
+  bool is_flushing;
+
+  // only used with adapt. options.level is the level currently in effect
+  LevelAdapter adapter;
+} DeflateState;
+
+typedef struct InflateOptions {
+  ZlibFormat format;
+  // largest window that will be accepted
+  int window_bits;
+  ZlibDecoder decoder;
+} InflateOptions;
+
+typedef struct InflateState {
+  InflateOptions options;
+
+  z_stream stream;
+  Arena arena;
+
+  // only used with ZLIB_DECODER_FAST, which reads headers and trailers itself
+  // and runs zlib on raw DEFLATE data. allocated from arena
+  FastInflater *fast;
+  FastInflatePhase phase;
+  // of the current stream's output so far
+  uint32_t checksum;
+  size_t stream_size;
+} InflateState;
+
+extern const char *const ZLIB_FORMAT_NAMES[3];
+extern const char *const ZLIB_DECODER_NAMES[2];
+
+DeflateOptions make_deflate_options(void);
+InflateOptions make_inflate_options(void);
+
+size_t deflate_size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan deflate_fit_memory(const FileAndMapping *input_file,
+                                   size_t budget, void *state_v);
+Error deflate_init(AppIOState *io_state, void *state_v);
+Error deflate_run(AppIOState *io_state, bool *finished, void *state_v);
+Error deflate_reset(AppIOState *io_state, void *state_v);
+void deflate_cleanup(AppIOState *io_state, void *state_v);
+
+size_t inflate_size(const FileAndMapping *input_file, void *state_v);
+Error inflate_init(AppIOState *io_state, void *state_v);
+Error inflate_run(AppIOState *io_state, bool *finished, void *state_v);
+Error inflate_reset(AppIOState *io_state, void *state_v);
+void inflate_cleanup(AppIOState *io_state, void *state_v);
+bool inflate_has_checksum(const FileAndMapping *input_file, void *state_v);
+size_t inflate_window_size(const FileAndMapping *input_file, void *state_v);
+
+// checks the header of the stream at the start of input_file, which must be
+// wholly mapped, and finds where the DEFLATE data after it begins
+Error inflate_stream_start(const FileAndMapping *input_file,
+                           const InflateOptions *options, size_t *offset);
+
+#endif
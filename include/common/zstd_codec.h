@@ -0,0 +1,97 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_ZSTD_CODEC_H
+#define COMMON_ZSTD_CODEC_H
+
+#include <common/adapt.h>
+#include <common/arena.h>
+#include <common/codec.h>
+#include <common/error.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <zstd.h>
+
+typedef struct ZstdCompressOptions {
+  // zero leaves the library default in place
+  int level;
+  ZSTD_strategy strategy;
+  // appends a checksum of the uncompressed contents to the frame
+  bool checksum;
+  // cut jobs at content-defined boundaries with ZSTD_c_rsyncable so that a
+  // local change to the input only changes the output around it
+  bool rsyncable;
+  // adjust the level between adapt_min_level and adapt_max_level as the
+  // frame is compressed, see LevelAdapter
+  bool adapt;
+  int adapt_min_level;
+  int adapt_max_level;
+  // zero leaves the level's value in place, otherwise they override it so
+  // that memory use no longer depends on the level or the input size
+  int window_log;
+  int hash_log;
+  int chain_log;
+} ZstdCompressOptions;
+
+typedef struct ZstdCompressState {
+  ZstdCompressOptions options;
+
+  // lives inside arena, which is sized for the options and never grows.
+  // rsyncable and adaptive contexts need worker threads and are allocated by
+  // libzstd
+  ZSTD_CCtx *context;
+  Arena arena;
+  // a frame has been started with ZSTD_compressStream2 but not ended
+  bool is_streaming;
+
+  // only used with adapt. options.level is the level currently in effect
+  LevelAdapter adapter;
+} ZstdCompressState;
+
+typedef struct ZstdDecompressState {
+  ZSTD_DStream *stream;
+  Arena arena;
+} ZstdDecompressState;
+
+extern const char *const ZSTD_STRATEGY_NAMES[9];
+extern const ZSTD_strategy ZSTD_STRATEGY_VALUES[9];
+
+size_t zstd_compress_size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan zstd_compress_fit_memory(const FileAndMapping *input_file,
+                                         size_t budget, void *state_v);
+Error zstd_compress_init(AppIOState *io_state, void *state_v);
+Error zstd_compress_run(AppIOState *io_state, bool *finished, void *state_v);
+Error zstd_compress_reset(AppIOState *io_state, void *state_v);
+void zstd_compress_cleanup(AppIOState *io_state, void *state_v);
+
+size_t zstd_decompress_size(const FileAndMapping *input_file, void *state_v);
+Error zstd_decompress_init(AppIOState *io_state, void *state_v);
+Error zstd_decompress_run(AppIOState *io_state, bool *finished, void *state_v);
+Error zstd_decompress_reset(AppIOState *io_state, void *state_v);
+void zstd_decompress_cleanup(AppIOState *io_state, void *state_v);
+bool zstd_decompress_has_checksum(const FileAndMapping *input_file,
+                                  void *state_v);
+size_t zstd_decompress_window_size(const FileAndMapping *input_file,
+                                   void *state_v);
+
+#endif
@@ -0,0 +1,127 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef MMC_MMC_H
+#define MMC_MMC_H
+
+#include <common/codec.h>
+#include <common/error.h>
+#include <common/file.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum MmcCodecId {
+  MMC_CODEC_ZLIB,
+  MMC_CODEC_GZIP,
+  // DEFLATE data with no header or trailer
+  MMC_CODEC_RAW_DEFLATE,
+  MMC_CODEC_LZ4,
+  MMC_CODEC_ZSTD,
+  NUM_MMC_CODECS,
+} MmcCodecId;
+
+typedef enum MmcDirection {
+  MMC_DIRECTION_COMPRESS,
+  MMC_DIRECTION_DECOMPRESS,
+} MmcDirection;
+
+typedef struct MmcOptions {
+  MmcCodecId codec;
+  // 0 selects the codec's default; ignored when decompressing
+  int level;
+} MmcOptions;
+
+// the same callbacks as the command line utilities use, operating on state_size
+// bytes of codec-specific state
+typedef struct MmcCodec {
+  const char *name;
+  size_t state_size;
+
+  // called once per context to store the options in the state
+  void (*configure)(void *state, const MmcOptions *options);
+  AppSizeFunc *size;
+  AppInitFunc *init;
+  AppRunFunc *run;
+  // NULL if the state must be cleaned up and initialized again instead
+  AppResetFunc *reset;
+  AppCleanupFunc *cleanup;
+} MmcCodec;
+
+// reusable across any number of transformations, but not concurrently. codec
+// state is initialized by the first transformation and reset by later ones
+typedef struct MmcContext MmcContext;
+
+// thread-safe cache of idle contexts keyed by codec, level, and direction
+typedef struct MmcContextPool MmcContextPool;
+
+// memory that holds the output of a buffer transformation
+typedef struct MmcBuffer {
+  void *data;
+  size_t size;
+
+  size_t mapping_size;
+} MmcBuffer;
+
+extern const char *const MMC_CODEC_NAMES[NUM_MMC_CODECS];
+
+MmcOptions mmc_make_options(MmcCodecId codec);
+// NULL if mmc was built without support for the codec
+const MmcCodec *mmc_get_codec(MmcCodecId codec, MmcDirection direction);
+// rejects codecs mmc was built without and levels outside the codec's range
+Error mmc_check_options(const MmcOptions *options);
+
+Error mmc_create_context(const MmcOptions *options, MmcDirection direction,
+                         MmcContext **context);
+void mmc_free_context(MmcContext *context);
+
+// at most max_idle released contexts are kept, the rest are freed
+Error mmc_create_context_pool(size_t max_idle, MmcContextPool **pool);
+// contexts that are still acquired must be freed separately
+void mmc_free_context_pool(MmcContextPool *pool);
+// reuses an idle context with the same options if there is one
+Error mmc_acquire_context(MmcContextPool *pool, const MmcOptions *options,
+                          MmcDirection direction, MmcContext **context);
+void mmc_release_context(MmcContextPool *pool, MmcContext *context);
+
+// output_filename is created or truncated, then removed if an error occurs
+Error mmc_transform_file(MmcContext *context, const char *input_filename,
+                         const char *output_filename);
+Error mmc_transform_buffer(MmcContext *context, const void *input,
+                           size_t input_size, MmcBuffer *output);
+// output_filename is treated as in mmc_transform_file
+Error mmc_transform_buffer_to_file(MmcContext *context, const void *input,
+                                   size_t input_size,
+                                   const char *output_filename);
+Error mmc_free_buffer(MmcBuffer buffer);
+
+// one-shot wrappers that create and free a context
+Error mmc_compress_file(const char *input_filename,
+                        const char *output_filename,
+                        const MmcOptions *options);
+Error mmc_decompress_file(const char *input_filename,
+                          const char *output_filename,
+                          const MmcOptions *options);
+Error mmc_compress_buffer(const void *input, size_t input_size,
+                          MmcBuffer *output, const MmcOptions *options);
+Error mmc_decompress_buffer(const void *input, size_t input_size,
+                            MmcBuffer *output, const MmcOptions *options);
+
+#endif
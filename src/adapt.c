@@ -0,0 +1,162 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/adapt.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+// fraction of a chunk's compression time spent waiting on writeback beyond
+// which the level goes up, and below which it goes down
+#define RAISE_WAIT_FRACTION (1.0 / 8)
+#define LOWER_WAIT_FRACTION (1.0 / 64)
+
+static double now_seconds(void);
+static Error sync_range(const FileAndMapping *output_file, size_t offset,
+                        size_t size, unsigned flags);
+
+LevelAdapter make_level_adapter(int min_level, int max_level, int level,
+                                bool skip_zero) {
+  assert(min_level <= max_level);
+
+  if (level < min_level) {
+    level = min_level;
+  } else if (level > max_level) {
+    level = max_level;
+  }
+
+  return (LevelAdapter){
+      .min_level = min_level,
+      .max_level = max_level,
+      .level = level,
+      .skip_zero = skip_zero,
+
+      .is_in_chunk = false,
+      .chunk_remaining = 0,
+      .chunk_start_seconds = 0,
+
+      .synced_offset = 0,
+      .writeback_offset = 0,
+  };
+}
+
+size_t begin_adapter_chunk(LevelAdapter *adapter, size_t available) {
+  assert(adapter);
+
+  if (!adapter->is_in_chunk) {
+    adapter->is_in_chunk = true;
+    adapter->chunk_remaining = ADAPT_CHUNK_SIZE;
+    adapter->chunk_start_seconds = now_seconds();
+  }
+
+  return available < adapter->chunk_remaining ? available
+                                              : adapter->chunk_remaining;
+}
+
+Error end_adapter_chunk(LevelAdapter *adapter,
+                        const FileAndMapping *output_file, size_t output_end) {
+  assert(adapter);
+  assert(adapter->is_in_chunk);
+  assert(adapter->chunk_remaining == 0);
+  assert(output_file);
+
+  adapter->is_in_chunk = false;
+
+  // anonymous mappings never need writing back
+  if (output_file->fd == -1) {
+    return NULL_ERROR;
+  }
+
+  const double compress_seconds = now_seconds() - adapter->chunk_start_seconds;
+  const double wait_start_seconds = now_seconds();
+  Error error;
+
+  // the previous chunk's output had all of this chunk's compression time
+  if ((error = sync_range(output_file, adapter->synced_offset,
+                          adapter->writeback_offset - adapter->synced_offset,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER)),
+      error.what) {
+    return error;
+  }
+
+  const double wait_seconds = now_seconds() - wait_start_seconds;
+  const size_t end = output_file->mapping_offset + output_end;
+
+  if ((error = sync_range(output_file, adapter->writeback_offset,
+                          end - adapter->writeback_offset,
+                          SYNC_FILE_RANGE_WRITE)),
+      error.what) {
+    return error;
+  }
+
+  adapter->synced_offset = adapter->writeback_offset;
+  adapter->writeback_offset = end;
+
+  int step;
+
+  if (wait_seconds > compress_seconds * RAISE_WAIT_FRACTION) {
+    step = 1;
+  } else if (wait_seconds < compress_seconds * LOWER_WAIT_FRACTION) {
+    step = -1;
+  } else {
+    return NULL_ERROR;
+  }
+
+  int level = adapter->level + step;
+
+  if (adapter->skip_zero && level == 0) {
+    level += step;
+  }
+
+  if (level >= adapter->min_level && level <= adapter->max_level) {
+    adapter->level = level;
+  }
+
+  return NULL_ERROR;
+}
+
+static double now_seconds(void) {
+  struct timespec time;
+  const int result = clock_gettime(CLOCK_MONOTONIC, &time);
+  assert(result == 0);
+  (void)result;
+
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static Error sync_range(const FileAndMapping *output_file, size_t offset,
+                        size_t size, unsigned flags) {
+  assert(output_file);
+
+  if (size == 0) {
+    return NULL_ERROR;
+  }
+
+  if (sync_file_range(output_file->fd, (off64_t)offset, (off64_t)size,
+                      flags) == -1) {
+    return ERRNO_EFORMAT("couldn't write back output file '%s'",
+                         output_file->filename);
+  }
+
+  return NULL_ERROR;
+}
@@ -21,11 +21,18 @@
 #include <common/app.h>
 
 #include <common/argparse.h>
+#include <common/committer.h>
+#include <common/cpu.h>
+#include <common/numa.h>
+#include <common/perf.h>
+#include <common/scheduler.h>
+#include <common/stats.h>
 
 #include <assert.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <unistd.h>
 
@@ -47,29 +54,158 @@
   "it is truncated to length 0 before being written to. Should %s exit with "  \
   "an error after truncating this file, it will be deleted. The current user " \
   "must have write permissions in this file's parent directory and, if the "   \
-  "file already exists, write permissions on this file."
+  "file already exists, write permissions on this file. Required unless "      \
+  "--test or --verify is given."
+
+#define STATS_HELP_TEXT                                                        \
+  "Print wall and CPU time, page faults, and system call counts to standard "  \
+  "error once finished, split into argument parsing, mapping the files, "      \
+  "running the codec, unmapping consumed pages, and expanding the output. "    \
+  "FORMAT is one of 'text' (the default) or 'json'."
+
+#define PERF_COUNTERS_HELP_TEXT                                                \
+  "Count CPU cycles, instructions, branch misses, last-level cache misses, "   \
+  "data TLB misses, and page faults during compression or decompression "      \
+  "using perf_event_open(2), then print them with IPC and cycles per "         \
+  "uncompressed byte alongside the other --stats. Implies --stats. Counters "  \
+  "that the kernel or hardware don't support are omitted."
+
+#define TEST_HELP_TEXT                                                         \
+  "Decompress INPUT_FILE without writing it anywhere, checking it against "    \
+  "the checksum of its contents if it carries one. Decompressed data is "      \
+  "written over a ring buffer in memory the size of the codec's history "      \
+  "window, so no output file is created or grown."
+
+#define VERIFY_HELP_TEXT                                                       \
+  "The same as --test, but fails if INPUT_FILE has no checksum of its "        \
+  "contents to check against."
+
+#define MAX_MEMORY_HELP_TEXT                                                   \
+  "Keep the mapped parts of INPUT_FILE and OUTPUT_FILE, the codec's own "      \
+  "memory, and 2 MiB set aside for the process itself under MIB mebibytes "    \
+  "together. If the codec can't fit next to the smallest input window, the "   \
+  "parameters its memory depends on are lowered until it does, which may "     \
+  "cost compression ratio. What the codec doesn't need is split between a "    \
+  "window of the input, mapped one at a time, and room in the output for "     \
+  "everything that window can compress to. --stats reports how the memory "    \
+  "was split. --memory-limit is accepted as well."
+
+#define COMPRESSION_THREADS_HELP_TEXT                                          \
+  "Compress on THREADS threads at once, defaulting to 1. INPUT_FILE is split " \
+  "into chunks of 4 MiB that are each compressed into a stream of their own "  \
+  "and written out in order, which decompress as one. Threads that run out "   \
+  "of chunks take those queued for busier ones, so chunks that are slow to "   \
+  "compress don't leave the others idle. Chunks don't refer back to one "      \
+  "another, which costs some compression ratio. Can't be combined with "       \
+  "--max-memory."
+
+#define DECOMPRESSION_THREADS_HELP_TEXT                                        \
+  "Decompress on THREADS threads at once, defaulting to 1. Streams are split " \
+  "into chunks that are each decompressed from the first block that appears " \
+  "to start in them, before the history they refer back to is known, then "   \
+  "pieced together in order. Chunks whose guess turns out wrong are "          \
+  "decompressed again on one thread, as is the rest of any chunk that "        \
+  "decompresses to more than 8 MiB. Each thread reserves about 32 MiB for "    \
+  "the output of its chunks. Can't be combined with --test or --verify."
+
+#define NUMA_HELP_TEXT                                                         \
+  "How to place --threads workers and their memory on NUMA nodes. 'local' "    \
+  "runs each worker on the CPUs of one node, taking the nodes in turn, and "   \
+  "keeps its codec state and the output of the chunks dealt to it there. "     \
+  "'interleave' spreads all memory evenly across nodes. 'off' (the default) "  \
+  "leaves placement to the kernel. Only applies with --threads."
+
+#define CPU_HELP_TEXT                                                          \
+  "Instruction set to pick checksum kernels for: one of 'generic', 'avx2', "   \
+  "or 'avx512'. Defaults to the best that the CPU supports, found with "       \
+  "cpuid. Asking for more than the CPU supports is an error. For comparing "   \
+  "kernels against one another."
+
+// for codecs that don't know their window size
+#define DEFAULT_RING_SIZE ((size_t)1 << 16)
+
+// an exabyte, more than any file
+#define MAX_MEMORY_LIMIT_MIB ((long long)1 << 40)
+// set aside for the executable, libraries, stack, and heap, which a cgroup
+// counts too. fixed rather than measured, since the resident size moves by a
+// few hundred kilobytes from run to run and the same limit should always get
+// the same verdict. md, mlc, and mzc start out at about 1.7MB
+#define PROCESS_ALLOWANCE_SIZE ((size_t)2 << 20)
+// smallest input window that a memory limit can leave
+#define MIN_WINDOW_SIZE ((size_t)1 << 16)
+// output that unmap_unused_pages may leave mapped behind the first unused
+// byte, and room for the headers and trailers that compressors add
+#define OUTPUT_SLACK_SIZE ((size_t)1 << 16)
+// every codec's compressed size is within a 64th of its input plus headers
+#define MAX_WINDOW_OUTPUT_SIZE(INPUT_SIZE)                                     \
+  ((INPUT_SIZE) + (INPUT_SIZE) / 64 + OUTPUT_SLACK_SIZE)
+// an input window and the output room for it, plus what unmap_unused_pages
+// leaves behind in the output
+#define WINDOW_FOOTPRINT(INPUT_SIZE)                                           \
+  ((INPUT_SIZE) + MAX_WINDOW_OUTPUT_SIZE(INPUT_SIZE) + OUTPUT_SLACK_SIZE)
+
+// input compressed into one stream by each task of a --threads run
+#define PARALLEL_CHUNK_SIZE ((size_t)4 << 20)
+
+// the input of a compressor, mapped one window at a time to stay within a
+// memory limit
+typedef struct InputWindows {
+  // owns the descriptor, but maps nothing
+  FileAndMapping file;
+  // zero if the whole file is mapped at once
+  size_t window_size;
+  size_t next_offset;
+
+  bool has_started;
+  bool is_mapped;
+} InputWindows;
+
+// compresses the input one chunk per task with run_scheduler. each worker
+// has its own copy of the codec's state, and copies its chunks to the output
+// through committer
+typedef struct ParallelJob {
+  const AppChunkCodec *codec;
+  const FileAndMapping *input_file;
+  OutputCommitter *committer;
+  size_t num_chunks;
+
+  void *states[SCHEDULER_MAX_WORKERS];
+  bool is_initialized[SCHEDULER_MAX_WORKERS];
+} ParallelJob;
 
 static int run_transformer_app(int argc, const char *const argv[argc],
-                               const AppParams *params,
+                               const AppParams *params, bool is_compression,
                                const char *input_help_text,
                                const char *output_help_text_format);
+static Error run_parallel(const AppChunkCodec *codec, size_t num_threads,
+                          const NumaTopology *maybe_numa, AppIOState *io_state,
+                          size_t *num_chunks);
+static Error plan_memory(const AppParams *params,
+                         const FileAndMapping *input_file,
+                         long long memory_limit_mib, StatsMemoryPlan *plan,
+                         size_t *window_size);
+static Error advance_window(InputWindows *windows, AppIOState *io_state);
 
 int run_compression_app(int argc, const char *const argv[argc],
                         const AppParams *params) {
-  return run_transformer_app(argc, argv, params, COMPRESSION_INPUT_HELP_TEXT,
+  return run_transformer_app(argc, argv, params, true,
+                             COMPRESSION_INPUT_HELP_TEXT,
                              COMPRESSION_OUTPUT_HELP_TEXT_FORMAT);
 }
 
 int run_decompression_app(int argc, const char *const argv[argc],
                           const AppParams *params) {
-  return run_transformer_app(argc, argv, params, DECOMPRESSION_INPUT_HELP_TEXT,
+  return run_transformer_app(argc, argv, params, false,
+                             DECOMPRESSION_INPUT_HELP_TEXT,
                              DECOMPRESSION_OUTPUT_HELP_TEXT_FORMAT);
 }
 
 static int run_transformer_app(int argc, const char *const argv[argc],
-                               const AppParams *params,
+                               const AppParams *params, bool is_compression,
                                const char *input_help_text,
                                const char *output_help_text_format) {
+  const StatsTimestamp argparse_start = stats_now();
+
 #ifndef NDEBUG
   assert(argc > 0);
   assert(argv);
@@ -110,6 +246,104 @@ static int run_transformer_app(int argc, const char *const argv[argc],
   PassthroughArgumentParser output_filename_parser =
       make_passthrough_parser("OUTPUT_FILE", NULL);
 
+  StringArgumentParser stats_parser = make_string_parser(
+      "-S, --stats", "FORMAT",
+      sizeof(STATS_FORMAT_NAMES) / sizeof(STATS_FORMAT_NAMES[0]),
+      STATS_FORMAT_NAMES);
+  KeywordArgument stats_arg = {
+      .short_name = 'S',
+      .long_name = "stats",
+      .help_text = STATS_HELP_TEXT,
+      .parser = &stats_parser.argument_parser,
+      .has_optional_value = true,
+  };
+
+  KeywordArgument perf_counters_arg = {
+      .short_name = 'P',
+      .long_name = "perf-counters",
+      .help_text = PERF_COUNTERS_HELP_TEXT,
+      .parser = NULL,
+  };
+
+  KeywordArgument test_arg = {
+      .short_name = 't',
+      .long_name = "test",
+      .help_text = TEST_HELP_TEXT,
+      .parser = NULL,
+  };
+
+  KeywordArgument verify_arg = {
+      .short_name = 'V',
+      .long_name = "verify",
+      .help_text = VERIFY_HELP_TEXT,
+      .parser = NULL,
+  };
+
+  IntegerArgumentParser max_memory_parser = make_integer_parser(
+      "-M, --max-memory", "MIB", 1, MAX_MEMORY_LIMIT_MIB);
+  KeywordArgument max_memory_arg = {
+      .short_name = 'M',
+      .long_name = "max-memory",
+      .long_name_alias = "memory-limit",
+      .help_text = MAX_MEMORY_HELP_TEXT,
+      .parser = &max_memory_parser.argument_parser,
+  };
+
+  IntegerArgumentParser threads_parser = make_integer_parser(
+      "-j, --threads", "THREADS", 1, SCHEDULER_MAX_WORKERS);
+  KeywordArgument threads_arg = {
+      .short_name = 'j',
+      .long_name = "threads",
+      .help_text = is_compression ? COMPRESSION_THREADS_HELP_TEXT
+                                  : DECOMPRESSION_THREADS_HELP_TEXT,
+      .parser = &threads_parser.argument_parser,
+  };
+
+  StringArgumentParser numa_parser = make_string_parser(
+      "-n, --numa", "MODE", NUM_NUMA_MODES, NUMA_MODE_NAMES);
+  KeywordArgument numa_arg = {
+      .short_name = 'n',
+      .long_name = "numa",
+      .help_text = NUMA_HELP_TEXT,
+      .parser = &numa_parser.argument_parser,
+  };
+
+  StringArgumentParser cpu_parser = make_string_parser(
+      "-C, --cpu", "LEVEL",
+      sizeof(CPU_LEVEL_NAMES) / sizeof(CPU_LEVEL_NAMES[0]), CPU_LEVEL_NAMES);
+  KeywordArgument cpu_arg = {
+      .short_name = 'C',
+      .long_name = "cpu",
+      .help_text = CPU_HELP_TEXT,
+      .parser = &cpu_parser.argument_parser,
+  };
+
+  // only offered by tools that can split their work between threads
+  const bool has_threads = is_compression ? params->chunk_codec != NULL
+                                          : params->parallel_run != NULL;
+  KeywordArgument *keyword_args[params->num_keyword_args + 7];
+  size_t num_keyword_args = 0;
+
+  for (size_t i = 0; i < params->num_keyword_args; ++i) {
+    keyword_args[num_keyword_args++] = params->keyword_args[i];
+  }
+
+  keyword_args[num_keyword_args++] = &stats_arg;
+  keyword_args[num_keyword_args++] = &perf_counters_arg;
+  keyword_args[num_keyword_args++] = &cpu_arg;
+
+  if (is_compression) {
+    keyword_args[num_keyword_args++] = &max_memory_arg;
+  } else {
+    keyword_args[num_keyword_args++] = &test_arg;
+    keyword_args[num_keyword_args++] = &verify_arg;
+  }
+
+  if (has_threads) {
+    keyword_args[num_keyword_args++] = &threads_arg;
+    keyword_args[num_keyword_args++] = &numa_arg;
+  }
+
   Arguments arguments = {
       .executable_name = params->executable_name,
       .version = params->version,
@@ -127,12 +361,13 @@ static int run_transformer_app(int argc, const char *const argv[argc],
                   .name = "OUTPUT_FILE",
                   .help_text = output_help_text,
                   .parser = &output_filename_parser.argument_parser,
+                  .is_optional = !is_compression,
               },
           },
       .num_positional_args = 2,
 
-      .keyword_args = params->keyword_args,
-      .num_keyword_args = params->num_keyword_args,
+      .keyword_args = keyword_args,
+      .num_keyword_args = num_keyword_args,
   };
 
   int return_code = EXIT_SUCCESS;
@@ -157,32 +392,175 @@ static int run_transformer_app(int argc, const char *const argv[argc],
 
   free(output_help_text);
 
+  // --verify is a stricter --test
+  const bool is_testing = test_arg.was_found || verify_arg.was_found;
+
+  if (is_testing && output_filename_parser.value) {
+    print_error(
+        STATIC_ERROR("OUTPUT_FILE can't be given with --test or --verify"));
+
+    return EXIT_FAILURE;
+  } else if (!is_testing && !output_filename_parser.value) {
+    print_error(STATIC_ERROR("missing required positional argument "
+                             "OUTPUT_FILE"));
+
+    return EXIT_FAILURE;
+  }
+
+  // before any kernel is picked
+  if (cpu_arg.was_found) {
+    if ((error = override_cpu_level((CpuLevel)cpu_parser.value_index)),
+        error.what) {
+      print_error(error);
+
+      return EXIT_FAILURE;
+    }
+  }
+
+  Stats stats = make_stats();
+  Stats *const maybe_stats =
+      (stats_arg.was_found || perf_counters_arg.was_found) ? &stats : NULL;
+  stats_record(maybe_stats, STATS_PHASE_ARGPARSE, argparse_start);
+
+  PerfCounters perf_counters;
+  PerfCounters *maybe_perf_counters = NULL;
+
+  if (perf_counters_arg.was_found) {
+    // not the end of the world if we can't count
+    if ((error = open_perf_counters(&perf_counters)), error.what) {
+      print_warning(error);
+    } else {
+      maybe_perf_counters = &perf_counters;
+    }
+  }
+
+  StatsTimestamp start = stats_start(maybe_stats);
+
   AppIOState io_state = {.input_mapping_first_unused_offset = 0,
                          .output_mapping_first_unused_offset = 0,
                          .output_bytes_written = 0};
+  InputWindows windows = {.window_size = 0};
+
+  if (max_memory_arg.was_found) {
+    error = open_file(input_filename_parser.value, &windows.file);
+    io_state.input_file = windows.file;
+  } else {
+    error = open_and_map_file(input_filename_parser.value,
+                              &io_state.input_file);
+  }
 
-  if ((error = open_and_map_file(input_filename_parser.value,
-                                 &io_state.input_file)),
-      error.what) {
+  if (error.what) {
     print_error(error);
+    return_code = EXIT_FAILURE;
 
-    return EXIT_FAILURE;
+    goto cleanup_perf_counters;
   }
 
+  stats.bytes_in = io_state.input_file.file_size;
+
   const size_t output_file_size =
-      params->size(io_state.input_file.file_size, params->arg);
+      params->size(&io_state.input_file, params->arg);
+
+  const size_t num_threads =
+      threads_arg.was_found ? (size_t)threads_parser.value : 1;
+  AppChunkCodec chunk_codec;
+  NumaTopology topology;
+
+  if (num_threads > 1) {
+    if (!is_compression) {
+      if (is_testing) {
+        error = STATIC_ERROR(
+            "--threads can't be combined with --test or --verify");
+      }
+    } else if (max_memory_arg.was_found) {
+      error = STATIC_ERROR("--threads can't be combined with --max-memory");
+    } else {
+      error = params->chunk_codec(&chunk_codec, params->arg);
+    }
+
+    if (!error.what && numa_arg.was_found) {
+      error = make_numa_topology((NumaMode)numa_parser.value_index, &topology);
+    }
+
+    if (error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      goto cleanup_input_only;
+    }
+  }
 
-  if ((error = create_and_map_file(output_filename_parser.value,
-                                   output_file_size, &io_state.output_file)),
-      error.what) {
+  const NumaTopology *const maybe_numa =
+      (num_threads > 1 && numa_arg.was_found) ? &topology : NULL;
+
+  if (max_memory_arg.was_found) {
+    if ((error = plan_memory(params, &io_state.input_file,
+                             max_memory_parser.value, &stats.memory_plan,
+                             &windows.window_size)),
+        error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      goto cleanup_input_only;
+    }
+
+    // grown by each window's worth as it comes
+    error = create_and_map_file(output_filename_parser.value,
+                                windows.window_size, &io_state.output_file);
+  } else if (!is_testing) {
+    error = create_and_map_file(output_filename_parser.value, output_file_size,
+                                &io_state.output_file);
+  } else if (verify_arg.was_found &&
+             (!params->has_checksum ||
+              !params->has_checksum(&io_state.input_file, params->arg))) {
+    error = eformat("couldn't verify input file '%s': it has no checksum of "
+                    "its contents",
+                    io_state.input_file.filename);
+  } else {
+    const size_t ring_size =
+        params->window_size
+            ? params->window_size(&io_state.input_file, params->arg)
+            : DEFAULT_RING_SIZE;
+
+    error = create_anonymous_mapping("ring buffer", ring_size,
+                                     &io_state.output_file);
+  }
+
+  if (error.what) {
     print_error(error);
     return_code = EXIT_FAILURE;
 
     goto cleanup_input_only;
   }
 
-  if (params->init) {
-    if ((error = params->init(&io_state, params->arg)), error.what) {
+  stats_record(maybe_stats, STATS_PHASE_MAP, start);
+  start = stats_start(maybe_stats);
+
+  bool finished = false;
+
+  if (num_threads > 1) {
+    if (maybe_perf_counters) {
+      enable_perf_counters(maybe_perf_counters);
+    }
+
+    if (is_compression) {
+      error = run_parallel(&chunk_codec, num_threads, maybe_numa, &io_state,
+                           &stats.num_runs);
+      // every chunk has been committed
+      finished = true;
+    } else {
+      error = params->parallel_run(&io_state, num_threads, maybe_numa,
+                                   &stats.num_runs, &finished, params->arg);
+    }
+
+    if (maybe_perf_counters) {
+      disable_perf_counters(maybe_perf_counters);
+    }
+
+    stats_record(maybe_stats, STATS_PHASE_RUN, start);
+    start = stats_start(maybe_stats);
+
+    if (error.what) {
       print_error(error);
       return_code = EXIT_FAILURE;
 
@@ -190,16 +568,54 @@ static int run_transformer_app(int argc, const char *const argv[argc],
     }
   }
 
-  bool finished = false;
+  // decompressors may leave the rest of the input to one thread
+  const bool is_sequential = !finished;
+
+  if (is_sequential && params->init) {
+    if ((error = params->init(&io_state, params->arg)), error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      goto cleanup_files;
+    }
+  }
 
   while (!finished) {
-    if ((error = params->run(&io_state, &finished, params->arg)), error.what) {
+    if (windows.window_size > 0) {
+      error = advance_window(&windows, &io_state);
+      stats_record(maybe_stats, STATS_PHASE_MAP, start);
+      start = stats_start(maybe_stats);
+
+      if (error.what) {
+        print_error(error);
+        return_code = EXIT_FAILURE;
+
+        goto cleanup;
+      }
+    }
+
+    if (maybe_perf_counters) {
+      enable_perf_counters(maybe_perf_counters);
+    }
+
+    error = params->run(&io_state, &finished, params->arg);
+
+    if (maybe_perf_counters) {
+      disable_perf_counters(maybe_perf_counters);
+    }
+
+    ++stats.num_runs;
+    stats_record(maybe_stats, STATS_PHASE_RUN, start);
+
+    if (error.what) {
       print_error(error);
       return_code = EXIT_FAILURE;
 
       goto cleanup;
     }
 
+    start = stats_start(maybe_stats);
+
     // not the end of the world if we can't unmap unused pages
     if ((error =
              unmap_unused_pages(&io_state.input_file,
@@ -208,17 +624,32 @@ static int run_transformer_app(int argc, const char *const argv[argc],
       print_warning(error);
     }
 
-    if ((error =
-             unmap_unused_pages(&io_state.output_file,
-                                &io_state.output_mapping_first_unused_offset)),
-        error.what) {
+    if (is_testing) {
+      // codecs keep their own copy of the history they refer back to
+      io_state.output_mapping_first_unused_offset = 0;
+    } else if ((error = unmap_unused_pages(
+                    &io_state.output_file,
+                    &io_state.output_mapping_first_unused_offset)),
+               error.what) {
       print_warning(error);
     }
 
-    if ((error = expand_output_mapping(
-             &io_state.output_file,
-             io_state.output_mapping_first_unused_offset)),
-        error.what) {
+    stats_record(maybe_stats, STATS_PHASE_UNMAP, start);
+    start = stats_start(maybe_stats);
+
+    if (finished) {
+      break;
+    } else if (is_testing || windows.window_size > 0) {
+      // advance_window makes room in the output instead
+      continue;
+    }
+
+    error = expand_output_mapping(&io_state.output_file,
+                                  io_state.output_mapping_first_unused_offset);
+    stats_record(maybe_stats, STATS_PHASE_EXPAND, start);
+    start = stats_start(maybe_stats);
+
+    if (error.what) {
       print_error(error);
       return_code = EXIT_FAILURE;
 
@@ -226,25 +657,35 @@ static int run_transformer_app(int argc, const char *const argv[argc],
     }
   }
 
-  if (ftruncate(io_state.output_file.fd,
-                (off_t)io_state.output_bytes_written) == -1) {
+  stats.bytes_out = io_state.output_bytes_written;
+  stats.uncompressed_bytes = is_compression ? stats.bytes_in : stats.bytes_out;
+
+  if (!is_testing && ftruncate(io_state.output_file.fd,
+                              (off_t)io_state.output_bytes_written) == -1) {
     print_error(ERRNO_EFORMAT("couldn't resize output file '%s'",
                               output_filename_parser.value));
     return_code = EXIT_FAILURE;
   }
 
+  stats_record(maybe_stats, STATS_PHASE_UNMAP, start);
+  start = stats_start(maybe_stats);
+
 cleanup:
-  if (params->cleanup) {
+  // workers clean up their own copies of the codec
+  if (params->cleanup && is_sequential) {
     params->cleanup(&io_state, params->arg);
   }
 
+  stats_record(maybe_stats, STATS_PHASE_RUN, start);
+  start = stats_start(maybe_stats);
+
 cleanup_files:
   if ((error = free_file(io_state.output_file)), error.what) {
     print_error(error);
     return_code = EXIT_FAILURE;
   }
 
-  if (return_code != EXIT_SUCCESS) {
+  if (return_code != EXIT_SUCCESS && !is_testing) {
     if (unlink(output_filename_parser.value) == -1) {
       print_error(ERRNO_EFORMAT("couldn't remove file '%s'",
                                 output_filename_parser.value));
@@ -253,10 +694,36 @@ cleanup_files:
   }
 
 cleanup_input_only:;
+  if (windows.window_size > 0) {
+    if (windows.is_mapped &&
+        (error = free_file(io_state.input_file), error.what)) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+    }
+
+    io_state.input_file = windows.file;
+  }
+
   if ((error = free_file(io_state.input_file)), error.what) {
     print_error(error);
+    return_code = EXIT_FAILURE;
+  }
 
-    return EXIT_FAILURE;
+  stats_record(maybe_stats, STATS_PHASE_UNMAP, start);
+
+cleanup_perf_counters:
+  if (maybe_perf_counters) {
+    stats.perf_counts = read_perf_counters(maybe_perf_counters);
+    close_perf_counters(maybe_perf_counters);
+  }
+
+  if (maybe_stats) {
+    if ((error = print_stats(maybe_stats,
+                             (StatsFormat)stats_parser.value_index)),
+        error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+    }
   }
 
   return return_code;
@@ -266,3 +733,314 @@ cleanup_help:
 
   return return_code;
 }
+
+// fits the codec next to the process allowance and the smallest input
+// window, then splits what is left of the limit between the input window and
+// room in the output for what it compresses to
+static Error plan_memory(const AppParams *params,
+                         const FileAndMapping *input_file,
+                         long long memory_limit_mib, StatsMemoryPlan *plan,
+                         size_t *window_size) {
+  assert(params);
+  assert(input_file);
+  assert(memory_limit_mib > 0);
+  assert(plan);
+  assert(window_size);
+
+  const size_t memory_limit = (size_t)memory_limit_mib << 20;
+
+  const size_t process_size = PROCESS_ALLOWANCE_SIZE;
+
+  const size_t min_footprint =
+      process_size + WINDOW_FOOTPRINT(MIN_WINDOW_SIZE);
+  const size_t codec_budget =
+      (memory_limit > min_footprint) ? memory_limit - min_footprint : 0;
+  const CodecMemoryPlan codec_plan =
+      params->fit_memory
+          ? params->fit_memory(input_file, codec_budget, params->arg)
+          : (CodecMemoryPlan){.size = 0, .parameters = "none"};
+  const size_t fixed_size =
+      process_size + codec_plan.size + 2 * OUTPUT_SLACK_SIZE;
+
+  // the window and MAX_WINDOW_OUTPUT_SIZE of it, which is 129/64 of a window
+  const size_t size = (memory_limit > fixed_size)
+                          ? (memory_limit - fixed_size) / 129 * 64
+                          : 0;
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  *window_size = size / page_size * page_size;
+
+  // windows are never mapped past the end of the input
+  const size_t input_window_size = (input_file->file_size < *window_size)
+                                       ? input_file->file_size
+                                       : *window_size;
+
+  // reported even if it doesn't fit
+  *plan = (StatsMemoryPlan){
+      .limit = memory_limit,
+      .process_size = process_size,
+      .codec = codec_plan,
+      .input_window_size = input_window_size,
+      .output_window_size = MAX_WINDOW_OUTPUT_SIZE(input_window_size),
+  };
+
+  if (size < MIN_WINDOW_SIZE) {
+    return eformat("a memory limit of %lld MiB leaves too little room next to "
+                   "the %zu bytes set aside for the process and the %zu bytes "
+                   "the codec needs with %s",
+                   memory_limit_mib, process_size, codec_plan.size,
+                   codec_plan.parameters);
+  }
+
+  return NULL_ERROR;
+}
+
+// maps the next window of input once the current one has been consumed, and
+// makes room in the output for everything that is left of it
+static Error advance_window(InputWindows *windows, AppIOState *io_state) {
+  assert(windows);
+  assert(windows->window_size > 0);
+  assert(io_state);
+
+  Error error;
+
+  if (!windows->has_started ||
+      (io_state->input_is_partial &&
+       io_state->input_mapping_first_unused_offset ==
+           io_state->input_file.mapping_size)) {
+    if (windows->is_mapped) {
+      windows->is_mapped = false;
+
+      if ((error = free_file(io_state->input_file)), error.what) {
+        return error;
+      }
+    }
+
+    const size_t offset = windows->next_offset;
+    const size_t remaining_size = windows->file.file_size - offset;
+    const size_t size = (remaining_size < windows->window_size)
+                            ? remaining_size
+                            : windows->window_size;
+
+    // offsets are multiples of the window size, and so of the page size
+    if (size == 0) {
+      io_state->input_file = (FileAndMapping){
+          .filename = windows->file.filename, .fd = -1, .mapping = NULL};
+    } else if ((error = map_file_range(windows->file.filename, windows->file.fd,
+                                       offset, size, false,
+                                       &io_state->input_file)),
+               error.what) {
+      return error;
+    } else {
+      windows->is_mapped = true;
+    }
+
+    io_state->input_mapping_first_unused_offset = 0;
+    io_state->input_is_partial = offset + size < windows->file.file_size;
+    windows->next_offset = offset + size;
+    windows->has_started = true;
+  }
+
+  const size_t remaining_size = io_state->input_file.mapping_size -
+                                io_state->input_mapping_first_unused_offset;
+
+  return reserve_bounded_output_space(
+      &io_state->output_file, io_state->output_mapping_first_unused_offset,
+      MAX_WINDOW_OUTPUT_SIZE(remaining_size));
+}
+
+static SchedulerWorkerInitFunc init_parallel_worker;
+static SchedulerTaskFunc compress_chunk;
+static SchedulerCommitFunc commit_chunk;
+static SchedulerWorkerCleanupFunc cleanup_parallel_worker;
+
+static Error run_parallel(const AppChunkCodec *codec, size_t num_threads,
+                          const NumaTopology *maybe_numa, AppIOState *io_state,
+                          size_t *num_chunks) {
+  assert(codec);
+  assert(codec->state);
+  assert(codec->size);
+  assert(codec->init);
+  assert(codec->run);
+  assert(codec->cleanup);
+  assert(num_threads > 0);
+  assert(num_threads <= SCHEDULER_MAX_WORKERS);
+  assert(io_state);
+  assert(num_chunks);
+
+  const size_t input_size = io_state->input_file.file_size;
+
+  // even empty input gets a stream
+  ParallelJob job = {
+      .codec = codec,
+      .input_file = &io_state->input_file,
+      .num_chunks =
+          (input_size + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE,
+  };
+
+  if (job.num_chunks == 0) {
+    job.num_chunks = 1;
+  }
+
+  // the size callback may store what it was called with, so a throwaway copy
+  void *const state = malloc(codec->state_size);
+
+  if (!state) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  memcpy(state, codec->state, codec->state_size);
+
+  const FileAndMapping largest_chunk = {
+      .filename = io_state->input_file.filename,
+      .fd = -1,
+      .file_size = (input_size < PARALLEL_CHUNK_SIZE) ? input_size
+                                                      : PARALLEL_CHUNK_SIZE,
+  };
+  const size_t max_output_size = codec->size(&largest_chunk, state);
+  free(state);
+
+  const SchedulerParams params = {
+      .num_workers = num_threads,
+      .num_tasks = job.num_chunks,
+      .max_output_size = max_output_size,
+      .init_worker = init_parallel_worker,
+      .run_task = compress_chunk,
+      .commit = commit_chunk,
+      .cleanup_worker = cleanup_parallel_worker,
+      .maybe_numa = maybe_numa,
+      .arg = &job,
+  };
+
+  *num_chunks = job.num_chunks;
+
+  Error error = create_output_committer(io_state, &job.committer);
+
+  if (error.what) {
+    return error;
+  }
+
+  error = run_scheduler(&params);
+  free_output_committer(job.committer);
+
+  return error;
+}
+
+static Error init_parallel_worker(size_t worker_index, void *job_v) {
+  assert(job_v);
+
+  ParallelJob *const job = (ParallelJob *)job_v;
+
+  assert(worker_index < SCHEDULER_MAX_WORKERS);
+
+  // the codec itself is initialized along with the first chunk, which it may
+  // want to see
+  job->states[worker_index] = malloc(job->codec->state_size);
+
+  if (!job->states[worker_index]) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  memcpy(job->states[worker_index], job->codec->state,
+         job->codec->state_size);
+  job->is_initialized[worker_index] = false;
+
+  return NULL_ERROR;
+}
+
+static Error compress_chunk(size_t worker_index, size_t task_index,
+                            void *output, size_t *output_size, void *job_v) {
+  assert(output);
+  assert(output_size);
+  assert(job_v);
+
+  ParallelJob *const job = (ParallelJob *)job_v;
+  const AppChunkCodec *const codec = job->codec;
+  void *const state = job->states[worker_index];
+
+  assert(worker_index < SCHEDULER_MAX_WORKERS);
+  assert(task_index < job->num_chunks);
+
+  const FileAndMapping *const input_file = job->input_file;
+  const size_t offset = task_index * PARALLEL_CHUNK_SIZE;
+  const size_t size = (input_file->file_size - offset < PARALLEL_CHUNK_SIZE)
+                          ? input_file->file_size - offset
+                          : PARALLEL_CHUNK_SIZE;
+
+  // a window of the input that the codec sees as the whole of it
+  AppIOState io_state = {
+      .input_file = {.filename = input_file->filename,
+                     .fd = -1,
+                     .file_size = size,
+                     .mapping = (char *)input_file->mapping + offset,
+                     .mapping_size = size,
+                     .mapping_offset = offset},
+      .input_mapping_first_unused_offset = 0,
+      .output_mapping_first_unused_offset = 0,
+      .output_bytes_written = 0,
+      .input_is_partial = false,
+  };
+
+  const size_t output_mapping_size = codec->size(&io_state.input_file, state);
+  io_state.output_file = (FileAndMapping){.filename = "chunk output",
+                                          .fd = -1,
+                                          .file_size = output_mapping_size,
+                                          .mapping = output,
+                                          .mapping_size = output_mapping_size};
+
+  Error error;
+
+  if (!job->is_initialized[worker_index]) {
+    error = codec->init(&io_state, state);
+  } else if (codec->reset) {
+    error = codec->reset(&io_state, state);
+  } else {
+    codec->cleanup(&io_state, state);
+    error = codec->init(&io_state, state);
+  }
+
+  job->is_initialized[worker_index] = !error.what;
+
+  if (error.what) {
+    return error;
+  }
+
+  bool finished = false;
+
+  while (!finished) {
+    if ((error = codec->run(&io_state, &finished, state)), error.what) {
+      return error;
+    }
+  }
+
+  // chunks start on page boundaries, and no other chunk reads this one
+  release_pages(io_state.input_file.mapping, size);
+  *output_size = io_state.output_bytes_written;
+
+  return NULL_ERROR;
+}
+
+static Error commit_chunk(size_t task_index, const void *output,
+                          size_t output_size, size_t offset, void *job_v) {
+  assert(output);
+  assert(job_v);
+
+  (void)task_index;
+
+  return commit_output(((ParallelJob *)job_v)->committer, offset, output,
+                       output_size);
+}
+
+static void cleanup_parallel_worker(size_t worker_index, void *job_v) {
+  assert(job_v);
+
+  ParallelJob *const job = (ParallelJob *)job_v;
+
+  assert(worker_index < SCHEDULER_MAX_WORKERS);
+
+  if (job->is_initialized[worker_index]) {
+    AppIOState io_state = {.input_mapping_first_unused_offset = 0};
+    job->codec->cleanup(&io_state, job->states[worker_index]);
+  }
+
+  free(job->states[worker_index]);
+}
@@ -0,0 +1,1312 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/argparse.h>
+#include <common/crc32c.h>
+#include <common/error.h>
+#include <common/file.h>
+#include <common/mmc.h>
+#include <common/numa.h>
+#include <mmc/mmc.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// an archive is a header, the compressed members back to back, a table of
+// contents, then a trailer that locates the table. integers are little-endian
+#define ARCHIVE_MAGIC "MMCA"
+#define ARCHIVE_MAGIC_SIZE 4
+#define ARCHIVE_VERSION 1
+
+// magic, version
+#define HEADER_SIZE 8
+// offset, compressed size, uncompressed size, CRC-32C of the compressed data,
+// mode, codec, reserved, path length, then the path itself
+#define ENTRY_SIZE 36
+// table of contents offset, size, and number of entries, CRC-32C of the table,
+// magic
+#define TRAILER_SIZE 32
+
+#define MAX_THREADS 1024
+
+typedef struct Member {
+  // relative to the archived directory, separated by '/'
+  char *path;
+
+  size_t offset;
+  size_t compressed_size;
+  size_t uncompressed_size;
+  uint32_t checksum;
+  uint32_t mode;
+  MmcCodecId codec;
+} Member;
+
+typedef struct Archive {
+  FileAndMapping file;
+
+  Member *members;
+  size_t num_members;
+} Archive;
+
+typedef struct Worker Worker;
+typedef Error(ProcessMemberFunc)(Worker *worker, size_t index);
+
+// members are handed out to worker threads one at a time, in order
+typedef struct Job {
+  Archive *archive;
+  // the directory that is archived or extracted to
+  const char *root;
+  MmcOptions options;
+  // NULL to extract every member
+  const char *maybe_member;
+  // NULL unless --numa was given
+  const NumaTopology *maybe_numa;
+
+  ProcessMemberFunc *process_member;
+  // one per node with --numa=local, so that contexts and the arenas they
+  // allocate stay on the node whose workers touched them first
+  MmcContextPool *pools[NUMA_MAX_NODES];
+  size_t num_pools;
+
+  pthread_mutex_t mutex;
+  size_t next_member;
+  // end of the data written so far when creating an archive
+  size_t end_offset;
+  // the first error any worker ran into; the rest stop after their member
+  Error error;
+  // summed over workers as they finish
+  NumaAccessCounts accesses;
+} Job;
+
+struct Worker {
+  Job *job;
+  pthread_t thread;
+  size_t node_index;
+  MmcContextPool *pool;
+  NumaAccessCounts accesses;
+};
+
+static Error create_archive(const char *directory, const char *filename,
+                            const MmcOptions *options, size_t num_threads,
+                            const NumaTopology *maybe_numa,
+                            NumaAccessCounts *accesses);
+static Error extract_archive(const char *filename, const char *directory,
+                             const char *maybe_member, size_t num_threads,
+                             const NumaTopology *maybe_numa,
+                             NumaAccessCounts *accesses);
+
+int main(int argc, const char *const argv[]) {
+  PassthroughArgumentParser source_parser =
+      make_passthrough_parser("SOURCE", NULL);
+  PassthroughArgumentParser destination_parser =
+      make_passthrough_parser("DESTINATION", NULL);
+
+  KeywordArgument extract = {
+      .short_name = 'x',
+      .long_name = "extract",
+      .help_text = "Extract the archive SOURCE into the directory "
+                   "DESTINATION, which is created if it doesn't exist, "
+                   "instead of archiving the directory SOURCE.",
+      .parser = NULL,
+  };
+
+  PassthroughArgumentParser member_parser =
+      make_passthrough_parser("-m, --member", "PATH");
+  KeywordArgument member = {
+      .short_name = 'm',
+      .long_name = "member",
+      .help_text = "Only extract the member with this path, relative to the "
+                   "archived directory. Only the table of contents and the "
+                   "member's own range of the archive are read.",
+      .parser = &member_parser.argument_parser,
+  };
+
+  StringArgumentParser codec_parser = make_string_parser(
+      "-c, --codec", "CODEC", NUM_MMC_CODECS, MMC_CODEC_NAMES);
+  KeywordArgument codec = {
+      .short_name = 'c',
+      .long_name = "codec",
+      .help_text = "Codec to compress members with. One of 'zlib', 'gzip', "
+                   "'raw', 'lz4', or 'zstd'. Only codecs that mmc was built "
+                   "with are available. Defaults to '" MMC_DEFAULT_CODEC_NAME
+                   "'.",
+      .parser = &codec_parser.argument_parser,
+  };
+
+  IntegerArgumentParser level_parser =
+      make_integer_parser("-l, --level", "LEVEL", INT_MIN, INT_MAX);
+  KeywordArgument level = {
+      .short_name = 'l',
+      .long_name = "level",
+      .help_text = "Compression level, with the same meaning and range as "
+                   "the corresponding frontend's --level. Defaults to the "
+                   "codec's default level.",
+      .parser = &level_parser.argument_parser,
+  };
+
+  IntegerArgumentParser threads_parser =
+      make_integer_parser("-j, --threads", "THREADS", 1, MAX_THREADS);
+  KeywordArgument threads = {
+      .short_name = 'j',
+      .long_name = "threads",
+      .help_text = "Number of members to compress or extract at once. "
+                   "Defaults to the number of online processors.",
+      .parser = &threads_parser.argument_parser,
+  };
+
+  StringArgumentParser numa_parser = make_string_parser(
+      "-n, --numa", "MODE", NUM_NUMA_MODES, NUMA_MODE_NAMES);
+  KeywordArgument numa = {
+      .short_name = 'n',
+      .long_name = "numa",
+      .help_text =
+          "How to place worker threads and memory on NUMA nodes. 'local' "
+          "pins each worker to the CPUs of one node, round-robin, and gives "
+          "each node its own pool of codec contexts. 'interleave' spreads "
+          "all memory, including the page cache that members are read into, "
+          "evenly across nodes. 'off' leaves placement to the kernel. With "
+          "any of them, a sample of the pages that workers read is checked "
+          "afterwards, and how many were on another node is printed.",
+      .parser = &numa_parser.argument_parser,
+  };
+
+  KeywordArgument *keyword_args[] = {&extract, &member, &codec,
+                                     &level,   &threads, &numa};
+
+  Arguments arguments = {
+      .executable_name = "mmc-archive",
+      .version = MMC_VERSION,
+      .author = MMC_AUTHOR,
+      .description =
+          "mmc-archive compresses every regular file below a directory into "
+          "a single archive, several files at a time, and extracts them "
+          "again in parallel. Each member is compressed separately and "
+          "listed with its offset, sizes, and CRC-32C in a table of "
+          "contents at the end of the archive, so that any one member can "
+          "be extracted without reading the others. Symbolic links and "
+          "special files are skipped.",
+
+      .positional_args =
+          (PositionalArgument *[]){
+              &(PositionalArgument){
+                  .name = "SOURCE",
+                  .help_text = "Directory to archive, or the archive to "
+                               "extract with --extract.",
+                  .parser = &source_parser.argument_parser,
+              },
+              &(PositionalArgument){
+                  .name = "DESTINATION",
+                  .help_text = "Archive to create, or the directory to "
+                               "extract into with --extract. An archive is "
+                               "created or truncated, then removed if an "
+                               "error occurs.",
+                  .parser = &destination_parser.argument_parser,
+              },
+          },
+      .num_positional_args = 2,
+
+      .keyword_args = keyword_args,
+      .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
+  };
+
+  Error error = parse_arguments(&arguments, argc, argv);
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if (arguments.has_help) {
+    print_help(&arguments);
+
+    return EXIT_SUCCESS;
+  } else if (arguments.has_version) {
+    print_version(&arguments);
+
+    return EXIT_SUCCESS;
+  }
+
+  size_t num_threads;
+
+  if (threads.was_found) {
+    num_threads = (size_t)threads_parser.value;
+  } else {
+    const long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    num_threads = num_processors > 0 ? (size_t)num_processors : 1;
+  }
+
+  NumaTopology topology;
+  NumaAccessCounts accesses = {.local_pages = 0, .remote_pages = 0};
+
+  if (numa.was_found &&
+      (error = make_numa_topology((NumaMode)numa_parser.value_index,
+                                  &topology),
+       error.what)) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  const NumaTopology *const maybe_numa = numa.was_found ? &topology : NULL;
+
+  if (extract.was_found) {
+    if (codec.was_found || level.was_found) {
+      print_error(STATIC_ERROR("--codec and --level only apply when creating "
+                               "an archive"));
+
+      return EXIT_FAILURE;
+    }
+
+    error = extract_archive(source_parser.value, destination_parser.value,
+                            member.was_found ? member_parser.value : NULL,
+                            num_threads, maybe_numa, &accesses);
+  } else {
+    if (member.was_found) {
+      print_error(STATIC_ERROR("--member only applies with --extract"));
+
+      return EXIT_FAILURE;
+    }
+
+    MmcOptions options = mmc_make_options(MMC_DEFAULT_CODEC);
+
+    if (codec.was_found) {
+      options.codec = (MmcCodecId)codec_parser.value_index;
+    }
+
+    if (level.was_found) {
+      options.level = (int)level_parser.value;
+    }
+
+    if ((error = mmc_check_options(&options)), error.what) {
+      print_error(error);
+
+      return EXIT_FAILURE;
+    }
+
+    error = create_archive(source_parser.value, destination_parser.value,
+                           &options, num_threads, maybe_numa, &accesses);
+  }
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if (maybe_numa && (error = print_numa_stats(maybe_numa, accesses),
+                     error.what)) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static void store_le(unsigned char *bytes, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static uint64_t load_le(const unsigned char *bytes, size_t size) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    value |= (uint64_t)bytes[i] << (8 * i);
+  }
+
+  return value;
+}
+
+static char *join_path(const char *directory, const char *name) {
+  assert(directory);
+  assert(name);
+
+  const size_t directory_length = strlen(directory);
+  const size_t name_length = strlen(name);
+  char *const path = malloc(directory_length + 1 + name_length + 1);
+
+  if (!path) {
+    return NULL;
+  }
+
+  memcpy(path, directory, directory_length);
+  path[directory_length] = '/';
+  memcpy(path + directory_length + 1, name, name_length + 1);
+
+  return path;
+}
+
+static void free_members(Archive *archive) {
+  assert(archive);
+
+  for (size_t i = 0; i < archive->num_members; ++i) {
+    free(archive->members[i].path);
+  }
+
+  free(archive->members);
+  archive->members = NULL;
+  archive->num_members = 0;
+}
+
+static Error run_job(Job *job, size_t num_threads);
+
+static Error collect_members(const char *directory, const char *relative_path,
+                             Archive *archive, size_t *capacity);
+static int compare_members(const void *lhs_v, const void *rhs_v);
+static Error compress_member(Worker *worker, size_t index);
+static Error reserve_range(Job *job, size_t size, size_t *offset);
+static Error grow_archive(Job *job, size_t size, size_t *offset);
+static Error write_range(const Archive *archive, size_t offset,
+                         const void *data, size_t size);
+static Error write_table_of_contents(Job *job);
+
+static Error create_archive(const char *directory, const char *filename,
+                            const MmcOptions *options, size_t num_threads,
+                            const NumaTopology *maybe_numa,
+                            NumaAccessCounts *accesses) {
+  assert(directory);
+  assert(filename);
+  assert(options);
+  assert(accesses);
+
+  Archive archive = {.members = NULL, .num_members = 0};
+  size_t capacity = 0;
+  Error error = collect_members(directory, "", &archive, &capacity);
+
+  if (error.what) {
+    free_members(&archive);
+
+    return error;
+  }
+
+  // sorted so that the same tree always produces the same table of contents
+  qsort(archive.members, archive.num_members, sizeof(Member),
+        compare_members);
+
+  if ((error = create_and_map_file(filename, HEADER_SIZE, &archive.file)),
+      error.what) {
+    free_members(&archive);
+
+    return error;
+  }
+
+  memcpy(archive.file.mapping, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+  store_le((unsigned char *)archive.file.mapping + ARCHIVE_MAGIC_SIZE,
+           ARCHIVE_VERSION, 4);
+
+  Job job = {.archive = &archive,
+             .root = directory,
+             .options = *options,
+             .maybe_member = NULL,
+             .maybe_numa = maybe_numa,
+             .process_member = compress_member,
+             .end_offset = HEADER_SIZE,
+             .accesses = *accesses};
+
+  if ((error = run_job(&job, num_threads)), !error.what) {
+    error = write_table_of_contents(&job);
+  }
+
+  *accesses = job.accesses;
+
+  const Error free_error = free_file(archive.file);
+
+  if (!error.what) {
+    error = free_error;
+  } else {
+    discard_error(free_error);
+  }
+
+  if (error.what) {
+    // the original error is more useful than why this failed
+    unlink(filename);
+  }
+
+  free_members(&archive);
+
+  return error;
+}
+
+static Error add_member(Archive *archive, size_t *capacity, char *path,
+                        const struct stat *statbuf);
+
+static Error collect_members(const char *directory, const char *relative_path,
+                             Archive *archive, size_t *capacity) {
+  assert(directory);
+  assert(relative_path);
+  assert(archive);
+  assert(capacity);
+
+  DIR *const stream = opendir(directory);
+
+  if (!stream) {
+    return ERRNO_EFORMAT("couldn't open directory '%s'", directory);
+  }
+
+  Error error = NULL_ERROR;
+  const struct dirent *entry;
+
+  while ((entry = readdir(stream))) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    char *const path = join_path(directory, entry->d_name);
+    char *const member_path = relative_path[0] == '\0'
+                                  ? strdup(entry->d_name)
+                                  : join_path(relative_path, entry->d_name);
+
+    if (!path || !member_path) {
+      free(path);
+      free(member_path);
+      error = ERROR_OUT_OF_MEMORY;
+
+      break;
+    }
+
+    struct stat statbuf;
+
+    // symbolic links are not followed, so every file is archived only once
+    if (lstat(path, &statbuf) == -1) {
+      error = ERRNO_EFORMAT("couldn't stat '%s'", path);
+      free(member_path);
+    } else if (S_ISDIR(statbuf.st_mode)) {
+      error = collect_members(path, member_path, archive, capacity);
+      free(member_path);
+    } else if (S_ISREG(statbuf.st_mode)) {
+      error = add_member(archive, capacity, member_path, &statbuf);
+    } else {
+      print_warning(eformat("skipping '%s', which isn't a regular file", path));
+      free(member_path);
+    }
+
+    free(path);
+
+    if (error.what) {
+      break;
+    }
+  }
+
+  closedir(stream);
+
+  return error;
+}
+
+// takes ownership of path
+static Error add_member(Archive *archive, size_t *capacity, char *path,
+                        const struct stat *statbuf) {
+  assert(archive);
+  assert(capacity);
+  assert(path);
+  assert(statbuf);
+
+  if (archive->num_members == *capacity) {
+    const size_t new_capacity = *capacity == 0 ? 64 : 2 * *capacity;
+    Member *const new_members =
+        realloc(archive->members, new_capacity * sizeof(Member));
+
+    if (!new_members) {
+      free(path);
+
+      return ERROR_OUT_OF_MEMORY;
+    }
+
+    archive->members = new_members;
+    *capacity = new_capacity;
+  }
+
+  archive->members[archive->num_members] = (Member){
+      .path = path,
+      .offset = 0,
+      .compressed_size = 0,
+      .uncompressed_size = (size_t)statbuf->st_size,
+      .checksum = 0,
+      .mode = (uint32_t)(statbuf->st_mode & 07777),
+      .codec = MMC_CODEC_ZLIB,
+  };
+  ++archive->num_members;
+
+  return NULL_ERROR;
+}
+
+static int compare_members(const void *lhs_v, const void *rhs_v) {
+  assert(lhs_v);
+  assert(rhs_v);
+
+  return strcmp(((const Member *)lhs_v)->path, ((const Member *)rhs_v)->path);
+}
+
+static Error compress_member(Worker *worker, size_t index) {
+  assert(worker);
+
+  Job *const job = worker->job;
+  assert(index < job->archive->num_members);
+
+  Member *const member = &job->archive->members[index];
+  char *const filename = join_path(job->root, member->path);
+
+  if (!filename) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  // empty files can't be mapped, but still get a valid compressed stream
+  const bool has_input = member->uncompressed_size > 0;
+  FileAndMapping input = {.mapping = "", .file_size = 0};
+  Error error = NULL_ERROR;
+
+  if (has_input &&
+      (error = open_and_map_file(filename, &input), error.what)) {
+    free(filename);
+
+    return error;
+  }
+
+  MmcContext *context;
+  MmcBuffer compressed;
+
+  if ((error = mmc_acquire_context(worker->pool, &job->options,
+                                   MMC_DIRECTION_COMPRESS, &context)),
+      error.what) {
+    goto cleanup_input;
+  }
+
+  error = mmc_transform_buffer(context, input.mapping, input.file_size,
+                               &compressed);
+  mmc_release_context(worker->pool, context);
+
+  if (error.what) {
+    goto cleanup_input;
+  }
+
+  // while the pages that were read are still mapped
+  if (job->maybe_numa && has_input) {
+    count_numa_accesses(job->maybe_numa, input.mapping, input.file_size,
+                        &worker->accesses);
+  }
+
+  // the file may have changed size since it was listed
+  member->uncompressed_size = input.file_size;
+  member->compressed_size = compressed.size;
+  member->checksum = crc32c(0, compressed.data, compressed.size);
+  member->codec = job->options.codec;
+
+  if ((error = reserve_range(job, compressed.size, &member->offset)),
+      !error.what) {
+    error = write_range(job->archive, member->offset, compressed.data,
+                        compressed.size);
+  }
+
+  discard_error(mmc_free_buffer(compressed));
+
+cleanup_input:
+  if (has_input) {
+    discard_error(free_file(input));
+  }
+
+  free(filename);
+
+  return error;
+}
+
+// appends size bytes to the archive, which any thread can then fill in
+static Error reserve_range(Job *job, size_t size, size_t *offset) {
+  assert(job);
+  assert(offset);
+
+  pthread_mutex_lock(&job->mutex);
+  const Error error = grow_archive(job, size, offset);
+  pthread_mutex_unlock(&job->mutex);
+
+  return error;
+}
+
+static Error grow_archive(Job *job, size_t size, size_t *offset) {
+  assert(job);
+  assert(offset);
+
+  const size_t new_end_offset = job->end_offset + size;
+
+  if (ftruncate(job->archive->file.fd, (off_t)new_end_offset) == -1) {
+    return ERRNO_EFORMAT("couldn't set length of file '%s' to '%zu'",
+                         job->archive->file.filename, new_end_offset);
+  }
+
+  *offset = job->end_offset;
+  job->end_offset = new_end_offset;
+
+  return NULL_ERROR;
+}
+
+// maps only the pages that hold the range, so writers never need to remap
+// the rest of the archive as it grows
+static Error write_range(const Archive *archive, size_t offset,
+                         const void *data, size_t size) {
+  assert(archive);
+  assert(data);
+
+  if (size == 0) {
+    return NULL_ERROR;
+  }
+
+  FileAndMapping range;
+  Error error = map_file_range(archive->file.filename, archive->file.fd,
+                               offset, size, true, &range);
+
+  if (error.what) {
+    return error;
+  }
+
+  memcpy((char *)range.mapping + (offset - range.mapping_offset), data, size);
+
+  return free_file(range);
+}
+
+static Error write_table_of_contents(Job *job) {
+  assert(job);
+
+  const Archive *const archive = job->archive;
+  size_t size = TRAILER_SIZE;
+
+  for (size_t i = 0; i < archive->num_members; ++i) {
+    size += ENTRY_SIZE + strlen(archive->members[i].path);
+  }
+
+  unsigned char *const table = malloc(size);
+
+  if (!table) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  unsigned char *entry = table;
+
+  for (size_t i = 0; i < archive->num_members; ++i) {
+    const Member *const member = &archive->members[i];
+    const size_t path_length = strlen(member->path);
+
+    store_le(entry, member->offset, 8);
+    store_le(entry + 8, member->compressed_size, 8);
+    store_le(entry + 16, member->uncompressed_size, 8);
+    store_le(entry + 24, member->checksum, 4);
+    store_le(entry + 28, member->mode, 4);
+    store_le(entry + 32, (uint64_t)member->codec, 1);
+    store_le(entry + 33, 0, 1);
+    store_le(entry + 34, path_length, 2);
+    memcpy(entry + ENTRY_SIZE, member->path, path_length);
+
+    entry += ENTRY_SIZE + path_length;
+  }
+
+  // the workers are done, so there's nothing to lock against
+  const size_t table_size = (size_t)(entry - table);
+  size_t offset = 0;
+  Error error = grow_archive(job, size, &offset);
+
+  if (!error.what) {
+    store_le(entry, offset, 8);
+    store_le(entry + 8, table_size, 8);
+    store_le(entry + 16, archive->num_members, 8);
+    store_le(entry + 24, crc32c(0, table, table_size), 4);
+    memcpy(entry + 28, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+
+    error = write_range(archive, offset, table, size);
+  }
+
+  free(table);
+
+  return error;
+}
+
+static void *run_worker(void *worker_v);
+
+static Error run_job(Job *job, size_t num_threads) {
+  assert(job);
+  assert(num_threads > 0);
+
+  job->next_member = 0;
+  job->error = NULL_ERROR;
+  job->num_pools = 0;
+
+  if (num_threads > job->archive->num_members) {
+    num_threads = job->archive->num_members;
+  }
+
+  if (num_threads == 0) {
+    return NULL_ERROR;
+  }
+
+  int errc = pthread_mutex_init(&job->mutex, NULL);
+
+  if (errc != 0) {
+    return eformat("couldn't initialize job mutex: %s (%d)", strerror(errc),
+                   errc);
+  }
+
+  Error error = NULL_ERROR;
+  Worker *const workers = malloc(num_threads * sizeof(Worker));
+
+  if (!workers) {
+    error = ERROR_OUT_OF_MEMORY;
+
+    goto cleanup_mutex;
+  }
+
+  const bool is_local =
+      job->maybe_numa && job->maybe_numa->mode == NUMA_MODE_LOCAL;
+  size_t num_pools = 1;
+
+  if (is_local) {
+    num_pools = (job->maybe_numa->num_nodes < num_threads)
+                    ? job->maybe_numa->num_nodes
+                    : num_threads;
+  }
+
+  // one idle context per thread is enough for every member to reuse one.
+  // workers are dealt out to nodes round-robin
+  for (; job->num_pools < num_pools; ++job->num_pools) {
+    const size_t num_pool_threads =
+        (num_threads - job->num_pools + num_pools - 1) / num_pools;
+
+    if ((error = mmc_create_context_pool(num_pool_threads,
+                                         &job->pools[job->num_pools])),
+        error.what) {
+      goto cleanup_pools;
+    }
+  }
+
+  size_t num_workers = 0;
+
+  for (; num_workers < num_threads; ++num_workers) {
+    Worker *const worker = &workers[num_workers];
+    const size_t node_index =
+        job->maybe_numa ? get_numa_worker_node(job->maybe_numa, num_workers)
+                        : 0;
+
+    *worker = (Worker){.job = job,
+                       .node_index = node_index,
+                       .pool = job->pools[is_local ? node_index : 0],
+                       .accesses = {.local_pages = 0, .remote_pages = 0}};
+
+    if ((errc = pthread_create(&worker->thread, NULL, run_worker, worker)) !=
+        0) {
+      error = eformat("couldn't create worker thread: %s (%d)", strerror(errc),
+                      errc);
+
+      break;
+    }
+  }
+
+  // without any workers, nobody else could take the remaining members
+  if (num_workers > 0) {
+    discard_error(error);
+    error = NULL_ERROR;
+  }
+
+  for (size_t i = 0; i < num_workers; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    add_numa_access_counts(&job->accesses, workers[i].accesses);
+  }
+
+  if (!error.what) {
+    error = job->error;
+  }
+
+cleanup_pools:
+  for (size_t i = 0; i < job->num_pools; ++i) {
+    mmc_free_context_pool(job->pools[i]);
+  }
+
+  job->num_pools = 0;
+  free(workers);
+
+cleanup_mutex:
+  pthread_mutex_destroy(&job->mutex);
+
+  return error;
+}
+
+static void record_error(Job *job, Error error);
+
+static void *run_worker(void *worker_v) {
+  assert(worker_v);
+
+  Worker *const worker = (Worker *)worker_v;
+  Job *const job = worker->job;
+  Error error;
+
+  // before the first member, so that everything it allocates and reads in is
+  // placed on its node
+  if (job->maybe_numa &&
+      (error = bind_thread_to_numa_node(job->maybe_numa, worker->node_index),
+       error.what)) {
+    record_error(job, error);
+
+    return NULL;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&job->mutex);
+
+    const bool has_failed = job->error.what != NULL;
+    const size_t index = job->next_member;
+
+    if (!has_failed && index < job->archive->num_members) {
+      ++job->next_member;
+    }
+
+    pthread_mutex_unlock(&job->mutex);
+
+    if (has_failed || index >= job->archive->num_members) {
+      return NULL;
+    }
+
+    if ((error = job->process_member(worker, index)), error.what) {
+      record_error(job, error);
+    }
+  }
+}
+
+// keeps the first error, which the other workers stop at
+static void record_error(Job *job, Error error) {
+  assert(job);
+  assert(error.what);
+
+  pthread_mutex_lock(&job->mutex);
+
+  if (!job->error.what) {
+    job->error = error;
+  } else {
+    discard_error(error);
+  }
+
+  pthread_mutex_unlock(&job->mutex);
+}
+
+static Error read_table_of_contents(Archive *archive, size_t archive_size);
+static Error extract_member(Worker *worker, size_t index);
+static Error make_directories(char *path);
+
+static Error extract_archive(const char *filename, const char *directory,
+                             const char *maybe_member, size_t num_threads,
+                             const NumaTopology *maybe_numa,
+                             NumaAccessCounts *accesses) {
+  assert(filename);
+  assert(directory);
+  assert(accesses);
+
+  Archive archive = {.members = NULL, .num_members = 0};
+  const int fd = open(filename, O_RDONLY);
+
+  if (fd == -1) {
+    return ERRNO_EFORMAT("couldn't open file '%s' for reading", filename);
+  }
+
+  struct stat statbuf;
+
+  if (fstat(fd, &statbuf) == -1) {
+    close(fd);
+
+    return ERRNO_EFORMAT("couldn't stat file '%s'", filename);
+  }
+
+  // only the ranges that are read are ever mapped
+  archive.file = (FileAndMapping){.filename = filename,
+                                  .fd = fd,
+                                  .file_size = (size_t)statbuf.st_size,
+                                  .mapping = NULL,
+                                  .mapping_size = 0,
+                                  .mapping_offset = 0};
+
+  Error error = read_table_of_contents(&archive, (size_t)statbuf.st_size);
+
+  if (error.what) {
+    goto cleanup;
+  }
+
+  if (maybe_member) {
+    size_t i = 0;
+
+    while (i < archive.num_members &&
+           strcmp(archive.members[i].path, maybe_member) != 0) {
+      ++i;
+    }
+
+    if (i == archive.num_members) {
+      error = eformat("archive '%s' has no member '%s'", filename,
+                      maybe_member);
+
+      goto cleanup;
+    }
+  }
+
+  char *const root = strdup(directory);
+
+  if (!root) {
+    error = ERROR_OUT_OF_MEMORY;
+
+    goto cleanup;
+  }
+
+  error = make_directories(root);
+  free(root);
+
+  if (error.what) {
+    goto cleanup;
+  }
+
+  Job job = {.archive = &archive,
+             .root = directory,
+             .maybe_member = maybe_member,
+             .maybe_numa = maybe_numa,
+             .process_member = extract_member,
+             .accesses = *accesses};
+
+  error = run_job(&job, maybe_member ? 1 : num_threads);
+  *accesses = job.accesses;
+
+cleanup:
+  free_members(&archive);
+  close(fd);
+
+  return error;
+}
+
+static bool is_safe_path(const char *path);
+
+static Error read_table_of_contents(Archive *archive, size_t archive_size) {
+  assert(archive);
+
+  const char *const filename = archive->file.filename;
+
+  if (archive_size < HEADER_SIZE + TRAILER_SIZE) {
+    return eformat("'%s' is too small to be an mmc archive", filename);
+  }
+
+  FileAndMapping header;
+  Error error = map_file_range(filename, archive->file.fd, 0, HEADER_SIZE,
+                               false, &header);
+
+  if (error.what) {
+    return error;
+  }
+
+  const unsigned char *const header_bytes =
+      (const unsigned char *)header.mapping;
+  const bool has_magic =
+      memcmp(header_bytes, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) == 0;
+  const uint64_t version = load_le(header_bytes + ARCHIVE_MAGIC_SIZE, 4);
+  discard_error(free_file(header));
+
+  if (!has_magic) {
+    return eformat("'%s' is not an mmc archive", filename);
+  } else if (version != ARCHIVE_VERSION) {
+    return eformat("archive '%s' has unsupported version %" PRIu64, filename,
+                   version);
+  }
+
+  FileAndMapping trailer;
+  const size_t trailer_offset = archive_size - TRAILER_SIZE;
+
+  if ((error = map_file_range(filename, archive->file.fd, trailer_offset,
+                              TRAILER_SIZE, false, &trailer)),
+      error.what) {
+    return error;
+  }
+
+  const unsigned char *const trailer_bytes =
+      (const unsigned char *)trailer.mapping +
+      (trailer_offset - trailer.mapping_offset);
+  const uint64_t table_offset = load_le(trailer_bytes, 8);
+  const uint64_t table_size = load_le(trailer_bytes + 8, 8);
+  const uint64_t num_members = load_le(trailer_bytes + 16, 8);
+  const uint32_t table_checksum = (uint32_t)load_le(trailer_bytes + 24, 4);
+  const bool has_trailer_magic =
+      memcmp(trailer_bytes + 28, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) == 0;
+  discard_error(free_file(trailer));
+
+  if (!has_trailer_magic || table_offset < HEADER_SIZE ||
+      table_offset > trailer_offset ||
+      table_size != trailer_offset - table_offset ||
+      num_members > table_size / ENTRY_SIZE) {
+    return eformat("archive '%s' is truncated or corrupted", filename);
+  }
+
+  archive->members = calloc(num_members > 0 ? num_members : 1, sizeof(Member));
+
+  if (!archive->members) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  if (num_members == 0) {
+    return NULL_ERROR;
+  }
+
+  FileAndMapping table;
+
+  if ((error = map_file_range(filename, archive->file.fd, table_offset,
+                              table_size, false, &table)),
+      error.what) {
+    return error;
+  }
+
+  const unsigned char *entry = (const unsigned char *)table.mapping +
+                               (table_offset - table.mapping_offset);
+  const unsigned char *const table_end = entry + table_size;
+
+  if (crc32c(0, entry, table_size) != table_checksum) {
+    error = eformat("table of contents of archive '%s' is corrupted",
+                    filename);
+
+    goto cleanup;
+  }
+
+  for (; archive->num_members < num_members; ++archive->num_members) {
+    Member *const member = &archive->members[archive->num_members];
+
+    if ((size_t)(table_end - entry) < ENTRY_SIZE) {
+      error = eformat("table of contents of archive '%s' is truncated",
+                      filename);
+
+      break;
+    }
+
+    member->offset = load_le(entry, 8);
+    member->compressed_size = load_le(entry + 8, 8);
+    member->uncompressed_size = load_le(entry + 16, 8);
+    member->checksum = (uint32_t)load_le(entry + 24, 4);
+    member->mode = (uint32_t)load_le(entry + 28, 4);
+    member->codec = (MmcCodecId)load_le(entry + 32, 1);
+
+    const size_t path_length = load_le(entry + 34, 2);
+
+    if ((size_t)(table_end - entry) - ENTRY_SIZE < path_length ||
+        member->codec >= NUM_MMC_CODECS || member->offset < HEADER_SIZE ||
+        member->offset > table_offset ||
+        member->compressed_size > table_offset - member->offset) {
+      error = eformat("table of contents of archive '%s' is corrupted",
+                      filename);
+
+      break;
+    }
+
+    member->path = malloc(path_length + 1);
+
+    if (!member->path) {
+      error = ERROR_OUT_OF_MEMORY;
+
+      break;
+    }
+
+    memcpy(member->path, entry + ENTRY_SIZE, path_length);
+    member->path[path_length] = '\0';
+
+    // the path is still owned by the member, so count it before checking
+    if (!is_safe_path(member->path)) {
+      error = eformat("archive '%s' has member with unsafe path '%s'",
+                      filename, member->path);
+      ++archive->num_members;
+
+      break;
+    }
+
+    entry += ENTRY_SIZE + path_length;
+  }
+
+cleanup:
+  discard_error(free_file(table));
+
+  return error;
+}
+
+// rejects paths that could escape the destination directory
+static bool is_safe_path(const char *path) {
+  assert(path);
+
+  if (path[0] == '\0' || path[0] == '/') {
+    return false;
+  }
+
+  for (const char *component = path;;) {
+    const char *const end = strchr(component, '/');
+    const size_t length = end ? (size_t)(end - component) : strlen(component);
+
+    if (length == 0 || (length == 1 && component[0] == '.') ||
+        (length == 2 && component[0] == '.' && component[1] == '.')) {
+      return false;
+    }
+
+    if (!end) {
+      return true;
+    }
+
+    component = end + 1;
+  }
+}
+
+static Error extract_member(Worker *worker, size_t index) {
+  assert(worker);
+
+  Job *const job = worker->job;
+  assert(index < job->archive->num_members);
+
+  const Member *const member = &job->archive->members[index];
+
+  if (job->maybe_member && strcmp(member->path, job->maybe_member) != 0) {
+    return NULL_ERROR;
+  }
+
+  char *const filename = join_path(job->root, member->path);
+
+  if (!filename) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  // join_path always adds a separator in front of the member's path
+  char *const last_separator = strrchr(filename, '/');
+  *last_separator = '\0';
+  Error error = make_directories(filename);
+  *last_separator = '/';
+
+  if (error.what) {
+    goto cleanup_filename;
+  }
+
+  FileAndMapping range;
+
+  if ((error = map_file_range(job->archive->file.filename,
+                              job->archive->file.fd, member->offset,
+                              member->compressed_size, false, &range)),
+      error.what) {
+    goto cleanup_filename;
+  }
+
+  const char *const data =
+      (const char *)range.mapping + (member->offset - range.mapping_offset);
+  const uint32_t checksum = crc32c(0, data, member->compressed_size);
+
+  if (checksum != member->checksum) {
+    error = eformat("member '%s' is corrupted: its CRC-32C is %08" PRIx32
+                    ", but should be %08" PRIx32,
+                    member->path, checksum, member->checksum);
+
+    goto cleanup_range;
+  }
+
+  if (member->uncompressed_size == 0) {
+    // nothing to map, so there's no need to run the codec
+    const int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (fd == -1) {
+      error = ERRNO_EFORMAT("couldn't create file '%s' for writing", filename);
+    } else {
+      close(fd);
+    }
+  } else {
+    const MmcOptions options = mmc_make_options(member->codec);
+    MmcContext *context;
+
+    if ((error = mmc_acquire_context(worker->pool, &options,
+                                     MMC_DIRECTION_DECOMPRESS, &context)),
+        !error.what) {
+      error = mmc_transform_buffer_to_file(context, data,
+                                           member->compressed_size, filename);
+      mmc_release_context(worker->pool, context);
+    }
+  }
+
+  if (job->maybe_numa) {
+    count_numa_accesses(job->maybe_numa, data, member->compressed_size,
+                        &worker->accesses);
+  }
+
+  if (error.what) {
+    goto cleanup_range;
+  }
+
+  struct stat statbuf;
+
+  if (stat(filename, &statbuf) == -1) {
+    error = ERRNO_EFORMAT("couldn't stat '%s'", filename);
+  } else if ((size_t)statbuf.st_size != member->uncompressed_size) {
+    error = eformat("member '%s' decompressed to %zu bytes instead of %zu",
+                    member->path, (size_t)statbuf.st_size,
+                    member->uncompressed_size);
+  } else if (chmod(filename, (mode_t)member->mode) == -1) {
+    error = ERRNO_EFORMAT("couldn't set permissions of '%s'", filename);
+  }
+
+cleanup_range:
+  discard_error(free_file(range));
+
+cleanup_filename:
+  free(filename);
+
+  return error;
+}
+
+// creates path and any of its parents that are missing. path is modified in
+// place, but restored before returning
+static Error make_directories(char *path) {
+  assert(path);
+
+  Error error = NULL_ERROR;
+  // a leading separator names the root directory, which always exists
+  char *next = path[0] == '/' ? path + 1 : path;
+
+  for (;;) {
+    char *const separator = strchr(next, '/');
+
+    if (separator) {
+      *separator = '\0';
+    }
+
+    // other workers may be creating the same directories
+    if (mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO) == -1 && errno != EEXIST) {
+      error = ERRNO_EFORMAT("couldn't create directory '%s'", path);
+    }
+
+    if (separator) {
+      *separator = '/';
+    }
+
+    if (error.what || !separator) {
+      return error;
+    }
+
+    next = separator + 1;
+  }
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/arena.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+// keeps hash tables and windows from sharing cache lines with other data
+#define ALIGNMENT ((size_t)64)
+
+static size_t round_up(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+Error create_arena(size_t reserve_size, Arena *arena) {
+  assert(reserve_size > 0);
+  assert(arena);
+
+  // a huge page would only make a small arena take up more memory
+  if (reserve_size < HUGE_PAGE_SIZE) {
+    const size_t size = round_up(reserve_size, (size_t)sysconf(_SC_PAGESIZE));
+    char *const base =
+        mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED) {
+      return ERRNO_EFORMAT("couldn't reserve %zu bytes for arena", size);
+    }
+
+    *arena = (Arena){.base = base, .size = size, .used = 0, .last_offset = 0};
+
+    return NULL_ERROR;
+  }
+
+  const size_t size = round_up(reserve_size, HUGE_PAGE_SIZE);
+
+  // reserve an extra huge page so that the arena can start on a boundary
+  char *const mapping =
+      mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (mapping == MAP_FAILED) {
+    return ERRNO_EFORMAT("couldn't reserve %zu bytes for arena", size);
+  }
+
+  char *const base =
+      (char *)round_up((size_t)(uintptr_t)mapping, HUGE_PAGE_SIZE);
+  const size_t head_size = (size_t)(base - mapping);
+  const size_t tail_size = HUGE_PAGE_SIZE - head_size;
+
+  if (head_size > 0) {
+    munmap(mapping, head_size);
+  }
+
+  if (tail_size > 0) {
+    munmap(base + size, tail_size);
+  }
+
+#ifdef MADV_HUGEPAGE
+  // not the end of the world if transparent huge pages are disabled
+  madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+  *arena = (Arena){.base = base, .size = size, .used = 0, .last_offset = 0};
+
+  return NULL_ERROR;
+}
+
+void *arena_allocate(Arena *arena, size_t size) {
+  assert(arena);
+
+  const size_t offset = round_up(arena->used, ALIGNMENT);
+
+  if (offset > arena->size || size > arena->size - offset) {
+    return malloc(size);
+  }
+
+  arena->last_offset = offset;
+  arena->used = offset + size;
+
+  return arena->base + offset;
+}
+
+void arena_free(Arena *arena, void *pointer) {
+  assert(arena);
+
+  if (!pointer) {
+    return;
+  }
+
+  char *const bytes = (char *)pointer;
+
+  if (bytes < arena->base || bytes >= arena->base + arena->size) {
+    free(pointer);
+
+    return;
+  }
+
+  // lets a codec that frees and reallocates a growing buffer reuse its space
+  if (bytes == arena->base + arena->last_offset &&
+      arena->last_offset < arena->used) {
+    arena->used = arena->last_offset;
+  }
+}
+
+void free_arena(Arena arena) {
+  if (!arena.base) {
+    return;
+  }
+
+  munmap(arena.base, arena.size);
+}
+
+size_t arena_resident_size(size_t size) {
+#ifdef MADV_HUGEPAGE
+  if (size >= HUGE_PAGE_SIZE) {
+    return round_up(size, HUGE_PAGE_SIZE);
+  }
+#endif
+
+  return round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+}
@@ -30,6 +30,8 @@
 
 static Error do_parse_integer(ArgumentParser *self_base,
                               const char *maybe_value_str);
+static Error do_parse_range(ArgumentParser *self_base,
+                            const char *maybe_value_str);
 static Error do_parse_string(ArgumentParser *self_base,
                              const char *maybe_value_str);
 static Error do_parse_passthrough(ArgumentParser *self_base,
@@ -52,6 +54,23 @@ IntegerArgumentParser make_integer_parser(const char *name,
   };
 }
 
+RangeArgumentParser make_range_parser(const char *name,
+                                      const char *metavariable,
+                                      long long min_value,
+                                      long long max_value) {
+  assert(name);
+  assert(metavariable);
+  assert(min_value <= max_value);
+
+  return (RangeArgumentParser){
+      .argument_parser = {.name = name,
+                          .metavariable = metavariable,
+                          .parser = do_parse_range},
+      .min_value = min_value,
+      .max_value = max_value,
+  };
+}
+
 StringArgumentParser
 make_string_parser(const char *name, const char *metavariable,
                    size_t num_possible_values,
@@ -127,6 +146,13 @@ Error parse_arguments(Arguments *arguments, int argc,
       assert(char_to_index(*ch) != SIZE_MAX || *ch == '-');
     }
 
+    if (this_keyword_arg->long_name_alias) {
+      for (const char *ch = this_keyword_arg->long_name_alias; *ch != '\0';
+           ++ch) {
+        assert(char_to_index(*ch) != SIZE_MAX || *ch == '-');
+      }
+    }
+
     if (this_keyword_arg->parser) {
       assert(this_keyword_arg->parser->parser);
       assert(this_keyword_arg->parser->name);
@@ -146,6 +172,11 @@ Error parse_arguments(Arguments *arguments, int argc,
     assert(this_positional_arg->parser);
     assert(this_positional_arg->parser->parser);
     assert(this_positional_arg->parser->name);
+
+    if (i > 0) {
+      assert(this_positional_arg->is_optional ||
+             !arguments->positional_args[i - 1]->is_optional);
+    }
   }
 
   // check for duplicate short names
@@ -270,6 +301,14 @@ Error parse_arguments(Arguments *arguments, int argc,
 
         goto cleanup;
       }
+
+      if (this_keyword_arg->long_name_alias &&
+          insert_unique(&arena, 0, this_keyword_arg->long_name_alias,
+                        this_keyword_arg) == SIZE_MAX) {
+        error = ERROR_OUT_OF_MEMORY;
+
+        goto cleanup;
+      }
     }
   } else {
     arena = (TrieArena){.root = NULL, .size = 0, .capacity = 0};
@@ -320,6 +359,28 @@ Error parse_arguments(Arguments *arguments, int argc,
         goto cleanup;
       }
 
+      if (!this_keyword_arg->parser) {
+        // flag
+        if (maybe_value) {
+          error = eformat("option -%c, --%s does not take an argument",
+                          this_keyword_arg->short_name,
+                          this_keyword_arg->long_name);
+
+          goto cleanup;
+        }
+
+        this_keyword_arg->was_found = true;
+
+        continue;
+      }
+
+      if (!maybe_value && this_keyword_arg->has_optional_value) {
+        // --key
+        this_keyword_arg->was_found = true;
+
+        continue;
+      }
+
       if (!maybe_value) {
         // --key value
         if (i + 1 >= last_index) {
@@ -341,6 +402,8 @@ Error parse_arguments(Arguments *arguments, int argc,
       if (error.what) {
         goto cleanup;
       }
+
+      this_keyword_arg->was_found = true;
     } else {
       // short option(s)
       if (arguments->num_keyword_args == 0) {
@@ -374,7 +437,12 @@ Error parse_arguments(Arguments *arguments, int argc,
         const char *maybe_value;
         bool contains_value;
 
-        if (*(ch + 1) == '\0') {
+        if (*(ch + 1) == '\0' && this_keyword_arg->has_optional_value) {
+          // -k
+          this_keyword_arg->was_found = true;
+
+          continue;
+        } else if (*(ch + 1) == '\0') {
           // -k value
           if (i + 1 >= last_index) {
             error = eformat("missing required argument %s for option -%c, --%s",
@@ -407,6 +475,8 @@ Error parse_arguments(Arguments *arguments, int argc,
           goto cleanup;
         }
 
+        this_keyword_arg->was_found = true;
+
         if (contains_value) {
           break;
         }
@@ -439,7 +509,8 @@ Error parse_arguments(Arguments *arguments, int argc,
     }
   }
 
-  if (positional_arg_index < arguments->num_positional_args) {
+  if (!error.what && positional_arg_index < arguments->num_positional_args &&
+      !arguments->positional_args[positional_arg_index]->is_optional) {
     const PositionalArgument *const this_positional_arg =
         arguments->positional_args[positional_arg_index];
 
@@ -495,7 +566,12 @@ Error print_help(const Arguments *arguments) {
   }
 
   for (size_t i = 0; i < arguments->num_positional_args; ++i) {
-    if (printf(" %s", arguments->positional_args[i]->name) < 0) {
+    const PositionalArgument *const this_positional_arg =
+        arguments->positional_args[i];
+    const char *const format =
+        this_positional_arg->is_optional ? " [%s]" : " %s";
+
+    if (printf(format, this_positional_arg->name) < 0) {
       return UNWRITEABLE_HELP_TEXT();
     }
   }
@@ -578,7 +654,15 @@ Error print_help(const Arguments *arguments) {
     const KeywordArgument *const this_keyword_arg = arguments->keyword_args[i];
     assert(this_keyword_arg);
 
-    if (this_keyword_arg->parser) {
+    if (this_keyword_arg->parser && this_keyword_arg->has_optional_value) {
+      assert(this_keyword_arg->parser->metavariable);
+
+      if (printf("\n    -%c, --%s[=%s]", this_keyword_arg->short_name,
+                 this_keyword_arg->long_name,
+                 this_keyword_arg->parser->metavariable) < 0) {
+        return UNWRITEABLE_HELP_TEXT();
+      }
+    } else if (this_keyword_arg->parser) {
       assert(this_keyword_arg->parser->metavariable);
 
       if (printf("\n    -%c, --%s=%s", this_keyword_arg->short_name,
@@ -802,6 +886,54 @@ static Error do_parse_integer(ArgumentParser *self_base,
   return NULL_ERROR;
 }
 
+static Error do_parse_range(ArgumentParser *self_base,
+                            const char *maybe_value_str) {
+  assert(self_base);
+  assert(maybe_value_str);
+
+  RangeArgumentParser *const self = (RangeArgumentParser *)self_base;
+
+  errno = 0;
+  char *separator;
+  const long long low = strtoll(maybe_value_str, &separator, 10);
+
+  if (separator == maybe_value_str || *separator != ':') {
+    return eformat("invalid argument for %s: couldn't parse '%s' as a range of "
+                   "the form MIN:MAX",
+                   self_base->name, maybe_value_str);
+  }
+
+  const int low_errno = errno;
+  errno = 0;
+  char *end;
+  const long long high = strtoll(separator + 1, &end, 10);
+
+  if (end == separator + 1 || *end != '\0') {
+    return eformat("invalid argument for %s: couldn't parse '%s' as a range of "
+                   "the form MIN:MAX",
+                   self_base->name, maybe_value_str);
+  }
+
+  if (low_errno != 0 || errno != 0 || low < self->min_value ||
+      high > self->max_value) {
+    return eformat("invalid argument for %s: expected both ends of the range "
+                   "to be in [%lld, %lld], got %s",
+                   self_base->name, self->min_value, self->max_value,
+                   maybe_value_str);
+  }
+
+  if (low > high) {
+    return eformat("invalid argument for %s: expected MIN to be at most MAX, "
+                   "got %s",
+                   self_base->name, maybe_value_str);
+  }
+
+  self->low = low;
+  self->high = high;
+
+  return NULL_ERROR;
+}
+
 static char *stringify_string_array(const char *const *strings,
                                     size_t num_strings);
 
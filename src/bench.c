@@ -0,0 +1,1773 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/app.h>
+#include <common/argparse.h>
+#include <common/cpu.h>
+#include <common/error.h>
+#include <common/file.h>
+#include <common/mmc.h>
+#include <common/perf.h>
+#include <common/stats.h>
+
+#ifdef MMC_HAVE_ZLIB
+#include <common/zlib_codec.h>
+#endif
+
+#ifdef MMC_HAVE_LZ4
+#include <common/lz4_codec.h>
+
+#include <lz4hc.h>
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+#include <common/zstd_codec.h>
+#endif
+
+#include "file_syscalls.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#define MAX_PARAMETERS_LENGTH 128
+
+// scales a median absolute deviation to a standard deviation for normal data
+#define MAD_TO_STANDARD_DEVIATION 1.4826
+
+// chance that comparing an unchanged build against its own baseline flags any
+// case as slower, spread over all the comparisons with a Bonferroni correction
+#define FAMILY_FALSE_ALARM_RATE 0.01
+
+// differences smaller than this many standard deviations are always noise
+#define MIN_NOISE_STANDARD_DEVIATIONS 3.0
+
+// time differences below this are never regressions. it is well above the
+// resolution of CLOCK_MONOTONIC, but a single preemption by a timer tick is
+// enough to move the median of a case that takes a fraction of a millisecond
+#define MIN_REGRESSION_SECONDS 1e-3
+
+typedef enum OutputFormat {
+  OUTPUT_FORMAT_CSV,
+  OUTPUT_FORMAT_JSON,
+} OutputFormat;
+
+typedef enum CodecFilter {
+  CODEC_FILTER_ALL,
+  CODEC_FILTER_ZLIB,
+  CODEC_FILTER_LZ4,
+  CODEC_FILTER_ZSTD,
+} CodecFilter;
+
+typedef struct BaselineEntry {
+  char *filename;
+  char *codec;
+  char *parameters;
+
+  size_t compressed_size;
+
+  double compress_seconds;
+  double compress_mad_seconds;
+  double decompress_seconds;
+  double decompress_mad_seconds;
+} BaselineEntry;
+
+typedef struct Bench {
+  OutputFormat format;
+  CodecFilter codec_filter;
+  size_t num_trials;
+  size_t num_warmups;
+
+  // regressions smaller than this fraction of the baseline are ignored
+  double threshold;
+  BaselineEntry *baseline;
+  size_t num_baseline_entries;
+  // time differences smaller than this many standard deviations are noise
+  double noise_standard_deviations;
+  size_t num_regressions;
+
+  // NULL unless hardware counters were requested and are available
+  PerfCounters *maybe_perf_counters;
+
+  size_t num_results;
+
+  // scratch space for per-trial timings, num_trials elements each
+  double *compress_seconds;
+  double *decompress_seconds;
+} Bench;
+
+typedef struct Measurement {
+  double seconds;
+  size_t page_faults;
+  size_t syscalls;
+  PerfCounts perf_counts;
+} Measurement;
+
+typedef struct Result {
+  const char *filename;
+  const char *codec;
+  const char *parameters;
+
+  size_t input_size;
+  size_t compressed_size;
+
+  double compress_seconds;
+  double compress_mad_seconds;
+  double decompress_seconds;
+  double decompress_mad_seconds;
+
+  long peak_rss_kib;
+  size_t compress_page_faults;
+  size_t decompress_page_faults;
+  size_t compress_syscalls;
+  size_t decompress_syscalls;
+
+  // averaged over all trials
+  PerfCounts compress_perf_counts;
+  PerfCounts decompress_perf_counts;
+} Result;
+
+typedef struct Corpus {
+  char **filenames;
+  FileAndMapping *files;
+  size_t num_files;
+} Corpus;
+
+static const char *const FORMAT_VALUES[] = {"csv", "json"};
+static const char *const CODEC_VALUES[] = {"all", "zlib", "lz4", "zstd"};
+
+static Error load_corpus(const char *path, Corpus *corpus);
+static Error load_baseline(const char *filename, Bench *bench);
+static double get_noise_standard_deviations(size_t num_comparisons);
+static void free_baseline(Bench *bench);
+static void free_corpus(Corpus *corpus);
+static Error bench_file(Bench *bench, const FileAndMapping *input);
+static Error bench_case(Bench *bench, const FileAndMapping *input,
+                        const char *codec, const char *parameters,
+                        const AppParams *compress, const AppParams *decompress);
+static void print_header(const Bench *bench);
+static void print_result(Bench *bench, const Result *result);
+static void print_footer(const Bench *bench);
+static void compare_to_baseline(Bench *bench, const Result *result);
+
+int main(int argc, const char *const argv[]) {
+  PassthroughArgumentParser corpus_parser =
+      make_passthrough_parser("CORPUS", NULL);
+
+  StringArgumentParser format_parser =
+      make_string_parser("-f, --format", "FORMAT",
+                         sizeof(FORMAT_VALUES) / sizeof(FORMAT_VALUES[0]),
+                         FORMAT_VALUES);
+  KeywordArgument format = {
+      .short_name = 'f',
+      .long_name = "format",
+      .help_text = "Output format. One of 'csv' (the default) or 'json'.",
+      .parser = &format_parser.argument_parser,
+  };
+
+  StringArgumentParser codec_parser = make_string_parser(
+      "-c, --codec", "CODEC", sizeof(CODEC_VALUES) / sizeof(CODEC_VALUES[0]),
+      CODEC_VALUES);
+  KeywordArgument codec = {
+      .short_name = 'c',
+      .long_name = "codec",
+      .help_text = "Codec to benchmark. One of 'all' (the default), 'zlib', "
+                   "'lz4', or 'zstd'. Only codecs that mmc was built with are "
+                   "available.",
+      .parser = &codec_parser.argument_parser,
+  };
+
+  IntegerArgumentParser trials_parser =
+      make_integer_parser("-t, --trials", "TRIALS", 1, 1000);
+  KeywordArgument trials = {
+      .short_name = 't',
+      .long_name = "trials",
+      .help_text = "Number of timed trials of each case, defaulting to 5. The "
+                   "median time of all trials is reported.",
+      .parser = &trials_parser.argument_parser,
+  };
+
+  IntegerArgumentParser warmup_parser =
+      make_integer_parser("-w, --warmup", "WARMUP", 0, 1000);
+  KeywordArgument warmup = {
+      .short_name = 'w',
+      .long_name = "warmup",
+      .help_text = "Number of untimed trials of each case to run before the "
+                   "timed trials, defaulting to 1.",
+      .parser = &warmup_parser.argument_parser,
+  };
+
+  PassthroughArgumentParser baseline_parser =
+      make_passthrough_parser("-b, --baseline", "BASELINE");
+  KeywordArgument baseline = {
+      .short_name = 'b',
+      .long_name = "baseline",
+      .help_text = "JSON output of a previous run to compare against. If any "
+                   "case is slower or compresses worse than in the baseline "
+                   "by more than the threshold, mmc-bench exits with a "
+                   "non-zero status.",
+      .parser = &baseline_parser.argument_parser,
+  };
+
+  IntegerArgumentParser threshold_parser =
+      make_integer_parser("-r, --threshold", "PERCENT", 1, 1000);
+  KeywordArgument threshold = {
+      .short_name = 'r',
+      .long_name = "threshold",
+      .help_text = "Largest tolerated regression against the baseline, in "
+                   "percent, defaulting to 5. Time differences must also "
+                   "exceed 1 ms and the noise of both runs, as estimated by "
+                   "the median absolute deviation of their trials. The more "
+                   "cases the baseline has, the more noise is tolerated, so "
+                   "that an unchanged build rarely fails against itself.",
+      .parser = &threshold_parser.argument_parser,
+  };
+
+  KeywordArgument perf_counters = {
+      .short_name = 'P',
+      .long_name = "perf-counters",
+      .help_text = "Count CPU cycles, instructions, branch misses, last-level "
+                   "cache misses, and data TLB misses while each codec runs "
+                   "using perf_event_open(2), and report IPC and cycles per "
+                   "uncompressed byte. Counters that the kernel or hardware "
+                   "don't support are left empty.",
+      .parser = NULL,
+  };
+
+  StringArgumentParser cpu_parser = make_string_parser(
+      "-C, --cpu", "LEVEL",
+      sizeof(CPU_LEVEL_NAMES) / sizeof(CPU_LEVEL_NAMES[0]), CPU_LEVEL_NAMES);
+  KeywordArgument cpu = {
+      .short_name = 'C',
+      .long_name = "cpu",
+      .help_text = "Instruction set to pick checksum kernels for: one of "
+                   "'generic', 'avx2', or 'avx512'. Defaults to the best that "
+                   "the CPU supports. Run once per level, each with its own "
+                   "--baseline, to compare kernels.",
+      .parser = &cpu_parser.argument_parser,
+  };
+
+  KeywordArgument *keyword_args[] = {&format,   &codec,     &trials,
+                                     &warmup,   &baseline,  &threshold,
+                                     &perf_counters, &cpu};
+
+  Arguments arguments = {
+      .executable_name = "mmc-bench",
+      .version = MMC_VERSION,
+      .author = MMC_AUTHOR,
+      .description =
+          "mmc-bench measures the mmc codecs in-process. Every file in the "
+          "corpus is mapped into memory once, then compressed and "
+          "decompressed with each combination of codec parameters. Results "
+          "are written to standard output.",
+
+      .positional_args =
+          (PositionalArgument *[]){
+              &(PositionalArgument){
+                  .name = "CORPUS",
+                  .help_text = "File or directory of files to benchmark "
+                               "with. Directories are not searched "
+                               "recursively.",
+                  .parser = &corpus_parser.argument_parser,
+              },
+          },
+      .num_positional_args = 1,
+
+      .keyword_args = keyword_args,
+      .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
+  };
+
+  Error error = parse_arguments(&arguments, argc, argv);
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if (arguments.has_help) {
+    print_help(&arguments);
+
+    return EXIT_SUCCESS;
+  } else if (arguments.has_version) {
+    print_version(&arguments);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (cpu.was_found) {
+    if ((error = override_cpu_level((CpuLevel)cpu_parser.value_index)),
+        error.what) {
+      print_error(error);
+
+      return EXIT_FAILURE;
+    }
+  }
+
+  Bench bench = {
+      .format = format.was_found ? (OutputFormat)format_parser.value_index
+                                 : OUTPUT_FORMAT_CSV,
+      .codec_filter = codec.was_found ? (CodecFilter)codec_parser.value_index
+                                      : CODEC_FILTER_ALL,
+      .num_trials = trials.was_found ? (size_t)trials_parser.value : 5,
+      .num_warmups = warmup.was_found ? (size_t)warmup_parser.value : 1,
+      .threshold =
+          threshold.was_found ? (double)threshold_parser.value / 100 : 0.05,
+      .baseline = NULL,
+      .num_baseline_entries = 0,
+      .noise_standard_deviations = MIN_NOISE_STANDARD_DEVIATIONS,
+      .num_regressions = 0,
+      .maybe_perf_counters = NULL,
+  };
+
+  bench.compress_seconds = malloc(bench.num_trials * sizeof(double));
+  bench.decompress_seconds = malloc(bench.num_trials * sizeof(double));
+
+  if (!bench.compress_seconds || !bench.decompress_seconds) {
+    free(bench.compress_seconds);
+    free(bench.decompress_seconds);
+    print_error(ERROR_OUT_OF_MEMORY);
+
+    return EXIT_FAILURE;
+  }
+
+  PerfCounters perf_counters_storage;
+
+  if (perf_counters.was_found) {
+    if ((error = open_perf_counters(&perf_counters_storage)), error.what) {
+      print_warning(error);
+    } else {
+      bench.maybe_perf_counters = &perf_counters_storage;
+    }
+  }
+
+  int return_code = EXIT_SUCCESS;
+
+  if (baseline.was_found) {
+    if ((error = load_baseline(baseline_parser.value, &bench)), error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      goto cleanup_bench;
+    }
+
+    // each case is compared on both compression and decompression time
+    bench.noise_standard_deviations =
+        get_noise_standard_deviations(2 * bench.num_baseline_entries);
+  }
+
+  Corpus corpus;
+
+  if ((error = load_corpus(corpus_parser.value, &corpus)), error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+
+    goto cleanup_baseline;
+  }
+
+  print_header(&bench);
+
+  for (size_t i = 0; i < corpus.num_files; ++i) {
+    if ((error = bench_file(&bench, &corpus.files[i])), error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      break;
+    }
+  }
+
+  print_footer(&bench);
+  free_corpus(&corpus);
+
+  if (return_code == EXIT_SUCCESS && bench.num_regressions > 0) {
+    print_error(eformat("%zu case(s) regressed by more than %g%% against "
+                        "baseline '%s'",
+                        bench.num_regressions, bench.threshold * 100,
+                        baseline_parser.value));
+    return_code = EXIT_FAILURE;
+  }
+
+cleanup_baseline:
+  free_baseline(&bench);
+
+cleanup_bench:
+  if (bench.maybe_perf_counters) {
+    close_perf_counters(bench.maybe_perf_counters);
+  }
+
+  free(bench.compress_seconds);
+  free(bench.decompress_seconds);
+
+  return return_code;
+}
+
+static int compare_strings(const void *lhs_v, const void *rhs_v);
+
+static Error load_corpus(const char *path, Corpus *corpus) {
+  assert(path);
+  assert(corpus);
+
+  *corpus = (Corpus){.filenames = NULL, .files = NULL, .num_files = 0};
+
+  struct stat statbuf;
+
+  if (stat(path, &statbuf) == -1) {
+    return ERRNO_EFORMAT("couldn't stat '%s'", path);
+  }
+
+  size_t capacity = 8;
+  corpus->filenames = malloc(capacity * sizeof(char *));
+
+  if (!corpus->filenames) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  Error error = NULL_ERROR;
+
+  if (S_ISDIR(statbuf.st_mode)) {
+    DIR *const directory = opendir(path);
+
+    if (!directory) {
+      error = ERRNO_EFORMAT("couldn't open directory '%s'", path);
+
+      goto cleanup;
+    }
+
+    const struct dirent *entry;
+
+    while ((entry = readdir(directory))) {
+      if (entry->d_name[0] == '.') {
+        continue;
+      }
+
+      const size_t length = strlen(path) + 1 + strlen(entry->d_name);
+      char *const filename = malloc(length + 1);
+
+      if (!filename) {
+        error = ERROR_OUT_OF_MEMORY;
+
+        break;
+      }
+
+      sprintf(filename, "%s/%s", path, entry->d_name);
+
+      if (stat(filename, &statbuf) == -1 || !S_ISREG(statbuf.st_mode) ||
+          statbuf.st_size == 0) {
+        free(filename);
+
+        continue;
+      }
+
+      if (corpus->num_files == capacity) {
+        char **const new_filenames =
+            realloc(corpus->filenames, 2 * capacity * sizeof(char *));
+
+        if (!new_filenames) {
+          free(filename);
+          error = ERROR_OUT_OF_MEMORY;
+
+          break;
+        }
+
+        corpus->filenames = new_filenames;
+        capacity *= 2;
+      }
+
+      corpus->filenames[corpus->num_files] = filename;
+      ++corpus->num_files;
+    }
+
+    closedir(directory);
+
+    if (error.what) {
+      goto cleanup;
+    }
+
+    qsort(corpus->filenames, corpus->num_files, sizeof(char *),
+          compare_strings);
+  } else {
+    corpus->filenames[0] = malloc(strlen(path) + 1);
+
+    if (!corpus->filenames[0]) {
+      error = ERROR_OUT_OF_MEMORY;
+
+      goto cleanup;
+    }
+
+    strcpy(corpus->filenames[0], path);
+    corpus->num_files = 1;
+  }
+
+  if (corpus->num_files == 0) {
+    error = eformat("corpus '%s' contains no non-empty files", path);
+
+    goto cleanup;
+  }
+
+  corpus->files = malloc(corpus->num_files * sizeof(FileAndMapping));
+
+  if (!corpus->files) {
+    error = ERROR_OUT_OF_MEMORY;
+
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < corpus->num_files; ++i) {
+    if ((error = open_and_map_file(corpus->filenames[i], &corpus->files[i])),
+        error.what) {
+      for (size_t j = 0; j < i; ++j) {
+        free_file(corpus->files[j]);
+      }
+
+      free(corpus->files);
+
+      goto cleanup;
+    }
+  }
+
+  return NULL_ERROR;
+
+cleanup:
+  for (size_t i = 0; i < corpus->num_files; ++i) {
+    free(corpus->filenames[i]);
+  }
+
+  free(corpus->filenames);
+
+  return error;
+}
+
+static void free_corpus(Corpus *corpus) {
+  assert(corpus);
+
+  for (size_t i = 0; i < corpus->num_files; ++i) {
+    const Error error = free_file(corpus->files[i]);
+
+    if (error.what) {
+      print_warning(error);
+    }
+
+    free(corpus->filenames[i]);
+  }
+
+  free(corpus->files);
+  free(corpus->filenames);
+}
+
+static int compare_strings(const void *lhs_v, const void *rhs_v) {
+  assert(lhs_v);
+  assert(rhs_v);
+
+  return strcmp(*(const char *const *)lhs_v, *(const char *const *)rhs_v);
+}
+
+#ifdef MMC_HAVE_ZLIB
+static Error bench_zlib(Bench *bench, const FileAndMapping *input);
+#endif
+
+#ifdef MMC_HAVE_LZ4
+static Error bench_lz4(Bench *bench, const FileAndMapping *input);
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+static Error bench_zstd(Bench *bench, const FileAndMapping *input);
+#endif
+
+static Error bench_file(Bench *bench, const FileAndMapping *input) {
+  assert(bench);
+  assert(input);
+
+  Error error = NULL_ERROR;
+  bool ran_any = false;
+
+#ifdef MMC_HAVE_ZLIB
+  if (bench->codec_filter == CODEC_FILTER_ALL ||
+      bench->codec_filter == CODEC_FILTER_ZLIB) {
+    if ((error = bench_zlib(bench, input)), error.what) {
+      return error;
+    }
+
+    ran_any = true;
+  }
+#endif
+
+#ifdef MMC_HAVE_LZ4
+  if (bench->codec_filter == CODEC_FILTER_ALL ||
+      bench->codec_filter == CODEC_FILTER_LZ4) {
+    if ((error = bench_lz4(bench, input)), error.what) {
+      return error;
+    }
+
+    ran_any = true;
+  }
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+  if (bench->codec_filter == CODEC_FILTER_ALL ||
+      bench->codec_filter == CODEC_FILTER_ZSTD) {
+    if ((error = bench_zstd(bench, input)), error.what) {
+      return error;
+    }
+
+    ran_any = true;
+  }
+#endif
+
+  if (!ran_any) {
+    return eformat("mmc-bench was built without support for codec '%s'",
+                   CODEC_VALUES[bench->codec_filter]);
+  }
+
+  return NULL_ERROR;
+}
+
+#ifdef MMC_HAVE_ZLIB
+static Error bench_zlib(Bench *bench, const FileAndMapping *input) {
+  static const char *const STRATEGY_NAMES[] = {"default", "filtered",
+                                               "huffman-only", "rle", "fixed"};
+  static const int STRATEGY_VALUES[] = {Z_DEFAULT_STRATEGY, Z_FILTERED,
+                                        Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+
+  DeflateState deflate_state;
+  InflateState inflate_state = {.options = make_inflate_options()};
+
+  const AppParams compress = {.size = deflate_size,
+                              .init = deflate_init,
+                              .run = deflate_run,
+                              .cleanup = deflate_cleanup,
+                              .arg = &deflate_state};
+  const AppParams decompress = {.size = inflate_size,
+                                .init = inflate_init,
+                                .run = inflate_run,
+                                .cleanup = inflate_cleanup,
+                                .arg = &inflate_state};
+
+  char parameters[MAX_PARAMETERS_LENGTH];
+  Error error;
+
+  for (size_t i = 0; i < sizeof(STRATEGY_VALUES) / sizeof(STRATEGY_VALUES[0]);
+       ++i) {
+    for (int level = 1; level <= Z_BEST_COMPRESSION; ++level) {
+      deflate_state.options = make_deflate_options();
+      deflate_state.options.level = level;
+      deflate_state.options.strategy = STRATEGY_VALUES[i];
+
+      sprintf(parameters, "level=%d strategy=%s", level, STRATEGY_NAMES[i]);
+
+      if ((error = bench_case(bench, input, "zlib", parameters, &compress,
+                              &decompress)),
+          error.what) {
+        return error;
+      }
+    }
+  }
+
+  // the fast decoder against zlib's own at the default level and strategy
+  for (size_t i = 0;
+       i < sizeof(ZLIB_DECODER_NAMES) / sizeof(ZLIB_DECODER_NAMES[0]); ++i) {
+    deflate_state.options = make_deflate_options();
+    inflate_state.options.decoder = (ZlibDecoder)i;
+
+    sprintf(parameters, "decoder=%s", ZLIB_DECODER_NAMES[i]);
+
+    if ((error = bench_case(bench, input, "zlib", parameters, &compress,
+                            &decompress)),
+        error.what) {
+      return error;
+    }
+  }
+
+  inflate_state.options = make_inflate_options();
+
+  // window and hash table sizes at the default level and strategy
+  for (int window_bits = DEFLATE_MIN_WINDOW_BITS; window_bits <= MAX_WBITS;
+       ++window_bits) {
+    for (int mem_level = 1; mem_level <= MAX_MEM_LEVEL; ++mem_level) {
+      deflate_state.options = make_deflate_options();
+      deflate_state.options.window_bits = window_bits;
+      deflate_state.options.mem_level = mem_level;
+
+      sprintf(parameters, "window-bits=%d mem-level=%d", window_bits,
+              mem_level);
+
+      if ((error = bench_case(bench, input, "zlib", parameters, &compress,
+                              &decompress)),
+          error.what) {
+        return error;
+      }
+    }
+  }
+
+  return NULL_ERROR;
+}
+#endif
+
+#ifdef MMC_HAVE_LZ4
+static Error bench_lz4(Bench *bench, const FileAndMapping *input) {
+  static const char *const BLOCK_MODE_NAMES[] = {"linked", "independent"};
+  static const LZ4F_blockMode_t BLOCK_MODE_VALUES[] = {LZ4F_blockLinked,
+                                                       LZ4F_blockIndependent};
+
+  Lz4CompressState compress_state = {.context = NULL};
+  Lz4DecompressState decompress_state = {.context = NULL};
+
+  const AppParams compress = {.size = lz4_compress_size,
+                              .init = lz4_compress_init,
+                              .run = lz4_compress_run,
+                              .cleanup = lz4_compress_cleanup,
+                              .arg = &compress_state};
+  const AppParams decompress = {.size = lz4_decompress_size,
+                                .init = lz4_decompress_init,
+                                .run = lz4_decompress_run,
+                                .cleanup = lz4_decompress_cleanup,
+                                .arg = &decompress_state};
+
+  char parameters[MAX_PARAMETERS_LENGTH];
+
+  for (size_t i = 0;
+       i < sizeof(BLOCK_MODE_VALUES) / sizeof(BLOCK_MODE_VALUES[0]); ++i) {
+    // levels below LZ4HC_CLEVEL_MIN all use the fast compressor
+    for (int level = LZ4HC_CLEVEL_MIN - 1; level <= LZ4HC_CLEVEL_MAX; ++level) {
+      compress_state.preferences = (LZ4F_preferences_t)LZ4F_INIT_PREFERENCES;
+      compress_state.preferences.compressionLevel = level;
+      compress_state.preferences.frameInfo.blockMode = BLOCK_MODE_VALUES[i];
+
+      sprintf(parameters, "level=%d block-mode=%s", level,
+              BLOCK_MODE_NAMES[i]);
+
+      const Error error = bench_case(bench, input, "lz4", parameters,
+                                     &compress, &decompress);
+
+      if (error.what) {
+        return error;
+      }
+    }
+  }
+
+  return NULL_ERROR;
+}
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+static Error bench_zstd(Bench *bench, const FileAndMapping *input) {
+  ZstdCompressState compress_state;
+  ZstdDecompressState decompress_state = {.stream = NULL};
+
+  const AppParams compress = {.size = zstd_compress_size,
+                              .init = zstd_compress_init,
+                              .run = zstd_compress_run,
+                              .cleanup = zstd_compress_cleanup,
+                              .arg = &compress_state};
+  const AppParams decompress = {.size = zstd_decompress_size,
+                                .init = zstd_decompress_init,
+                                .run = zstd_decompress_run,
+                                .cleanup = zstd_decompress_cleanup,
+                                .arg = &decompress_state};
+
+  char parameters[MAX_PARAMETERS_LENGTH];
+  Error error;
+
+  for (int level = 1; level <= ZSTD_maxCLevel(); ++level) {
+    compress_state.options =
+        (ZstdCompressOptions){.level = level, .strategy = 0};
+
+    sprintf(parameters, "level=%d", level);
+
+    if ((error = bench_case(bench, input, "zstd", parameters, &compress,
+                            &decompress)),
+        error.what) {
+      return error;
+    }
+  }
+
+  // every strategy at the default level
+  for (size_t i = 0;
+       i < sizeof(ZSTD_STRATEGY_VALUES) / sizeof(ZSTD_STRATEGY_VALUES[0]);
+       ++i) {
+    compress_state.options = (ZstdCompressOptions){
+        .level = ZSTD_CLEVEL_DEFAULT, .strategy = ZSTD_STRATEGY_VALUES[i]};
+
+    sprintf(parameters, "level=%d strategy=%s", ZSTD_CLEVEL_DEFAULT,
+            ZSTD_STRATEGY_NAMES[i]);
+
+    if ((error = bench_case(bench, input, "zstd", parameters, &compress,
+                            &decompress)),
+        error.what) {
+      return error;
+    }
+  }
+
+  return NULL_ERROR;
+}
+#endif
+
+static size_t syscalls(void);
+static void reset_peak_rss(void);
+static long peak_rss_kib(void);
+static int compare_doubles(const void *lhs_v, const void *rhs_v);
+static double median(double *values, size_t num_values);
+static double median_absolute_deviation(double *values, size_t num_values,
+                                        double median_value);
+static Error transform(const AppParams *codec,
+                       const PerfCounters *maybe_perf_counters,
+                       const FileAndMapping *input, FileAndMapping *output,
+                       size_t *output_size, Measurement *measurement);
+
+static Error bench_case(Bench *bench, const FileAndMapping *input,
+                        const char *codec, const char *parameters,
+                        const AppParams *compress,
+                        const AppParams *decompress) {
+  assert(bench);
+  assert(input);
+  assert(codec);
+  assert(parameters);
+  assert(compress);
+  assert(decompress);
+
+  Result result = {
+      .filename = input->filename,
+      .codec = codec,
+      .parameters = parameters,
+      .input_size = input->file_size,
+      .compress_perf_counts = make_perf_counts(),
+      .decompress_perf_counts = make_perf_counts(),
+  };
+
+  reset_peak_rss();
+
+  for (size_t i = 0; i < bench->num_warmups + bench->num_trials; ++i) {
+    FileAndMapping compressed;
+    size_t compressed_size;
+    Measurement compress_measurement;
+
+    Error error = transform(compress, bench->maybe_perf_counters, input,
+                            &compressed, &compressed_size,
+                            &compress_measurement);
+
+    if (error.what) {
+      return error;
+    }
+
+    // only the compressed bytes are visible to the decompressor
+    FileAndMapping compressed_view = compressed;
+    compressed_view.file_size = compressed_size;
+    compressed_view.mapping_size = compressed_size;
+
+    FileAndMapping decompressed;
+    size_t decompressed_size;
+    Measurement decompress_measurement;
+
+    error = transform(decompress, bench->maybe_perf_counters, &compressed_view,
+                      &decompressed, &decompressed_size,
+                      &decompress_measurement);
+
+    if (!error.what && i == 0 &&
+        (decompressed_size != input->file_size ||
+         memcmp(decompressed.mapping, input->mapping, input->file_size) != 0)) {
+      error = eformat("%s (%s) didn't round trip '%s'", codec, parameters,
+                      input->filename);
+    }
+
+    Error free_error;
+
+    if (!error.what) {
+      if ((free_error = free_file(decompressed)), free_error.what) {
+        print_warning(free_error);
+      }
+    }
+
+    if ((free_error = free_file(compressed)), free_error.what) {
+      print_warning(free_error);
+    }
+
+    if (error.what) {
+      return error;
+    }
+
+    if (i < bench->num_warmups) {
+      continue;
+    }
+
+    const size_t trial = i - bench->num_warmups;
+
+    bench->compress_seconds[trial] = compress_measurement.seconds;
+    bench->decompress_seconds[trial] = decompress_measurement.seconds;
+
+    // counts are deterministic, so keep those of the last trial
+    result.compressed_size = compressed_size;
+    result.compress_page_faults = compress_measurement.page_faults;
+    result.decompress_page_faults = decompress_measurement.page_faults;
+    result.compress_syscalls = compress_measurement.syscalls;
+    result.decompress_syscalls = decompress_measurement.syscalls;
+
+    add_perf_counts(&result.compress_perf_counts,
+                    compress_measurement.perf_counts);
+    add_perf_counts(&result.decompress_perf_counts,
+                    decompress_measurement.perf_counts);
+  }
+
+  divide_perf_counts(&result.compress_perf_counts, bench->num_trials);
+  divide_perf_counts(&result.decompress_perf_counts, bench->num_trials);
+
+  result.compress_seconds = median(bench->compress_seconds, bench->num_trials);
+  result.compress_mad_seconds = median_absolute_deviation(
+      bench->compress_seconds, bench->num_trials, result.compress_seconds);
+  result.decompress_seconds =
+      median(bench->decompress_seconds, bench->num_trials);
+  result.decompress_mad_seconds = median_absolute_deviation(
+      bench->decompress_seconds, bench->num_trials, result.decompress_seconds);
+  result.peak_rss_kib = peak_rss_kib();
+
+  print_result(bench, &result);
+
+  if (bench->baseline) {
+    compare_to_baseline(bench, &result);
+  }
+
+  return NULL_ERROR;
+}
+
+static Error transform(const AppParams *codec,
+                       const PerfCounters *maybe_perf_counters,
+                       const FileAndMapping *input, FileAndMapping *output,
+                       size_t *output_size, Measurement *measurement) {
+  assert(codec);
+  assert(codec->size);
+  assert(codec->run);
+  assert(input);
+  assert(output);
+  assert(output_size);
+  assert(measurement);
+
+  if (maybe_perf_counters) {
+    reset_perf_counters(maybe_perf_counters);
+  }
+
+  const StatsTimestamp start = stats_now();
+  const size_t start_syscalls = syscalls();
+
+  // the corpus stays mapped between cases, so input pages are never unmapped
+  AppIOState io_state = {.input_file = *input,
+                         .input_mapping_first_unused_offset = 0,
+                         .output_mapping_first_unused_offset = 0,
+                         .output_bytes_written = 0};
+
+  Error error = create_anonymous_mapping(
+      "output", codec->size(&io_state.input_file, codec->arg),
+      &io_state.output_file);
+
+  if (error.what) {
+    return error;
+  }
+
+  if (codec->init) {
+    if ((error = codec->init(&io_state, codec->arg)), error.what) {
+      goto cleanup_output;
+    }
+  }
+
+  bool finished = false;
+
+  while (!finished) {
+    if (maybe_perf_counters) {
+      enable_perf_counters(maybe_perf_counters);
+    }
+
+    error = codec->run(&io_state, &finished, codec->arg);
+
+    if (maybe_perf_counters) {
+      disable_perf_counters(maybe_perf_counters);
+    }
+
+    if (error.what) {
+      break;
+    }
+
+    if (finished) {
+      break;
+    }
+
+    if ((error = expand_output_mapping(
+             &io_state.output_file,
+             io_state.output_mapping_first_unused_offset)),
+        error.what) {
+      break;
+    }
+  }
+
+  if (codec->cleanup) {
+    codec->cleanup(&io_state, codec->arg);
+  }
+
+  if (error.what) {
+    goto cleanup_output;
+  }
+
+  const StatsTimestamp elapsed = stats_elapsed(start);
+
+  *measurement = (Measurement){
+      .seconds = elapsed.wall_seconds,
+      .page_faults = elapsed.minor_page_faults + elapsed.major_page_faults,
+      .syscalls = syscalls() - start_syscalls,
+      .perf_counts = maybe_perf_counters
+                         ? read_perf_counters(maybe_perf_counters)
+                         : make_perf_counts(),
+  };
+  *output = io_state.output_file;
+  *output_size = io_state.output_bytes_written;
+
+  return NULL_ERROR;
+
+cleanup_output:;
+  const Error free_error = free_file(io_state.output_file);
+
+  if (free_error.what) {
+    print_warning(free_error);
+  }
+
+  return error;
+}
+
+static size_t syscalls(void) {
+  return file_syscall_counts.num_mmaps + file_syscall_counts.num_munmaps +
+         file_syscall_counts.num_mremaps + file_syscall_counts.num_ftruncates;
+}
+
+// resets VmHWM to the current resident set size, see proc(5)
+static void reset_peak_rss(void) {
+  FILE *const clear_refs = fopen("/proc/self/clear_refs", "w");
+
+  if (!clear_refs) {
+    return;
+  }
+
+  fputs("5", clear_refs);
+  fclose(clear_refs);
+}
+
+static long peak_rss_kib(void) {
+  FILE *const status = fopen("/proc/self/status", "r");
+
+  if (status) {
+    char line[256];
+    long kib = -1;
+
+    while (fgets(line, sizeof(line), status)) {
+      if (sscanf(line, "VmHWM: %ld kB", &kib) == 1) {
+        break;
+      }
+    }
+
+    fclose(status);
+
+    if (kib >= 0) {
+      return kib;
+    }
+  }
+
+  // peak of the whole process instead of this case
+  struct rusage usage;
+  const int result = getrusage(RUSAGE_SELF, &usage);
+  assert(result == 0);
+  (void)result;
+
+  return usage.ru_maxrss;
+}
+
+static int compare_doubles(const void *lhs_v, const void *rhs_v) {
+  assert(lhs_v);
+  assert(rhs_v);
+
+  const double lhs = *(const double *)lhs_v;
+  const double rhs = *(const double *)rhs_v;
+
+  if (lhs < rhs) {
+    return -1;
+  } else if (lhs > rhs) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static double median(double *values, size_t num_values) {
+  assert(values);
+  assert(num_values > 0);
+
+  qsort(values, num_values, sizeof(double), compare_doubles);
+
+  if (num_values % 2 == 1) {
+    return values[num_values / 2];
+  }
+
+  return (values[num_values / 2 - 1] + values[num_values / 2]) / 2;
+}
+
+// overwrites values with their absolute deviations from median
+static double median_absolute_deviation(double *values, size_t num_values,
+                                        double median_value) {
+  assert(values);
+
+  for (size_t i = 0; i < num_values; ++i) {
+    values[i] = fabs(values[i] - median_value);
+  }
+
+  return median(values, num_values);
+}
+
+static void print_json_string(const char *string);
+static void print_perf_counts(const Bench *bench, const char *prefix,
+                              const PerfCounts *counts, size_t num_bytes);
+
+static void print_header(const Bench *bench) {
+  assert(bench);
+
+  if (bench->format == OUTPUT_FORMAT_JSON) {
+    putchar('[');
+
+    return;
+  }
+
+  puts("file,codec,parameters,input_bytes,compressed_bytes,ratio,"
+       "compress_mb_per_s,decompress_mb_per_s,compress_seconds,"
+       "compress_mad_seconds,decompress_seconds,decompress_mad_seconds,"
+       "peak_rss_kib,compress_page_faults,decompress_page_faults,"
+       "compress_syscalls,decompress_syscalls,compress_ipc,"
+       "compress_cycles_per_byte,compress_branch_misses,compress_llc_misses,"
+       "compress_dtlb_misses,decompress_ipc,decompress_cycles_per_byte,"
+       "decompress_branch_misses,decompress_llc_misses,decompress_dtlb_misses");
+}
+
+static void print_result(Bench *bench, const Result *result) {
+  assert(bench);
+  assert(result);
+
+  static const double BYTES_PER_MB = 1e6;
+
+  const double ratio =
+      (double)result->input_size / (double)result->compressed_size;
+  const double compress_mb_per_s =
+      (double)result->input_size / BYTES_PER_MB / result->compress_seconds;
+  const double decompress_mb_per_s =
+      (double)result->input_size / BYTES_PER_MB / result->decompress_seconds;
+
+  if (bench->format == OUTPUT_FORMAT_CSV) {
+    // parameters never contain commas or quotes
+    printf("\"%s\",%s,%s,%zu,%zu,%.4f,%.3f,%.3f,%.9f,%.9f,%.9f,%.9f,%ld,%zu,"
+           "%zu,%zu,%zu",
+           result->filename, result->codec, result->parameters,
+           result->input_size, result->compressed_size, ratio,
+           compress_mb_per_s, decompress_mb_per_s, result->compress_seconds,
+           result->compress_mad_seconds, result->decompress_seconds,
+           result->decompress_mad_seconds, result->peak_rss_kib,
+           result->compress_page_faults, result->decompress_page_faults,
+           result->compress_syscalls, result->decompress_syscalls);
+  } else {
+    fputs(bench->num_results == 0 ? "\n  {\"file\": " : ",\n  {\"file\": ",
+          stdout);
+    print_json_string(result->filename);
+    printf(", \"codec\": \"%s\", \"parameters\": \"%s\", \"input_bytes\": "
+           "%zu, \"compressed_bytes\": %zu, \"ratio\": %.4f, "
+           "\"compress_mb_per_s\": %.3f, \"decompress_mb_per_s\": %.3f, "
+           "\"compress_seconds\": %.9f, \"compress_mad_seconds\": %.9f, "
+           "\"decompress_seconds\": %.9f, \"decompress_mad_seconds\": %.9f, "
+           "\"peak_rss_kib\": %ld, \"compress_page_faults\": %zu, "
+           "\"decompress_page_faults\": %zu, \"compress_syscalls\": %zu, "
+           "\"decompress_syscalls\": %zu",
+           result->codec, result->parameters, result->input_size,
+           result->compressed_size, ratio, compress_mb_per_s,
+           decompress_mb_per_s, result->compress_seconds,
+           result->compress_mad_seconds, result->decompress_seconds,
+           result->decompress_mad_seconds, result->peak_rss_kib,
+           result->compress_page_faults, result->decompress_page_faults,
+           result->compress_syscalls, result->decompress_syscalls);
+  }
+
+  print_perf_counts(bench, "compress", &result->compress_perf_counts,
+                    result->input_size);
+  print_perf_counts(bench, "decompress", &result->decompress_perf_counts,
+                    result->input_size);
+  fputs(bench->format == OUTPUT_FORMAT_CSV ? "\n" : "}", stdout);
+
+  fflush(stdout);
+  ++bench->num_results;
+}
+
+static void print_footer(const Bench *bench) {
+  assert(bench);
+
+  if (bench->format == OUTPUT_FORMAT_JSON) {
+    puts("\n]");
+  }
+}
+
+static void print_optional_double(const Bench *bench, const char *name,
+                                  bool is_available, double value);
+static void print_optional_count(const Bench *bench, const char *name,
+                                 bool is_available, uint64_t value);
+
+// unavailable counts are empty in CSV and null in JSON
+static void print_perf_counts(const Bench *bench, const char *prefix,
+                              const PerfCounts *counts, size_t num_bytes) {
+  assert(bench);
+  assert(prefix);
+  assert(counts);
+
+  static const PerfEvent MISS_EVENTS[] = {
+      PERF_EVENT_BRANCH_MISSES, PERF_EVENT_LLC_MISSES, PERF_EVENT_DTLB_MISSES};
+
+  char name[64];
+  double value = 0;
+
+  sprintf(name, "%s_ipc", prefix);
+  const bool has_ipc = get_ipc(counts, &value);
+  print_optional_double(bench, name, has_ipc, value);
+
+  sprintf(name, "%s_cycles_per_byte", prefix);
+  const bool has_cycles_per_byte =
+      get_cycles_per_byte(counts, num_bytes, &value);
+  print_optional_double(bench, name, has_cycles_per_byte, value);
+
+  for (size_t i = 0; i < sizeof(MISS_EVENTS) / sizeof(MISS_EVENTS[0]); ++i) {
+    sprintf(name, "%s_%s", prefix, PERF_EVENT_NAMES[MISS_EVENTS[i]]);
+    print_optional_count(bench, name, counts->is_available[MISS_EVENTS[i]],
+                         counts->values[MISS_EVENTS[i]]);
+  }
+}
+
+static void print_optional_double(const Bench *bench, const char *name,
+                                  bool is_available, double value) {
+  assert(bench);
+  assert(name);
+
+  if (bench->format == OUTPUT_FORMAT_CSV) {
+    putchar(',');
+
+    if (is_available) {
+      printf("%.3f", value);
+    }
+  } else if (is_available) {
+    printf(", \"%s\": %.3f", name, value);
+  } else {
+    printf(", \"%s\": null", name);
+  }
+}
+
+static void print_optional_count(const Bench *bench, const char *name,
+                                 bool is_available, uint64_t value) {
+  assert(bench);
+  assert(name);
+
+  if (bench->format == OUTPUT_FORMAT_CSV) {
+    putchar(',');
+
+    if (is_available) {
+      printf("%" PRIu64, value);
+    }
+  } else if (is_available) {
+    printf(", \"%s\": %" PRIu64, name, value);
+  } else {
+    printf(", \"%s\": null", name);
+  }
+}
+
+static void print_json_string(const char *string) {
+  assert(string);
+
+  putchar('"');
+
+  for (const char *ch = string; *ch != '\0'; ++ch) {
+    if (*ch == '"' || *ch == '\\') {
+      putchar('\\');
+      putchar(*ch);
+    } else if ((unsigned char)*ch < 0x20) {
+      printf("\\u%04x", (unsigned)(unsigned char)*ch);
+    } else {
+      putchar(*ch);
+    }
+  }
+
+  putchar('"');
+}
+
+typedef struct JsonReader {
+  const char *filename;
+  const char *begin;
+  const char *cursor;
+  const char *end;
+} JsonReader;
+
+static Error read_baseline_entry(JsonReader *reader, BaselineEntry *entry);
+static void skip_json_whitespace(JsonReader *reader);
+static Error expect_json_char(JsonReader *reader, char expected);
+static Error read_json_string(JsonReader *reader, char **value);
+static Error read_json_number(JsonReader *reader, double *value);
+
+// reads the JSON array written by print_result; only the fields needed to
+// compare against are kept
+static Error load_baseline(const char *filename, Bench *bench) {
+  assert(filename);
+  assert(bench);
+
+  FileAndMapping file;
+  Error error = open_and_map_file(filename, &file);
+
+  if (error.what) {
+    return error;
+  }
+
+  JsonReader reader = {.filename = filename,
+                       .begin = file.mapping,
+                       .cursor = file.mapping,
+                       .end = (const char *)file.mapping + file.file_size};
+  size_t capacity = 0;
+
+  if ((error = expect_json_char(&reader, '[')), error.what) {
+    goto cleanup;
+  }
+
+  skip_json_whitespace(&reader);
+
+  if (reader.cursor < reader.end && *reader.cursor == ']') {
+    goto cleanup;
+  }
+
+  while (true) {
+    if (bench->num_baseline_entries == capacity) {
+      const size_t new_capacity = capacity == 0 ? 64 : 2 * capacity;
+      BaselineEntry *const new_baseline =
+          realloc(bench->baseline, new_capacity * sizeof(BaselineEntry));
+
+      if (!new_baseline) {
+        error = ERROR_OUT_OF_MEMORY;
+
+        goto cleanup;
+      }
+
+      bench->baseline = new_baseline;
+      capacity = new_capacity;
+    }
+
+    if ((error = read_baseline_entry(
+             &reader, &bench->baseline[bench->num_baseline_entries])),
+        error.what) {
+      goto cleanup;
+    }
+
+    ++bench->num_baseline_entries;
+    skip_json_whitespace(&reader);
+
+    if (reader.cursor < reader.end && *reader.cursor == ',') {
+      ++reader.cursor;
+
+      continue;
+    }
+
+    error = expect_json_char(&reader, ']');
+
+    break;
+  }
+
+cleanup:;
+  const Error free_error = free_file(file);
+
+  if (free_error.what) {
+    print_warning(free_error);
+  }
+
+  if (!error.what && bench->num_baseline_entries == 0) {
+    error = eformat("baseline '%s' contains no results", filename);
+  }
+
+  return error;
+}
+
+static void free_baseline_entry(BaselineEntry *entry);
+
+static void free_baseline(Bench *bench) {
+  assert(bench);
+
+  for (size_t i = 0; i < bench->num_baseline_entries; ++i) {
+    free_baseline_entry(&bench->baseline[i]);
+  }
+
+  free(bench->baseline);
+  bench->baseline = NULL;
+  bench->num_baseline_entries = 0;
+}
+
+static void free_baseline_entry(BaselineEntry *entry) {
+  assert(entry);
+
+  free(entry->filename);
+  free(entry->codec);
+  free(entry->parameters);
+}
+
+static Error read_baseline_entry(JsonReader *reader, BaselineEntry *entry) {
+  assert(reader);
+  assert(entry);
+
+  *entry = (BaselineEntry){.filename = NULL,
+                           .codec = NULL,
+                           .parameters = NULL,
+                           .compressed_size = 0,
+                           .compress_seconds = -1,
+                           .compress_mad_seconds = 0,
+                           .decompress_seconds = -1,
+                           .decompress_mad_seconds = 0};
+
+  const size_t offset = (size_t)(reader->cursor - reader->begin);
+  Error error = expect_json_char(reader, '{');
+
+  while (!error.what) {
+    char *key;
+
+    if ((error = read_json_string(reader, &key)), error.what) {
+      break;
+    }
+
+    if ((error = expect_json_char(reader, ':')), error.what) {
+      free(key);
+
+      break;
+    }
+
+    skip_json_whitespace(reader);
+
+    char **string_field = NULL;
+
+    if (strcmp(key, "file") == 0) {
+      string_field = &entry->filename;
+    } else if (strcmp(key, "codec") == 0) {
+      string_field = &entry->codec;
+    } else if (strcmp(key, "parameters") == 0) {
+      string_field = &entry->parameters;
+    }
+
+    if (reader->end - reader->cursor >= 4 &&
+        memcmp(reader->cursor, "null", 4) == 0) {
+      // unavailable counters
+      reader->cursor += 4;
+    } else if (reader->cursor < reader->end && *reader->cursor == '"') {
+      char *value;
+
+      if ((error = read_json_string(reader, &value)), !error.what) {
+        if (string_field) {
+          free(*string_field);
+          *string_field = value;
+        } else {
+          free(value);
+        }
+      }
+    } else {
+      double value;
+
+      if ((error = read_json_number(reader, &value)), !error.what) {
+        if (strcmp(key, "compressed_bytes") == 0) {
+          entry->compressed_size = (size_t)value;
+        } else if (strcmp(key, "compress_seconds") == 0) {
+          entry->compress_seconds = value;
+        } else if (strcmp(key, "compress_mad_seconds") == 0) {
+          entry->compress_mad_seconds = value;
+        } else if (strcmp(key, "decompress_seconds") == 0) {
+          entry->decompress_seconds = value;
+        } else if (strcmp(key, "decompress_mad_seconds") == 0) {
+          entry->decompress_mad_seconds = value;
+        }
+      }
+    }
+
+    free(key);
+
+    if (error.what) {
+      break;
+    }
+
+    skip_json_whitespace(reader);
+
+    if (reader->cursor < reader->end && *reader->cursor == ',') {
+      ++reader->cursor;
+
+      continue;
+    }
+
+    if ((error = expect_json_char(reader, '}')), error.what) {
+      break;
+    }
+
+    if (!entry->filename || !entry->codec || !entry->parameters ||
+        entry->compressed_size == 0 || entry->compress_seconds < 0 ||
+        entry->decompress_seconds < 0) {
+      error = eformat("baseline '%s' has an incomplete result at byte %zu",
+                      reader->filename, offset);
+    }
+
+    break;
+  }
+
+  if (error.what) {
+    free_baseline_entry(entry);
+  }
+
+  return error;
+}
+
+static void skip_json_whitespace(JsonReader *reader) {
+  assert(reader);
+
+  while (reader->cursor < reader->end &&
+         (*reader->cursor == ' ' || *reader->cursor == '\t' ||
+          *reader->cursor == '\n' || *reader->cursor == '\r')) {
+    ++reader->cursor;
+  }
+}
+
+static Error expect_json_char(JsonReader *reader, char expected) {
+  assert(reader);
+
+  skip_json_whitespace(reader);
+
+  if (reader->cursor == reader->end || *reader->cursor != expected) {
+    return eformat("baseline '%s' is malformed at byte %zu: expected '%c'",
+                   reader->filename, (size_t)(reader->cursor - reader->begin),
+                   expected);
+  }
+
+  ++reader->cursor;
+
+  return NULL_ERROR;
+}
+
+static Error read_json_string(JsonReader *reader, char **value) {
+  assert(reader);
+  assert(value);
+
+  Error error = expect_json_char(reader, '"');
+
+  if (error.what) {
+    return error;
+  }
+
+  // escapes only ever shorten the string
+  const char *const first = reader->cursor;
+  const char *last = first;
+
+  while (last < reader->end && *last != '"') {
+    last += (*last == '\\') ? 2 : 1;
+  }
+
+  if (last >= reader->end) {
+    return eformat("baseline '%s' has an unterminated string at byte %zu",
+                   reader->filename, (size_t)(first - reader->begin - 1));
+  }
+
+  char *const string = malloc((size_t)(last - first) + 1);
+
+  if (!string) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  char *output = string;
+
+  for (const char *ch = first; ch < last; ++ch) {
+    if (*ch != '\\') {
+      *output++ = *ch;
+
+      continue;
+    }
+
+    ++ch;
+
+    if (*ch == 'u') {
+      unsigned code_point;
+
+      // print_json_string only escapes control characters this way
+      if (last - ch < 5 || sscanf(ch + 1, "%4x", &code_point) != 1 ||
+          code_point >= 0x80) {
+        free(string);
+
+        return eformat("baseline '%s' has an unsupported escape at byte %zu",
+                       reader->filename, (size_t)(ch - reader->begin - 1));
+      }
+
+      *output++ = (char)code_point;
+      ch += 4;
+    } else {
+      *output++ = *ch;
+    }
+  }
+
+  *output = '\0';
+  reader->cursor = last + 1;
+  *value = string;
+
+  return NULL_ERROR;
+}
+
+static Error read_json_number(JsonReader *reader, double *value) {
+  assert(reader);
+  assert(value);
+
+  char buffer[64];
+  size_t length = 0;
+
+  while (reader->cursor + length < reader->end &&
+         length < sizeof(buffer) - 1 &&
+         strchr("+-.0123456789eE", reader->cursor[length])) {
+    buffer[length] = reader->cursor[length];
+    ++length;
+  }
+
+  buffer[length] = '\0';
+
+  char *number_end;
+  *value = strtod(buffer, &number_end);
+
+  if (length == 0 || number_end != buffer + length) {
+    return eformat("baseline '%s' is malformed at byte %zu: expected a "
+                   "string or a number",
+                   reader->filename, (size_t)(reader->cursor - reader->begin));
+  }
+
+  reader->cursor += length;
+
+  return NULL_ERROR;
+}
+
+static const char *base_name(const char *path);
+static bool is_slower(const Bench *bench, double seconds, double mad_seconds,
+                      double baseline_seconds, double baseline_mad_seconds);
+
+// results are matched by the name of the file, not its directory, so a
+// baseline remains valid when the corpus is moved
+static void compare_to_baseline(Bench *bench, const Result *result) {
+  assert(bench);
+  assert(result);
+
+  const char *const name = base_name(result->filename);
+  const BaselineEntry *entry = NULL;
+
+  for (size_t i = 0; i < bench->num_baseline_entries; ++i) {
+    const BaselineEntry *const this_entry = &bench->baseline[i];
+
+    if (strcmp(base_name(this_entry->filename), name) == 0 &&
+        strcmp(this_entry->codec, result->codec) == 0 &&
+        strcmp(this_entry->parameters, result->parameters) == 0) {
+      entry = this_entry;
+
+      break;
+    }
+  }
+
+  if (!entry) {
+    print_warning(eformat("no baseline for '%s' %s (%s)", result->filename,
+                          result->codec, result->parameters));
+
+    return;
+  }
+
+  static const double BYTES_PER_MB = 1e6;
+  const double input_mb = (double)result->input_size / BYTES_PER_MB;
+  bool regressed = false;
+
+  if (is_slower(bench, result->compress_seconds, result->compress_mad_seconds,
+                entry->compress_seconds, entry->compress_mad_seconds)) {
+    print_warning(eformat("'%s' %s (%s) compressed at %.3f MB/s, down from "
+                          "%.3f MB/s",
+                          result->filename, result->codec, result->parameters,
+                          input_mb / result->compress_seconds,
+                          input_mb / entry->compress_seconds));
+    regressed = true;
+  }
+
+  if (is_slower(bench, result->decompress_seconds,
+                result->decompress_mad_seconds, entry->decompress_seconds,
+                entry->decompress_mad_seconds)) {
+    print_warning(eformat("'%s' %s (%s) decompressed at %.3f MB/s, down from "
+                          "%.3f MB/s",
+                          result->filename, result->codec, result->parameters,
+                          input_mb / result->decompress_seconds,
+                          input_mb / entry->decompress_seconds));
+    regressed = true;
+  }
+
+  // compressed sizes are deterministic, so only the threshold applies
+  if ((double)result->compressed_size >
+      (double)entry->compressed_size * (1 + bench->threshold)) {
+    print_warning(eformat("'%s' %s (%s) compressed to %zu bytes, up from %zu "
+                          "bytes",
+                          result->filename, result->codec, result->parameters,
+                          result->compressed_size, entry->compressed_size));
+    regressed = true;
+  }
+
+  if (regressed) {
+    ++bench->num_regressions;
+  }
+}
+
+static const char *base_name(const char *path) {
+  assert(path);
+
+  const char *const last_slash = strrchr(path, '/');
+
+  return last_slash ? last_slash + 1 : path;
+}
+
+// the difference of the medians must exceed the threshold, the floor, and the
+// noise of both runs, estimating their standard deviations from the MAD
+static bool is_slower(const Bench *bench, double seconds, double mad_seconds,
+                      double baseline_seconds, double baseline_mad_seconds) {
+  assert(bench);
+
+  const double noise_seconds =
+      bench->noise_standard_deviations * MAD_TO_STANDARD_DEVIATION *
+      sqrt(mad_seconds * mad_seconds +
+           baseline_mad_seconds * baseline_mad_seconds);
+
+  return seconds > baseline_seconds * (1 + bench->threshold) &&
+         seconds - baseline_seconds > MIN_REGRESSION_SECONDS &&
+         seconds - baseline_seconds > noise_seconds;
+}
+
+// the normal tail beyond z standard deviations is below exp(-z^2 / 2), so this
+// keeps each comparison under its share of FAMILY_FALSE_ALARM_RATE
+static double get_noise_standard_deviations(size_t num_comparisons) {
+  if (num_comparisons == 0) {
+    return MIN_NOISE_STANDARD_DEVIATIONS;
+  }
+
+  const double rate = FAMILY_FALSE_ALARM_RATE / (double)num_comparisons;
+  const double standard_deviations = sqrt(-2 * log(rate));
+
+  return standard_deviations > MIN_NOISE_STANDARD_DEVIATIONS
+             ? standard_deviations
+             : MIN_NOISE_STANDARD_DEVIATIONS;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/checksum.h>
+#include <common/cpu.h>
+
+#include "kernels.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#include <zlib.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+typedef uint32_t(ChecksumFunc)(uint32_t checksum, const unsigned char *data,
+                               size_t size);
+
+static ChecksumFunc zlib_adler32;
+static ChecksumFunc zlib_crc32;
+
+static ChecksumFunc *adler32_kernel = zlib_adler32;
+static ChecksumFunc *crc32_kernel = zlib_crc32;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels(void);
+
+uint32_t checksum_adler32(uint32_t adler, const void *data, size_t size) {
+  assert(data || size == 0);
+
+  pthread_once(&kernels_once, pick_kernels);
+
+  return adler32_kernel(adler, (const unsigned char *)data, size);
+}
+
+uint32_t checksum_crc32(uint32_t crc, const void *data, size_t size) {
+  assert(data || size == 0);
+
+  pthread_once(&kernels_once, pick_kernels);
+
+  return crc32_kernel(crc, (const unsigned char *)data, size);
+}
+
+// zlib takes at most UINT_MAX bytes at once
+static uint32_t zlib_adler32(uint32_t adler, const unsigned char *data,
+                             size_t size) {
+  do {
+    const size_t piece = MIN(size, (size_t)UINT_MAX);
+    adler = (uint32_t)adler32(adler, data, (uInt)piece);
+    data += piece;
+    size -= piece;
+  } while (size > 0);
+
+  return adler;
+}
+
+static uint32_t zlib_crc32(uint32_t crc, const unsigned char *data,
+                           size_t size) {
+  do {
+    const size_t piece = MIN(size, (size_t)UINT_MAX);
+    crc = (uint32_t)crc32(crc, data, (uInt)piece);
+    data += piece;
+    size -= piece;
+  } while (size > 0);
+
+  return crc;
+}
+
+#ifdef MMC_HAVE_X86_KERNELS
+// zlib is left the bytes past the last multiple of 16
+static uint32_t pclmul_crc32(uint32_t crc, const unsigned char *data,
+                             size_t size) {
+  if (size >= 64) {
+    const size_t folded = size & ~(size_t)15;
+    crc = ~pclmul_crc32_blocks(~crc, data, folded);
+    data += folded;
+    size -= folded;
+  }
+
+  return size > 0 ? zlib_crc32(crc, data, size) : crc;
+}
+
+static uint32_t vpclmul_crc32(uint32_t crc, const unsigned char *data,
+                              size_t size) {
+  if (size < 256) {
+    return pclmul_crc32(crc, data, size);
+  }
+
+  const size_t folded = size & ~(size_t)15;
+  crc = ~vpclmul_crc32_blocks(~crc, data, folded);
+
+  return size > folded ? zlib_crc32(crc, data + folded, size - folded) : crc;
+}
+#endif
+
+static void pick_kernels(void) {
+  switch (cpu_level()) {
+#ifdef MMC_HAVE_X86_KERNELS
+  case CPU_LEVEL_AVX512:
+    adler32_kernel = avx512_adler32;
+    crc32_kernel = vpclmul_crc32;
+
+    break;
+  case CPU_LEVEL_AVX2:
+    adler32_kernel = avx2_adler32;
+    crc32_kernel = pclmul_crc32;
+
+    break;
+#endif
+  default:
+    break;
+  }
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/chunker.h>
+
+#include <assert.h>
+
+#include <pthread.h>
+
+// random values for each byte, so that every input bit affects the hash
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// splitmix64 with a fixed seed, so cut points never change between runs
+static void fill_gear(void) {
+  uint64_t state = 0x6D6D632D63686E6BULL;
+
+  for (size_t i = 0; i < 256; ++i) {
+    state += 0x9E3779B97F4A7C15ULL;
+
+    uint64_t value = state;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+
+    gear[i] = value ^ (value >> 31);
+  }
+}
+
+// the hash shifts left once per byte, so its top bits depend on the most
+// bytes and make the best cut-point test
+static uint64_t top_bits(unsigned num_bits) {
+  assert(num_bits > 0 && num_bits < 64);
+
+  return ~(uint64_t)0 << (64 - num_bits);
+}
+
+ChunkSizes make_chunk_sizes(size_t average_size) {
+  assert(average_size >= 64);
+  assert((average_size & (average_size - 1)) == 0);
+
+  unsigned average_bits = 0;
+
+  while (((size_t)1 << average_bits) < average_size) {
+    ++average_bits;
+  }
+
+  return (ChunkSizes){
+      .min_size = average_size / 4,
+      .average_size = average_size,
+      .max_size = average_size * 8,
+
+      .small_mask = top_bits(average_bits + 2),
+      .large_mask = top_bits(average_bits - 2),
+  };
+}
+
+size_t find_chunk_size(const ChunkSizes *sizes, const void *data,
+                       size_t size) {
+  assert(sizes);
+  assert(data || size == 0);
+
+  if (size <= sizes->min_size) {
+    return size;
+  }
+
+  pthread_once(&gear_once, fill_gear);
+
+  const unsigned char *const bytes = (const unsigned char *)data;
+  const size_t normal_size =
+      size < sizes->average_size ? size : sizes->average_size;
+  const size_t max_size = size < sizes->max_size ? size : sizes->max_size;
+
+  // no chunk is shorter than min_size, so there's no point hashing its bytes
+  uint64_t hash = 0;
+  size_t i = sizes->min_size;
+
+  for (; i < normal_size; ++i) {
+    hash = (hash << 1) + gear[bytes[i]];
+
+    if (!(hash & sizes->small_mask)) {
+      return i + 1;
+    }
+  }
+
+  for (; i < max_size; ++i) {
+    hash = (hash << 1) + gear[bytes[i]];
+
+    if (!(hash & sizes->large_mask)) {
+      return i + 1;
+    }
+  }
+
+  return max_size;
+}
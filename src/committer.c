@@ -0,0 +1,295 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/committer.h>
+
+#include <common/file.h>
+
+#include "file_syscalls.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+struct OutputCommitter {
+  AppIOState *io_state;
+
+  // where offset zero of the output is mapped and how far the mapping goes.
+  // only changed by the grower while no writer is copying
+  char *_Atomic base;
+  atomic_size_t capacity;
+  // writers past the capacity check that haven't finished their copy
+  atomic_size_t num_copying;
+  // set by the grower before it waits for num_copying to drop to zero
+  atomic_bool is_growing;
+  // one past the furthest byte committed
+  atomic_size_t end;
+
+  // guards everything below. signaled when a writer needs more room, when the
+  // last writer steps out while the grower waits, and when growth is done
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  // the furthest end that a writer has asked for room up to
+  size_t requested;
+  bool is_closing;
+  Error error;
+
+  pthread_t grower;
+  // file_syscall_counts is per thread, so the grower's are handed back here
+  FileSyscallCounts grower_syscalls;
+};
+
+static void publish_mapping(OutputCommitter *committer);
+static void *run_grower(void *committer_v);
+
+Error create_output_committer(AppIOState *io_state,
+                              OutputCommitter **committer) {
+  assert(io_state);
+  assert(committer);
+
+  OutputCommitter *const new_committer = malloc(sizeof(OutputCommitter));
+
+  if (!new_committer) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  new_committer->io_state = io_state;
+  atomic_init(&new_committer->base, NULL);
+  atomic_init(&new_committer->capacity, 0);
+  atomic_init(&new_committer->num_copying, 0);
+  atomic_init(&new_committer->is_growing, false);
+  atomic_init(&new_committer->end, 0);
+  new_committer->requested = 0;
+  new_committer->is_closing = false;
+  new_committer->error = NULL_ERROR;
+  publish_mapping(new_committer);
+
+  Error error;
+  int errc = pthread_mutex_init(&new_committer->mutex, NULL);
+
+  if (errc != 0) {
+    error = eformat("couldn't initialize committer mutex: %s (%d)",
+                    strerror(errc), errc);
+
+    goto cleanup_committer;
+  }
+
+  if ((errc = pthread_cond_init(&new_committer->changed, NULL)) != 0) {
+    error = eformat("couldn't initialize committer condition variable: %s (%d)",
+                    strerror(errc), errc);
+
+    goto cleanup_mutex;
+  }
+
+  if ((errc = pthread_create(&new_committer->grower, NULL, run_grower,
+                             new_committer)) != 0) {
+    error = eformat("couldn't create output thread: %s (%d)", strerror(errc),
+                    errc);
+
+    goto cleanup_cond;
+  }
+
+  *committer = new_committer;
+
+  return NULL_ERROR;
+
+cleanup_cond:
+  pthread_cond_destroy(&new_committer->changed);
+
+cleanup_mutex:
+  pthread_mutex_destroy(&new_committer->mutex);
+
+cleanup_committer:
+  free(new_committer);
+
+  return error;
+}
+
+void free_output_committer(OutputCommitter *committer) {
+  assert(committer);
+
+  pthread_mutex_lock(&committer->mutex);
+  committer->is_closing = true;
+  pthread_cond_broadcast(&committer->changed);
+  pthread_mutex_unlock(&committer->mutex);
+
+  pthread_join(committer->grower, NULL);
+
+  const FileSyscallCounts *const syscalls = &committer->grower_syscalls;
+  file_syscall_counts.num_mmaps += syscalls->num_mmaps;
+  file_syscall_counts.num_munmaps += syscalls->num_munmaps;
+  file_syscall_counts.num_mremaps += syscalls->num_mremaps;
+  file_syscall_counts.num_ftruncates += syscalls->num_ftruncates;
+
+  AppIOState *const io_state = committer->io_state;
+  const size_t end = atomic_load(&committer->end);
+  io_state->output_bytes_written = end;
+  io_state->output_mapping_first_unused_offset =
+      end - io_state->output_file.mapping_offset;
+
+  // every writer that waited on it was handed a copy
+  discard_error(committer->error);
+
+  pthread_cond_destroy(&committer->changed);
+  pthread_mutex_destroy(&committer->mutex);
+  free(committer);
+}
+
+static void step_out(OutputCommitter *committer);
+static Error wait_for_room(OutputCommitter *committer, size_t end);
+
+Error commit_output(OutputCommitter *committer, size_t offset,
+                    const void *data, size_t size) {
+  assert(committer);
+  assert(data || size == 0);
+
+  const size_t end = offset + size;
+
+  // a writer counts itself before it looks at the mapping, and the grower
+  // announces itself before it counts the writers, so at least one of them
+  // sees the other
+  for (;;) {
+    atomic_fetch_add(&committer->num_copying, 1);
+
+    if (!atomic_load(&committer->is_growing) &&
+        end <= atomic_load(&committer->capacity)) {
+      break;
+    }
+
+    step_out(committer);
+
+    const Error error = wait_for_room(committer, end);
+
+    if (error.what) {
+      return error;
+    }
+  }
+
+  char *const address = atomic_load(&committer->base) + offset;
+  memcpy(address, data, size);
+  release_pages(address, size);
+
+  size_t furthest = atomic_load(&committer->end);
+
+  while (furthest < end &&
+         !atomic_compare_exchange_weak(&committer->end, &furthest, end)) {
+  }
+
+  step_out(committer);
+
+  return NULL_ERROR;
+}
+
+static void step_out(OutputCommitter *committer) {
+  assert(committer);
+
+  if (atomic_fetch_sub(&committer->num_copying, 1) == 1 &&
+      atomic_load(&committer->is_growing)) {
+    pthread_mutex_lock(&committer->mutex);
+    pthread_cond_broadcast(&committer->changed);
+    pthread_mutex_unlock(&committer->mutex);
+  }
+}
+
+// asks the grower for room up to end and waits until it has made it
+static Error wait_for_room(OutputCommitter *committer, size_t end) {
+  assert(committer);
+
+  pthread_mutex_lock(&committer->mutex);
+
+  if (committer->requested < end) {
+    committer->requested = end;
+    pthread_cond_broadcast(&committer->changed);
+  }
+
+  while (!committer->error.what && (atomic_load(&committer->is_growing) ||
+                                    atomic_load(&committer->capacity) < end)) {
+    pthread_cond_wait(&committer->changed, &committer->mutex);
+  }
+
+  const Error error = committer->error.what
+                          ? eformat("%s", committer->error.what)
+                          : NULL_ERROR;
+
+  pthread_mutex_unlock(&committer->mutex);
+
+  return error;
+}
+
+// the only thread that calls expand_output_mapping, which may move the
+// mapping, and so only once every writer has stepped out
+static void *run_grower(void *committer_v) {
+  assert(committer_v);
+
+  OutputCommitter *const committer = (OutputCommitter *)committer_v;
+  FileAndMapping *const output = &committer->io_state->output_file;
+
+  pthread_mutex_lock(&committer->mutex);
+
+  for (;;) {
+    while (!committer->is_closing &&
+           (committer->error.what ||
+            committer->requested <= atomic_load(&committer->capacity))) {
+      pthread_cond_wait(&committer->changed, &committer->mutex);
+    }
+
+    if (committer->is_closing) {
+      break;
+    }
+
+    atomic_store(&committer->is_growing, true);
+
+    while (atomic_load(&committer->num_copying) > 0) {
+      pthread_cond_wait(&committer->changed, &committer->mutex);
+    }
+
+    // doubles the file each time, as when compressing on one thread
+    while (!committer->error.what &&
+           output->mapping_offset + output->mapping_size <
+               committer->requested) {
+      committer->error = expand_output_mapping(output, output->mapping_size);
+    }
+
+    publish_mapping(committer);
+    atomic_store(&committer->is_growing, false);
+    pthread_cond_broadcast(&committer->changed);
+  }
+
+  committer->grower_syscalls = file_syscall_counts;
+  pthread_mutex_unlock(&committer->mutex);
+
+  return NULL;
+}
+
+static void publish_mapping(OutputCommitter *committer) {
+  assert(committer);
+
+  const FileAndMapping *const output = &committer->io_state->output_file;
+
+  atomic_store(&committer->base,
+               (char *)output->mapping - output->mapping_offset);
+  atomic_store(&committer->capacity,
+               output->mapping_offset + output->mapping_size);
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/cpu.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#ifdef MMC_HAVE_X86_KERNELS
+#include <cpuid.h>
+#endif
+
+const char *const CPU_LEVEL_NAMES[3] = {"generic", "avx2", "avx512"};
+
+static CpuLevel detected_level = CPU_LEVEL_GENERIC;
+static CpuLevel level = CPU_LEVEL_GENERIC;
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+static void detect(void);
+
+CpuLevel detect_cpu_level(void) {
+  pthread_once(&detect_once, detect);
+
+  return detected_level;
+}
+
+CpuLevel cpu_level(void) {
+  pthread_once(&detect_once, detect);
+
+  return level;
+}
+
+Error override_cpu_level(CpuLevel new_level) {
+  assert(new_level >= CPU_LEVEL_GENERIC && new_level <= CPU_LEVEL_AVX512);
+
+  pthread_once(&detect_once, detect);
+
+#ifndef MMC_HAVE_X86_KERNELS
+  if (new_level > CPU_LEVEL_GENERIC) {
+    return eformat("mmc was built without its %s kernels",
+                   CPU_LEVEL_NAMES[new_level]);
+  }
+#endif
+
+  if (new_level > detected_level) {
+    return eformat("this CPU doesn't support %s, only up to %s",
+                   CPU_LEVEL_NAMES[new_level], CPU_LEVEL_NAMES[detected_level]);
+  }
+
+  level = new_level;
+
+  return NULL_ERROR;
+}
+
+#ifdef MMC_HAVE_X86_KERNELS
+// cpuid leaf 1, ecx
+#define CPUID_PCLMULQDQ (1u << 1)
+#define CPUID_SSE41 (1u << 19)
+#define CPUID_SSE42 (1u << 20)
+#define CPUID_OSXSAVE (1u << 27)
+#define CPUID_AVX (1u << 28)
+// cpuid leaf 7, ebx
+#define CPUID_AVX2 (1u << 5)
+#define CPUID_AVX512F (1u << 16)
+#define CPUID_AVX512BW (1u << 30)
+#define CPUID_AVX512VL (1u << 31)
+// cpuid leaf 7, ecx
+#define CPUID_VPCLMULQDQ (1u << 10)
+
+// XCR0: the OS saves SSE and AVX state, then opmask and both halves of the
+// upper 16 ZMM registers
+#define XCR0_AVX 0x06u
+#define XCR0_AVX512 0xe6u
+
+// _xgetbv needs -mxsave, which would leak into the rest of this file
+static uint32_t read_xcr0(void) {
+  uint32_t eax;
+  uint32_t edx;
+  __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+  return eax;
+}
+
+static bool has_all(uint32_t reg, uint32_t bits) {
+  return (reg & bits) == bits;
+}
+#endif
+
+static void detect(void) {
+#ifdef MMC_HAVE_X86_KERNELS
+  unsigned int eax;
+  unsigned int ebx;
+  unsigned int ecx;
+  unsigned int edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+      !has_all(ecx, CPUID_PCLMULQDQ | CPUID_SSE41 | CPUID_SSE42 |
+                        CPUID_OSXSAVE | CPUID_AVX)) {
+    return;
+  }
+
+  const uint32_t xcr0 = read_xcr0();
+
+  if (!has_all(xcr0, XCR0_AVX) ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+      !has_all(ebx, CPUID_AVX2)) {
+    return;
+  }
+
+  detected_level = CPU_LEVEL_AVX2;
+
+  if (has_all(xcr0, XCR0_AVX512) &&
+      has_all(ebx, CPUID_AVX512F | CPUID_AVX512BW | CPUID_AVX512VL) &&
+      has_all(ecx, CPUID_VPCLMULQDQ)) {
+    detected_level = CPU_LEVEL_AVX512;
+  }
+
+  level = detected_level;
+#endif
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/crc32c.h>
+#include <common/cpu.h>
+
+#include "kernels.h"
+
+#include <assert.h>
+
+#include <pthread.h>
+
+// reflected form of the Castagnoli polynomial 0x1EDC6F41
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+
+// slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t table[8][256];
+
+typedef uint32_t(Crc32cFunc)(uint32_t crc, const unsigned char *data,
+                             size_t size);
+
+static Crc32cFunc slicing_crc32c;
+
+static Crc32cFunc *kernel = slicing_crc32c;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+// the table is only filled if there's no crc32 instruction to use
+static void pick_kernel(void) {
+#ifdef MMC_HAVE_X86_KERNELS
+  if (cpu_level() >= CPU_LEVEL_AVX2) {
+    kernel = sse42_crc32c;
+
+    return;
+  }
+#endif
+
+  for (uint32_t byte = 0; byte < 256; ++byte) {
+    uint32_t crc = byte;
+
+    for (int i = 0; i < 8; ++i) {
+      crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+    }
+
+    table[0][byte] = crc;
+  }
+
+  for (size_t k = 1; k < 8; ++k) {
+    for (size_t byte = 0; byte < 256; ++byte) {
+      const uint32_t previous = table[k - 1][byte];
+
+      table[k][byte] = (previous >> 8) ^ table[0][previous & 0xFF];
+    }
+  }
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+  assert(data || size == 0);
+
+  pthread_once(&kernel_once, pick_kernel);
+
+  return kernel(crc, (const unsigned char *)data, size);
+}
+
+static uint32_t slicing_crc32c(uint32_t crc, const unsigned char *next,
+                               size_t size) {
+  crc = ~crc;
+
+  for (; size >= 8; size -= 8, next += 8) {
+    // assembled byte by byte, so neither alignment nor endianness matter
+    const uint32_t low = crc ^ ((uint32_t)next[0] | (uint32_t)next[1] << 8 |
+                                (uint32_t)next[2] << 16 |
+                                (uint32_t)next[3] << 24);
+
+    crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+          table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+          table[3][next[4]] ^ table[2][next[5]] ^ table[1][next[6]] ^
+          table[0][next[7]];
+  }
+
+  for (; size > 0; --size, ++next) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *next) & 0xFF];
+  }
+
+  return ~crc;
+}
@@ -0,0 +1,643 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/argparse.h>
+#include <common/chunker.h>
+#include <common/crc32c.h>
+#include <common/error.h>
+#include <common/file.h>
+#include <common/mmc.h>
+#include <mmc/mmc.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+// a deduplicated file is a header, a recipe that lists the chunks of the
+// original file in order as ranges of the chunk store, then the chunk store
+// itself: every distinct chunk once, compressed as a single stream. integers
+// are little-endian
+#define DEDUP_MAGIC "MMCD"
+#define DEDUP_MAGIC_SIZE 4
+#define DEDUP_VERSION 1
+
+// magic, version, codec, reserved, original size, number of recipe entries,
+// chunk store size, compressed chunk store size
+#define HEADER_SIZE 48
+// offset into the chunk store, size
+#define RECIPE_ENTRY_SIZE 12
+
+#define DEFAULT_AVERAGE_CHUNK_SIZE ((size_t)8 << 10)
+
+typedef struct UniqueChunk {
+  // CRC-32C in the high half and size in the low half, so never 0
+  uint64_t key;
+
+  size_t input_offset;
+  size_t store_offset;
+} UniqueChunk;
+
+// open addressing with linear probing, kept at most half full
+typedef struct ChunkIndex {
+  UniqueChunk *slots;
+  size_t capacity;
+  size_t num_chunks;
+} ChunkIndex;
+
+typedef struct Recipe {
+  unsigned char *entries;
+  size_t num_entries;
+  size_t capacity;
+} Recipe;
+
+static Error deduplicate(const char *input_filename,
+                         const char *output_filename, const MmcOptions *options,
+                         size_t average_chunk_size, bool print_stats);
+static Error reassemble(const char *input_filename,
+                        const char *output_filename);
+
+int main(int argc, const char *const argv[]) {
+  PassthroughArgumentParser input_filename_parser =
+      make_passthrough_parser("INPUT_FILE", NULL);
+  PassthroughArgumentParser output_filename_parser =
+      make_passthrough_parser("OUTPUT_FILE", NULL);
+
+  KeywordArgument decompress = {
+      .short_name = 'd',
+      .long_name = "decompress",
+      .help_text = "Reassemble a deduplicated INPUT_FILE into OUTPUT_FILE.",
+      .parser = NULL,
+  };
+
+  StringArgumentParser codec_parser = make_string_parser(
+      "-c, --codec", "CODEC", NUM_MMC_CODECS, MMC_CODEC_NAMES);
+  KeywordArgument codec = {
+      .short_name = 'c',
+      .long_name = "codec",
+      .help_text = "Codec to compress the chunk store with. One of 'zlib', "
+                   "'gzip', 'raw', 'lz4', or 'zstd'. Only codecs that mmc "
+                   "was built with are available. Defaults to '"
+                   MMC_DEFAULT_CODEC_NAME "'.",
+      .parser = &codec_parser.argument_parser,
+  };
+
+  IntegerArgumentParser level_parser =
+      make_integer_parser("-l, --level", "LEVEL", INT_MIN, INT_MAX);
+  KeywordArgument level = {
+      .short_name = 'l',
+      .long_name = "level",
+      .help_text = "Compression level, with the same meaning and range as "
+                   "the corresponding frontend's --level. Defaults to the "
+                   "codec's default level.",
+      .parser = &level_parser.argument_parser,
+  };
+
+  IntegerArgumentParser average_size_parser = make_integer_parser(
+      "-a, --average-chunk-size", "BYTES", 256, (long long)1 << 20);
+  KeywordArgument average_size = {
+      .short_name = 'a',
+      .long_name = "average-chunk-size",
+      .help_text = "Average size of content-defined chunks, a power of two "
+                   "between 256 bytes and 1MiB that defaults to 8KiB. "
+                   "Chunks are between a quarter of and eight times as long. "
+                   "Smaller chunks find more duplicates, but make for a "
+                   "longer recipe.",
+      .parser = &average_size_parser.argument_parser,
+  };
+
+  KeywordArgument stats = {
+      .short_name = 's',
+      .long_name = "stats",
+      .help_text = "Print the number of chunks and how many bytes were "
+                   "deduplicated to standard error.",
+      .parser = NULL,
+  };
+
+  KeywordArgument *keyword_args[] = {&decompress, &codec, &level,
+                                     &average_size, &stats};
+
+  Arguments arguments = {
+      .executable_name = "mmc-dedup",
+      .version = MMC_VERSION,
+      .author = MMC_AUTHOR,
+      .description =
+          "mmc-dedup splits INPUT_FILE into content-defined chunks with "
+          "FastCDC, stores each distinct chunk once, and compresses the "
+          "distinct chunks with one of the mmc codecs. A recipe of chunk "
+          "references is written in front of them, and is used to "
+          "reassemble the original file with --decompress.",
+
+      .positional_args =
+          (PositionalArgument *[]){
+              &(PositionalArgument){
+                  .name = "INPUT_FILE",
+                  .help_text = "File to read from.",
+                  .parser = &input_filename_parser.argument_parser,
+              },
+              &(PositionalArgument){
+                  .name = "OUTPUT_FILE",
+                  .help_text = "File to write to. It is created or "
+                               "truncated, then removed if an error occurs.",
+                  .parser = &output_filename_parser.argument_parser,
+              },
+          },
+      .num_positional_args = 2,
+
+      .keyword_args = keyword_args,
+      .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
+  };
+
+  Error error = parse_arguments(&arguments, argc, argv);
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if (arguments.has_help) {
+    print_help(&arguments);
+
+    return EXIT_SUCCESS;
+  } else if (arguments.has_version) {
+    print_version(&arguments);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (decompress.was_found) {
+    if (codec.was_found || level.was_found || average_size.was_found ||
+        stats.was_found) {
+      print_error(STATIC_ERROR("--codec, --level, --average-chunk-size, and "
+                               "--stats only apply when deduplicating"));
+
+      return EXIT_FAILURE;
+    }
+
+    error = reassemble(input_filename_parser.value,
+                       output_filename_parser.value);
+  } else {
+    MmcOptions options = mmc_make_options(MMC_DEFAULT_CODEC);
+
+    if (codec.was_found) {
+      options.codec = (MmcCodecId)codec_parser.value_index;
+    }
+
+    if (level.was_found) {
+      options.level = (int)level_parser.value;
+    }
+
+    const size_t average_chunk_size =
+        average_size.was_found ? (size_t)average_size_parser.value
+                               : DEFAULT_AVERAGE_CHUNK_SIZE;
+
+    if ((average_chunk_size & (average_chunk_size - 1)) != 0) {
+      print_error(eformat("average chunk size %zu is not a power of two",
+                          average_chunk_size));
+
+      return EXIT_FAILURE;
+    }
+
+    if ((error = mmc_check_options(&options)), error.what) {
+      print_error(error);
+
+      return EXIT_FAILURE;
+    }
+
+    error = deduplicate(input_filename_parser.value,
+                        output_filename_parser.value, &options,
+                        average_chunk_size, stats.was_found);
+  }
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static void store_le(unsigned char *bytes, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static uint64_t load_le(const unsigned char *bytes, size_t size) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    value |= (uint64_t)bytes[i] << (8 * i);
+  }
+
+  return value;
+}
+
+static Error find_or_add_chunk(ChunkIndex *index, const unsigned char *input,
+                               size_t offset, size_t size,
+                               size_t *store_offset, bool *is_new);
+static Error append_to_recipe(Recipe *recipe, size_t store_offset,
+                              size_t size);
+static Error write_output(const char *filename, const FileAndMapping *input,
+                          const Recipe *recipe, const MmcOptions *options,
+                          const MmcBuffer *compressed_store,
+                          size_t store_size);
+
+static Error deduplicate(const char *input_filename,
+                         const char *output_filename, const MmcOptions *options,
+                         size_t average_chunk_size, bool print_stats) {
+  assert(input_filename);
+  assert(output_filename);
+  assert(options);
+
+  FileAndMapping input;
+  Error error = open_and_map_file(input_filename, &input);
+
+  if (error.what) {
+    return error;
+  }
+
+  const ChunkSizes sizes = make_chunk_sizes(average_chunk_size);
+  const unsigned char *const bytes = (const unsigned char *)input.mapping;
+
+  ChunkIndex index = {.slots = NULL, .capacity = 0, .num_chunks = 0};
+  Recipe recipe = {.entries = NULL, .num_entries = 0, .capacity = 0};
+  size_t store_size = 0;
+
+  for (size_t offset = 0; offset < input.file_size;) {
+    const size_t size =
+        find_chunk_size(&sizes, bytes + offset, input.file_size - offset);
+    size_t store_offset = store_size;
+    bool is_new;
+
+    if ((error = find_or_add_chunk(&index, bytes, offset, size, &store_offset,
+                                   &is_new)),
+        error.what) {
+      goto cleanup;
+    }
+
+    if (is_new) {
+      store_size += size;
+    }
+
+    if ((error = append_to_recipe(&recipe, store_offset, size)), error.what) {
+      goto cleanup;
+    }
+
+    offset += size;
+  }
+
+  // the distinct chunks in the order they first appear. if every chunk is
+  // distinct, that's the input itself
+  FileAndMapping store = input;
+
+  if (store_size < input.file_size) {
+    if ((error = create_anonymous_mapping("chunk store", store_size, &store)),
+        error.what) {
+      goto cleanup;
+    }
+
+    for (size_t i = 0; i < index.capacity; ++i) {
+      const UniqueChunk *const chunk = &index.slots[i];
+
+      if (chunk->key != 0) {
+        memcpy((char *)store.mapping + chunk->store_offset,
+               bytes + chunk->input_offset, (size_t)(chunk->key & 0xFFFFFFFF));
+      }
+    }
+  }
+
+  MmcBuffer compressed_store;
+
+  if ((error = mmc_compress_buffer(store.mapping, store_size,
+                                   &compressed_store, options)),
+      !error.what) {
+    error = write_output(output_filename, &input, &recipe, options,
+                         &compressed_store, store_size);
+    discard_error(mmc_free_buffer(compressed_store));
+  }
+
+  if (store.mapping != input.mapping) {
+    discard_error(free_file(store));
+  }
+
+  if (!error.what && print_stats) {
+    const size_t deduplicated_size = input.file_size - store_size;
+
+    fprintf(stderr,
+            "%zu chunks, %zu distinct, %zu of %zu bytes deduplicated "
+            "(%.1f%%)\n",
+            recipe.num_entries, index.num_chunks, deduplicated_size,
+            input.file_size,
+            100.0 * (double)deduplicated_size / (double)input.file_size);
+  }
+
+cleanup:
+  free(recipe.entries);
+  free(index.slots);
+
+  const Error free_error = free_file(input);
+
+  if (!error.what) {
+    return free_error;
+  }
+
+  discard_error(free_error);
+
+  return error;
+}
+
+static Error grow_index(ChunkIndex *index);
+
+// store_offset is where the chunk would go if it's new
+static Error find_or_add_chunk(ChunkIndex *index, const unsigned char *input,
+                               size_t offset, size_t size,
+                               size_t *store_offset, bool *is_new) {
+  assert(index);
+  assert(input);
+  assert(size > 0 && size <= UINT32_MAX);
+  assert(store_offset);
+  assert(is_new);
+
+  if (2 * (index->num_chunks + 1) > index->capacity) {
+    const Error error = grow_index(index);
+
+    if (error.what) {
+      return error;
+    }
+  }
+
+  const uint64_t key = (uint64_t)crc32c(0, input + offset, size) << 32 | size;
+  size_t i = (size_t)(key >> 32) & (index->capacity - 1);
+
+  for (;; i = (i + 1) & (index->capacity - 1)) {
+    UniqueChunk *const slot = &index->slots[i];
+
+    if (slot->key == 0) {
+      *slot = (UniqueChunk){
+          .key = key, .input_offset = offset, .store_offset = *store_offset};
+      ++index->num_chunks;
+      *is_new = true;
+
+      return NULL_ERROR;
+    }
+
+    // matching checksums are only a hint
+    if (slot->key == key &&
+        memcmp(input + slot->input_offset, input + offset, size) == 0) {
+      *store_offset = slot->store_offset;
+      *is_new = false;
+
+      return NULL_ERROR;
+    }
+  }
+}
+
+static Error grow_index(ChunkIndex *index) {
+  assert(index);
+
+  const size_t new_capacity = index->capacity == 0 ? 1024 : 2 * index->capacity;
+  UniqueChunk *const new_slots = calloc(new_capacity, sizeof(UniqueChunk));
+
+  if (!new_slots) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  for (size_t i = 0; i < index->capacity; ++i) {
+    const UniqueChunk *const chunk = &index->slots[i];
+
+    if (chunk->key == 0) {
+      continue;
+    }
+
+    size_t j = (size_t)(chunk->key >> 32) & (new_capacity - 1);
+
+    while (new_slots[j].key != 0) {
+      j = (j + 1) & (new_capacity - 1);
+    }
+
+    new_slots[j] = *chunk;
+  }
+
+  free(index->slots);
+  index->slots = new_slots;
+  index->capacity = new_capacity;
+
+  return NULL_ERROR;
+}
+
+static Error append_to_recipe(Recipe *recipe, size_t store_offset,
+                              size_t size) {
+  assert(recipe);
+
+  if (recipe->num_entries == recipe->capacity) {
+    const size_t new_capacity =
+        recipe->capacity == 0 ? 1024 : 2 * recipe->capacity;
+    unsigned char *const new_entries =
+        realloc(recipe->entries, new_capacity * RECIPE_ENTRY_SIZE);
+
+    if (!new_entries) {
+      return ERROR_OUT_OF_MEMORY;
+    }
+
+    recipe->entries = new_entries;
+    recipe->capacity = new_capacity;
+  }
+
+  unsigned char *const entry =
+      recipe->entries + recipe->num_entries * RECIPE_ENTRY_SIZE;
+  store_le(entry, store_offset, 8);
+  store_le(entry + 8, size, 4);
+  ++recipe->num_entries;
+
+  return NULL_ERROR;
+}
+
+static Error write_output(const char *filename, const FileAndMapping *input,
+                          const Recipe *recipe, const MmcOptions *options,
+                          const MmcBuffer *compressed_store,
+                          size_t store_size) {
+  assert(filename);
+  assert(input);
+  assert(recipe);
+  assert(options);
+  assert(compressed_store);
+
+  const size_t recipe_size = recipe->num_entries * RECIPE_ENTRY_SIZE;
+  FileAndMapping output;
+  Error error = create_and_map_file(
+      filename, HEADER_SIZE + recipe_size + compressed_store->size, &output);
+
+  if (error.what) {
+    return error;
+  }
+
+  unsigned char *const header = (unsigned char *)output.mapping;
+  memcpy(header, DEDUP_MAGIC, DEDUP_MAGIC_SIZE);
+  store_le(header + 4, DEDUP_VERSION, 4);
+  store_le(header + 8, (uint64_t)options->codec, 1);
+  store_le(header + 9, 0, 7);
+  store_le(header + 16, input->file_size, 8);
+  store_le(header + 24, recipe->num_entries, 8);
+  store_le(header + 32, store_size, 8);
+  store_le(header + 40, compressed_store->size, 8);
+
+  memcpy(header + HEADER_SIZE, recipe->entries, recipe_size);
+  memcpy(header + HEADER_SIZE + recipe_size, compressed_store->data,
+         compressed_store->size);
+
+  if ((error = free_file(output)), error.what) {
+    unlink(filename);
+  }
+
+  return error;
+}
+
+static Error reassemble(const char *input_filename,
+                        const char *output_filename) {
+  assert(input_filename);
+  assert(output_filename);
+
+  FileAndMapping input;
+  Error error = open_and_map_file(input_filename, &input);
+
+  if (error.what) {
+    return error;
+  }
+
+  const unsigned char *const header = (const unsigned char *)input.mapping;
+
+  if (input.file_size < HEADER_SIZE ||
+      memcmp(header, DEDUP_MAGIC, DEDUP_MAGIC_SIZE) != 0) {
+    error = eformat("'%s' is not a deduplicated file", input_filename);
+
+    goto cleanup_input;
+  }
+
+  const uint64_t version = load_le(header + 4, 4);
+  const uint64_t codec = load_le(header + 8, 1);
+  const uint64_t original_size = load_le(header + 16, 8);
+  const uint64_t num_entries = load_le(header + 24, 8);
+  const uint64_t store_size = load_le(header + 32, 8);
+  const uint64_t compressed_store_size = load_le(header + 40, 8);
+
+  if (version != DEDUP_VERSION) {
+    error = eformat("deduplicated file '%s' has unsupported version %zu",
+                    input_filename, (size_t)version);
+
+    goto cleanup_input;
+  }
+
+  const size_t body_size = input.file_size - HEADER_SIZE;
+
+  if (codec >= NUM_MMC_CODECS || original_size == 0 ||
+      num_entries > body_size / RECIPE_ENTRY_SIZE ||
+      compressed_store_size !=
+          body_size - num_entries * RECIPE_ENTRY_SIZE) {
+    error = eformat("deduplicated file '%s' is truncated or corrupted",
+                    input_filename);
+
+    goto cleanup_input;
+  }
+
+  const unsigned char *const recipe = header + HEADER_SIZE;
+  MmcBuffer store;
+  const MmcOptions options = mmc_make_options((MmcCodecId)codec);
+
+  if ((error = mmc_decompress_buffer(recipe + num_entries * RECIPE_ENTRY_SIZE,
+                                     compressed_store_size, &store, &options)),
+      error.what) {
+    goto cleanup_input;
+  }
+
+  if (store.size != store_size) {
+    error = eformat("chunk store of '%s' decompressed to %zu bytes instead of "
+                    "%zu",
+                    input_filename, store.size, (size_t)store_size);
+
+    goto cleanup_store;
+  }
+
+  FileAndMapping output;
+
+  if ((error = create_and_map_file(output_filename, original_size, &output)),
+      error.what) {
+    goto cleanup_store;
+  }
+
+  size_t output_offset = 0;
+
+  for (size_t i = 0; i < num_entries; ++i) {
+    const unsigned char *const entry = recipe + i * RECIPE_ENTRY_SIZE;
+    const uint64_t store_offset = load_le(entry, 8);
+    const size_t size = (size_t)load_le(entry + 8, 4);
+
+    if (store_offset > store.size || size > store.size - store_offset ||
+        size > original_size - output_offset) {
+      error = eformat("recipe of '%s' refers past the end of its chunk store "
+                      "or the original file",
+                      input_filename);
+
+      break;
+    }
+
+    memcpy((char *)output.mapping + output_offset,
+           (const char *)store.data + store_offset, size);
+    output_offset += size;
+  }
+
+  if (!error.what && output_offset != original_size) {
+    error = eformat("recipe of '%s' covers %zu bytes instead of %zu",
+                    input_filename, output_offset, (size_t)original_size);
+  }
+
+  const Error free_error = free_file(output);
+
+  if (!error.what) {
+    error = free_error;
+  } else {
+    discard_error(free_error);
+  }
+
+  if (error.what) {
+    // the original error is more useful than why this failed
+    unlink(output_filename);
+  }
+
+cleanup_store:
+  discard_error(mmc_free_buffer(store));
+
+cleanup_input:
+  if (!error.what) {
+    return free_file(input);
+  }
+
+  discard_error(free_file(input));
+
+  return error;
+}
@@ -22,6 +22,7 @@
 #include <common/argparse.h>
 #include <common/error.h>
 #include <common/mmc.h>
+#include <common/zlib_codec.h>
 
 #include <assert.h>
 #include <stdbool.h>
@@ -29,8 +30,6 @@
 
 #include <zlib.h>
 
-#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
-
 typedef struct State {
   IntegerArgumentParser level_parser;
   KeywordArgument level;
@@ -38,16 +37,32 @@ typedef struct State {
   StringArgumentParser strategy_parser;
   KeywordArgument strategy;
 
-  z_stream stream;
+  StringArgumentParser format_parser;
+  KeywordArgument format;
+
+  IntegerArgumentParser window_bits_parser;
+  KeywordArgument window_bits;
+
+  IntegerArgumentParser mem_level_parser;
+  KeywordArgument mem_level;
+
+  KeywordArgument checksum;
+  KeywordArgument rsyncable;
+
+  RangeArgumentParser adapt_parser;
+  KeywordArgument adapt;
+
+  DeflateState codec;
 } State;
 
-size_t size(size_t input_file_size, void *state_v);
+size_t size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v);
+Error chunk_codec(AppChunkCodec *codec, void *state_v);
 Error init(AppIOState *io_state, void *state_v);
 Error run(AppIOState *io_state, bool *finished, void *state_v);
 void cleanup(AppIOState *io_state, void *state_v);
 
-size_t max_compressed_size(size_t uncompressed_size);
-
 static const char *const STRATEGY_VALUES[] = {"default", "filtered",
                                               "huffman-only", "rle", "fixed"};
 static const int STRATEGY_MAPPING[] = {Z_DEFAULT_STRATEGY, Z_FILTERED,
@@ -77,9 +92,91 @@ int main(int argc, const char *const argv[]) {
                "'huffman-only', 'rle', or 'fixed', corresponding to the "
                "zlib compression strategies.",
            .parser = &state.strategy_parser.argument_parser},
+
+      .format_parser = make_string_parser("-f, --format", "FORMAT",
+                                          sizeof(ZLIB_FORMAT_NAMES) /
+                                              sizeof(ZLIB_FORMAT_NAMES[0]),
+                                          ZLIB_FORMAT_NAMES),
+      .format = {.short_name = 'f',
+                 .long_name = "format",
+                 .help_text =
+                     "Container format to write. One of 'zlib', 'gzip', or "
+                     "'raw'. 'zlib' (the default) writes a zlib stream, "
+                     "'gzip' writes a single gzip member that can be read by "
+                     "gunzip(1), and 'raw' writes DEFLATE data without any "
+                     "header or trailer.",
+                 .parser = &state.format_parser.argument_parser},
+
+      .window_bits_parser = make_integer_parser(
+          "-w, --window-bits", "BITS", DEFLATE_MIN_WINDOW_BITS, MAX_WBITS),
+      .window_bits =
+          {.short_name = 'w',
+           .long_name = "window-bits",
+           .help_text =
+               "Base two logarithm of the history window size. An integer in "
+               "the range [" STRINGIFY(DEFLATE_MIN_WINDOW_BITS) ", " STRINGIFY(
+                   MAX_WBITS) "]. Smaller windows reduce the memory needed to "
+                              "compress and decompress at the cost of "
+                              "compression ratio.",
+           .parser = &state.window_bits_parser.argument_parser},
+
+      .mem_level_parser = make_integer_parser("-m, --mem-level", "LEVEL", 1,
+                                              MAX_MEM_LEVEL),
+      .mem_level =
+          {.short_name = 'm',
+           .long_name = "mem-level",
+           .help_text =
+               "Amount of memory to allocate for the internal compression "
+               "state. An integer in the range [1, " STRINGIFY(
+                   MAX_MEM_LEVEL) "], defaulting to " STRINGIFY(
+                   DEFLATE_DEFAULT_MEM_LEVEL) ". Higher levels use more "
+                                              "memory for a larger hash "
+                                              "table, which is faster and "
+                                              "compresses slightly better.",
+           .parser = &state.mem_level_parser.argument_parser},
+
+      .checksum = {.short_name = 'c',
+                   .long_name = "checksum",
+                   .help_text =
+                       "Require a checksum of the uncompressed contents. zlib "
+                       "streams always end with an Adler-32 checksum and "
+                       "gzip members with a CRC-32, so this only rejects "
+                       "--format=raw, which has nowhere to store one.",
+                   .parser = NULL},
+
+      .rsyncable = {.short_name = 'r',
+                    .long_name = "rsyncable",
+                    .help_text =
+                        "Fully flush the stream at content-defined "
+                        "boundaries, like gzip --rsyncable, so that a local "
+                        "change to the input only changes the output around "
+                        "it. Each flush discards the history window, which "
+                        "costs a little compression ratio.",
+                    .parser = NULL},
+
+      .adapt_parser = make_range_parser("-a, --adapt", "MIN:MAX",
+                                        Z_NO_COMPRESSION, Z_BEST_COMPRESSION),
+      .adapt = {.short_name = 'a',
+                .long_name = "adapt",
+                .help_text =
+                    "Adjust the compression level as the file is compressed, "
+                    "raising it while writing the output back to disk is the "
+                    "bottleneck and lowering it while compression is. The "
+                    "level starts at --level and stays within MIN:MAX, "
+                    "defaulting to 1:" STRINGIFY(Z_BEST_COMPRESSION) ".",
+                .parser = &state.adapt_parser.argument_parser,
+                .has_optional_value = true},
+
+      .codec = {.options = make_deflate_options()},
   };
 
-  KeywordArgument *keyword_args[] = {&state.level, &state.strategy};
+  // used when --adapt is given without a range
+  state.adapt_parser.low = state.codec.options.adapt_min_level;
+  state.adapt_parser.high = state.codec.options.adapt_max_level;
+
+  KeywordArgument *keyword_args[] = {
+      &state.level,     &state.strategy, &state.format, &state.window_bits,
+      &state.mem_level, &state.checksum, &state.rsyncable, &state.adapt};
 
   return run_compression_app(
       argc, argv,
@@ -100,172 +197,108 @@ int main(int argc, const char *const argv[]) {
           .init = init,
           .run = run,
           .cleanup = cleanup,
+          .fit_memory = fit_memory,
+          .chunk_codec = chunk_codec,
           .arg = &state,
       });
 }
 
-size_t size(size_t input_file_size, void *state_v) {
-  (void)state_v;
-
-  return max_compressed_size(input_file_size);
-}
-
-Error init(AppIOState *io_state, void *state_v) {
-  assert(io_state);
+size_t size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
   assert(state_v);
 
   State *const state = (State *)state_v;
+  DeflateOptions *const options = &state->codec.options;
 
-  int strategy_value = Z_DEFAULT_STRATEGY;
-  if (state->strategy.was_found) {
-    strategy_value = STRATEGY_MAPPING[state->strategy_parser.value_index];
-  }
-
-  int level_value = Z_DEFAULT_COMPRESSION;
   if (state->level.was_found) {
-    level_value = (int)state->level_parser.value;
+    options->level = (int)state->level_parser.value;
   }
 
-  state->stream =
-      (z_stream){.zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL};
-
-  const int init_errc = deflateInit2(&state->stream, level_value, Z_DEFLATED,
-                                     15, 8, strategy_value);
-
-  if (init_errc != Z_OK) {
-    assert(init_errc != Z_STREAM_ERROR);
+  if (state->strategy.was_found) {
+    options->strategy = STRATEGY_MAPPING[state->strategy_parser.value_index];
+  }
 
-    const char *what;
-    switch (init_errc) {
-    case Z_MEM_ERROR:
-      what = "out of memory";
+  if (state->format.was_found) {
+    options->format = (ZlibFormat)state->format_parser.value_index;
+  }
 
-      break;
+  if (state->window_bits.was_found) {
+    options->window_bits = (int)state->window_bits_parser.value;
+  }
 
-    case Z_VERSION_ERROR:
-      what = "zlib library version mismatch";
+  if (state->mem_level.was_found) {
+    options->mem_level = (int)state->mem_level_parser.value;
+  }
 
-      break;
-    default:
-      assert(false);
-    }
+  if (state->rsyncable.was_found) {
+    options->rsyncable = true;
+  }
 
-    if (state->stream.msg) {
-      return eformat("couldn't initialize deflate stream: %s (%d): %s", what,
-                     init_errc, state->stream.msg);
-    } else {
-      return eformat("couldn't initialize deflate stream: %s (%d)", what,
-                     init_errc);
-    }
+  if (state->adapt.was_found) {
+    options->adapt = true;
+    options->adapt_min_level = (int)state->adapt_parser.low;
+    options->adapt_max_level = (int)state->adapt_parser.high;
   }
 
-  return NULL_ERROR;
+  return deflate_size(input_file, &state->codec);
 }
 
-Error run(AppIOState *io_state, bool *finished, void *state_v) {
-  assert(io_state);
-  assert(finished);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v) {
   assert(state_v);
 
-  State *const state = (State *)state_v;
-
-  z_stream *const stream = &state->stream;
-
-  stream->next_in = (z_const Bytef *)io_state->input_file.mapping +
-                    io_state->input_mapping_first_unused_offset;
-  stream->avail_in = (uInt)MIN(io_state->input_file.mapping_size -
-                                   io_state->input_mapping_first_unused_offset,
-                               (size_t)UINT_MAX);
-  stream->total_in = 0;
-
-  stream->next_out = (Bytef *)io_state->output_file.mapping +
-                     io_state->output_mapping_first_unused_offset;
-  stream->avail_out =
-      (uInt)MIN(io_state->output_file.mapping_size -
-                    io_state->output_mapping_first_unused_offset,
-                (size_t)UINT_MAX);
-  stream->total_out = 0;
-
-  int flag;
-
-  if ((size_t)stream->avail_out >=
-      max_compressed_size((size_t)stream->avail_in)) {
-    flag = Z_FINISH;
-  } else {
-    flag = Z_NO_FLUSH;
-  }
+  return deflate_fit_memory(input_file, budget, &((State *)state_v)->codec);
+}
 
-  const int errc = deflate(&state->stream, flag);
+Error chunk_codec(AppChunkCodec *codec, void *state_v) {
+  assert(codec);
+  assert(state_v);
 
-  if (errc == Z_OK || errc == Z_STREAM_END) {
-    io_state->input_mapping_first_unused_offset += (size_t)stream->total_in;
-    io_state->output_mapping_first_unused_offset += (size_t)stream->total_out;
-    io_state->output_bytes_written += (size_t)stream->total_out;
+  State *const state = (State *)state_v;
+  const DeflateOptions *const options = &state->codec.options;
+
+  // gzip files may hold several concatenated members, but zlib and raw files
+  // hold one stream
+  if (options->format != ZLIB_FORMAT_GZIP) {
+    return STATIC_ERROR("--threads needs --format gzip, since zlib and raw "
+                        "streams can't be concatenated");
+  } else if (options->rsyncable || options->adapt) {
+    return STATIC_ERROR("--threads can't be combined with --rsyncable or "
+                        "--adapt");
   }
 
-  if (errc != Z_OK) {
-    assert(errc != Z_STREAM_ERROR);
-    assert(errc != Z_BUF_ERROR);
-
-    const char *what;
-    switch (errc) {
-    case Z_STREAM_END: {
-      *finished = true;
+  *codec = (AppChunkCodec){.state = &state->codec,
+                           .state_size = sizeof(DeflateState),
+                           .size = deflate_size,
+                           .init = deflate_init,
+                           .run = deflate_run,
+                           .reset = deflate_reset,
+                           .cleanup = deflate_cleanup};
 
-      return NULL_ERROR;
-    }
-    case Z_NEED_DICT:
-      what = "dictionary needed";
-
-      break;
-
-    case Z_DATA_ERROR:
-      what = "input data corrupted";
-
-      break;
-
-    case Z_MEM_ERROR:
-      what = "out of memory";
-
-      break;
+  return NULL_ERROR;
+}
 
-    default:
-      assert(false);
-    }
+Error init(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-    if (state->stream.msg) {
-      return eformat("couldn't inflate stream: %s (%d): %s", what, errc,
-                     state->stream.msg);
-    }
+  State *const state = (State *)state_v;
 
-    return eformat("couldn't inflate stream: %s (%d)", what, errc);
+  if (state->checksum.was_found &&
+      state->codec.options.format == ZLIB_FORMAT_RAW) {
+    return STATIC_ERROR("raw DEFLATE streams can't carry a checksum");
   }
 
-  *finished = false;
-
-  return NULL_ERROR;
+  return deflate_init(io_state, &state->codec);
 }
 
-void cleanup(AppIOState *io_state, void *state_v) {
-  assert(io_state);
+Error run(AppIOState *io_state, bool *finished, void *state_v) {
   assert(state_v);
 
-  (void)io_state;
-
-  State *const state = (State *)state_v;
-  deflateEnd(&state->stream);
+  return deflate_run(io_state, finished, &((State *)state_v)->codec);
 }
 
-size_t max_compressed_size(size_t uncompressed_size) {
-  static const size_t BLOCK_SIZE = 16000;
-  static const size_t BYTES_PER_BLOCK = 5;
-  static const size_t OVERHEAD_PER_STREAM;
-
-  size_t num_blocks = uncompressed_size / BLOCK_SIZE; // 16 KB
-
-  if (uncompressed_size % BLOCK_SIZE == 0) {
-    ++num_blocks;
-  }
+void cleanup(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-  return uncompressed_size + num_blocks * BYTES_PER_BLOCK + OVERHEAD_PER_STREAM;
+  deflate_cleanup(io_state, &((State *)state_v)->codec);
 }
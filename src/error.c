@@ -80,3 +80,9 @@ int print_warning(Error error) {
 
   return result;
 }
+
+void discard_error(Error error) {
+  if (error.allocated) {
+    free(error.what);
+  }
+}
@@ -0,0 +1,288 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <common/fast_inflate.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+void init_fast_inflater(FastInflater *inflater, size_t max_distance) {
+  assert(inflater);
+
+  make_fixed_huffman_codes(&inflater->fixed_lengths,
+                           &inflater->fixed_distances);
+  reset_fast_inflater(inflater, max_distance);
+}
+
+void reset_fast_inflater(FastInflater *inflater, size_t max_distance) {
+  assert(inflater);
+  assert(max_distance <= DEFLATE_WINDOW_SIZE);
+
+  inflater->max_distance = max_distance;
+  inflater->history_size = 0;
+}
+
+void append_fast_inflater_history(FastInflater *inflater,
+                                  const unsigned char *data, size_t size) {
+  assert(inflater);
+  assert(data || size == 0);
+
+  if (size >= DEFLATE_WINDOW_SIZE) {
+    memcpy(inflater->history, data + size - DEFLATE_WINDOW_SIZE,
+           DEFLATE_WINDOW_SIZE);
+  } else {
+    memmove(inflater->history, inflater->history + size,
+            DEFLATE_WINDOW_SIZE - size);
+    memcpy(inflater->history + DEFLATE_WINDOW_SIZE - size, data, size);
+  }
+
+  inflater->history_size = MIN(inflater->history_size + size,
+                               DEFLATE_WINDOW_SIZE);
+}
+
+static bool inflate_stored(BitReader *reader, unsigned char **output,
+                           unsigned char *output_end);
+static bool inflate_codes(FastInflater *inflater, BitReader *reader,
+                          const HuffmanCode *lengths,
+                          const HuffmanCode *distances,
+                          const unsigned char *output_start,
+                          unsigned char **output, unsigned char *output_end);
+
+bool fast_inflate_block(FastInflater *inflater, BitReader *reader,
+                        const unsigned char *output_start,
+                        unsigned char **output, unsigned char *output_end,
+                        bool *is_final) {
+  assert(inflater);
+  assert(reader);
+  assert(output_start);
+  assert(output);
+  assert(*output);
+  assert(output_end);
+  assert(output_start <= *output && *output <= output_end);
+  assert(is_final);
+
+  BitReader block = *reader;
+  unsigned char *next = *output;
+
+  const bool is_final_block = read_bits(&block, 1);
+  bool is_valid;
+
+  switch (read_bits(&block, 2)) {
+  case 0:
+    is_valid = inflate_stored(&block, &next, output_end);
+
+    break;
+  case 1:
+    is_valid =
+        inflate_codes(inflater, &block, &inflater->fixed_lengths,
+                      &inflater->fixed_distances, output_start, &next,
+                      output_end);
+
+    break;
+  case 2:
+    is_valid = read_dynamic_huffman_codes(&block, &inflater->lengths,
+                                          &inflater->distances) &&
+               inflate_codes(inflater, &block, &inflater->lengths,
+                             &inflater->distances, output_start, &next,
+                             output_end);
+
+    break;
+  default:
+    is_valid = false;
+  }
+
+  if (!is_valid || block.position > block.size * 8) {
+    return false;
+  }
+
+  *reader = block;
+  *output = next;
+  *is_final = is_final_block;
+
+  return true;
+}
+
+static bool inflate_stored(BitReader *reader, unsigned char **output,
+                           unsigned char *output_end) {
+  assert(reader);
+  assert(output);
+  assert(output_end);
+
+  size_t next_byte = (reader->position + 7) / 8;
+
+  if (next_byte > reader->size || reader->size - next_byte < 4) {
+    return false;
+  }
+
+  const unsigned char *const header = reader->data + next_byte;
+  const size_t length = (size_t)header[0] | (size_t)header[1] << 8;
+  const size_t complement = (size_t)header[2] | (size_t)header[3] << 8;
+  next_byte += 4;
+
+  if (length != (~complement & 0xffff) ||
+      reader->size - next_byte < length ||
+      (size_t)(output_end - *output) < length) {
+    return false;
+  }
+
+  memcpy(*output, reader->data + next_byte, length);
+  *output += length;
+  reader->position = (next_byte + length) * 8;
+
+  return true;
+}
+
+static void copy_match(const FastInflater *inflater,
+                       const unsigned char *output_start,
+                       unsigned char *output, size_t length, size_t distance);
+
+// every symbol is decoded from one peek at the input: a length code, its
+// extra bits, a distance code, and its extra bits take at most 48 bits
+static bool inflate_codes(FastInflater *inflater, BitReader *reader,
+                          const HuffmanCode *lengths,
+                          const HuffmanCode *distances,
+                          const unsigned char *output_start,
+                          unsigned char **output, unsigned char *output_end) {
+  assert(inflater);
+  assert(reader);
+  assert(lengths);
+  assert(distances);
+  assert(output_start);
+  assert(output);
+  assert(output_end);
+
+  const size_t end_position = reader->size * 8;
+  unsigned char *next = *output;
+
+  // matches are written whole, and may overshoot, before anything is checked
+  while (reader->position <= end_position &&
+         (size_t)(output_end - next) >= FAST_INFLATE_MIN_OUTPUT) {
+    uint64_t bits = peek_bits(reader);
+    size_t position = reader->position;
+    const int symbol = decode_huffman_bits(reader, lengths, bits);
+
+    if (symbol < 0) {
+      return false;
+    } else if (symbol < END_OF_BLOCK) {
+      *next++ = (unsigned char)symbol;
+
+      continue;
+    } else if (symbol == END_OF_BLOCK) {
+      *output = next;
+
+      return reader->position <= end_position;
+    }
+
+    const size_t length_index = (size_t)symbol - END_OF_BLOCK - 1;
+
+    if (length_index >= 29) {
+      return false;
+    }
+
+    bits >>= reader->position - position;
+    const unsigned num_length_bits = DEFLATE_LENGTH_EXTRA_BITS[length_index];
+    const size_t length = DEFLATE_LENGTH_BASES[length_index] +
+                          (size_t)(bits & ((1u << num_length_bits) - 1));
+    bits >>= num_length_bits;
+    reader->position += num_length_bits;
+
+    position = reader->position;
+    const int distance_index = decode_huffman_bits(reader, distances, bits);
+
+    if (distance_index < 0 || distance_index >= 30) {
+      return false;
+    }
+
+    bits >>= reader->position - position;
+    const unsigned num_distance_bits =
+        DEFLATE_DISTANCE_EXTRA_BITS[distance_index];
+    const size_t distance = DEFLATE_DISTANCE_BASES[distance_index] +
+                            (size_t)(bits & ((1u << num_distance_bits) - 1));
+    reader->position += num_distance_bits;
+
+    const size_t available = (size_t)(next - output_start);
+
+    if (distance > inflater->max_distance ||
+        (distance > available &&
+         distance - available > inflater->history_size)) {
+      return false;
+    }
+
+    copy_match(inflater, output_start, next, length, distance);
+    next += length;
+  }
+
+  // left to zlib, which stops when the output is full
+  return false;
+}
+
+// may write up to 15 bytes past the end of the match
+static void copy_match(const FastInflater *inflater,
+                       const unsigned char *output_start,
+                       unsigned char *output, size_t length, size_t distance) {
+  assert(inflater);
+  assert(output_start);
+  assert(output);
+
+  const size_t available = (size_t)(output - output_start);
+  unsigned char *const end = output + length;
+
+  if (distance > available) {
+    // only the first window of each run of output refers back this far. the
+    // history is kept right-aligned, ending at the last byte of the window
+    const unsigned char *const history =
+        inflater->history + DEFLATE_WINDOW_SIZE - (distance - available);
+    const size_t from_history = MIN(length, distance - available);
+
+    memcpy(output, history, from_history);
+
+    for (size_t i = from_history; i < length; ++i) {
+      output[i] = output[i - distance];
+    }
+
+    return;
+  }
+
+  const unsigned char *source = output - distance;
+
+  if (distance >= 16) {
+    // each copy reads only bytes that are already written
+    do {
+      memcpy(output, source, 16);
+      output += 16;
+      source += 16;
+    } while (output < end);
+  } else if (distance >= 8) {
+    do {
+      memcpy(output, source, 8);
+      output += 8;
+      source += 8;
+    } while (output < end);
+  } else if (distance == 1) {
+    memset(output, *source, length);
+  } else {
+    for (size_t i = 0; i < length; ++i) {
+      output[i] = source[i];
+    }
+  }
+}
@@ -20,7 +20,10 @@
 
 #include <common/file.h>
 
+#include "file_syscalls.h"
+
 #include <assert.h>
+#include <stdint.h>
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -28,6 +31,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+__thread FileSyscallCounts file_syscall_counts;
+
+static Error grow_mapping(FileAndMapping *file, size_t size_increment);
+
 Error open_and_map_file(const char *filename, FileAndMapping *file) {
   assert(filename);
   assert(file);
@@ -48,6 +55,7 @@ Error open_and_map_file(const char *filename, FileAndMapping *file) {
 
   const size_t size = (size_t)statbuf.st_size;
   void *const mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  ++file_syscall_counts.num_mmaps;
 
   if (mapping == MAP_FAILED) {
     close(fd);
@@ -71,6 +79,38 @@ Error open_and_map_file(const char *filename, FileAndMapping *file) {
   return NULL_ERROR;
 }
 
+Error open_file(const char *filename, FileAndMapping *file) {
+  assert(filename);
+  assert(file);
+
+  const int fd = open(filename, O_RDONLY);
+
+  if (fd == -1) {
+    return ERRNO_EFORMAT("couldn't open file '%s' for reading", filename);
+  }
+
+  struct stat statbuf;
+
+  if (fstat(fd, &statbuf) == -1) {
+    close(fd);
+
+    return ERRNO_EFORMAT("couldn't stat file '%s'", filename);
+  }
+
+  *file = (FileAndMapping){
+      .filename = filename,
+
+      .fd = fd,
+      .file_size = (size_t)statbuf.st_size,
+
+      .mapping = NULL,
+      .mapping_size = 0,
+      .mapping_offset = 0,
+  };
+
+  return NULL_ERROR;
+}
+
 Error create_and_map_file(const char *filename, size_t size,
                           FileAndMapping *file) {
   assert(filename);
@@ -84,6 +124,8 @@ Error create_and_map_file(const char *filename, size_t size,
   }
 
   if (size > 0) {
+    ++file_syscall_counts.num_ftruncates;
+
     if (ftruncate(fd, (off_t)size) == -1) {
       return ERRNO_EFORMAT("couldn't set length of file '%s' to '%zu'",
                            filename, size);
@@ -92,6 +134,7 @@ Error create_and_map_file(const char *filename, size_t size,
 
   void *const mapping =
       mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ++file_syscall_counts.num_mmaps;
 
   if (mapping == MAP_FAILED) {
     close(fd);
@@ -115,6 +158,71 @@ Error create_and_map_file(const char *filename, size_t size,
   return NULL_ERROR;
 }
 
+Error create_anonymous_mapping(const char *name, size_t size,
+                               FileAndMapping *file) {
+  assert(name);
+  assert(file);
+
+  void *const mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ++file_syscall_counts.num_mmaps;
+
+  if (mapping == MAP_FAILED) {
+    return ERRNO_EFORMAT("couldn't map %zu bytes of memory for '%s'", size,
+                         name);
+  }
+
+  *file = (FileAndMapping){
+      .filename = name,
+
+      .fd = -1,
+      .file_size = size,
+
+      .mapping = mapping,
+      .mapping_size = size,
+      .mapping_offset = 0,
+  };
+
+  return NULL_ERROR;
+}
+
+Error map_file_range(const char *filename, int fd, size_t offset, size_t size,
+                     bool is_writable, FileAndMapping *file) {
+  assert(filename);
+  assert(fd != -1);
+  assert(size > 0);
+  assert(file);
+
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t mapping_offset = offset - offset % page_size;
+  const size_t mapping_size = offset - mapping_offset + size;
+
+  void *const mapping =
+      mmap(NULL, mapping_size, is_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+           MAP_SHARED, fd, (off_t)mapping_offset);
+  ++file_syscall_counts.num_mmaps;
+
+  if (mapping == MAP_FAILED) {
+    return ERRNO_EFORMAT("couldn't map %zu bytes at offset %zu of file '%s' "
+                         "into memory",
+                         size, offset, filename);
+  }
+
+  // free_file must leave the descriptor to its owner
+  *file = (FileAndMapping){
+      .filename = filename,
+
+      .fd = -1,
+      .file_size = mapping_size,
+
+      .mapping = mapping,
+      .mapping_size = mapping_size,
+      .mapping_offset = mapping_offset,
+  };
+
+  return NULL_ERROR;
+}
+
 Error unmap_unused_pages(FileAndMapping *file, size_t *first_unused_offset) {
   assert(file);
   assert(first_unused_offset);
@@ -133,6 +241,7 @@ Error unmap_unused_pages(FileAndMapping *file, size_t *first_unused_offset) {
   }
 
   const size_t num_bytes_to_unmap = num_spans_to_unmap * UNMAP_SPAN_SIZE;
+  ++file_syscall_counts.num_munmaps;
 
   if (munmap(file->mapping, num_bytes_to_unmap) == -1) {
     return ERRNO_EFORMAT("couldn't unmap part of file '%s' from memory",
@@ -150,16 +259,107 @@ Error unmap_unused_pages(FileAndMapping *file, size_t *first_unused_offset) {
 Error expand_output_mapping(FileAndMapping *file, size_t first_unused_offset) {
   assert(file);
 
-  if (file->mapping_size < first_unused_offset) {
+  // only grow once the codec has filled the mapping
+  if (first_unused_offset < file->mapping_size) {
+    return NULL_ERROR;
+  }
+
+  return grow_mapping(file, file->file_size);
+}
+
+Error reserve_output_space(FileAndMapping *file, size_t first_unused_offset,
+                           size_t size) {
+  assert(file);
+  assert(file->file_size > 0);
+  assert(first_unused_offset <= file->mapping_size);
+
+  const size_t available_size = file->mapping_size - first_unused_offset;
+
+  if (available_size >= size) {
+    return NULL_ERROR;
+  }
+
+  // keep doubling so that many small reservations stay amortized
+  size_t size_increment = file->file_size;
+
+  while (size_increment < size - available_size) {
+    size_increment *= 2;
+  }
+
+  return grow_mapping(file, size_increment);
+}
+
+Error reserve_bounded_output_space(FileAndMapping *file,
+                                   size_t first_unused_offset, size_t size) {
+  assert(file);
+  assert(first_unused_offset <= file->mapping_size);
+
+  const size_t available_size = file->mapping_size - first_unused_offset;
+
+  if (available_size >= size) {
+    return NULL_ERROR;
+  }
+
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t missing_size = size - available_size;
+
+  return grow_mapping(file, (missing_size + page_size - 1) / page_size *
+                                page_size);
+}
+
+void release_pages(void *address, size_t size) {
+  assert(address || size == 0);
+
+  const uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+  const uintptr_t first = ((uintptr_t)address + page_size - 1) / page_size;
+  const uintptr_t last = ((uintptr_t)address + size) / page_size;
+
+  // not the end of the world if the pages stay
+  if (first < last) {
+    madvise((void *)(first * page_size), (last - first) * page_size,
+            MADV_DONTNEED);
+  }
+}
+
+Error free_file(FileAndMapping file) {
+  // open_file maps nothing
+  if (!file.mapping) {
+    if (file.fd != -1 && close(file.fd) == -1) {
+      return ERRNO_EFORMAT("couldn't close file '%s'", file.filename);
+    }
+
     return NULL_ERROR;
   }
 
-  const size_t size_increment = file->file_size;
+  ++file_syscall_counts.num_munmaps;
+
+  if (munmap(file.mapping, file.mapping_size) == -1) {
+    if (file.fd != -1) {
+      close(file.fd);
+    }
+
+    return ERRNO_EFORMAT("couldn't unmap file '%s' from memory", file.filename);
+  }
+
+  if (file.fd != -1 && close(file.fd) == -1) {
+    return ERRNO_EFORMAT("couldn't close file '%s'", file.filename);
+  }
+
+  return NULL_ERROR;
+}
+
+static Error grow_mapping(FileAndMapping *file, size_t size_increment) {
+  assert(file);
+
   const size_t new_size = file->file_size + size_increment;
 
-  if (ftruncate(file->fd, (off_t)new_size) == -1) {
-    return ERRNO_EFORMAT("couldn't set length of file '%s' to '%zu'",
-                         file->filename, new_size);
+  if (file->fd != -1) {
+    ++file_syscall_counts.num_ftruncates;
+
+    if (ftruncate(file->fd, (off_t)new_size) == -1) {
+      return ERRNO_EFORMAT("couldn't set length of file '%s' to '%zu'",
+                           file->filename, new_size);
+    }
   }
 
   file->file_size = new_size;
@@ -167,6 +367,7 @@ Error expand_output_mapping(FileAndMapping *file, size_t first_unused_offset) {
   const size_t new_mapping_size = file->mapping_size + size_increment;
   void *const new_mapping = mremap(file->mapping, file->mapping_size,
                                    new_mapping_size, MREMAP_MAYMOVE);
+  ++file_syscall_counts.num_mremaps;
 
   if (new_mapping == MAP_FAILED) {
     return ERRNO_EFORMAT(
@@ -181,17 +382,3 @@ Error expand_output_mapping(FileAndMapping *file, size_t first_unused_offset) {
 
   return NULL_ERROR;
 }
-
-Error free_file(FileAndMapping file) {
-  if (munmap(file.mapping, file.mapping_size) == -1) {
-    close(file.fd);
-
-    return ERRNO_EFORMAT("couldn't unmap file '%s' from memory", file.filename);
-  }
-
-  if (close(file.fd) == -1) {
-    return ERRNO_EFORMAT("couldn't close file '%s'", file.filename);
-  }
-
-  return NULL_ERROR;
-}
@@ -0,0 +1,214 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <common/huffman.h>
+
+#include <assert.h>
+#include <string.h>
+
+const uint16_t DEFLATE_LENGTH_BASES[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t DEFLATE_LENGTH_EXTRA_BITS[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DEFLATE_DISTANCE_BASES[30] = {
+    1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+    33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DEFLATE_DISTANCE_EXTRA_BITS[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+bool build_huffman_code(HuffmanCode *code, const uint8_t *lengths,
+                        size_t num_symbols, bool must_be_complete) {
+  assert(code);
+  assert(lengths);
+  assert(num_symbols <= NUM_LENGTH_SYMBOLS);
+
+  memset(code->counts, 0, sizeof(code->counts));
+
+  for (size_t i = 0; i < num_symbols; ++i) {
+    ++code->counts[lengths[i]];
+  }
+
+  code->counts[0] = 0;
+  int left = 1;
+  size_t max_length = 0;
+
+  for (size_t length = 1; length <= MAX_CODE_BITS; ++length) {
+    left = (left << 1) - (int)code->counts[length];
+
+    if (left < 0) {
+      return false;
+    } else if (code->counts[length] > 0) {
+      max_length = length;
+    }
+  }
+
+  if (left > 0 && max_length > 0 && (must_be_complete || max_length != 1)) {
+    return false;
+  }
+
+  uint16_t offsets[MAX_CODE_BITS + 2];
+  unsigned next_codes[MAX_CODE_BITS + 1];
+  offsets[1] = 0;
+  next_codes[1] = 0;
+
+  for (size_t length = 1; length <= MAX_CODE_BITS; ++length) {
+    offsets[length + 1] = (uint16_t)(offsets[length] + code->counts[length]);
+
+    if (length < MAX_CODE_BITS) {
+      next_codes[length + 1] =
+          (next_codes[length] + code->counts[length]) << 1;
+    }
+  }
+
+  memset(code->fast, 0, sizeof(code->fast));
+
+  for (size_t symbol = 0; symbol < num_symbols; ++symbol) {
+    const unsigned length = lengths[symbol];
+
+    if (length == 0) {
+      continue;
+    }
+
+    code->symbols[offsets[length]++] = (uint16_t)symbol;
+    const unsigned value = next_codes[length]++;
+
+    if (length > FAST_BITS) {
+      continue;
+    }
+
+    // codes are packed starting from their most significant bit
+    unsigned reversed = 0;
+
+    for (unsigned i = 0; i < length; ++i) {
+      reversed |= ((value >> i) & 1) << (length - 1 - i);
+    }
+
+    const uint16_t entry = (uint16_t)(symbol << 4 | length);
+
+    for (size_t i = reversed; i < ((size_t)1 << FAST_BITS);
+         i += (size_t)1 << length) {
+      code->fast[i] = entry;
+    }
+  }
+
+  return true;
+}
+
+void make_fixed_huffman_codes(HuffmanCode *lengths, HuffmanCode *distances) {
+  assert(lengths);
+  assert(distances);
+
+  uint8_t code_lengths[NUM_LENGTH_SYMBOLS];
+  memset(code_lengths, 8, 144);
+  memset(code_lengths + 144, 9, 256 - 144);
+  memset(code_lengths + 256, 7, 280 - 256);
+  memset(code_lengths + 280, 8, NUM_LENGTH_SYMBOLS - 280);
+
+  bool is_valid =
+      build_huffman_code(lengths, code_lengths, NUM_LENGTH_SYMBOLS, true);
+  assert(is_valid);
+
+  memset(code_lengths, 5, NUM_DISTANCE_SYMBOLS);
+  is_valid =
+      build_huffman_code(distances, code_lengths, NUM_DISTANCE_SYMBOLS, true);
+  assert(is_valid);
+  (void)is_valid;
+}
+
+bool read_dynamic_huffman_codes(BitReader *reader, HuffmanCode *lengths,
+                                HuffmanCode *distances) {
+  assert(reader);
+  assert(lengths);
+  assert(distances);
+
+  static const uint8_t CODE_LENGTH_ORDER[NUM_CODE_LENGTH_SYMBOLS] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+  const size_t num_lengths = read_bits(reader, 5) + 257;
+  const size_t num_distances = read_bits(reader, 5) + 1;
+  const size_t num_code_lengths = read_bits(reader, 4) + 4;
+
+  if (num_lengths > 286 || num_distances > 30) {
+    return false;
+  }
+
+  uint8_t code_lengths[NUM_LENGTH_SYMBOLS + NUM_DISTANCE_SYMBOLS] = {0};
+
+  for (size_t i = 0; i < num_code_lengths; ++i) {
+    code_lengths[CODE_LENGTH_ORDER[i]] = (uint8_t)read_bits(reader, 3);
+  }
+
+  // the code length code's tables are only needed here, so they borrow the
+  // distance code's
+  HuffmanCode *const code_length_code = distances;
+
+  if (!build_huffman_code(code_length_code, code_lengths,
+                          NUM_CODE_LENGTH_SYMBOLS, true)) {
+    return false;
+  }
+
+  const size_t num_symbols = num_lengths + num_distances;
+
+  for (size_t i = 0; i < num_symbols;) {
+    const int symbol = decode_huffman_symbol(reader, code_length_code);
+
+    if (symbol < 0) {
+      return false;
+    } else if (symbol < 16) {
+      code_lengths[i++] = (uint8_t)symbol;
+
+      continue;
+    }
+
+    uint8_t length = 0;
+    size_t num_repeats;
+
+    if (symbol == 16) {
+      if (i == 0) {
+        return false;
+      }
+
+      length = code_lengths[i - 1];
+      num_repeats = 3 + read_bits(reader, 2);
+    } else if (symbol == 17) {
+      num_repeats = 3 + read_bits(reader, 3);
+    } else {
+      num_repeats = 11 + read_bits(reader, 7);
+    }
+
+    if (num_repeats > num_symbols - i) {
+      return false;
+    }
+
+    memset(code_lengths + i, length, num_repeats);
+    i += num_repeats;
+  }
+
+  return reader->position <= reader->size * 8 &&
+         code_lengths[END_OF_BLOCK] != 0 &&
+         build_huffman_code(lengths, code_lengths, num_lengths, false) &&
+         build_huffman_code(distances, code_lengths + num_lengths,
+                            num_distances, false);
+}
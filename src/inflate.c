@@ -19,8 +19,11 @@
 // SOFTWARE.
 
 #include <common/app.h>
+#include <common/argparse.h>
 #include <common/error.h>
 #include <common/mmc.h>
+#include <common/parallel_inflate.h>
+#include <common/zlib_codec.h>
 
 #include <assert.h>
 #include <stdbool.h>
@@ -28,15 +31,82 @@
 
 #include <zlib.h>
 
-#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+typedef struct State {
+  StringArgumentParser format_parser;
+  KeywordArgument format;
 
-size_t size(size_t input_file_size, void *stream_v);
-Error init(AppIOState *io_state, void *stream_v);
-Error run(AppIOState *io_state, bool *finished, void *stream_v);
-void cleanup(AppIOState *io_state, void *stream_v);
+  IntegerArgumentParser window_bits_parser;
+  KeywordArgument window_bits;
+
+  StringArgumentParser decoder_parser;
+  KeywordArgument decoder;
+
+  InflateState codec;
+} State;
+
+size_t size(const FileAndMapping *input_file, void *state_v);
+Error init(AppIOState *io_state, void *state_v);
+Error run(AppIOState *io_state, bool *finished, void *state_v);
+void cleanup(AppIOState *io_state, void *state_v);
+Error parallel_run(AppIOState *io_state, size_t num_threads,
+                   const NumaTopology *maybe_numa, size_t *num_chunks,
+                   bool *finished, void *state_v);
+bool has_checksum(const FileAndMapping *input_file, void *state_v);
+size_t window_size(const FileAndMapping *input_file, void *state_v);
 
 int main(int argc, const char *const argv[]) {
-  z_stream stream;
+  State state = {
+      .format_parser = make_string_parser("-f, --format", "FORMAT",
+                                          sizeof(ZLIB_FORMAT_NAMES) /
+                                              sizeof(ZLIB_FORMAT_NAMES[0]),
+                                          ZLIB_FORMAT_NAMES),
+      .format = {.short_name = 'f',
+                 .long_name = "format",
+                 .help_text =
+                     "Container format to read. One of 'zlib', 'gzip', or "
+                     "'raw'. 'zlib' (the default) reads a zlib stream, "
+                     "'gzip' reads one or more concatenated gzip members as "
+                     "written by gzip(1), and 'raw' reads DEFLATE data "
+                     "without any header or trailer.",
+                 .parser = &state.format_parser.argument_parser},
+
+      .window_bits_parser = make_integer_parser(
+          "-w, --window-bits", "BITS", INFLATE_MIN_WINDOW_BITS, MAX_WBITS),
+      .window_bits =
+          {.short_name = 'w',
+           .long_name = "window-bits",
+           .help_text =
+               "Base two logarithm of the largest history window to accept. "
+               "An integer in the range [" STRINGIFY(INFLATE_MIN_WINDOW_BITS)
+               ", " STRINGIFY(MAX_WBITS) "], defaulting to " STRINGIFY(
+                   MAX_WBITS) ". zlib streams that declare a larger window "
+                              "in their header are rejected before "
+                              "decompression starts; raw and gzip streams "
+                              "that refer further back than the window fail "
+                              "during decompression.",
+           .parser = &state.window_bits_parser.argument_parser},
+
+      .decoder_parser = make_string_parser("-d, --decoder", "DECODER",
+                                           sizeof(ZLIB_DECODER_NAMES) /
+                                               sizeof(ZLIB_DECODER_NAMES[0]),
+                                           ZLIB_DECODER_NAMES),
+      .decoder =
+          {.short_name = 'd',
+           .long_name = "decoder",
+           .help_text =
+               "DEFLATE decoder to use. One of 'fast' or 'zlib'. 'fast' (the "
+               "default) inflates each block that fits in the output "
+               "mapping straight into it, copying matches 16 bytes at a "
+               "time, leaves the rest to zlib, and checks the trailer with "
+               "vectorized Adler-32 or CRC-32 where the CPU supports it. "
+               "'zlib' uses zlib alone.",
+           .parser = &state.decoder_parser.argument_parser},
+
+      .codec = {.options = make_inflate_options()},
+  };
+
+  KeywordArgument *keyword_args[] = {&state.format, &state.window_bits,
+                                     &state.decoder};
 
   return run_decompression_app(
       argc, argv,
@@ -52,149 +122,77 @@ int main(int argc, const char *const argv[]) {
               "and "
               "write data to disk.",
 
+          .keyword_args = keyword_args,
+          .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
+
           .size = size,
           .init = init,
           .run = run,
           .cleanup = cleanup,
-          .arg = &stream,
+          .parallel_run = parallel_run,
+          .has_checksum = has_checksum,
+          .window_size = window_size,
+          .arg = &state,
       });
 }
 
-size_t size(size_t input_file_size, void *stream_v) {
-  assert(stream_v);
-
-  (void)stream_v;
-
-  return input_file_size;
-}
-
-Error init(AppIOState *io_state, void *stream_v) {
-  assert(io_state);
-  assert(stream_v);
-
-  z_stream *const stream = (z_stream *)stream_v;
-
-  *stream = (z_stream){.next_in = NULL,
-                       .avail_in = 0,
-                       .zalloc = Z_NULL,
-                       .zfree = Z_NULL,
-                       .opaque = Z_NULL};
-
-  const int init_errc = inflateInit(stream);
-
-  if (init_errc != Z_OK) {
-    assert(init_errc != Z_STREAM_ERROR);
-
-    const char *what;
-    switch (init_errc) {
-    case Z_MEM_ERROR:
-      what = "out of memory";
+size_t size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
 
-      break;
+  State *const state = (State *)state_v;
+  InflateOptions *const options = &state->codec.options;
 
-    case Z_VERSION_ERROR:
-      what = "zlib library version mismatch";
-
-      break;
-    default:
-      assert(false);
-    }
-
-    if (stream->msg) {
-      return eformat("couldn't initialize inflate stream: %s (%d): %s", what,
-                     init_errc, stream->msg);
-    } else {
-      return eformat("couldn't initialize inflate stream: %s (%d)", what,
-                     init_errc);
-    }
+  if (state->format.was_found) {
+    options->format = (ZlibFormat)state->format_parser.value_index;
   }
 
-  return NULL_ERROR;
-}
-
-Error run(AppIOState *io_state, bool *finished, void *stream_v) {
-  assert(io_state);
-  assert(finished);
-  assert(stream_v);
-
-  z_stream *const stream = (z_stream *)stream_v;
-
-  stream->next_in = (z_const Bytef *)io_state->input_file.mapping +
-                    io_state->input_mapping_first_unused_offset;
-  stream->avail_in = (uInt)MIN(io_state->input_file.mapping_size -
-                                   io_state->input_mapping_first_unused_offset,
-                               (size_t)UINT_MAX);
-  stream->total_in = 0;
-
-  stream->next_out = (Bytef *)io_state->output_file.mapping +
-                     io_state->output_mapping_first_unused_offset;
-  stream->avail_out =
-      (uInt)MIN(io_state->output_file.mapping_size -
-                    io_state->output_mapping_first_unused_offset,
-                (size_t)UINT_MAX);
-  stream->total_out = 0;
-
-  int flag;
-
-  if ((size_t)stream->avail_out / 1032 > (size_t)stream->avail_in) {
-    flag = Z_FINISH;
-  } else {
-    flag = Z_NO_FLUSH;
+  if (state->window_bits.was_found) {
+    options->window_bits = (int)state->window_bits_parser.value;
   }
 
-  const int errc = inflate(stream, flag);
-
-  if (errc == Z_OK || errc == Z_STREAM_END) {
-    io_state->input_mapping_first_unused_offset += (size_t)stream->total_in;
-    io_state->output_mapping_first_unused_offset += (size_t)stream->total_out;
-    io_state->output_bytes_written += (size_t)stream->total_out;
+  if (state->decoder.was_found) {
+    options->decoder = (ZlibDecoder)state->decoder_parser.value_index;
   }
 
-  if (errc != Z_OK) {
-    assert(errc != Z_STREAM_ERROR);
-    assert(errc != Z_BUF_ERROR);
-
-    const char *what;
-    switch (errc) {
-    case Z_STREAM_END:
-      *finished = true;
+  return inflate_size(input_file, &state->codec);
+}
 
-      return NULL_ERROR;
-    case Z_NEED_DICT:
-      what = "dictionary needed";
+Error init(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-      break;
-    case Z_DATA_ERROR:
-      what = "input data corrupted";
+  return inflate_init(io_state, &((State *)state_v)->codec);
+}
 
-      break;
-    case Z_MEM_ERROR:
-      what = "out of memory";
+Error run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(state_v);
 
-      break;
-    default:
-      assert(false);
-    }
+  return inflate_run(io_state, finished, &((State *)state_v)->codec);
+}
 
-    if (stream->msg) {
-      return eformat("couldn't inflate stream: %s (%d): %s", what, errc,
-                     stream->msg);
-    }
+void cleanup(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-    return eformat("couldn't inflate stream: %s (%d)", what, errc);
-  }
+  inflate_cleanup(io_state, &((State *)state_v)->codec);
+}
 
-  *finished = false;
+Error parallel_run(AppIOState *io_state, size_t num_threads,
+                   const NumaTopology *maybe_numa, size_t *num_chunks,
+                   bool *finished, void *state_v) {
+  assert(state_v);
 
-  return NULL_ERROR;
+  return parallel_inflate(io_state, &((State *)state_v)->codec.options,
+                          num_threads, maybe_numa, num_chunks, finished);
 }
 
-void cleanup(AppIOState *io_state, void *stream_v) {
-  assert(io_state);
-  assert(stream_v);
+bool has_checksum(const FileAndMapping *input_file, void *state_v) {
+  assert(state_v);
+
+  return inflate_has_checksum(input_file, &((State *)state_v)->codec);
+}
 
-  (void)io_state;
+size_t window_size(const FileAndMapping *input_file, void *state_v) {
+  assert(state_v);
 
-  z_stream *const stream = (z_stream *)stream_v;
-  inflateEnd(stream);
+  return inflate_window_size(input_file, &((State *)state_v)->codec);
 }
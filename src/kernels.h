@@ -0,0 +1,57 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_INTERNAL_KERNELS_H
+#define COMMON_INTERNAL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// each x86 instruction set's kernels are in their own translation unit,
+// compiled with flags for that set alone, so that nothing else can pick up
+// instructions the CPU might not have. cpu_level() decides which are called
+
+// see RFC 1950 section 2.2
+#define ADLER32_BASE 65521u
+// most bytes that can be summed before s2 might overflow 32 bits, see zlib's
+// adler32.c
+#define ADLER32_NMAX 5552
+
+#ifdef MMC_HAVE_X86_KERNELS
+// CPU_LEVEL_AVX2, in kernels_avx2.c
+
+uint32_t avx2_adler32(uint32_t adler, const unsigned char *data, size_t size);
+// takes the CRC-32 without its final inversion and a multiple of 16 bytes, at
+// least 64
+uint32_t pclmul_crc32_blocks(uint32_t crc, const unsigned char *data,
+                             size_t size);
+// the whole CRC-32C, inversions included
+uint32_t sse42_crc32c(uint32_t crc, const unsigned char *data, size_t size);
+
+// CPU_LEVEL_AVX512, in kernels_avx512.c
+
+uint32_t avx512_adler32(uint32_t adler, const unsigned char *data,
+                        size_t size);
+// as pclmul_crc32_blocks, but at least 256 bytes
+uint32_t vpclmul_crc32_blocks(uint32_t crc, const unsigned char *data,
+                              size_t size);
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "kernels.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+// 32 bytes at a time: s1 gains their sum and s2 gains 32 times s1 before
+// them plus each byte weighted by its distance from the end, as in
+// Chromium's adler32_simd.c
+uint32_t avx2_adler32(uint32_t adler, const unsigned char *data, size_t size) {
+  static const size_t BLOCK_SIZE = 32;
+
+  uint32_t s1 = adler & 0xffff;
+  uint32_t s2 = adler >> 16;
+
+  const __m256i weights = _mm256_setr_epi8(
+      32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15,
+      14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i zero = _mm256_setzero_si256();
+
+  while (size >= BLOCK_SIZE) {
+    const size_t num_blocks =
+        MIN(size, (size_t)ADLER32_NMAX / BLOCK_SIZE * BLOCK_SIZE) /
+        BLOCK_SIZE;
+
+    // s1 before each block, summed
+    __m256i prefix_sums = zero;
+    __m256i sums = zero;
+    __m256i weighted_sums = zero;
+
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const __m256i bytes = _mm256_loadu_si256((const __m256i *)data);
+
+      prefix_sums = _mm256_add_epi32(prefix_sums, sums);
+      sums = _mm256_add_epi32(sums, _mm256_sad_epu8(bytes, zero));
+      weighted_sums = _mm256_add_epi32(
+          weighted_sums,
+          _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+
+      data += BLOCK_SIZE;
+    }
+
+    size -= num_blocks * BLOCK_SIZE;
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes,
+                        _mm256_add_epi32(_mm256_slli_epi32(prefix_sums, 5),
+                                         weighted_sums));
+    uint32_t weighted_sum = 0;
+
+    for (size_t i = 0; i < 8; ++i) {
+      weighted_sum += lanes[i];
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, sums);
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < 8; ++i) {
+      sum += lanes[i];
+    }
+
+    s2 = (s2 + s1 * (uint32_t)(num_blocks * BLOCK_SIZE) + weighted_sum) %
+         ADLER32_BASE;
+    s1 = (s1 + sum) % ADLER32_BASE;
+  }
+
+  // fewer than 32 bytes are left
+  for (; size > 0; --size, ++data) {
+    s1 += *data;
+    s2 += s1;
+  }
+
+  return (s2 % ADLER32_BASE) << 16 | (s1 % ADLER32_BASE);
+}
+
+// folds four 128-bit lanes of the message at once with carry-less multiplies,
+// then reduces them to 32 bits, as in Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction" and Chromium's
+// crc32_simd.c
+uint32_t pclmul_crc32_blocks(uint32_t crc, const unsigned char *data,
+                             size_t size) {
+  assert(size >= 64 && size % 16 == 0);
+
+  // x^(4*128+32) and x^(4*128-32) mod P, x^(128+32) and x^(128-32) mod P,
+  // x^64 mod P, then P and mu for the Barrett reduction, all bit-reflected
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i low_words = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+  __m128i x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+  __m128i x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+  __m128i x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+  data += 64;
+  size -= 64;
+
+  for (; size >= 64; data += 64, size -= 64) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i *)(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                       _mm_loadu_si128((const __m128i *)(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                       _mm_loadu_si128((const __m128i *)(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                       _mm_loadu_si128((const __m128i *)(data + 0x30)));
+  }
+
+  // fold the four lanes into one, then the rest of the message into it
+  const __m128i lanes[3] = {x2, x3, x4};
+
+  for (size_t i = 0; i < 3; ++i) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+  }
+
+  for (; size >= 16; data += 16, size -= 16) {
+    const __m128i next = _mm_loadu_si128((const __m128i *)data);
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+  }
+
+  // 128 bits to 64
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, low_words);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x2 = _mm_and_si128(x1, low_words);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, low_words);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+// eight bytes per crc32 instruction, the rest one at a time
+uint32_t sse42_crc32c(uint32_t crc, const unsigned char *data, size_t size) {
+  uint64_t crc64 = ~crc;
+
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+
+  crc = (uint32_t)crc64;
+
+  for (; size > 0; ++data, --size) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+
+  return ~crc;
+}
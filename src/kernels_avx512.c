@@ -0,0 +1,170 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "kernels.h"
+
+#include <assert.h>
+
+#include <immintrin.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+// avx2_adler32 with 64-byte blocks
+uint32_t avx512_adler32(uint32_t adler, const unsigned char *data,
+                        size_t size) {
+  static const size_t BLOCK_SIZE = 64;
+
+  uint32_t s1 = adler & 0xffff;
+  uint32_t s2 = adler >> 16;
+
+  const __m512i weights = _mm512_set_epi8(
+      1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+      22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+      40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57,
+      58, 59, 60, 61, 62, 63, 64);
+  const __m512i ones = _mm512_set1_epi16(1);
+  const __m512i zero = _mm512_setzero_si512();
+
+  while (size >= BLOCK_SIZE) {
+    const size_t num_blocks =
+        MIN(size, (size_t)ADLER32_NMAX / BLOCK_SIZE * BLOCK_SIZE) /
+        BLOCK_SIZE;
+
+    // s1 before each block, summed
+    __m512i prefix_sums = zero;
+    __m512i sums = zero;
+    __m512i weighted_sums = zero;
+
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const __m512i bytes = _mm512_loadu_si512((const void *)data);
+
+      prefix_sums = _mm512_add_epi32(prefix_sums, sums);
+      sums = _mm512_add_epi32(sums, _mm512_sad_epu8(bytes, zero));
+      weighted_sums = _mm512_add_epi32(
+          weighted_sums,
+          _mm512_madd_epi16(_mm512_maddubs_epi16(bytes, weights), ones));
+
+      data += BLOCK_SIZE;
+    }
+
+    size -= num_blocks * BLOCK_SIZE;
+
+    const uint32_t weighted_sum = (uint32_t)_mm512_reduce_add_epi32(
+        _mm512_add_epi32(_mm512_slli_epi32(prefix_sums, 6), weighted_sums));
+    const uint32_t sum = (uint32_t)_mm512_reduce_add_epi32(sums);
+
+    s2 = (s2 + s1 * (uint32_t)(num_blocks * BLOCK_SIZE) + weighted_sum) %
+         ADLER32_BASE;
+    s1 = (s1 + sum) % ADLER32_BASE;
+  }
+
+  // fewer than 64 bytes are left
+  for (; size > 0; --size, ++data) {
+    s1 += *data;
+    s2 += s1;
+  }
+
+  return (s2 % ADLER32_BASE) << 16 | (s1 % ADLER32_BASE);
+}
+
+// x ^ y ^ z in one instruction
+static __m512i xor3(__m512i x, __m512i y, __m512i z) {
+  return _mm512_ternarylogic_epi64(x, y, z, 0x96);
+}
+
+// each 128-bit lane of x moved forward by the distance that constants were
+// made for, then added to next
+static __m512i fold(__m512i x, __m512i constants, __m512i next) {
+  return xor3(_mm512_clmulepi64_epi128(x, constants, 0x00),
+              _mm512_clmulepi64_epi128(x, constants, 0x11), next);
+}
+
+static __m128i fold_128(__m128i x, __m128i constants, __m128i next) {
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, constants, 0x00),
+                                     _mm_clmulepi64_si128(x, constants, 0x11)),
+                       next);
+}
+
+// pclmul_crc32_blocks with sixteen 128-bit lanes in four ZMM registers, so
+// each iteration folds 256 bytes
+uint32_t vpclmul_crc32_blocks(uint32_t crc, const unsigned char *data,
+                              size_t size) {
+  assert(size >= 256 && size % 16 == 0);
+
+  // x^(16*128+32) and x^(16*128-32) mod P, then the same for 4*128, all
+  // bit-reflected. the rest are as in pclmul_crc32_blocks
+  const __m512i k16 =
+      _mm512_broadcast_i32x4(_mm_set_epi64x(0x01322d1430, 0x011542778a));
+  const __m512i k4 =
+      _mm512_broadcast_i32x4(_mm_set_epi64x(0x01c6e41596, 0x0154442bd4));
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i low_words = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m512i x1 = _mm512_loadu_si512((const void *)(data + 0x00));
+  __m512i x2 = _mm512_loadu_si512((const void *)(data + 0x40));
+  __m512i x3 = _mm512_loadu_si512((const void *)(data + 0x80));
+  __m512i x4 = _mm512_loadu_si512((const void *)(data + 0xc0));
+  x1 = _mm512_xor_si512(x1, _mm512_castsi128_si512(
+                                _mm_cvtsi32_si128((int)crc)));
+
+  data += 256;
+  size -= 256;
+
+  for (; size >= 256; data += 256, size -= 256) {
+    x1 = fold(x1, k16, _mm512_loadu_si512((const void *)(data + 0x00)));
+    x2 = fold(x2, k16, _mm512_loadu_si512((const void *)(data + 0x40)));
+    x3 = fold(x3, k16, _mm512_loadu_si512((const void *)(data + 0x80)));
+    x4 = fold(x4, k16, _mm512_loadu_si512((const void *)(data + 0xc0)));
+  }
+
+  // four registers into one, then its four lanes into one
+  x1 = fold(x1, k4, x2);
+  x1 = fold(x1, k4, x3);
+  x1 = fold(x1, k4, x4);
+
+  __m128i y1 = _mm512_castsi512_si128(x1);
+  y1 = fold_128(y1, k3k4, _mm512_extracti32x4_epi32(x1, 1));
+  y1 = fold_128(y1, k3k4, _mm512_extracti32x4_epi32(x1, 2));
+  y1 = fold_128(y1, k3k4, _mm512_extracti32x4_epi32(x1, 3));
+
+  for (; size >= 16; data += 16, size -= 16) {
+    y1 = fold_128(y1, k3k4, _mm_loadu_si128((const __m128i *)data));
+  }
+
+  // 128 bits to 64
+  __m128i y2 = _mm_clmulepi64_si128(y1, k3k4, 0x10);
+  y1 = _mm_xor_si128(_mm_srli_si128(y1, 8), y2);
+
+  y2 = _mm_srli_si128(y1, 4);
+  y1 = _mm_and_si128(y1, low_words);
+  y1 = _mm_clmulepi64_si128(y1, k5k0, 0x00);
+  y1 = _mm_xor_si128(y1, y2);
+
+  // Barrett reduction to 32 bits
+  y2 = _mm_and_si128(y1, low_words);
+  y2 = _mm_clmulepi64_si128(y2, poly, 0x10);
+  y2 = _mm_and_si128(y2, low_words);
+  y2 = _mm_clmulepi64_si128(y2, poly, 0x00);
+  y1 = _mm_xor_si128(y1, y2);
+
+  return (uint32_t)_mm_extract_epi32(y1, 1);
+}
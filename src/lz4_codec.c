@@ -0,0 +1,362 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/lz4_codec.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+size_t lz4_compress_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+
+  state->preferences.frameInfo.contentSize =
+      (unsigned long long)input_file->file_size;
+
+  return LZ4F_compressFrameBound(input_file->file_size, &state->preferences);
+}
+
+static size_t estimate_compress_memory(const LZ4F_preferences_t *preferences);
+
+CodecMemoryPlan lz4_compress_fit_memory(const FileAndMapping *input_file,
+                                        size_t budget, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)input_file;
+
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+  LZ4F_frameInfo_t *const frame_info = &state->preferences.frameInfo;
+
+  if (frame_info->blockSizeID == LZ4F_default) {
+    frame_info->blockSizeID = LZ4F_max64KB;
+  }
+
+  size_t size = estimate_compress_memory(&state->preferences);
+
+  // the hash tables are a fixed size, so only the block buffer can shrink
+  while (size > budget && frame_info->blockSizeID > LZ4F_max64KB) {
+    frame_info->blockSizeID = (LZ4F_blockSizeID_t)(frame_info->blockSizeID - 1);
+    size = estimate_compress_memory(&state->preferences);
+  }
+
+  CodecMemoryPlan plan = {.size = size};
+  snprintf(plan.parameters, sizeof(plan.parameters), "block_size=%zu",
+           (size_t)1 << (8 + 2 * frame_info->blockSizeID));
+
+  return plan;
+}
+
+Error lz4_compress_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+
+  state->has_begun = false;
+
+  const LZ4F_errorCode_t errc =
+      LZ4F_createCompressionContext(&state->context, LZ4F_VERSION);
+
+  if (LZ4F_isError(errc)) {
+    const char *const what = LZ4F_getErrorName(errc);
+
+    return eformat("couldn't initialize compression context: %s (%zu)", what,
+                   errc);
+  }
+
+  return NULL_ERROR;
+}
+
+static Error compress_error(const AppIOState *io_state, size_t errc) {
+  const char *const what = LZ4F_getErrorName(errc);
+
+  return eformat("couldn't compress input file '%s': %s (%zu)",
+                 io_state->input_file.filename, what, errc);
+}
+
+// the same as LZ4F_compressFrame, but the context and its hash tables survive
+// between frames and partial input can be fed in over several calls
+Error lz4_compress_run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+
+  assert(state->context);
+
+  char *const output = (char *)io_state->output_file.mapping;
+  const size_t output_size = io_state->output_file.mapping_size;
+  const size_t output_start = io_state->output_mapping_first_unused_offset;
+  size_t output_offset = output_start;
+
+  if (!state->has_begun) {
+    // LZ4F_compressFrameBound assumes that nothing is left buffered
+    LZ4F_preferences_t preferences = state->preferences;
+    preferences.autoFlush = 1;
+
+    if (io_state->input_is_partial) {
+      preferences.frameInfo.contentSize = 0;
+    }
+
+    const size_t header_size_or_error =
+        LZ4F_compressBegin(state->context, output + output_offset,
+                           output_size - output_offset, &preferences);
+
+    if (LZ4F_isError(header_size_or_error)) {
+      return compress_error(io_state, header_size_or_error);
+    }
+
+    output_offset += header_size_or_error;
+    state->has_begun = true;
+  }
+
+  const size_t input_offset = io_state->input_mapping_first_unused_offset;
+  const size_t input_size = io_state->input_file.mapping_size;
+  // a multiple of every block size, so slicing never adds a block
+  const size_t slice_size = (input_size - input_offset < CODEC_SLICE_SIZE)
+                                ? input_size - input_offset
+                                : CODEC_SLICE_SIZE;
+
+  if (slice_size > 0) {
+    const size_t body_size_or_error = LZ4F_compressUpdate(
+        state->context, output + output_offset, output_size - output_offset,
+        (const char *)io_state->input_file.mapping + input_offset, slice_size,
+        NULL);
+
+    if (LZ4F_isError(body_size_or_error)) {
+      return compress_error(io_state, body_size_or_error);
+    }
+
+    output_offset += body_size_or_error;
+    io_state->input_mapping_first_unused_offset += slice_size;
+  }
+
+  const bool is_last =
+      !io_state->input_is_partial &&
+      io_state->input_mapping_first_unused_offset == input_size;
+
+  if (is_last) {
+    const size_t footer_size_or_error =
+        LZ4F_compressEnd(state->context, output + output_offset,
+                         output_size - output_offset, NULL);
+
+    if (LZ4F_isError(footer_size_or_error)) {
+      return compress_error(io_state, footer_size_or_error);
+    }
+
+    output_offset += footer_size_or_error;
+    state->has_begun = false;
+  }
+
+  io_state->output_mapping_first_unused_offset = output_offset;
+  io_state->output_bytes_written += output_offset - output_start;
+
+  *finished = is_last;
+
+  return NULL_ERROR;
+}
+
+Error lz4_compress_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  // LZ4F_compressBegin starts every frame from a clean slate
+  ((Lz4CompressState *)state_v)->has_begun = false;
+
+  return NULL_ERROR;
+}
+
+void lz4_compress_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+
+  LZ4F_freeCompressionContext(state->context);
+}
+
+size_t lz4_decompress_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  return input_file->file_size;
+}
+
+Error lz4_decompress_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  Lz4DecompressState *const state = (Lz4DecompressState *)state_v;
+
+  const LZ4F_errorCode_t errc =
+      LZ4F_createDecompressionContext(&state->context, LZ4F_VERSION);
+
+  if (LZ4F_isError(errc)) {
+    const char *const what = LZ4F_getErrorName(errc);
+
+    return eformat("couldn't initialize decompression context: %s (%zu)", what,
+                   errc);
+  }
+
+  return NULL_ERROR;
+}
+
+Error lz4_decompress_run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  Lz4DecompressState *const state = (Lz4DecompressState *)state_v;
+
+  size_t input_unused_length_or_bytes_consumed =
+      io_state->input_file.mapping_size -
+      io_state->input_mapping_first_unused_offset;
+  size_t output_unused_length_or_bytes_consumed =
+      io_state->output_file.mapping_size -
+      io_state->output_mapping_first_unused_offset;
+  const size_t maybe_decompress_errc =
+      LZ4F_decompress(state->context,
+                      (char *)io_state->output_file.mapping +
+                          io_state->output_mapping_first_unused_offset,
+                      &output_unused_length_or_bytes_consumed,
+                      (const char *)io_state->input_file.mapping +
+                          io_state->input_mapping_first_unused_offset,
+                      &input_unused_length_or_bytes_consumed, NULL);
+
+  if (LZ4F_isError(maybe_decompress_errc)) {
+    const char *const what = LZ4F_getErrorName(maybe_decompress_errc);
+
+    return eformat("couldn't decompress stream: %s (%zu)", what,
+                   maybe_decompress_errc);
+  }
+
+  io_state->input_mapping_first_unused_offset +=
+      input_unused_length_or_bytes_consumed;
+  io_state->output_mapping_first_unused_offset +=
+      output_unused_length_or_bytes_consumed;
+  io_state->output_bytes_written += output_unused_length_or_bytes_consumed;
+
+  // unless the frame is complete, a full output mapping may mean that decoded
+  // data is still buffered
+  *finished = io_state->input_mapping_first_unused_offset ==
+                  io_state->input_file.mapping_size &&
+              (maybe_decompress_errc == 0 ||
+               io_state->output_mapping_first_unused_offset <
+                   io_state->output_file.mapping_size);
+
+  return NULL_ERROR;
+}
+
+Error lz4_decompress_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  Lz4DecompressState *const state = (Lz4DecompressState *)state_v;
+
+#if LZ4_VERSION_NUMBER >= 10803
+  (void)io_state;
+
+  LZ4F_resetDecompressionContext(state->context);
+
+  return NULL_ERROR;
+#else
+  LZ4F_freeDecompressionContext(state->context);
+
+  return lz4_decompress_init(io_state, state_v);
+#endif
+}
+
+void lz4_decompress_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  Lz4DecompressState *const state = (Lz4DecompressState *)state_v;
+
+  LZ4F_freeDecompressionContext(state->context);
+}
+
+// only the first frame is checked
+bool lz4_decompress_has_checksum(const FileAndMapping *input_file,
+                                 void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  static const unsigned long FRAME_MAGIC = 0x184d2204;
+  static const unsigned CONTENT_CHECKSUM_FLAG = 1 << 2;
+
+  if (input_file->mapping_size < 5) {
+    return false;
+  }
+
+  const unsigned char *const header =
+      (const unsigned char *)input_file->mapping;
+  const unsigned long magic =
+      (unsigned long)header[0] | (unsigned long)header[1] << 8 |
+      (unsigned long)header[2] << 16 | (unsigned long)header[3] << 24;
+
+  return magic == FRAME_MAGIC && (header[4] & CONTENT_CHECKSUM_FLAG);
+}
+
+size_t lz4_decompress_window_size(const FileAndMapping *input_file,
+                                  void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)input_file;
+  (void)state_v;
+
+  // the furthest back that a match can refer, even across linked blocks
+  return (size_t)64 << 10;
+}
+
+static size_t estimate_compress_memory(const LZ4F_preferences_t *preferences) {
+  assert(preferences);
+
+  // LZ4F_max64KB through LZ4F_max4MB are 4 through 7, and 0 is the default
+  const int block_size_id = (preferences->frameInfo.blockSizeID == 0)
+                                ? LZ4F_max64KB
+                                : preferences->frameInfo.blockSizeID;
+  const size_t block_size = (size_t)1 << (8 + 2 * block_size_id);
+  const size_t state_size = (preferences->compressionLevel >= LZ4HC_CLEVEL_MIN)
+                                ? sizeof(LZ4_streamHC_t)
+                                : sizeof(LZ4_stream_t);
+
+  // a block of buffered input and the 64KiB of history kept between calls
+  return block_size + ((size_t)64 << 10) + state_size;
+}
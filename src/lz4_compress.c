@@ -21,6 +21,7 @@
 #include <common/app.h>
 #include <common/argparse.h>
 #include <common/error.h>
+#include <common/lz4_codec.h>
 #include <common/mmc.h>
 
 #include <assert.h>
@@ -43,11 +44,18 @@ typedef struct State {
   IntegerArgumentParser level_parser;
   KeywordArgument level;
 
-  LZ4F_preferences_t preferences;
+  KeywordArgument checksum;
+
+  Lz4CompressState codec;
 } State;
 
-size_t size(size_t input_file_size, void *state_v);
+size_t size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v);
+Error chunk_codec(AppChunkCodec *codec, void *state_v);
+Error init(AppIOState *io_state, void *state_v);
 Error run(AppIOState *io_state, bool *finished, void *state_v);
+void cleanup(AppIOState *io_state, void *state_v);
 
 static const char *const BLOCK_MODE_VALUES[] = {"linked", "independent"};
 static const LZ4F_blockMode_t BLOCK_MODE_MAPPING[] = {LZ4F_blockLinked,
@@ -112,12 +120,19 @@ int main(int argc, const char *const argv[]) {
                 .help_text = level_help_text,
                 .parser = &state.level_parser.argument_parser},
 
-      .preferences = LZ4F_INIT_PREFERENCES,
+      .checksum = {.short_name = 'c',
+                   .long_name = "checksum",
+                   .help_text = "Append an xxHash-32 checksum of the "
+                                "uncompressed contents to the frame, which "
+                                "decompressors verify.",
+                   .parser = NULL},
+
+      .codec = {.preferences = LZ4F_INIT_PREFERENCES, .context = NULL},
   };
 
-  KeywordArgument *keyword_args[] = {&state.block_mode, &state.block_size,
-                                     &state.favor_decompression_speed,
-                                     &state.level};
+  KeywordArgument *keyword_args[] = {
+      &state.block_mode, &state.block_size, &state.favor_decompression_speed,
+      &state.level, &state.checksum};
 
   return run_compression_app(
       argc, argv,
@@ -134,66 +149,86 @@ int main(int argc, const char *const argv[]) {
           .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
 
           .size = size,
+          .init = init,
           .run = run,
+          .cleanup = cleanup,
+          .fit_memory = fit_memory,
+          .chunk_codec = chunk_codec,
           .arg = &state,
       });
 }
 
-size_t size(size_t input_file_size, void *state_v) {
+size_t size(const FileAndMapping *input_file, void *state_v) {
   assert(state_v);
 
   State *const state = (State *)state_v;
+  LZ4F_preferences_t *const preferences = &state->codec.preferences;
 
   if (state->favor_decompression_speed.was_found) {
-    state->preferences.favorDecSpeed = 1;
+    preferences->favorDecSpeed = 1;
   }
 
   if (state->level.was_found) {
-    state->preferences.compressionLevel = (int)state->level_parser.value;
+    preferences->compressionLevel = (int)state->level_parser.value;
   }
 
   if (state->block_mode.was_found) {
-    state->preferences.frameInfo.blockMode =
+    preferences->frameInfo.blockMode =
         BLOCK_MODE_MAPPING[state->block_mode_parser.value_index];
   }
 
   if (state->block_size.was_found) {
-    state->preferences.frameInfo.blockSizeID =
+    preferences->frameInfo.blockSizeID =
         BLOCK_SIZE_MAPPING[state->block_size_parser.value_index];
   }
 
-  state->preferences.frameInfo.contentSize =
-      (unsigned long long)input_file_size;
+  if (state->checksum.was_found) {
+    preferences->frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  }
 
-  return LZ4F_compressFrameBound(input_file_size, &state->preferences);
+  return lz4_compress_size(input_file, &state->codec);
 }
 
-Error run(AppIOState *io_state, bool *finished, void *state_v) {
-  assert(io_state);
-  assert(finished);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v) {
+  assert(state_v);
+
+  return lz4_compress_fit_memory(input_file, budget,
+                                 &((State *)state_v)->codec);
+}
+
+Error chunk_codec(AppChunkCodec *codec, void *state_v) {
+  assert(codec);
   assert(state_v);
 
   State *const state = (State *)state_v;
 
-  const size_t output_final_size_or_error = LZ4F_compressFrame(
-      io_state->output_file.mapping, io_state->output_file.mapping_size,
-      io_state->input_file.mapping, io_state->input_file.mapping_size,
-      &state->preferences);
+  // concatenated frames are decompressed one after another
+  *codec = (AppChunkCodec){.state = &state->codec,
+                           .state_size = sizeof(Lz4CompressState),
+                           .size = lz4_compress_size,
+                           .init = lz4_compress_init,
+                           .run = lz4_compress_run,
+                           .reset = lz4_compress_reset,
+                           .cleanup = lz4_compress_cleanup};
+
+  return NULL_ERROR;
+}
+
+Error init(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-  if (LZ4F_isError(output_final_size_or_error)) {
-    const char *const what = LZ4F_getErrorName(output_final_size_or_error);
+  return lz4_compress_init(io_state, &((State *)state_v)->codec);
+}
 
-    return eformat("couldn't compress input file '%s': %s (%zu)",
-                   io_state->input_file.filename, what,
-                   output_final_size_or_error);
-  }
+Error run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(state_v);
 
-  io_state->input_mapping_first_unused_offset =
-      io_state->input_file.mapping_size;
-  io_state->output_mapping_first_unused_offset = output_final_size_or_error;
-  io_state->output_bytes_written = output_final_size_or_error;
+  return lz4_compress_run(io_state, finished, &((State *)state_v)->codec);
+}
 
-  *finished = true;
+void cleanup(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-  return NULL_ERROR;
+  lz4_compress_cleanup(io_state, &((State *)state_v)->codec);
 }
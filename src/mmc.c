@@ -0,0 +1,731 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <mmc/mmc.h>
+
+#ifdef MMC_HAVE_ZLIB
+#include <common/zlib_codec.h>
+#endif
+
+#ifdef MMC_HAVE_LZ4
+#include <common/lz4_codec.h>
+
+#include <lz4hc.h>
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+#include <common/zstd_codec.h>
+#endif
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct MmcContext {
+  const MmcCodec *codec;
+  void *state;
+  // init has run and cleanup has not, so the next transform can reset
+  bool is_initialized;
+
+  // the key that a pool matches on
+  MmcOptions options;
+  MmcDirection direction;
+  MmcContext *next_idle;
+};
+
+struct MmcContextPool {
+  pthread_mutex_t mutex;
+
+  // most recently released first, so the warmest context is reused
+  MmcContext *idle;
+  size_t num_idle;
+  size_t max_idle;
+};
+
+const char *const MMC_CODEC_NAMES[NUM_MMC_CODECS] = {"zlib", "gzip", "raw",
+                                                     "lz4", "zstd"};
+
+#ifdef MMC_HAVE_ZLIB
+static ZlibFormat zlib_format(MmcCodecId codec) {
+  switch (codec) {
+  case MMC_CODEC_GZIP:
+    return ZLIB_FORMAT_GZIP;
+  case MMC_CODEC_RAW_DEFLATE:
+    return ZLIB_FORMAT_RAW;
+  default:
+    return ZLIB_FORMAT_ZLIB;
+  }
+}
+
+static void configure_deflate(void *state_v, const MmcOptions *options) {
+  DeflateState *const state = (DeflateState *)state_v;
+
+  state->options = make_deflate_options();
+  state->options.format = zlib_format(options->codec);
+
+  if (options->level != 0) {
+    state->options.level = options->level;
+  }
+}
+
+static void configure_inflate(void *state_v, const MmcOptions *options) {
+  InflateState *const state = (InflateState *)state_v;
+
+  state->options = make_inflate_options();
+  state->options.format = zlib_format(options->codec);
+}
+
+#define DEFLATE_CODEC(NAME)                                                    \
+  {                                                                            \
+    .name = (NAME), .state_size = sizeof(DeflateState),                        \
+    .configure = configure_deflate, .size = deflate_size,                      \
+    .init = deflate_init, .run = deflate_run, .reset = deflate_reset,          \
+    .cleanup = deflate_cleanup,                                                \
+  }
+#define INFLATE_CODEC(NAME)                                                    \
+  {                                                                            \
+    .name = (NAME), .state_size = sizeof(InflateState),                        \
+    .configure = configure_inflate, .size = inflate_size,                      \
+    .init = inflate_init, .run = inflate_run, .reset = inflate_reset,          \
+    .cleanup = inflate_cleanup,                                                \
+  }
+
+static const MmcCodec ZLIB_CODECS[][2] = {
+    {DEFLATE_CODEC("zlib"), INFLATE_CODEC("zlib")},
+    {DEFLATE_CODEC("gzip"), INFLATE_CODEC("gzip")},
+    {DEFLATE_CODEC("raw"), INFLATE_CODEC("raw")},
+};
+#endif
+
+#ifdef MMC_HAVE_LZ4
+static void configure_lz4_compress(void *state_v, const MmcOptions *options) {
+  Lz4CompressState *const state = (Lz4CompressState *)state_v;
+
+  state->preferences = (LZ4F_preferences_t)LZ4F_INIT_PREFERENCES;
+  state->preferences.compressionLevel = options->level;
+  state->context = NULL;
+}
+
+static void configure_lz4_decompress(void *state_v,
+                                     const MmcOptions *options) {
+  (void)options;
+
+  ((Lz4DecompressState *)state_v)->context = NULL;
+}
+
+static const MmcCodec LZ4_CODECS[2] = {
+    {.name = "lz4",
+     .state_size = sizeof(Lz4CompressState),
+     .configure = configure_lz4_compress,
+     .size = lz4_compress_size,
+     .init = lz4_compress_init,
+     .run = lz4_compress_run,
+     .reset = lz4_compress_reset,
+     .cleanup = lz4_compress_cleanup},
+    {.name = "lz4",
+     .state_size = sizeof(Lz4DecompressState),
+     .configure = configure_lz4_decompress,
+     .size = lz4_decompress_size,
+     .init = lz4_decompress_init,
+     .run = lz4_decompress_run,
+     .reset = lz4_decompress_reset,
+     .cleanup = lz4_decompress_cleanup},
+};
+#endif
+
+#ifdef MMC_HAVE_ZSTD
+static void configure_zstd_compress(void *state_v, const MmcOptions *options) {
+  ZstdCompressState *const state = (ZstdCompressState *)state_v;
+
+  state->options =
+      (ZstdCompressOptions){.level = options->level, .strategy = 0};
+  state->context = NULL;
+}
+
+static void configure_zstd_decompress(void *state_v,
+                                      const MmcOptions *options) {
+  (void)options;
+
+  ((ZstdDecompressState *)state_v)->stream = NULL;
+}
+
+static const MmcCodec ZSTD_CODECS[2] = {
+    {.name = "zstd",
+     .state_size = sizeof(ZstdCompressState),
+     .configure = configure_zstd_compress,
+     .size = zstd_compress_size,
+     .init = zstd_compress_init,
+     .run = zstd_compress_run,
+     .reset = zstd_compress_reset,
+     .cleanup = zstd_compress_cleanup},
+    {.name = "zstd",
+     .state_size = sizeof(ZstdDecompressState),
+     .configure = configure_zstd_decompress,
+     .size = zstd_decompress_size,
+     .init = zstd_decompress_init,
+     .run = zstd_decompress_run,
+     .reset = zstd_decompress_reset,
+     .cleanup = zstd_decompress_cleanup},
+};
+#endif
+
+MmcOptions mmc_make_options(MmcCodecId codec) {
+  assert(codec < NUM_MMC_CODECS);
+
+  return (MmcOptions){.codec = codec, .level = 0};
+}
+
+const MmcCodec *mmc_get_codec(MmcCodecId codec, MmcDirection direction) {
+  assert(codec < NUM_MMC_CODECS);
+  assert(direction == MMC_DIRECTION_COMPRESS ||
+         direction == MMC_DIRECTION_DECOMPRESS);
+
+  switch (codec) {
+#ifdef MMC_HAVE_ZLIB
+  case MMC_CODEC_ZLIB:
+  case MMC_CODEC_GZIP:
+  case MMC_CODEC_RAW_DEFLATE:
+    return &ZLIB_CODECS[codec - MMC_CODEC_ZLIB][direction];
+#endif
+#ifdef MMC_HAVE_LZ4
+  case MMC_CODEC_LZ4:
+    return &LZ4_CODECS[direction];
+#endif
+#ifdef MMC_HAVE_ZSTD
+  case MMC_CODEC_ZSTD:
+    return &ZSTD_CODECS[direction];
+#endif
+  default:
+    return NULL;
+  }
+}
+
+Error mmc_check_options(const MmcOptions *options) {
+  assert(options);
+  assert(options->codec < NUM_MMC_CODECS);
+
+  long long min_level;
+  long long max_level;
+
+  switch (options->codec) {
+#ifdef MMC_HAVE_ZLIB
+  case MMC_CODEC_ZLIB:
+  case MMC_CODEC_GZIP:
+  case MMC_CODEC_RAW_DEFLATE:
+    min_level = Z_NO_COMPRESSION;
+    max_level = Z_BEST_COMPRESSION;
+
+    break;
+#endif
+#ifdef MMC_HAVE_LZ4
+  case MMC_CODEC_LZ4:
+    min_level = INT_MIN;
+    max_level = LZ4HC_CLEVEL_MAX;
+
+    break;
+#endif
+#ifdef MMC_HAVE_ZSTD
+  case MMC_CODEC_ZSTD:
+    min_level = ZSTD_minCLevel();
+    max_level = ZSTD_maxCLevel();
+
+    break;
+#endif
+  default:
+    return eformat("mmc was built without support for codec '%s'",
+                   MMC_CODEC_NAMES[options->codec]);
+  }
+
+  // 0 always selects the default
+  if (options->level != 0 &&
+      (options->level < min_level || options->level > max_level)) {
+    return eformat("level %d is out of range for codec '%s' ([%lld, %lld])",
+                   options->level, MMC_CODEC_NAMES[options->codec], min_level,
+                   max_level);
+  }
+
+  return NULL_ERROR;
+}
+
+Error mmc_create_context(const MmcOptions *options, MmcDirection direction,
+                         MmcContext **context) {
+  assert(options);
+  assert(context);
+
+  Error error = mmc_check_options(options);
+
+  if (error.what) {
+    return error;
+  }
+
+  const MmcCodec *const codec = mmc_get_codec(options->codec, direction);
+  assert(codec);
+
+  MmcContext *const new_context = malloc(sizeof(MmcContext));
+
+  if (!new_context) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  new_context->codec = codec;
+  new_context->is_initialized = false;
+  new_context->options = *options;
+  new_context->direction = direction;
+  new_context->next_idle = NULL;
+  new_context->state = malloc(codec->state_size);
+
+  if (!new_context->state) {
+    free(new_context);
+
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  codec->configure(new_context->state, options);
+  *context = new_context;
+
+  return NULL_ERROR;
+}
+
+static void cleanup_codec(MmcContext *context);
+
+void mmc_free_context(MmcContext *context) {
+  if (!context) {
+    return;
+  }
+
+  cleanup_codec(context);
+  free(context->state);
+  free(context);
+}
+
+Error mmc_create_context_pool(size_t max_idle, MmcContextPool **pool) {
+  assert(pool);
+
+  MmcContextPool *const new_pool = malloc(sizeof(MmcContextPool));
+
+  if (!new_pool) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  const int errc = pthread_mutex_init(&new_pool->mutex, NULL);
+
+  if (errc != 0) {
+    free(new_pool);
+
+    return eformat("couldn't initialize context pool mutex: %s (%d)",
+                   strerror(errc), errc);
+  }
+
+  new_pool->idle = NULL;
+  new_pool->num_idle = 0;
+  new_pool->max_idle = max_idle;
+  *pool = new_pool;
+
+  return NULL_ERROR;
+}
+
+void mmc_free_context_pool(MmcContextPool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  MmcContext *next;
+
+  for (MmcContext *context = pool->idle; context; context = next) {
+    next = context->next_idle;
+    mmc_free_context(context);
+  }
+
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool);
+}
+
+static bool context_matches(const MmcContext *context,
+                            const MmcOptions *options,
+                            MmcDirection direction) {
+  if (context->options.codec != options->codec ||
+      context->direction != direction) {
+    return false;
+  }
+
+  // the level has no effect on decompression
+  return direction == MMC_DIRECTION_DECOMPRESS ||
+         context->options.level == options->level;
+}
+
+Error mmc_acquire_context(MmcContextPool *pool, const MmcOptions *options,
+                          MmcDirection direction, MmcContext **context) {
+  assert(pool);
+  assert(options);
+  assert(context);
+
+  MmcContext *found = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+
+  for (MmcContext **link = &pool->idle; *link; link = &(*link)->next_idle) {
+    if (context_matches(*link, options, direction)) {
+      found = *link;
+      *link = found->next_idle;
+      --pool->num_idle;
+
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (!found) {
+    return mmc_create_context(options, direction, context);
+  }
+
+  found->next_idle = NULL;
+  *context = found;
+
+  return NULL_ERROR;
+}
+
+void mmc_release_context(MmcContextPool *pool, MmcContext *context) {
+  assert(pool);
+
+  if (!context) {
+    return;
+  }
+
+  assert(!context->next_idle);
+
+  pthread_mutex_lock(&pool->mutex);
+
+  const bool is_kept = pool->num_idle < pool->max_idle;
+
+  if (is_kept) {
+    context->next_idle = pool->idle;
+    pool->idle = context;
+    ++pool->num_idle;
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (!is_kept) {
+    mmc_free_context(context);
+  }
+}
+
+static Error run_codec(MmcContext *context, AppIOState *io_state,
+                       bool unmap_consumed_pages);
+static Error transform_into_file(MmcContext *context, AppIOState *io_state,
+                                 const char *output_filename,
+                                 bool unmap_consumed_pages);
+
+Error mmc_transform_file(MmcContext *context, const char *input_filename,
+                         const char *output_filename) {
+  assert(context);
+  assert(input_filename);
+  assert(output_filename);
+
+  AppIOState io_state = {.input_mapping_first_unused_offset = 0,
+                         .output_mapping_first_unused_offset = 0,
+                         .output_bytes_written = 0};
+  Error error = open_and_map_file(input_filename, &io_state.input_file);
+
+  if (error.what) {
+    return error;
+  }
+
+  error = transform_into_file(context, &io_state, output_filename, true);
+  Error free_error = free_file(io_state.input_file);
+
+  if (!error.what) {
+    return free_error;
+  }
+
+  discard_error(free_error);
+
+  return error;
+}
+
+Error mmc_transform_buffer_to_file(MmcContext *context, const void *input,
+                                   size_t input_size,
+                                   const char *output_filename) {
+  assert(context);
+  assert(input);
+  assert(output_filename);
+
+  // codecs never write to their input, so the cast is harmless
+  AppIOState io_state = {
+      .input_file = {.filename = "input buffer",
+                     .fd = -1,
+                     .file_size = input_size,
+                     .mapping = (void *)input,
+                     .mapping_size = input_size,
+                     .mapping_offset = 0},
+      .input_mapping_first_unused_offset = 0,
+      .output_mapping_first_unused_offset = 0,
+      .output_bytes_written = 0,
+  };
+
+  // the buffer belongs to the caller, so none of its pages are unmapped
+  return transform_into_file(context, &io_state, output_filename, false);
+}
+
+Error mmc_transform_buffer(MmcContext *context, const void *input,
+                           size_t input_size, MmcBuffer *output) {
+  assert(context);
+  assert(input);
+  assert(output);
+
+  // codecs never write to their input, so the cast is harmless
+  AppIOState io_state = {
+      .input_file = {.filename = "input buffer",
+                     .fd = -1,
+                     .file_size = input_size,
+                     .mapping = (void *)input,
+                     .mapping_size = input_size,
+                     .mapping_offset = 0},
+      .input_mapping_first_unused_offset = 0,
+      .output_mapping_first_unused_offset = 0,
+      .output_bytes_written = 0,
+  };
+
+  const size_t output_size =
+      context->codec->size(&io_state.input_file, context->state);
+  Error error = create_anonymous_mapping("output buffer", output_size,
+                                         &io_state.output_file);
+
+  if (error.what) {
+    return error;
+  }
+
+  if ((error = run_codec(context, &io_state, false)), error.what) {
+    discard_error(free_file(io_state.output_file));
+
+    return error;
+  }
+
+  *output = (MmcBuffer){.data = io_state.output_file.mapping,
+                        .size = io_state.output_bytes_written,
+                        .mapping_size = io_state.output_file.mapping_size};
+
+  return NULL_ERROR;
+}
+
+Error mmc_free_buffer(MmcBuffer buffer) {
+  return free_file((FileAndMapping){.filename = "output buffer",
+                                    .fd = -1,
+                                    .file_size = buffer.mapping_size,
+                                    .mapping = buffer.data,
+                                    .mapping_size = buffer.mapping_size,
+                                    .mapping_offset = 0});
+}
+
+static Error transform_file_once(const char *input_filename,
+                                 const char *output_filename,
+                                 const MmcOptions *options,
+                                 MmcDirection direction);
+static Error transform_buffer_once(const void *input, size_t input_size,
+                                   MmcBuffer *output, const MmcOptions *options,
+                                   MmcDirection direction);
+
+Error mmc_compress_file(const char *input_filename,
+                        const char *output_filename,
+                        const MmcOptions *options) {
+  return transform_file_once(input_filename, output_filename, options,
+                             MMC_DIRECTION_COMPRESS);
+}
+
+Error mmc_decompress_file(const char *input_filename,
+                          const char *output_filename,
+                          const MmcOptions *options) {
+  return transform_file_once(input_filename, output_filename, options,
+                             MMC_DIRECTION_DECOMPRESS);
+}
+
+Error mmc_compress_buffer(const void *input, size_t input_size,
+                          MmcBuffer *output, const MmcOptions *options) {
+  return transform_buffer_once(input, input_size, output, options,
+                               MMC_DIRECTION_COMPRESS);
+}
+
+Error mmc_decompress_buffer(const void *input, size_t input_size,
+                            MmcBuffer *output, const MmcOptions *options) {
+  return transform_buffer_once(input, input_size, output, options,
+                               MMC_DIRECTION_DECOMPRESS);
+}
+
+static Error transform_file_once(const char *input_filename,
+                                 const char *output_filename,
+                                 const MmcOptions *options,
+                                 MmcDirection direction) {
+  MmcContext *context = NULL;
+  Error error = mmc_create_context(options, direction, &context);
+
+  if (error.what) {
+    return error;
+  }
+
+  error = mmc_transform_file(context, input_filename, output_filename);
+  mmc_free_context(context);
+
+  return error;
+}
+
+static Error transform_buffer_once(const void *input, size_t input_size,
+                                   MmcBuffer *output, const MmcOptions *options,
+                                   MmcDirection direction) {
+  MmcContext *context = NULL;
+  Error error = mmc_create_context(options, direction, &context);
+
+  if (error.what) {
+    return error;
+  }
+
+  error = mmc_transform_buffer(context, input, input_size, output);
+  mmc_free_context(context);
+
+  return error;
+}
+
+// creates the output file and truncates it to what the codec wrote, or removes
+// it if anything goes wrong
+static Error transform_into_file(MmcContext *context, AppIOState *io_state,
+                                 const char *output_filename,
+                                 bool unmap_consumed_pages) {
+  assert(context);
+  assert(io_state);
+  assert(output_filename);
+
+  const size_t output_file_size =
+      context->codec->size(&io_state->input_file, context->state);
+  Error error = create_and_map_file(output_filename, output_file_size,
+                                    &io_state->output_file);
+
+  if (error.what) {
+    return error;
+  }
+
+  error = run_codec(context, io_state, unmap_consumed_pages);
+
+  if (!error.what && ftruncate(io_state->output_file.fd,
+                               (off_t)io_state->output_bytes_written) == -1) {
+    error = ERRNO_EFORMAT("couldn't resize output file '%s'", output_filename);
+  }
+
+  const Error free_error = free_file(io_state->output_file);
+
+  if (!error.what) {
+    error = free_error;
+  } else {
+    discard_error(free_error);
+  }
+
+  if (error.what) {
+    // the original error is more useful than why this failed
+    unlink(output_filename);
+  }
+
+  return error;
+}
+
+// the same loop as run_transformer_app, except that consumed pages are only
+// unmapped when both sides are files. the codec state is kept for the next
+// transformation unless something went wrong
+static Error run_codec(MmcContext *context, AppIOState *io_state,
+                       bool unmap_consumed_pages) {
+  assert(context);
+  assert(io_state);
+
+  const MmcCodec *const codec = context->codec;
+  Error error;
+
+  if (!context->is_initialized) {
+    if (codec->init) {
+      if ((error = codec->init(io_state, context->state)), error.what) {
+        return error;
+      }
+    }
+
+    context->is_initialized = true;
+  } else if (codec->reset) {
+    if ((error = codec->reset(io_state, context->state)), error.what) {
+      cleanup_codec(context);
+
+      return error;
+    }
+  }
+
+  bool finished = false;
+
+  while (!finished) {
+    if ((error = codec->run(io_state, &finished, context->state)),
+        error.what) {
+      break;
+    }
+
+    // not the end of the world if we can't unmap unused pages
+    if (unmap_consumed_pages) {
+      discard_error(
+          unmap_unused_pages(&io_state->input_file,
+                             &io_state->input_mapping_first_unused_offset));
+      discard_error(
+          unmap_unused_pages(&io_state->output_file,
+                             &io_state->output_mapping_first_unused_offset));
+    }
+
+    if (finished) {
+      break;
+    }
+
+    if ((error = expand_output_mapping(
+             &io_state->output_file,
+             io_state->output_mapping_first_unused_offset)),
+        error.what) {
+      break;
+    }
+  }
+
+  // a failed stream may leave the state in any condition, so start over
+  if (error.what) {
+    cleanup_codec(context);
+  }
+
+  return error;
+}
+
+static void cleanup_codec(MmcContext *context) {
+  assert(context);
+
+  if (!context->is_initialized) {
+    return;
+  }
+
+  if (context->codec->cleanup) {
+    // every cleanup function ignores the I/O state
+    AppIOState io_state;
+    memset(&io_state, 0, sizeof(io_state));
+
+    context->codec->cleanup(&io_state, context->state);
+  }
+
+  context->is_initialized = false;
+}
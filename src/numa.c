@@ -0,0 +1,400 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/numa.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define NODE_DIRECTORY "/sys/devices/system/node"
+// longer than any list sysfs prints for node or CPU numbers in practice
+#define MAX_LIST_SIZE 8192
+// pages of a range whose placement is looked up, in one call to move_pages
+#define MAX_SAMPLED_PAGES 1024
+#define BITS_PER_MASK_WORD (8 * sizeof(unsigned long))
+#define NUM_MASK_WORDS (NUMA_MAX_NODES / BITS_PER_MASK_WORD)
+
+const char *const NUMA_MODE_NAMES[NUM_NUMA_MODES] = {"off", "interleave",
+                                                     "local"};
+
+// glibc provides no wrappers, and libnuma isn't worth depending on for three
+// system calls. the kernel reads one bit less than max_node says
+static long set_mempolicy(int mode, const unsigned long *mask) {
+  return syscall(SYS_set_mempolicy, mode, mask, NUMA_MAX_NODES + 1);
+}
+
+static long mbind(void *address, size_t size, int mode,
+                  const unsigned long *mask) {
+  return syscall(SYS_mbind, address, size, mode, mask, NUMA_MAX_NODES + 1, 0);
+}
+
+static long move_pages(size_t count, const void **pages, int *status) {
+  return syscall(SYS_move_pages, 0, count, pages, NULL, status, 0);
+}
+
+static bool read_list(const char *path, cpu_set_t *set);
+static void make_interleave_mask(const NumaTopology *topology,
+                                 unsigned long mask[NUM_MASK_WORDS]);
+
+Error make_numa_topology(NumaMode mode, NumaTopology *topology) {
+  assert(mode < NUM_NUMA_MODES);
+  assert(topology);
+
+  cpu_set_t allowed_cpus;
+
+  if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == -1) {
+    return ERRNO_EFORMAT("couldn't get CPU affinity");
+  }
+
+  topology->mode = mode;
+  topology->num_nodes = 0;
+
+  cpu_set_t online_nodes;
+
+  if (read_list(NODE_DIRECTORY "/online", &online_nodes)) {
+    for (int id = 0; id < NUMA_MAX_NODES; ++id) {
+      if (!CPU_ISSET((size_t)id, &online_nodes)) {
+        continue;
+      }
+
+      char path[64];
+      snprintf(path, sizeof(path), NODE_DIRECTORY "/node%d/cpulist", id);
+      NumaNode *const node = &topology->nodes[topology->num_nodes];
+
+      if (!read_list(path, &node->cpus)) {
+        continue;
+      }
+
+      CPU_AND(&node->cpus, &node->cpus, &allowed_cpus);
+
+      // memory-only nodes, and nodes that a cpuset keeps us off of
+      if (CPU_COUNT(&node->cpus) == 0) {
+        continue;
+      }
+
+      node->id = id;
+      ++topology->num_nodes;
+    }
+  }
+
+  if (topology->num_nodes == 0) {
+    topology->nodes[0] = (NumaNode){.id = 0, .cpus = allowed_cpus};
+    topology->num_nodes = 1;
+  }
+
+  if (mode == NUMA_MODE_INTERLEAVE) {
+    unsigned long mask[NUM_MASK_WORDS];
+    make_interleave_mask(topology, mask);
+
+    if (set_mempolicy(MPOL_INTERLEAVE, mask) == -1) {
+      return ERRNO_EFORMAT("couldn't interleave memory across NUMA nodes");
+    }
+  }
+
+  return NULL_ERROR;
+}
+
+size_t get_numa_worker_node(const NumaTopology *topology,
+                            size_t worker_index) {
+  assert(topology);
+  assert(topology->num_nodes > 0);
+
+  return worker_index % topology->num_nodes;
+}
+
+static bool find_node_index(const NumaTopology *topology, int id,
+                            size_t *node_index);
+
+size_t get_numa_current_node(const NumaTopology *topology) {
+  assert(topology);
+
+  unsigned cpu;
+  unsigned id;
+  size_t node_index;
+
+  // not the end of the world if we can't tell
+  if (syscall(SYS_getcpu, &cpu, &id, NULL) == -1 ||
+      !find_node_index(topology, (int)id, &node_index)) {
+    return 0;
+  }
+
+  return node_index;
+}
+
+Error bind_thread_to_numa_node(const NumaTopology *topology,
+                               size_t node_index) {
+  assert(topology);
+  assert(node_index < topology->num_nodes);
+
+  if (topology->mode != NUMA_MODE_LOCAL) {
+    return NULL_ERROR;
+  }
+
+  const NumaNode *const node = &topology->nodes[node_index];
+  const int errc =
+      pthread_setaffinity_np(pthread_self(), sizeof(node->cpus), &node->cpus);
+
+  if (errc != 0) {
+    return eformat("couldn't bind thread to NUMA node %d: %s (%d)", node->id,
+                   strerror(errc), errc);
+  }
+
+  return NULL_ERROR;
+}
+
+Error place_numa_range(const NumaTopology *topology, size_t node_index,
+                       void *address, size_t size) {
+  assert(topology);
+  assert(node_index < topology->num_nodes);
+  assert(address);
+  assert((uintptr_t)address % (uintptr_t)sysconf(_SC_PAGESIZE) == 0);
+
+  unsigned long mask[NUM_MASK_WORDS] = {0};
+  long result = 0;
+
+  if (topology->mode == NUMA_MODE_LOCAL) {
+    const size_t id = (size_t)topology->nodes[node_index].id;
+    mask[id / BITS_PER_MASK_WORD] |= 1UL << (id % BITS_PER_MASK_WORD);
+
+    // preferred rather than bound, so allocation can fall back when the node
+    // is full instead of swapping
+    result = mbind(address, size, MPOL_PREFERRED, mask);
+  } else if (topology->mode == NUMA_MODE_INTERLEAVE) {
+    make_interleave_mask(topology, mask);
+    result = mbind(address, size, MPOL_INTERLEAVE, mask);
+  }
+
+  if (result == -1) {
+    return ERRNO_EFORMAT("couldn't place %zu bytes on NUMA node %d", size,
+                         topology->nodes[node_index].id);
+  }
+
+  return NULL_ERROR;
+}
+
+static size_t sample_pages(const void *address, size_t size,
+                           int status[MAX_SAMPLED_PAGES]);
+
+size_t find_numa_range_node(const NumaTopology *topology, const void *address,
+                            size_t size) {
+  assert(topology);
+
+  int status[MAX_SAMPLED_PAGES];
+  const size_t num_sampled = sample_pages(address, size, status);
+  size_t counts[NUMA_MAX_NODES] = {0};
+
+  for (size_t i = 0; i < num_sampled; ++i) {
+    size_t node_index;
+
+    // negative if the page isn't resident
+    if (status[i] >= 0 && find_node_index(topology, status[i], &node_index)) {
+      ++counts[node_index];
+    }
+  }
+
+  size_t most_index = get_numa_current_node(topology);
+
+  for (size_t i = 0; i < topology->num_nodes; ++i) {
+    if (counts[i] > counts[most_index]) {
+      most_index = i;
+    }
+  }
+
+  return most_index;
+}
+
+void count_numa_accesses(const NumaTopology *topology, const void *address,
+                         size_t size, NumaAccessCounts *counts) {
+  assert(topology);
+  assert(counts);
+
+  int status[MAX_SAMPLED_PAGES];
+  const size_t num_sampled = sample_pages(address, size, status);
+  const int id = topology->nodes[get_numa_current_node(topology)].id;
+
+  for (size_t i = 0; i < num_sampled; ++i) {
+    if (status[i] == id) {
+      ++counts->local_pages;
+    } else if (status[i] >= 0) {
+      ++counts->remote_pages;
+    }
+  }
+}
+
+void add_numa_access_counts(NumaAccessCounts *total, NumaAccessCounts counts) {
+  assert(total);
+
+  total->local_pages += counts.local_pages;
+  total->remote_pages += counts.remote_pages;
+}
+
+Error print_numa_stats(const NumaTopology *topology, NumaAccessCounts counts) {
+  assert(topology);
+
+  const size_t num_sampled = counts.local_pages + counts.remote_pages;
+
+  if (fprintf(stderr,
+              "%s: numa stats:\n"
+              "    mode:             %s\n"
+              "    nodes:            %zu\n"
+              "    local pages:      %zu\n"
+              "    remote pages:     %zu\n",
+              executable_name, NUMA_MODE_NAMES[topology->mode],
+              topology->num_nodes, counts.local_pages,
+              counts.remote_pages) < 0 ||
+      (num_sampled > 0 &&
+       fprintf(stderr, "    remote ratio:     %.3f\n",
+               (double)counts.remote_pages / (double)num_sampled) < 0)) {
+    return ERRNO_EFORMAT("couldn't write NUMA stats");
+  }
+
+  return NULL_ERROR;
+}
+
+// parses a sysfs list of numbers and inclusive ranges, like "0-3,8-11". false
+// if it can't be read or is malformed
+static bool read_list(const char *path, cpu_set_t *set) {
+  assert(path);
+  assert(set);
+
+  FILE *const file = fopen(path, "r");
+
+  if (!file) {
+    return false;
+  }
+
+  char text[MAX_LIST_SIZE];
+  const bool has_read = fgets(text, sizeof(text), file) != NULL;
+  fclose(file);
+
+  if (!has_read) {
+    return false;
+  }
+
+  CPU_ZERO(set);
+  const char *position = text;
+
+  while (*position != '\0' && *position != '\n') {
+    char *end;
+    const long first = strtol(position, &end, 10);
+    long last = first;
+
+    if (end == position || first < 0) {
+      return false;
+    }
+
+    if (*end == '-') {
+      position = end + 1;
+      last = strtol(position, &end, 10);
+
+      if (end == position || last < first) {
+        return false;
+      }
+    }
+
+    for (long i = first; i <= last && i < CPU_SETSIZE; ++i) {
+      CPU_SET((size_t)i, set);
+    }
+
+    position = (*end == ',') ? end + 1 : end;
+  }
+
+  return true;
+}
+
+// every node with memory, not only those with CPUs we can run on
+static void make_interleave_mask(const NumaTopology *topology,
+                                 unsigned long mask[NUM_MASK_WORDS]) {
+  assert(topology);
+  assert(mask);
+
+  memset(mask, 0, NUM_MASK_WORDS * sizeof(unsigned long));
+  cpu_set_t memory_nodes;
+
+  if (read_list(NODE_DIRECTORY "/has_memory", &memory_nodes)) {
+    for (size_t id = 0; id < NUMA_MAX_NODES; ++id) {
+      if (CPU_ISSET(id, &memory_nodes)) {
+        mask[id / BITS_PER_MASK_WORD] |= 1UL << (id % BITS_PER_MASK_WORD);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < topology->num_nodes; ++i) {
+      const size_t id = (size_t)topology->nodes[i].id;
+      mask[id / BITS_PER_MASK_WORD] |= 1UL << (id % BITS_PER_MASK_WORD);
+    }
+  }
+}
+
+static bool find_node_index(const NumaTopology *topology, int id,
+                            size_t *node_index) {
+  assert(topology);
+  assert(node_index);
+
+  for (size_t i = 0; i < topology->num_nodes; ++i) {
+    if (topology->nodes[i].id == id) {
+      *node_index = i;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// looks up the node of up to MAX_SAMPLED_PAGES pages spread evenly over a
+// range, returning how many were looked up. status is negative for pages that
+// aren't resident
+static size_t sample_pages(const void *address, size_t size,
+                           int status[MAX_SAMPLED_PAGES]) {
+  assert(status);
+
+  if (!address || size == 0) {
+    return 0;
+  }
+
+  const uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+  const uintptr_t first_page = (uintptr_t)address / page_size * page_size;
+  const size_t num_pages =
+      (size_t)(((uintptr_t)address + size - first_page + page_size - 1) /
+               page_size);
+  const size_t num_sampled =
+      (num_pages < MAX_SAMPLED_PAGES) ? num_pages : MAX_SAMPLED_PAGES;
+  const void *pages[MAX_SAMPLED_PAGES];
+
+  for (size_t i = 0; i < num_sampled; ++i) {
+    pages[i] = (const void *)(first_page + i * num_pages / num_sampled *
+                                               page_size);
+  }
+
+  if (move_pages(num_sampled, pages, status) == -1) {
+    return 0;
+  }
+
+  return num_sampled;
+}
@@ -0,0 +1,1063 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/parallel_inflate.h>
+
+#include <common/checksum.h>
+#include <common/committer.h>
+#include <common/file.h>
+#include <common/huffman.h>
+#include <common/scheduler.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+// compressed input that each task searches for a block header in. a task's
+// output ends at the first block that starts past its chunk, which is where
+// the next task's should begin
+#define CHUNK_SIZE ((size_t)1 << 20)
+// symbols that a task may inflate before the rest of its chunk is left to
+// zlib, once the chunk before it has been committed. each output slot holds
+// this many, so it's tied to the chunk size rather than to the most a chunk
+// could inflate to: chunks that compress better than 8:1 are rare enough that
+// finishing them on one thread beats reserving 64MiB for every slot
+#define MAX_CHUNK_SYMBOLS (CHUNK_SIZE * 8)
+// set on symbols that stand for a byte of the window before their chunk,
+// whose index is held in the other bits. literals are below 256
+#define MARKER_FLAG 0x8000u
+// output that is resolved or inflated at once, at least DEFLATE_WINDOW_SIZE
+#define PIECE_SIZE ((size_t)1 << 16)
+
+// what a task leaves in its output slot for the commit
+typedef struct SpeculativeChunk {
+  // if a block header was found that the chunk could be inflated from
+  bool is_found;
+  // bit offsets into the input
+  size_t start_position;
+  size_t end_position;
+  // the chunk ran to a block starting past the chunk or the stream's last
+  // block, rather than running out of room for its symbols
+  bool is_complete;
+  bool is_final;
+  // lowest index into the window before the chunk that a marker refers to,
+  // or DEFLATE_WINDOW_SIZE if there are none
+  size_t min_window_index;
+
+  size_t num_symbols;
+  // symbols before this may be markers. the rest have been narrowed to bytes,
+  // which are stored right after them
+  size_t marker_end;
+  // of the narrowed bytes
+  uLong checksum;
+
+  // set once the chunk is ordered if the symbols start where the chunk before
+  // ended, in which case window holds what came before them
+  bool is_valid;
+  unsigned char window[DEFLATE_WINDOW_SIZE];
+
+  uint16_t symbols[];
+} SpeculativeChunk;
+
+// checksums of what each chunk wrote, combined in order once every chunk has
+// been committed
+typedef struct ChunkChecksums {
+  // of the symbols that the task inflated
+  uLong speculative;
+  size_t speculative_size;
+  // of what zlib inflated after them
+  uLong serial;
+  size_t serial_size;
+} ChunkChecksums;
+
+// inflates blocks into symbols, one per byte of output or marker
+typedef struct Inflater {
+  BitReader reader;
+
+  uint16_t *symbols;
+  size_t num_symbols;
+  size_t capacity;
+
+  // distances past this are invalid
+  size_t max_distance;
+  // if there is history before the first symbol, which becomes markers.
+  // otherwise referring back before it is invalid
+  bool has_window;
+  size_t min_window_index;
+  // one past the last symbol that may be a marker
+  size_t marker_end;
+
+  const HuffmanCode *fixed_lengths;
+  const HuffmanCode *fixed_distances;
+  HuffmanCode lengths;
+  HuffmanCode distances;
+} Inflater;
+
+// the tasks only read it. the rest of the state is kept by each chunk's order,
+// which runs one at a time, except that the commits fill in checksums
+typedef struct ParallelInflateJob {
+  const unsigned char *input;
+  size_t input_size;
+  size_t max_distance;
+  ZlibFormat format;
+  // where the DEFLATE data starts, in bytes
+  size_t start;
+  size_t num_chunks;
+
+  HuffmanCode fixed_lengths;
+  HuffmanCode fixed_distances;
+
+  OutputCommitter *committer;
+  // one per chunk
+  ChunkChecksums *checksums;
+  // inflates chunks whose guessed block header was wrong
+  z_stream stream;
+
+  // bit offset into the input of the next block to order
+  size_t position;
+  // the last block has been ordered
+  bool is_finished;
+  // bytes of input before this have been ordered and can be released
+  size_t input_released;
+  size_t output_size;
+
+  // the last history_size bytes hold the end of the output so far
+  unsigned char history[DEFLATE_WINDOW_SIZE];
+  size_t history_size;
+  unsigned char piece[PIECE_SIZE];
+} ParallelInflateJob;
+
+static Error inflate_chunk(size_t worker_index, size_t task_index,
+                           void *output, size_t *output_size, void *job_v);
+static Error order_chunk(size_t task_index, void *output, size_t *output_size,
+                         void *job_v);
+static Error commit_chunk(size_t task_index, const void *output,
+                          size_t output_size, size_t offset, void *job_v);
+static Error finish_stream(const ParallelInflateJob *job,
+                           AppIOState *io_state, bool *finished);
+static Error make_inflate_error(const z_stream *stream, int errc);
+
+Error parallel_inflate(AppIOState *io_state, const InflateOptions *options,
+                       size_t num_threads, const NumaTopology *maybe_numa,
+                       size_t *num_chunks, bool *finished) {
+  assert(io_state);
+  assert(options);
+  assert(num_threads > 0);
+  assert(num_chunks);
+  assert(finished);
+
+  const FileAndMapping *const input_file = &io_state->input_file;
+  size_t start;
+  Error error;
+
+  if ((error = inflate_stream_start(input_file, options, &start)),
+      error.what) {
+    return error;
+  }
+
+  ParallelInflateJob *const job = malloc(sizeof(ParallelInflateJob));
+
+  if (!job) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  job->input = (const unsigned char *)input_file->mapping;
+  job->input_size = input_file->mapping_size;
+  job->max_distance = (size_t)1 << options->window_bits;
+  job->format = options->format;
+  job->start = start;
+  job->num_chunks = (job->input_size - start + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  if (job->num_chunks == 0) {
+    job->num_chunks = 1;
+  }
+
+  job->position = start * 8;
+  job->is_finished = false;
+  job->input_released = 0;
+  job->output_size = 0;
+  job->history_size = 0;
+  make_fixed_huffman_codes(&job->fixed_lengths, &job->fixed_distances);
+
+  if (!(job->checksums = malloc(job->num_chunks * sizeof(ChunkChecksums)))) {
+    error = ERROR_OUT_OF_MEMORY;
+
+    goto cleanup_job;
+  }
+
+  job->stream = (z_stream){
+      .next_in = Z_NULL, .avail_in = 0, .zalloc = Z_NULL, .zfree = Z_NULL};
+
+  const int init_errc = inflateInit2(&job->stream, -options->window_bits);
+
+  if (init_errc != Z_OK) {
+    error = make_inflate_error(&job->stream, init_errc);
+
+    goto cleanup_checksums;
+  }
+
+  if ((error = create_output_committer(io_state, &job->committer)),
+      error.what) {
+    goto cleanup_stream;
+  }
+
+  const SchedulerParams params = {
+      .num_workers = num_threads,
+      .num_tasks = job->num_chunks,
+      .max_output_size = sizeof(SpeculativeChunk) +
+                         MAX_CHUNK_SYMBOLS * sizeof(uint16_t),
+      .init_worker = NULL,
+      .run_task = inflate_chunk,
+      .order = order_chunk,
+      .commit = commit_chunk,
+      .cleanup_worker = NULL,
+      .maybe_numa = maybe_numa,
+      .arg = job,
+  };
+
+  error = run_scheduler(&params);
+  free_output_committer(job->committer);
+  *num_chunks = job->num_chunks;
+
+  if (!error.what) {
+    error = finish_stream(job, io_state, finished);
+  }
+
+cleanup_stream:
+  inflateEnd(&job->stream);
+
+cleanup_checksums:
+  free(job->checksums);
+
+cleanup_job:
+  free(job);
+
+  return error;
+}
+
+static void find_and_inflate(Inflater *inflater, size_t search_end,
+                             size_t stop_position, SpeculativeChunk *chunk);
+static bool inflate_blocks(Inflater *inflater, size_t stop_position,
+                           SpeculativeChunk *chunk);
+static void narrow_symbols(const ParallelInflateJob *job,
+                           SpeculativeChunk *chunk);
+static uLong update_checksum(ZlibFormat format, uLong checksum,
+                             const unsigned char *data, size_t size);
+static uLong combine_checksums(ZlibFormat format, uLong first, uLong second,
+                               size_t size);
+
+// inflates a chunk from the first block header in it that it can be inflated
+// from to the first block that starts past it
+static Error inflate_chunk(size_t worker_index, size_t task_index,
+                           void *output, size_t *output_size, void *job_v) {
+  assert(output);
+  assert(output_size);
+  assert(job_v);
+
+  (void)worker_index;
+
+  const ParallelInflateJob *const job = (const ParallelInflateJob *)job_v;
+  SpeculativeChunk *const chunk = (SpeculativeChunk *)output;
+
+  const size_t search_start = (job->start + task_index * CHUNK_SIZE) * 8;
+  Inflater inflater = {
+      .reader = {.data = job->input,
+                 .size = job->input_size,
+                 .position = search_start},
+      .symbols = chunk->symbols,
+      .num_symbols = 0,
+      .capacity = MAX_CHUNK_SYMBOLS,
+      .max_distance = job->max_distance,
+      .has_window = task_index > 0,
+      .min_window_index = DEFLATE_WINDOW_SIZE,
+      .marker_end = 0,
+      .fixed_lengths = &job->fixed_lengths,
+      .fixed_distances = &job->fixed_distances,
+  };
+
+  size_t search_end;
+  size_t stop_position;
+
+  if (task_index + 1 < job->num_chunks) {
+    search_end = search_start + CHUNK_SIZE * 8;
+    stop_position = search_end;
+  } else {
+    search_end = job->input_size * 8;
+    stop_position = SIZE_MAX;
+  }
+
+  if (task_index == 0) {
+    // the first block starts right after the header
+    chunk->is_found = inflate_blocks(&inflater, stop_position, chunk);
+    chunk->start_position = search_start;
+  } else {
+    find_and_inflate(&inflater, search_end, stop_position, chunk);
+  }
+
+  if (!chunk->is_found) {
+    chunk->num_symbols = 0;
+    chunk->marker_end = 0;
+  }
+
+  narrow_symbols(job, chunk);
+  *output_size = sizeof(SpeculativeChunk) +
+                 chunk->marker_end * sizeof(uint16_t) +
+                 (chunk->num_symbols - chunk->marker_end);
+
+  return NULL_ERROR;
+}
+
+// so that the commit only has to look up the symbols that may be markers
+static void narrow_symbols(const ParallelInflateJob *job,
+                           SpeculativeChunk *chunk) {
+  assert(job);
+  assert(chunk);
+
+  const size_t num_bytes = chunk->num_symbols - chunk->marker_end;
+  const uint16_t *const symbols = chunk->symbols + chunk->marker_end;
+  // each byte is stored at or before the symbol it came from
+  unsigned char *const bytes = (unsigned char *)symbols;
+
+  for (size_t i = 0; i < num_bytes; ++i) {
+    bytes[i] = (unsigned char)symbols[i];
+  }
+
+  chunk->checksum = update_checksum(
+      job->format, update_checksum(job->format, 0, NULL, 0), bytes, num_bytes);
+}
+
+static bool could_start_block(const BitReader *reader);
+
+// tries each bit offset from where the reader is up to search_end in turn
+static void find_and_inflate(Inflater *inflater, size_t search_end,
+                             size_t stop_position, SpeculativeChunk *chunk) {
+  assert(inflater);
+  assert(chunk);
+
+  BitReader *const reader = &inflater->reader;
+
+  for (size_t position = reader->position; position < search_end;
+       ++position) {
+    reader->position = position;
+
+    if (!could_start_block(reader)) {
+      continue;
+    }
+
+    inflater->num_symbols = 0;
+    inflater->min_window_index = DEFLATE_WINDOW_SIZE;
+    inflater->marker_end = 0;
+
+    if (inflate_blocks(inflater, stop_position, chunk)) {
+      chunk->is_found = true;
+      chunk->start_position = position;
+
+      return;
+    }
+  }
+
+  chunk->is_found = false;
+}
+
+// whether a block that isn't the last could start where the reader is,
+// judging by a cheap look at its header. the last block is left to the chunk
+// before, and fixed Huffman blocks have too little header to tell apart from
+// noise
+static bool could_start_block(const BitReader *reader) {
+  assert(reader);
+
+  BitReader header = *reader;
+
+  switch (read_bits(&header, 3)) {
+  case 0: {
+    // a stored block, padded with zeros to a byte boundary before its length
+    // and the length's complement
+    const unsigned num_padding_bits = (unsigned)(-header.position & 7);
+
+    if (read_bits(&header, num_padding_bits) != 0) {
+      return false;
+    }
+
+    const size_t length = read_bits(&header, 16);
+
+    return read_bits(&header, 16) == (~length & 0xffff) &&
+           header.position <= header.size * 8;
+  }
+  case 2 << 1: {
+    // a dynamic Huffman block, whose code length code must be complete
+    const size_t num_lengths = read_bits(&header, 5) + 257;
+    const size_t num_distances = read_bits(&header, 5) + 1;
+
+    if (num_lengths > 286 || num_distances > 30) {
+      return false;
+    }
+
+    const size_t num_code_lengths = read_bits(&header, 4) + 4;
+    unsigned counts[8] = {0};
+
+    for (size_t i = 0; i < num_code_lengths; ++i) {
+      ++counts[read_bits(&header, 3)];
+    }
+
+    int left = 1;
+
+    for (size_t length = 1; length < 8; ++length) {
+      left = (left << 1) - (int)counts[length];
+
+      if (left < 0) {
+        return false;
+      }
+    }
+
+    return left == 0;
+  }
+  default:
+    return false;
+  }
+}
+
+static bool inflate_stored(Inflater *inflater, bool *is_full);
+static bool inflate_codes(Inflater *inflater, const HuffmanCode *lengths,
+                          const HuffmanCode *distances, bool *is_full);
+
+// inflates blocks until one starts at or past stop_position or the last one
+// ends, or until a block doesn't fit. false if the input isn't valid DEFLATE
+static bool inflate_blocks(Inflater *inflater, size_t stop_position,
+                           SpeculativeChunk *chunk) {
+  assert(inflater);
+  assert(chunk);
+
+  BitReader *const reader = &inflater->reader;
+
+  for (;;) {
+    const size_t block_position = reader->position;
+    const size_t num_symbols = inflater->num_symbols;
+
+    if (block_position >= stop_position) {
+      chunk->end_position = block_position;
+      chunk->is_complete = true;
+      chunk->is_final = false;
+
+      break;
+    }
+
+    const bool is_final = read_bits(reader, 1);
+    bool is_full = false;
+    bool is_valid;
+
+    switch (read_bits(reader, 2)) {
+    case 0:
+      is_valid = inflate_stored(inflater, &is_full);
+
+      break;
+    case 1:
+      is_valid = inflate_codes(inflater, inflater->fixed_lengths,
+                               inflater->fixed_distances, &is_full);
+
+      break;
+    case 2:
+      is_valid = read_dynamic_huffman_codes(reader, &inflater->lengths,
+                                         &inflater->distances) &&
+                 inflate_codes(inflater, &inflater->lengths,
+                               &inflater->distances, &is_full);
+
+      break;
+    default:
+      is_valid = false;
+    }
+
+    if (!is_valid) {
+      return false;
+    } else if (is_full) {
+      // the rest is left to zlib once the history is known
+      inflater->num_symbols = num_symbols;
+      chunk->end_position = block_position;
+      chunk->is_complete = false;
+      chunk->is_final = false;
+
+      break;
+    } else if (is_final) {
+      chunk->end_position = reader->position;
+      chunk->is_complete = true;
+      chunk->is_final = true;
+
+      break;
+    }
+  }
+
+  chunk->min_window_index = inflater->min_window_index;
+  chunk->num_symbols = inflater->num_symbols;
+  chunk->marker_end = MIN(inflater->marker_end, inflater->num_symbols);
+
+  return true;
+}
+
+static bool inflate_stored(Inflater *inflater, bool *is_full) {
+  assert(inflater);
+  assert(is_full);
+
+  BitReader *const reader = &inflater->reader;
+  size_t next_byte = (reader->position + 7) / 8;
+
+  if (next_byte > reader->size || reader->size - next_byte < 4) {
+    return false;
+  }
+
+  const unsigned char *const header = reader->data + next_byte;
+  const size_t length = (size_t)header[0] | (size_t)header[1] << 8;
+  const size_t complement = (size_t)header[2] | (size_t)header[3] << 8;
+  next_byte += 4;
+
+  if (length != (~complement & 0xffff) ||
+      reader->size - next_byte < length) {
+    return false;
+  } else if (inflater->capacity - inflater->num_symbols < length) {
+    *is_full = true;
+
+    return true;
+  }
+
+  uint16_t *const symbols = inflater->symbols + inflater->num_symbols;
+
+  for (size_t i = 0; i < length; ++i) {
+    symbols[i] = reader->data[next_byte + i];
+  }
+
+  inflater->num_symbols += length;
+  reader->position = (next_byte + length) * 8;
+
+  return true;
+}
+
+static bool copy_match(Inflater *inflater, size_t length, size_t distance,
+                       bool *is_full);
+
+static bool inflate_codes(Inflater *inflater, const HuffmanCode *lengths,
+                          const HuffmanCode *distances, bool *is_full) {
+  assert(inflater);
+  assert(lengths);
+  assert(distances);
+  assert(is_full);
+
+  BitReader *const reader = &inflater->reader;
+  const size_t end_position = reader->size * 8;
+
+  while (reader->position <= end_position) {
+    const int symbol = decode_huffman_symbol(reader, lengths);
+
+    if (symbol < 0) {
+      return false;
+    } else if (symbol < END_OF_BLOCK) {
+      if (inflater->num_symbols == inflater->capacity) {
+        *is_full = true;
+
+        return true;
+      }
+
+      inflater->symbols[inflater->num_symbols++] = (uint16_t)symbol;
+
+      continue;
+    } else if (symbol == END_OF_BLOCK) {
+      return reader->position <= end_position;
+    }
+
+    const size_t length_index = (size_t)symbol - END_OF_BLOCK - 1;
+
+    if (length_index >= 29) {
+      return false;
+    }
+
+    const size_t length =
+        DEFLATE_LENGTH_BASES[length_index] +
+        read_bits(reader, DEFLATE_LENGTH_EXTRA_BITS[length_index]);
+    const int distance_index = decode_huffman_symbol(reader, distances);
+
+    if (distance_index < 0 || distance_index >= 30) {
+      return false;
+    }
+
+    const size_t distance =
+        DEFLATE_DISTANCE_BASES[distance_index] +
+        read_bits(reader, DEFLATE_DISTANCE_EXTRA_BITS[distance_index]);
+
+    if (!copy_match(inflater, length, distance, is_full)) {
+      return false;
+    } else if (*is_full) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// symbols that refer back before the first become markers for the window
+static bool copy_match(Inflater *inflater, size_t length, size_t distance,
+                       bool *is_full) {
+  assert(inflater);
+  assert(is_full);
+
+  const size_t num_symbols = inflater->num_symbols;
+  uint16_t *const symbols = inflater->symbols;
+
+  if (distance > inflater->max_distance) {
+    return false;
+  } else if (inflater->capacity - num_symbols < length) {
+    *is_full = true;
+
+    return true;
+  }
+
+  if (distance <= num_symbols) {
+    // markers copied from earlier symbols are still markers
+    unsigned copied = 0;
+
+    for (size_t i = num_symbols; i < num_symbols + length; ++i) {
+      symbols[i] = symbols[i - distance];
+      copied |= symbols[i];
+    }
+
+    if (copied & MARKER_FLAG) {
+      inflater->marker_end = num_symbols + length;
+    }
+  } else if (!inflater->has_window) {
+    return false;
+  } else {
+    const size_t window_index = DEFLATE_WINDOW_SIZE - (distance - num_symbols);
+
+    if (window_index < inflater->min_window_index) {
+      inflater->min_window_index = window_index;
+    }
+
+    inflater->marker_end = num_symbols + length;
+
+    for (size_t i = num_symbols; i < num_symbols + length; ++i) {
+      symbols[i] = i >= distance
+                       ? symbols[i - distance]
+                       : (uint16_t)(MARKER_FLAG | (window_index + i -
+                                                   num_symbols));
+    }
+  }
+
+  inflater->num_symbols += length;
+
+  return true;
+}
+
+static void resolve_symbols(const SpeculativeChunk *chunk, size_t first,
+                            size_t count, unsigned char *output);
+static void append_history(ParallelInflateJob *job,
+                           const unsigned char *data, size_t size);
+static Error inflate_serially(ParallelInflateJob *job, size_t stop_position,
+                              ChunkChecksums *checksums);
+
+// keeps what the task inflated if it started where the chunk before ended,
+// passing on the history after it, and inflates the rest of the chunk with
+// zlib. the output size becomes the number of bytes the chunk adds
+static Error order_chunk(size_t task_index, void *output, size_t *output_size,
+                         void *job_v) {
+  assert(output);
+  assert(output_size);
+  assert(job_v);
+
+  ParallelInflateJob *const job = (ParallelInflateJob *)job_v;
+  SpeculativeChunk *const chunk = (SpeculativeChunk *)output;
+  ChunkChecksums *const checksums = &job->checksums[task_index];
+  const uLong initial_checksum = update_checksum(job->format, 0, NULL, 0);
+
+  *checksums = (ChunkChecksums){.speculative = initial_checksum,
+                                .speculative_size = 0,
+                                .serial = initial_checksum,
+                                .serial_size = 0};
+  chunk->is_valid = false;
+  *output_size = 0;
+
+  // anything after the last block is trailer, or further gzip members
+  if (job->is_finished) {
+    return NULL_ERROR;
+  }
+
+  const size_t stop_position =
+      task_index + 1 < job->num_chunks
+          ? (job->start + (task_index + 1) * CHUNK_SIZE) * 8
+          : SIZE_MAX;
+  const size_t output_start = job->output_size;
+
+  if (chunk->is_found && chunk->start_position == job->position &&
+      DEFLATE_WINDOW_SIZE - chunk->min_window_index <= job->history_size) {
+    chunk->is_valid = true;
+    memcpy(chunk->window, job->history, DEFLATE_WINDOW_SIZE);
+
+    // only the end of the chunk is needed for the history after it. the rest
+    // of its markers are replaced by the commit
+    const size_t size = MIN(chunk->num_symbols, DEFLATE_WINDOW_SIZE);
+    resolve_symbols(chunk, chunk->num_symbols - size, size, job->piece);
+    append_history(job, job->piece, size);
+
+    job->output_size += chunk->num_symbols;
+    job->position = chunk->end_position;
+    job->is_finished = chunk->is_final;
+  }
+
+  if (!job->is_finished && job->position < stop_position) {
+    const Error error = inflate_serially(job, stop_position, checksums);
+
+    if (error.what) {
+      return error;
+    }
+  }
+
+  const size_t ordered = MIN(job->position / 8, job->input_size);
+  release_pages((void *)(job->input + job->input_released),
+                ordered - job->input_released);
+  job->input_released = ordered;
+  *output_size = job->output_size - output_start;
+
+  return NULL_ERROR;
+}
+
+// writes the symbols that the task inflated, replacing markers with the bytes
+// they stand for. runs alongside the commits of other chunks
+static Error commit_chunk(size_t task_index, const void *output,
+                          size_t output_size, size_t offset, void *job_v) {
+  assert(output);
+  assert(job_v);
+
+  (void)output_size;
+
+  const ParallelInflateJob *const job = (const ParallelInflateJob *)job_v;
+  const SpeculativeChunk *const chunk = (const SpeculativeChunk *)output;
+
+  if (!chunk->is_valid) {
+    return NULL_ERROR;
+  }
+
+  unsigned char piece[PIECE_SIZE];
+  uLong checksum = update_checksum(job->format, 0, NULL, 0);
+  Error error;
+
+  for (size_t i = 0; i < chunk->marker_end; i += PIECE_SIZE) {
+    const size_t size = MIN(chunk->marker_end - i, PIECE_SIZE);
+    resolve_symbols(chunk, i, size, piece);
+    checksum = update_checksum(job->format, checksum, piece, size);
+
+    if ((error = commit_output(job->committer, offset + i, piece, size)),
+        error.what) {
+      return error;
+    }
+  }
+
+  const size_t num_bytes = chunk->num_symbols - chunk->marker_end;
+
+  if (num_bytes > 0) {
+    if ((error = commit_output(
+             job->committer, offset + chunk->marker_end,
+             (const unsigned char *)(chunk->symbols + chunk->marker_end),
+             num_bytes)),
+        error.what) {
+      return error;
+    }
+
+    checksum = combine_checksums(job->format, checksum, chunk->checksum,
+                                 num_bytes);
+  }
+
+  // its own entry, which the order left alone once it returned
+  ChunkChecksums *const checksums = &job->checksums[task_index];
+  checksums->speculative = checksum;
+  checksums->speculative_size = chunk->num_symbols;
+
+  return NULL_ERROR;
+}
+
+// count symbols of the chunk starting at first, as bytes
+static void resolve_symbols(const SpeculativeChunk *chunk, size_t first,
+                            size_t count, unsigned char *output) {
+  assert(chunk);
+  assert(first + count <= chunk->num_symbols);
+  assert(output || count == 0);
+
+  const size_t num_markable = first < chunk->marker_end
+                                  ? MIN(chunk->marker_end - first, count)
+                                  : 0;
+
+  for (size_t i = 0; i < num_markable; ++i) {
+    const unsigned symbol = chunk->symbols[first + i];
+
+    output[i] = symbol & MARKER_FLAG
+                    ? chunk->window[symbol & (MARKER_FLAG - 1)]
+                    : (unsigned char)symbol;
+  }
+
+  const unsigned char *const bytes =
+      (const unsigned char *)(chunk->symbols + chunk->marker_end);
+  memcpy(output + num_markable,
+         bytes + (first + num_markable - chunk->marker_end),
+         count - num_markable);
+}
+
+static void append_history(ParallelInflateJob *job,
+                           const unsigned char *data, size_t size) {
+  assert(job);
+  assert(data || size == 0);
+
+  if (size >= DEFLATE_WINDOW_SIZE) {
+    memcpy(job->history, data + size - DEFLATE_WINDOW_SIZE,
+           DEFLATE_WINDOW_SIZE);
+  } else {
+    memmove(job->history, job->history + size, DEFLATE_WINDOW_SIZE - size);
+    memcpy(job->history + DEFLATE_WINDOW_SIZE - size, data, size);
+  }
+
+  job->history_size = MIN(job->history_size + size, DEFLATE_WINDOW_SIZE);
+}
+
+// picks up from the last ordered block with the history so far, writing to
+// the output right away, until a block starts at or past stop_position or
+// the last one ends
+static Error inflate_serially(ParallelInflateJob *job, size_t stop_position,
+                              ChunkChecksums *checksums) {
+  assert(job);
+  assert(checksums);
+
+  z_stream *const stream = &job->stream;
+  int errc = inflateReset(stream);
+  assert(errc == Z_OK);
+
+  if (job->history_size > 0) {
+    errc = inflateSetDictionary(
+        stream, job->history + DEFLATE_WINDOW_SIZE - job->history_size,
+        (uInt)job->history_size);
+    assert(errc == Z_OK);
+  }
+
+  size_t next_byte = job->position / 8;
+  const unsigned num_used_bits = (unsigned)(job->position % 8);
+
+  if (num_used_bits > 0) {
+    errc = inflatePrime(stream, (int)(8 - num_used_bits),
+                        job->input[next_byte] >> num_used_bits);
+    assert(errc == Z_OK);
+    ++next_byte;
+  }
+
+  (void)errc;
+
+  stream->next_in = (z_const Bytef *)job->input + next_byte;
+  stream->avail_in = 0;
+
+  for (;;) {
+    if (stream->avail_in == 0) {
+      const size_t consumed = (size_t)(stream->next_in - job->input);
+      stream->avail_in =
+          (uInt)MIN(job->input_size - consumed, (size_t)UINT_MAX);
+    }
+
+    stream->next_out = job->piece;
+    stream->avail_out = (uInt)PIECE_SIZE;
+
+    // stops at the end of each block
+    const int inflate_errc = inflate(stream, Z_BLOCK);
+    const size_t size = PIECE_SIZE - stream->avail_out;
+
+    if (size > 0) {
+      const Error error =
+          commit_output(job->committer, job->output_size, job->piece, size);
+
+      if (error.what) {
+        return error;
+      }
+
+      checksums->serial =
+          update_checksum(job->format, checksums->serial, job->piece, size);
+      checksums->serial_size += size;
+      job->output_size += size;
+      append_history(job, job->piece, size);
+    }
+
+    // data_type holds the bits left over in the last byte read
+    const size_t position = (size_t)(stream->next_in - job->input) * 8 -
+                            (size_t)(stream->data_type & 7);
+
+    if (inflate_errc == Z_STREAM_END) {
+      job->position = position;
+      job->is_finished = true;
+
+      return NULL_ERROR;
+    } else if (inflate_errc != Z_OK) {
+      return make_inflate_error(stream, inflate_errc);
+    } else if ((stream->data_type & 128) && position >= stop_position) {
+      job->position = position;
+      // set if that block was the last, which zlib only reports on the next
+      // call
+      job->is_finished = (stream->data_type & 64) != 0;
+
+      return NULL_ERROR;
+    }
+  }
+}
+
+// Adler-32 for zlib streams, CRC-32 for gzip members, and nothing for raw
+// streams. a checksum of zero bytes when data is NULL
+static uLong update_checksum(ZlibFormat format, uLong checksum,
+                             const unsigned char *data, size_t size) {
+  assert(data || size == 0);
+
+  switch (format) {
+  case ZLIB_FORMAT_ZLIB:
+    return data ? checksum_adler32((uint32_t)checksum, data, size) : 1;
+  case ZLIB_FORMAT_GZIP:
+    return data ? checksum_crc32((uint32_t)checksum, data, size) : 0;
+  case ZLIB_FORMAT_RAW:
+    return 0;
+  }
+
+  assert(false);
+
+  return 0;
+}
+
+// of the concatenation of data with a checksum of first and size bytes with
+// a checksum of second
+static uLong combine_checksums(ZlibFormat format, uLong first, uLong second,
+                               size_t size) {
+  if (size == 0) {
+    return first;
+  }
+
+  switch (format) {
+  case ZLIB_FORMAT_ZLIB:
+    return adler32_combine(first, second, (z_off_t)size);
+  case ZLIB_FORMAT_GZIP:
+    return crc32_combine(first, second, (z_off_t)size);
+  case ZLIB_FORMAT_RAW:
+    return 0;
+  }
+
+  assert(false);
+
+  return 0;
+}
+
+// checks the trailer after the last block, see RFC 1950 section 2.2 and RFC
+// 1952 section 2.2
+static Error finish_stream(const ParallelInflateJob *job,
+                           AppIOState *io_state, bool *finished) {
+  assert(job);
+  assert(io_state);
+  assert(finished);
+
+  static const size_t TRAILER_SIZES[] = {4, 8, 0};
+
+  size_t offset = (job->position + 7) / 8;
+
+  if (!job->is_finished || offset > job->input_size ||
+      job->input_size - offset < TRAILER_SIZES[job->format]) {
+    return eformat("couldn't inflate stream: unexpected end of input (%d)",
+                   Z_BUF_ERROR);
+  }
+
+  uLong checksum = update_checksum(job->format, 0, NULL, 0);
+
+  for (size_t i = 0; i < job->num_chunks; ++i) {
+    const ChunkChecksums *const checksums = &job->checksums[i];
+    checksum = combine_checksums(job->format, checksum, checksums->speculative,
+                                 checksums->speculative_size);
+    checksum = combine_checksums(job->format, checksum, checksums->serial,
+                                 checksums->serial_size);
+  }
+
+  const unsigned char *const trailer = job->input + offset;
+  bool is_checksum_valid = true;
+  bool is_length_valid = true;
+
+  if (job->format == ZLIB_FORMAT_ZLIB) {
+    const uLong expected_checksum =
+        (uLong)trailer[0] << 24 | (uLong)trailer[1] << 16 |
+        (uLong)trailer[2] << 8 | (uLong)trailer[3];
+    is_checksum_valid = expected_checksum == checksum;
+  } else if (job->format == ZLIB_FORMAT_GZIP) {
+    const uLong expected_checksum =
+        (uLong)trailer[0] | (uLong)trailer[1] << 8 |
+        (uLong)trailer[2] << 16 | (uLong)trailer[3] << 24;
+    const size_t length = (size_t)trailer[4] | (size_t)trailer[5] << 8 |
+                          (size_t)trailer[6] << 16 | (size_t)trailer[7] << 24;
+    is_checksum_valid = expected_checksum == checksum;
+    is_length_valid = length == (job->output_size & 0xffffffff);
+  }
+
+  if (!is_checksum_valid) {
+    return eformat("couldn't inflate stream: input data corrupted (%d): "
+                   "incorrect data check",
+                   Z_DATA_ERROR);
+  } else if (!is_length_valid) {
+    return eformat("couldn't inflate stream: input data corrupted (%d): "
+                   "incorrect length check",
+                   Z_DATA_ERROR);
+  }
+
+  offset += TRAILER_SIZES[job->format];
+  io_state->input_mapping_first_unused_offset = offset;
+
+  // gzip files may hold several concatenated members, see RFC 1952
+  *finished = job->format != ZLIB_FORMAT_GZIP || offset >= job->input_size;
+
+  return NULL_ERROR;
+}
+
+static Error make_inflate_error(const z_stream *stream, int errc) {
+  assert(stream);
+
+  const char *what;
+  switch (errc) {
+  case Z_BUF_ERROR:
+    what = "unexpected end of input";
+
+    break;
+  case Z_DATA_ERROR:
+    what = "input data corrupted";
+
+    break;
+  case Z_MEM_ERROR:
+    what = "out of memory";
+
+    break;
+  case Z_VERSION_ERROR:
+    what = "zlib library version mismatch";
+
+    break;
+  default:
+    what = "unknown error";
+  }
+
+  if (stream->msg) {
+    return eformat("couldn't inflate stream: %s (%d): %s", what, errc,
+                   stream->msg);
+  }
+
+  return eformat("couldn't inflate stream: %s (%d)", what, errc);
+}
@@ -0,0 +1,233 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/perf.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *const PERF_EVENT_NAMES[NUM_PERF_EVENTS] = {
+    "cycles",     "instructions", "branch_misses",
+    "llc_misses", "dtlb_misses",  "page_faults"};
+
+typedef struct PerfEventConfig {
+  uint32_t type;
+  uint64_t config;
+} PerfEventConfig;
+
+#define CACHE_MISS_CONFIG(CACHE)                                               \
+  ((uint64_t)(CACHE) | ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8) |          \
+   ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const PerfEventConfig PERF_EVENT_CONFIGS[NUM_PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS_CONFIG(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS_CONFIG(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+// glibc provides no wrapper
+static int perf_event_open(struct perf_event_attr *attr) {
+  return (int)syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+Error open_perf_counters(PerfCounters *counters) {
+  assert(counters);
+
+  counters->num_open = 0;
+  int last_errno = 0;
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = PERF_EVENT_CONFIGS[i].type;
+    attr.config = PERF_EVENT_CONFIGS[i].config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    // allowed with the default perf_event_paranoid of 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // worker threads started while enabled add to the totals once they exit
+    attr.inherit = 1;
+
+    counters->fds[i] = perf_event_open(&attr);
+
+    if (counters->fds[i] == -1) {
+      last_errno = errno;
+    } else {
+      ++counters->num_open;
+    }
+  }
+
+  if (counters->num_open == 0) {
+    errno = last_errno;
+
+    return ERRNO_EFORMAT("hardware performance counters are unavailable");
+  }
+
+  return NULL_ERROR;
+}
+
+void close_perf_counters(PerfCounters *counters) {
+  assert(counters);
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    if (counters->fds[i] != -1) {
+      close(counters->fds[i]);
+      counters->fds[i] = -1;
+    }
+  }
+
+  counters->num_open = 0;
+}
+
+static void ioctl_all(const PerfCounters *counters, unsigned long request) {
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    if (counters->fds[i] != -1) {
+      ioctl(counters->fds[i], request, 0);
+    }
+  }
+}
+
+void reset_perf_counters(const PerfCounters *counters) {
+  assert(counters);
+
+  ioctl_all(counters, PERF_EVENT_IOC_RESET);
+}
+
+void enable_perf_counters(const PerfCounters *counters) {
+  assert(counters);
+
+  ioctl_all(counters, PERF_EVENT_IOC_ENABLE);
+}
+
+void disable_perf_counters(const PerfCounters *counters) {
+  assert(counters);
+
+  ioctl_all(counters, PERF_EVENT_IOC_DISABLE);
+}
+
+PerfCounts read_perf_counters(const PerfCounters *counters) {
+  assert(counters);
+
+  PerfCounts counts = make_perf_counts();
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    if (counters->fds[i] == -1) {
+      continue;
+    }
+
+    // value, time enabled, time running
+    uint64_t buffer[3];
+
+    if (read(counters->fds[i], buffer, sizeof(buffer)) !=
+        (ssize_t)sizeof(buffer)) {
+      continue;
+    }
+
+    // never scheduled onto the PMU, so there's nothing to extrapolate from
+    if (buffer[2] == 0 && buffer[1] != 0) {
+      continue;
+    }
+
+    counts.is_available[i] = true;
+
+    if (buffer[2] < buffer[1]) {
+      counts.values[i] =
+          (uint64_t)((double)buffer[0] * (double)buffer[1] / (double)buffer[2]);
+    } else {
+      counts.values[i] = buffer[0];
+    }
+  }
+
+  return counts;
+}
+
+PerfCounts make_perf_counts(void) {
+  PerfCounts counts;
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    counts.is_available[i] = false;
+    counts.values[i] = 0;
+  }
+
+  return counts;
+}
+
+void add_perf_counts(PerfCounts *total, PerfCounts counts) {
+  assert(total);
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    total->is_available[i] = total->is_available[i] || counts.is_available[i];
+    total->values[i] += counts.values[i];
+  }
+}
+
+void divide_perf_counts(PerfCounts *counts, uint64_t divisor) {
+  assert(counts);
+  assert(divisor > 0);
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    counts->values[i] /= divisor;
+  }
+}
+
+bool get_ipc(const PerfCounts *counts, double *ipc) {
+  assert(counts);
+  assert(ipc);
+
+  if (!counts->is_available[PERF_EVENT_CYCLES] ||
+      !counts->is_available[PERF_EVENT_INSTRUCTIONS] ||
+      counts->values[PERF_EVENT_CYCLES] == 0) {
+    return false;
+  }
+
+  *ipc = (double)counts->values[PERF_EVENT_INSTRUCTIONS] /
+         (double)counts->values[PERF_EVENT_CYCLES];
+
+  return true;
+}
+
+bool get_cycles_per_byte(const PerfCounts *counts, size_t num_bytes,
+                         double *cycles_per_byte) {
+  assert(counts);
+  assert(cycles_per_byte);
+
+  if (!counts->is_available[PERF_EVENT_CYCLES] || num_bytes == 0) {
+    return false;
+  }
+
+  *cycles_per_byte =
+      (double)counts->values[PERF_EVENT_CYCLES] / (double)num_bytes;
+
+  return true;
+}
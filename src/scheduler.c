@@ -0,0 +1,511 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/scheduler.h>
+
+#include <common/file.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+// the tasks dealt to one worker: queue_index, queue_index + num_workers, and
+// so on. whoever takes from it takes the oldest
+typedef struct TaskQueue {
+  atomic_size_t next_task;
+} TaskQueue;
+
+// where a task writes its output until it has been committed. task i uses
+// slot i % num_slots
+typedef struct OutputSlot {
+  FileAndMapping output;
+  // the task that may use the slot: task i until it has been committed, then
+  // task i + num_slots
+  atomic_size_t ready_task;
+  // how many of the task's output size and its offset are known. whoever
+  // makes it two commits the task and passes the next offset on
+  atomic_uint num_known;
+  size_t output_size;
+  size_t offset;
+} OutputSlot;
+
+typedef struct Scheduler {
+  const SchedulerParams *params;
+
+  TaskQueue *queues;
+  // one per worker, but no more than there are tasks
+  size_t num_queues;
+  OutputSlot *slots;
+  size_t num_slots;
+
+  atomic_bool has_failed;
+  // workers asleep in wait_for_slot, who must be woken when a slot is freed
+  atomic_size_t num_waiting;
+
+  // only taken to sleep, to wake sleepers, and to record an error, never on
+  // the way to a commit. guards error
+  pthread_mutex_t mutex;
+  pthread_cond_t slot_freed;
+  Error error;
+} Scheduler;
+
+typedef struct Worker {
+  Scheduler *scheduler;
+  size_t index;
+  pthread_t thread;
+} Worker;
+
+typedef enum TakeResult {
+  TAKE_RESULT_TAKEN,
+  // every task left needs a slot that hasn't been committed yet
+  TAKE_RESULT_MUST_WAIT,
+  TAKE_RESULT_NONE_LEFT,
+} TakeResult;
+
+static Error create_slots(Scheduler *scheduler);
+static void free_slots(Scheduler *scheduler, size_t num_slots);
+static void *run_worker(void *worker_v);
+
+Error run_scheduler(const SchedulerParams *params) {
+  assert(params);
+  assert(params->num_workers > 0);
+  assert(params->num_workers <= SCHEDULER_MAX_WORKERS);
+  assert(params->run_task);
+  assert(params->commit);
+
+  if (params->num_tasks == 0) {
+    return NULL_ERROR;
+  }
+
+  // more would only ever find every queue empty
+  const size_t num_workers = (params->num_workers < params->num_tasks)
+                                 ? params->num_workers
+                                 : params->num_tasks;
+  const size_t max_slots = num_workers * SCHEDULER_SLOTS_PER_WORKER;
+
+  Scheduler scheduler = {
+      .params = params,
+      .num_queues = num_workers,
+      .num_slots =
+          (max_slots < params->num_tasks) ? max_slots : params->num_tasks,
+      .error = NULL_ERROR,
+  };
+
+  atomic_init(&scheduler.has_failed, false);
+  atomic_init(&scheduler.num_waiting, 0);
+
+  Error error = NULL_ERROR;
+  int errc = pthread_mutex_init(&scheduler.mutex, NULL);
+
+  if (errc != 0) {
+    return eformat("couldn't initialize scheduler mutex: %s (%d)",
+                   strerror(errc), errc);
+  }
+
+  if ((errc = pthread_cond_init(&scheduler.slot_freed, NULL)) != 0) {
+    error = eformat("couldn't initialize scheduler condition variable: %s (%d)",
+                    strerror(errc), errc);
+
+    goto cleanup_mutex;
+  }
+
+  scheduler.queues = malloc(num_workers * sizeof(TaskQueue));
+  Worker *const workers = malloc(num_workers * sizeof(Worker));
+
+  if (!scheduler.queues || !workers) {
+    error = ERROR_OUT_OF_MEMORY;
+
+    goto cleanup_workers;
+  }
+
+  for (size_t i = 0; i < num_workers; ++i) {
+    atomic_init(&scheduler.queues[i].next_task, i);
+  }
+
+  if ((error = create_slots(&scheduler)), error.what) {
+    goto cleanup_workers;
+  }
+
+  size_t num_started = 0;
+
+  for (; num_started < num_workers; ++num_started) {
+    Worker *const worker = &workers[num_started];
+    *worker = (Worker){.scheduler = &scheduler, .index = num_started};
+
+    if ((errc = pthread_create(&worker->thread, NULL, run_worker, worker)) !=
+        0) {
+      error = eformat("couldn't create worker thread: %s (%d)", strerror(errc),
+                      errc);
+
+      break;
+    }
+  }
+
+  // the workers that did start steal the queues of those that didn't
+  if (num_started > 0) {
+    discard_error(error);
+    error = NULL_ERROR;
+  }
+
+  for (size_t i = 0; i < num_started; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  if (!error.what) {
+    error = scheduler.error;
+  }
+
+  free_slots(&scheduler, scheduler.num_slots);
+
+cleanup_workers:
+  free(workers);
+  free(scheduler.queues);
+  pthread_cond_destroy(&scheduler.slot_freed);
+
+cleanup_mutex:
+  pthread_mutex_destroy(&scheduler.mutex);
+
+  return error;
+}
+
+// mapped up front, but only touched as far as tasks write to them. the first
+// task's offset is known from the start
+static Error create_slots(Scheduler *scheduler) {
+  assert(scheduler);
+
+  scheduler->slots = malloc(scheduler->num_slots * sizeof(OutputSlot));
+
+  if (!scheduler->slots) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  for (size_t i = 0; i < scheduler->num_slots; ++i) {
+    OutputSlot *const slot = &scheduler->slots[i];
+    atomic_init(&slot->ready_task, i);
+    atomic_init(&slot->num_known, (i == 0) ? 1 : 0);
+    slot->output_size = 0;
+    slot->offset = 0;
+
+    Error error = create_anonymous_mapping(
+        "task output", scheduler->params->max_output_size, &slot->output);
+
+    if (error.what) {
+      free_slots(scheduler, i);
+
+      return error;
+    }
+
+    // task i is dealt to worker i % num_queues, and so are the others that
+    // use this slot unless they are stolen
+    const NumaTopology *const maybe_numa = scheduler->params->maybe_numa;
+
+    if (maybe_numa &&
+        (error = place_numa_range(
+             maybe_numa,
+             get_numa_worker_node(maybe_numa, i % scheduler->num_queues),
+             slot->output.mapping, slot->output.mapping_size),
+         error.what)) {
+      free_slots(scheduler, i + 1);
+
+      return error;
+    }
+  }
+
+  return NULL_ERROR;
+}
+
+static void free_slots(Scheduler *scheduler, size_t num_slots) {
+  assert(scheduler);
+
+  for (size_t i = 0; i < num_slots; ++i) {
+    discard_error(free_file(scheduler->slots[i].output));
+  }
+
+  free(scheduler->slots);
+}
+
+static TakeResult take_task(Scheduler *scheduler, size_t worker_index,
+                            size_t *task_index);
+static void wait_for_slot(Scheduler *scheduler);
+static void finish_task(Scheduler *scheduler, size_t task_index,
+                        size_t output_size);
+static void record_error(Scheduler *scheduler, Error error);
+
+static void *run_worker(void *worker_v) {
+  assert(worker_v);
+
+  const Worker *const worker = (const Worker *)worker_v;
+  Scheduler *const scheduler = worker->scheduler;
+  const SchedulerParams *const params = scheduler->params;
+  Error error;
+
+  // so that what init_worker allocates is first touched on the worker's node
+  if (params->maybe_numa &&
+      (error = bind_thread_to_numa_node(
+           params->maybe_numa,
+           get_numa_worker_node(params->maybe_numa, worker->index)),
+       error.what)) {
+    record_error(scheduler, error);
+
+    return NULL;
+  }
+
+  if (params->init_worker &&
+      (error = params->init_worker(worker->index, params->arg), error.what)) {
+    record_error(scheduler, error);
+
+    return NULL;
+  }
+
+  for (;;) {
+    size_t task_index;
+    const TakeResult result = take_task(scheduler, worker->index, &task_index);
+
+    if (result == TAKE_RESULT_NONE_LEFT) {
+      break;
+    } else if (result == TAKE_RESULT_MUST_WAIT) {
+      wait_for_slot(scheduler);
+
+      continue;
+    }
+
+    OutputSlot *const slot =
+        &scheduler->slots[task_index % scheduler->num_slots];
+    size_t output_size = 0;
+
+    if ((error = params->run_task(worker->index, task_index,
+                                  slot->output.mapping, &output_size,
+                                  params->arg)),
+        error.what) {
+      record_error(scheduler, error);
+
+      break;
+    }
+
+    assert(output_size <= params->max_output_size);
+    finish_task(scheduler, task_index, output_size);
+  }
+
+  if (params->cleanup_worker) {
+    params->cleanup_worker(worker->index, params->arg);
+  }
+
+  return NULL;
+}
+
+static TakeResult pop_task(Scheduler *scheduler, TaskQueue *queue,
+                           size_t *task_index);
+
+// the worker's own queue first, then the others' starting with the next
+// worker's, so that thieves spread out over their victims
+static TakeResult take_task(Scheduler *scheduler, size_t worker_index,
+                            size_t *task_index) {
+  assert(scheduler);
+  assert(task_index);
+
+  if (atomic_load(&scheduler->has_failed)) {
+    return TAKE_RESULT_NONE_LEFT;
+  }
+
+  TakeResult result = TAKE_RESULT_NONE_LEFT;
+
+  for (size_t i = 0; i < scheduler->num_queues; ++i) {
+    TaskQueue *const queue =
+        &scheduler->queues[(worker_index + i) % scheduler->num_queues];
+    const TakeResult queue_result = pop_task(scheduler, queue, task_index);
+
+    if (queue_result == TAKE_RESULT_TAKEN) {
+      return TAKE_RESULT_TAKEN;
+    } else if (queue_result == TAKE_RESULT_MUST_WAIT) {
+      result = TAKE_RESULT_MUST_WAIT;
+    }
+  }
+
+  return result;
+}
+
+// the owner and thieves race for the oldest task with compare-and-swap
+static TakeResult pop_task(Scheduler *scheduler, TaskQueue *queue,
+                           size_t *task_index) {
+  assert(scheduler);
+  assert(queue);
+  assert(task_index);
+
+  size_t task = atomic_load(&queue->next_task);
+
+  for (;;) {
+    if (task >= scheduler->params->num_tasks) {
+      return TAKE_RESULT_NONE_LEFT;
+    }
+
+    const OutputSlot *const slot =
+        &scheduler->slots[task % scheduler->num_slots];
+
+    if (atomic_load(&slot->ready_task) != task) {
+      return TAKE_RESULT_MUST_WAIT;
+    }
+
+    if (atomic_compare_exchange_weak(&queue->next_task, &task,
+                                     task + scheduler->num_queues)) {
+      *task_index = task;
+
+      return TAKE_RESULT_TAKEN;
+    }
+  }
+}
+
+static bool has_ready_task(const Scheduler *scheduler);
+
+// sleeps until a slot is freed. the task that holds it was taken, so it will
+// be committed or an error will be recorded
+static void wait_for_slot(Scheduler *scheduler) {
+  assert(scheduler);
+
+  // before looking again, so that a slot freed after this can't go unseen
+  atomic_fetch_add(&scheduler->num_waiting, 1);
+
+  pthread_mutex_lock(&scheduler->mutex);
+
+  while (!atomic_load(&scheduler->has_failed) && !has_ready_task(scheduler)) {
+    pthread_cond_wait(&scheduler->slot_freed, &scheduler->mutex);
+  }
+
+  pthread_mutex_unlock(&scheduler->mutex);
+
+  atomic_fetch_sub(&scheduler->num_waiting, 1);
+}
+
+// if any queue has run dry or has a task at its front whose slot is free
+static bool has_ready_task(const Scheduler *scheduler) {
+  assert(scheduler);
+
+  for (size_t i = 0; i < scheduler->num_queues; ++i) {
+    const size_t task = atomic_load(&scheduler->queues[i].next_task);
+
+    if (task >= scheduler->params->num_tasks ||
+        atomic_load(&scheduler->slots[task % scheduler->num_slots]
+                         .ready_task) == task) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void commit_tasks(Scheduler *scheduler, size_t task_index);
+
+// the task's offset may already be known, in which case it is committed here
+static void finish_task(Scheduler *scheduler, size_t task_index,
+                        size_t output_size) {
+  assert(scheduler);
+
+  OutputSlot *const slot = &scheduler->slots[task_index % scheduler->num_slots];
+  slot->output_size = output_size;
+
+  if (atomic_fetch_add(&slot->num_known, 1) == 1) {
+    commit_tasks(scheduler, task_index);
+  }
+}
+
+// commits a task whose output size and offset are both known, along with each
+// task after it whose output size became known while this one was missing its
+// offset. the next offset is passed on before committing, so that commits of
+// later tasks can run alongside this one's
+static void commit_tasks(Scheduler *scheduler, size_t task_index) {
+  assert(scheduler);
+
+  const SchedulerParams *const params = scheduler->params;
+
+  for (;;) {
+    OutputSlot *const slot =
+        &scheduler->slots[task_index % scheduler->num_slots];
+    const size_t offset = slot->offset;
+    size_t output_size = slot->output_size;
+
+    if (params->order && !atomic_load(&scheduler->has_failed)) {
+      const Error error = params->order(task_index, slot->output.mapping,
+                                        &output_size, params->arg);
+
+      if (error.what) {
+        record_error(scheduler, error);
+      }
+    }
+
+    // ordered before the next offset is passed on, and so before the task
+    // that next uses this slot can pass its own
+    atomic_store_explicit(&slot->num_known, 0, memory_order_relaxed);
+
+    bool commits_next = false;
+
+    if (task_index + 1 < params->num_tasks) {
+      OutputSlot *const next_slot =
+          &scheduler->slots[(task_index + 1) % scheduler->num_slots];
+      next_slot->offset = offset + output_size;
+      commits_next = atomic_fetch_add(&next_slot->num_known, 1) == 1;
+    }
+
+    if (!atomic_load(&scheduler->has_failed)) {
+      const Error error =
+          params->commit(task_index, slot->output.mapping, output_size,
+                         offset, params->arg);
+
+      if (error.what) {
+        record_error(scheduler, error);
+      }
+    }
+
+    atomic_store(&slot->ready_task, task_index + scheduler->num_slots);
+
+    if (atomic_load(&scheduler->num_waiting) > 0) {
+      pthread_mutex_lock(&scheduler->mutex);
+      pthread_cond_broadcast(&scheduler->slot_freed);
+      pthread_mutex_unlock(&scheduler->mutex);
+    }
+
+    if (!commits_next) {
+      return;
+    }
+
+    ++task_index;
+  }
+}
+
+// keeps the first error, which the other workers stop at
+static void record_error(Scheduler *scheduler, Error error) {
+  assert(scheduler);
+  assert(error.what);
+
+  pthread_mutex_lock(&scheduler->mutex);
+
+  if (!scheduler->error.what) {
+    scheduler->error = error;
+    atomic_store(&scheduler->has_failed, true);
+    pthread_cond_broadcast(&scheduler->slot_freed);
+  } else {
+    discard_error(error);
+  }
+
+  pthread_mutex_unlock(&scheduler->mutex);
+}
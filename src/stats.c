@@ -0,0 +1,374 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/stats.h>
+
+#include "file_syscalls.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#define UNWRITEABLE_STATS() ERRNO_EFORMAT("couldn't write stats")
+
+const char *const STATS_FORMAT_NAMES[2] = {"text", "json"};
+const char *const STATS_PHASE_NAMES[NUM_STATS_PHASES] = {
+    "argparse", "map", "run", "unmap", "expand"};
+
+Stats make_stats(void) {
+  Stats stats = {.bytes_in = 0,
+                 .bytes_out = 0,
+                 .uncompressed_bytes = 0,
+                 .num_runs = 0,
+                 .perf_counts = make_perf_counts(),
+                 .memory_plan = {.limit = 0}};
+
+  for (size_t i = 0; i < NUM_STATS_PHASES; ++i) {
+    stats.phases[i] = (StatsTimestamp){.wall_seconds = 0,
+                                       .user_seconds = 0,
+                                       .system_seconds = 0,
+                                       .minor_page_faults = 0,
+                                       .major_page_faults = 0};
+  }
+
+  stats.syscalls = file_syscall_counts;
+
+  return stats;
+}
+
+static double timeval_to_seconds(struct timeval time);
+
+StatsTimestamp stats_now(void) {
+  struct timespec time;
+  int result = clock_gettime(CLOCK_MONOTONIC, &time);
+  assert(result == 0);
+
+  struct rusage usage;
+  result = getrusage(RUSAGE_SELF, &usage);
+  assert(result == 0);
+  (void)result;
+
+  return (StatsTimestamp){
+      .wall_seconds = (double)time.tv_sec + (double)time.tv_nsec * 1e-9,
+      .user_seconds = timeval_to_seconds(usage.ru_utime),
+      .system_seconds = timeval_to_seconds(usage.ru_stime),
+      .minor_page_faults = (size_t)usage.ru_minflt,
+      .major_page_faults = (size_t)usage.ru_majflt,
+  };
+}
+
+StatsTimestamp stats_start(const Stats *maybe_stats) {
+  if (!maybe_stats) {
+    return (StatsTimestamp){.wall_seconds = 0,
+                            .user_seconds = 0,
+                            .system_seconds = 0,
+                            .minor_page_faults = 0,
+                            .major_page_faults = 0};
+  }
+
+  return stats_now();
+}
+
+StatsTimestamp stats_elapsed(StatsTimestamp since) {
+  const StatsTimestamp now = stats_now();
+
+  return (StatsTimestamp){
+      .wall_seconds = now.wall_seconds - since.wall_seconds,
+      .user_seconds = now.user_seconds - since.user_seconds,
+      .system_seconds = now.system_seconds - since.system_seconds,
+      .minor_page_faults = now.minor_page_faults - since.minor_page_faults,
+      .major_page_faults = now.major_page_faults - since.major_page_faults,
+  };
+}
+
+void stats_record(Stats *maybe_stats, StatsPhase phase, StatsTimestamp since) {
+  assert(phase < NUM_STATS_PHASES);
+
+  if (!maybe_stats) {
+    return;
+  }
+
+  const StatsTimestamp elapsed = stats_elapsed(since);
+  StatsTimestamp *const total = &maybe_stats->phases[phase];
+
+  total->wall_seconds += elapsed.wall_seconds;
+  total->user_seconds += elapsed.user_seconds;
+  total->system_seconds += elapsed.system_seconds;
+  total->minor_page_faults += elapsed.minor_page_faults;
+  total->major_page_faults += elapsed.major_page_faults;
+}
+
+static Error print_text_stats(const Stats *stats, StatsTimestamp total,
+                              FileSyscallCounts syscalls);
+static Error print_json_stats(const Stats *stats, StatsTimestamp total,
+                              FileSyscallCounts syscalls);
+
+Error print_stats(const Stats *stats, StatsFormat format) {
+  assert(stats);
+
+  StatsTimestamp total = {.wall_seconds = 0,
+                          .user_seconds = 0,
+                          .system_seconds = 0,
+                          .minor_page_faults = 0,
+                          .major_page_faults = 0};
+
+  for (size_t i = 0; i < NUM_STATS_PHASES; ++i) {
+    total.wall_seconds += stats->phases[i].wall_seconds;
+    total.user_seconds += stats->phases[i].user_seconds;
+    total.system_seconds += stats->phases[i].system_seconds;
+    total.minor_page_faults += stats->phases[i].minor_page_faults;
+    total.major_page_faults += stats->phases[i].major_page_faults;
+  }
+
+  // stats->syscalls holds the counts from when the stats were made
+  const FileSyscallCounts syscalls = {
+      .num_mmaps = file_syscall_counts.num_mmaps - stats->syscalls.num_mmaps,
+      .num_munmaps =
+          file_syscall_counts.num_munmaps - stats->syscalls.num_munmaps,
+      .num_mremaps =
+          file_syscall_counts.num_mremaps - stats->syscalls.num_mremaps,
+      .num_ftruncates =
+          file_syscall_counts.num_ftruncates - stats->syscalls.num_ftruncates,
+  };
+
+  if (format == STATS_FORMAT_JSON) {
+    return print_json_stats(stats, total, syscalls);
+  }
+
+  return print_text_stats(stats, total, syscalls);
+}
+
+static double timeval_to_seconds(struct timeval time) {
+  return (double)time.tv_sec + (double)time.tv_usec * 1e-6;
+}
+
+static Error print_text_phase(const char *name, StatsTimestamp phase);
+
+static Error print_text_stats(const Stats *stats, StatsTimestamp total,
+                              FileSyscallCounts syscalls) {
+  assert(stats);
+
+  if (fprintf(stderr,
+              "%s: stats:\n"
+              "    %-10s %12s %12s %12s %12s %12s\n",
+              executable_name, "phase", "wall (s)", "user (s)", "system (s)",
+              "minor faults", "major faults") < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  Error error;
+
+  for (size_t i = 0; i < NUM_STATS_PHASES; ++i) {
+    if ((error = print_text_phase(STATS_PHASE_NAMES[i], stats->phases[i])),
+        error.what) {
+      return error;
+    }
+  }
+
+  if ((error = print_text_phase("total", total)), error.what) {
+    return error;
+  }
+
+  if (fprintf(stderr,
+              "    bytes in:         %zu\n"
+              "    bytes out:        %zu\n"
+              "    run calls:        %zu\n"
+              "    mmap calls:       %zu\n"
+              "    munmap calls:     %zu\n"
+              "    mremap calls:     %zu\n"
+              "    ftruncate calls:  %zu\n",
+              stats->bytes_in, stats->bytes_out, stats->num_runs,
+              syscalls.num_mmaps, syscalls.num_munmaps, syscalls.num_mremaps,
+              syscalls.num_ftruncates) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  const StatsMemoryPlan *const plan = &stats->memory_plan;
+
+  if (plan->limit > 0 &&
+      fprintf(stderr,
+              "    memory limit:     %zu\n"
+              "    process memory:   %zu\n"
+              "    codec memory:     %zu (%s)\n"
+              "    input window:     %zu\n"
+              "    output window:    %zu\n",
+              plan->limit, plan->process_size, plan->codec.size,
+              plan->codec.parameters,
+              plan->input_window_size, plan->output_window_size) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  const PerfCounts *const counts = &stats->perf_counts;
+
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    if (!counts->is_available[i]) {
+      continue;
+    }
+
+    if (fprintf(stderr, "    %-17s %" PRIu64 "\n", PERF_EVENT_NAMES[i],
+                counts->values[i]) < 0) {
+      return UNWRITEABLE_STATS();
+    }
+  }
+
+  double ipc;
+  double cycles_per_byte;
+
+  if (get_ipc(&stats->perf_counts, &ipc) &&
+      fprintf(stderr, "    %-17s %.3f\n", "ipc", ipc) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  if (get_cycles_per_byte(&stats->perf_counts, stats->uncompressed_bytes,
+                          &cycles_per_byte) &&
+      fprintf(stderr, "    %-17s %.3f\n", "cycles/byte", cycles_per_byte) <
+          0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  return NULL_ERROR;
+}
+
+static Error print_text_phase(const char *name, StatsTimestamp phase) {
+  assert(name);
+
+  if (fprintf(stderr, "    %-10s %12.6f %12.6f %12.6f %12zu %12zu\n", name,
+              phase.wall_seconds, phase.user_seconds, phase.system_seconds,
+              phase.minor_page_faults, phase.major_page_faults) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  return NULL_ERROR;
+}
+
+static Error print_json_phase(const char *name, StatsTimestamp phase);
+
+// executable_name is printed as-is, so it must not need escaping
+static Error print_json_stats(const Stats *stats, StatsTimestamp total,
+                              FileSyscallCounts syscalls) {
+  assert(stats);
+
+  if (fprintf(stderr, "{\"executable\": \"%s\", \"phases\": {",
+              executable_name) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  Error error;
+
+  for (size_t i = 0; i < NUM_STATS_PHASES; ++i) {
+    if (i > 0 && fputs(", ", stderr) == EOF) {
+      return UNWRITEABLE_STATS();
+    }
+
+    if ((error = print_json_phase(STATS_PHASE_NAMES[i], stats->phases[i])),
+        error.what) {
+      return error;
+    }
+  }
+
+  if (fputs("}, ", stderr) == EOF) {
+    return UNWRITEABLE_STATS();
+  }
+
+  if ((error = print_json_phase("total", total)), error.what) {
+    return error;
+  }
+
+  if (fprintf(stderr,
+              ", \"bytes_in\": %zu, \"bytes_out\": %zu, \"run_calls\": %zu, "
+              "\"mmap_calls\": %zu, \"munmap_calls\": %zu, "
+              "\"mremap_calls\": %zu, \"ftruncate_calls\": %zu",
+              stats->bytes_in, stats->bytes_out, stats->num_runs,
+              syscalls.num_mmaps, syscalls.num_munmaps, syscalls.num_mremaps,
+              syscalls.num_ftruncates) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  const StatsMemoryPlan *const plan = &stats->memory_plan;
+  // parameters are name=value pairs of identifiers and numbers, which need no
+  // escaping
+  const int plan_result =
+      (plan->limit > 0)
+          ? fprintf(stderr,
+                    ", \"memory_plan\": {\"limit\": %zu, \"process\": %zu, "
+                    "\"codec\": %zu, \"codec_parameters\": \"%s\", "
+                    "\"input_window\": %zu, \"output_window\": %zu}",
+                    plan->limit, plan->process_size, plan->codec.size,
+                    plan->codec.parameters,
+                    plan->input_window_size, plan->output_window_size)
+          : fputs(", \"memory_plan\": null", stderr);
+
+  if (plan_result < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  // unavailable counters are null rather than missing
+  for (size_t i = 0; i < NUM_PERF_EVENTS; ++i) {
+    const int result =
+        stats->perf_counts.is_available[i]
+            ? fprintf(stderr, ", \"%s\": %" PRIu64, PERF_EVENT_NAMES[i],
+                      stats->perf_counts.values[i])
+            : fprintf(stderr, ", \"%s\": null", PERF_EVENT_NAMES[i]);
+
+    if (result < 0) {
+      return UNWRITEABLE_STATS();
+    }
+  }
+
+  double ipc;
+  double cycles_per_byte;
+  int result = get_ipc(&stats->perf_counts, &ipc)
+                   ? fprintf(stderr, ", \"ipc\": %.3f", ipc)
+                   : fputs(", \"ipc\": null", stderr);
+
+  if (result < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  result = get_cycles_per_byte(&stats->perf_counts, stats->uncompressed_bytes,
+                               &cycles_per_byte)
+               ? fprintf(stderr, ", \"cycles_per_byte\": %.3f", cycles_per_byte)
+               : fputs(", \"cycles_per_byte\": null", stderr);
+
+  if (result < 0 || fputs("}\n", stderr) == EOF) {
+    return UNWRITEABLE_STATS();
+  }
+
+  return NULL_ERROR;
+}
+
+static Error print_json_phase(const char *name, StatsTimestamp phase) {
+  assert(name);
+
+  if (fprintf(stderr,
+              "\"%s\": {\"wall_seconds\": %.9f, \"user_seconds\": %.6f, "
+              "\"system_seconds\": %.6f, \"minor_page_faults\": %zu, "
+              "\"major_page_faults\": %zu}",
+              name, phase.wall_seconds, phase.user_seconds,
+              phase.system_seconds, phase.minor_page_faults,
+              phase.major_page_faults) < 0) {
+    return UNWRITEABLE_STATS();
+  }
+
+  return NULL_ERROR;
+}
@@ -0,0 +1,698 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/argparse.h>
+#include <common/error.h>
+#include <common/file.h>
+#include <common/mmc.h>
+#include <common/numa.h>
+#include <mmc/mmc.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+// decoded data passes through NUM_SLOTS slots of SLOT_SIZE bytes each, so the
+// uncompressed contents are never held in memory all at once
+#define SLOT_SIZE ((size_t)1 << 20)
+#define NUM_SLOTS 4
+
+typedef struct Stage {
+  const MmcCodec *codec;
+  void *state;
+  AppIOState io_state;
+  bool is_initialized;
+} Stage;
+
+typedef struct Transcoder {
+  Stage decoder;
+  Stage encoder;
+
+  FileAndMapping window;
+  size_t slot_sizes[NUM_SLOTS];
+
+  // NULL unless --numa was given. accesses are only counted by the thread
+  // that decompresses
+  const NumaTopology *maybe_numa;
+  NumaAccessCounts accesses;
+
+  // the rest is only used when the stages run on separate threads
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+
+  // slots are filled and drained in order, so these only ever increase
+  size_t num_filled;
+  size_t num_drained;
+  bool decoder_finished;
+  bool is_cancelled;
+  Error decoder_error;
+} Transcoder;
+
+static Error create_stage(MmcCodecId codec, int level, MmcDirection direction,
+                          Stage *stage);
+static void free_stage(Stage *stage);
+static Error transcode(Transcoder *transcoder);
+static Error transcode_in_parallel(Transcoder *transcoder);
+
+int main(int argc, const char *const argv[]) {
+  PassthroughArgumentParser input_filename_parser =
+      make_passthrough_parser("INPUT_FILE", NULL);
+  PassthroughArgumentParser output_filename_parser =
+      make_passthrough_parser("OUTPUT_FILE", NULL);
+
+  StringArgumentParser from_parser = make_string_parser(
+      "-f, --from", "CODEC", NUM_MMC_CODECS, MMC_CODEC_NAMES);
+  KeywordArgument from = {
+      .short_name = 'f',
+      .long_name = "from",
+      .help_text = "Codec that INPUT_FILE is compressed with. One of 'zlib', "
+                   "'gzip', 'raw' (headerless DEFLATE data), 'lz4', or 'zstd'. "
+                   "Only codecs that mmc was built with are available.",
+      .parser = &from_parser.argument_parser,
+  };
+
+  StringArgumentParser to_parser = make_string_parser(
+      "-t, --to", "CODEC", NUM_MMC_CODECS, MMC_CODEC_NAMES);
+  KeywordArgument to = {
+      .short_name = 't',
+      .long_name = "to",
+      .help_text = "Codec to compress OUTPUT_FILE with. Accepts the same "
+                   "values as --from.",
+      .parser = &to_parser.argument_parser,
+  };
+
+  IntegerArgumentParser level_parser =
+      make_integer_parser("-l, --level", "LEVEL", INT_MIN, INT_MAX);
+  KeywordArgument level = {
+      .short_name = 'l',
+      .long_name = "level",
+      .help_text = "Compression level of OUTPUT_FILE, with the same meaning "
+                   "and range as the corresponding frontend's --level. "
+                   "Defaults to the codec's default level.",
+      .parser = &level_parser.argument_parser,
+  };
+
+  KeywordArgument parallel = {
+      .short_name = 'p',
+      .long_name = "parallel",
+      .help_text = "Decompress on a separate thread, so that decompression "
+                   "runs ahead of compression by up to four windows of one "
+                   "MiB each.",
+      .parser = NULL,
+  };
+
+  StringArgumentParser numa_parser = make_string_parser(
+      "-n, --numa", "MODE", NUM_NUMA_MODES, NUMA_MODE_NAMES);
+  KeywordArgument numa = {
+      .short_name = 'n',
+      .long_name = "numa",
+      .help_text =
+          "How to place threads and memory on NUMA nodes. 'local' pins both "
+          "stages to the CPUs of the node that holds most of INPUT_FILE's "
+          "resident pages, and places the window there too. 'interleave' "
+          "spreads all memory evenly across nodes. 'off' leaves placement "
+          "to the kernel. With any of them, a sample of the input pages "
+          "that were decompressed is checked, and how many were on another "
+          "node is printed afterwards.",
+      .parser = &numa_parser.argument_parser,
+  };
+
+  KeywordArgument *keyword_args[] = {&from, &to, &level, &parallel, &numa};
+
+  Arguments arguments = {
+      .executable_name = "mmc-transcode",
+      .version = MMC_VERSION,
+      .author = MMC_AUTHOR,
+      .description =
+          "mmc-transcode converts a compressed file from one codec to "
+          "another without writing the uncompressed contents anywhere. "
+          "INPUT_FILE is mapped into memory and decompressed one window at "
+          "a time, and each window is compressed into OUTPUT_FILE as soon as "
+          "it is full.",
+
+      .positional_args =
+          (PositionalArgument *[]){
+              &(PositionalArgument){
+                  .name = "INPUT_FILE",
+                  .help_text = "Compressed file to read from.",
+                  .parser = &input_filename_parser.argument_parser,
+              },
+              &(PositionalArgument){
+                  .name = "OUTPUT_FILE",
+                  .help_text = "File to write to. It is created or "
+                               "truncated, then removed if an error occurs.",
+                  .parser = &output_filename_parser.argument_parser,
+              },
+          },
+      .num_positional_args = 2,
+
+      .keyword_args = keyword_args,
+      .num_keyword_args = sizeof(keyword_args) / sizeof(keyword_args[0]),
+  };
+
+  Error error = parse_arguments(&arguments, argc, argv);
+
+  if (error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if (arguments.has_help) {
+    print_help(&arguments);
+
+    return EXIT_SUCCESS;
+  } else if (arguments.has_version) {
+    print_version(&arguments);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (!from.was_found || !to.was_found) {
+    print_error(STATIC_ERROR("both --from and --to are required"));
+
+    return EXIT_FAILURE;
+  }
+
+  const MmcCodecId from_codec = (MmcCodecId)from_parser.value_index;
+  MmcOptions to_options = mmc_make_options((MmcCodecId)to_parser.value_index);
+
+  if (level.was_found) {
+    to_options.level = (int)level_parser.value;
+  }
+
+  if ((error = mmc_check_options(&to_options)), error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  const char *const input_filename = input_filename_parser.value;
+  const char *const output_filename = output_filename_parser.value;
+
+  NumaTopology topology;
+
+  if (numa.was_found &&
+      (error = make_numa_topology((NumaMode)numa_parser.value_index,
+                                  &topology),
+       error.what)) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  Transcoder transcoder = {.maybe_numa = numa.was_found ? &topology : NULL,
+                           .accesses = {.local_pages = 0, .remote_pages = 0},
+                           .num_filled = 0,
+                           .num_drained = 0,
+                           .decoder_finished = false,
+                           .is_cancelled = false,
+                           .decoder_error = NULL_ERROR};
+  int return_code = EXIT_SUCCESS;
+
+  if ((error = open_and_map_file(input_filename,
+                                 &transcoder.decoder.io_state.input_file)),
+      error.what) {
+    print_error(error);
+
+    return EXIT_FAILURE;
+  }
+
+  if ((error = create_anonymous_mapping("decompression window",
+                                        NUM_SLOTS * SLOT_SIZE,
+                                        &transcoder.window)),
+      error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+
+    goto cleanup_input;
+  }
+
+  // before the window is touched, and before the decompression thread is
+  // created so that it inherits the binding
+  if (numa.was_found) {
+    const FileAndMapping *const input_file =
+        &transcoder.decoder.io_state.input_file;
+    const size_t node_index = find_numa_range_node(
+        &topology, input_file->mapping, input_file->mapping_size);
+
+    if ((error = bind_thread_to_numa_node(&topology, node_index)),
+        !error.what) {
+      error = place_numa_range(&topology, node_index, transcoder.window.mapping,
+                               transcoder.window.mapping_size);
+    }
+
+    if (error.what) {
+      print_error(error);
+      return_code = EXIT_FAILURE;
+
+      goto cleanup_window;
+    }
+  }
+
+  // grown as needed, then truncated to what was written
+  if ((error = create_and_map_file(output_filename, SLOT_SIZE,
+                                   &transcoder.encoder.io_state.output_file)),
+      error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+
+    goto cleanup_window;
+  }
+
+  if ((error = create_stage(from_codec, 0, MMC_DIRECTION_DECOMPRESS,
+                            &transcoder.decoder)),
+      error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+
+    goto cleanup_output;
+  }
+
+  if ((error = create_stage(to_options.codec, to_options.level,
+                            MMC_DIRECTION_COMPRESS, &transcoder.encoder)),
+      error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+
+    goto cleanup_decoder;
+  }
+
+  if (parallel.was_found) {
+    error = transcode_in_parallel(&transcoder);
+  } else {
+    error = transcode(&transcoder);
+  }
+
+  if (error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+  } else if (numa.was_found &&
+             (error = print_numa_stats(&topology, transcoder.accesses),
+              error.what)) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+  } else if (ftruncate(transcoder.encoder.io_state.output_file.fd,
+                       (off_t)transcoder.encoder.io_state
+                           .output_bytes_written) == -1) {
+    print_error(
+        ERRNO_EFORMAT("couldn't resize output file '%s'", output_filename));
+    return_code = EXIT_FAILURE;
+  }
+
+  free_stage(&transcoder.encoder);
+
+cleanup_decoder:
+  free_stage(&transcoder.decoder);
+
+cleanup_output:
+  if ((error = free_file(transcoder.encoder.io_state.output_file)),
+      error.what) {
+    print_error(error);
+    return_code = EXIT_FAILURE;
+  }
+
+  if (return_code != EXIT_SUCCESS) {
+    unlink(output_filename);
+  }
+
+cleanup_window:
+  if ((error = free_file(transcoder.window)), error.what) {
+    print_warning(error);
+  }
+
+cleanup_input:
+  if ((error = free_file(transcoder.decoder.io_state.input_file)),
+      error.what) {
+    print_warning(error);
+  }
+
+  return return_code;
+}
+
+static Error create_stage(MmcCodecId codec, int level, MmcDirection direction,
+                          Stage *stage) {
+  assert(codec < NUM_MMC_CODECS);
+  assert(stage);
+
+  stage->codec = mmc_get_codec(codec, direction);
+  stage->is_initialized = false;
+
+  if (!stage->codec) {
+    return eformat("mmc-transcode was built without support for codec '%s'",
+                   MMC_CODEC_NAMES[codec]);
+  }
+
+  stage->state = malloc(stage->codec->state_size);
+
+  if (!stage->state) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  MmcOptions options = mmc_make_options(codec);
+  options.level = level;
+  stage->codec->configure(stage->state, &options);
+
+  AppIOState *const io_state = &stage->io_state;
+  io_state->input_mapping_first_unused_offset = 0;
+  io_state->output_mapping_first_unused_offset = 0;
+  io_state->output_bytes_written = 0;
+  io_state->input_is_partial = false;
+
+  // the decoder's input and the encoder's output are already mapped, and the
+  // other end of each is pointed at the window one slot at a time
+  const Error error = stage->codec->init(io_state, stage->state);
+
+  if (error.what) {
+    free(stage->state);
+
+    return error;
+  }
+
+  stage->is_initialized = true;
+
+  return NULL_ERROR;
+}
+
+static void free_stage(Stage *stage) {
+  assert(stage);
+
+  if (!stage->is_initialized) {
+    return;
+  }
+
+  if (stage->codec->cleanup) {
+    stage->codec->cleanup(&stage->io_state, stage->state);
+  }
+
+  free(stage->state);
+  stage->is_initialized = false;
+}
+
+static FileAndMapping slot_view(const Transcoder *transcoder, size_t index,
+                                size_t size) {
+  assert(transcoder);
+  assert(index < NUM_SLOTS);
+  assert(size <= SLOT_SIZE);
+
+  return (FileAndMapping){
+      .filename = transcoder->window.filename,
+
+      .fd = -1,
+      .file_size = size,
+
+      .mapping = (char *)transcoder->window.mapping + index * SLOT_SIZE,
+      .mapping_size = size,
+      .mapping_offset = 0,
+  };
+}
+
+// decompresses into a slot until it is full or the input is exhausted
+static Error fill_slot(Transcoder *transcoder, size_t index, size_t *size,
+                       bool *finished) {
+  assert(transcoder);
+  assert(size);
+  assert(finished);
+
+  Stage *const decoder = &transcoder->decoder;
+  AppIOState *const io_state = &decoder->io_state;
+
+  io_state->output_file = slot_view(transcoder, index, SLOT_SIZE);
+  io_state->output_mapping_first_unused_offset = 0;
+  *finished = false;
+
+  Error error;
+
+  while (!*finished && io_state->output_mapping_first_unused_offset <
+                           io_state->output_file.mapping_size) {
+    const size_t input_offset = io_state->input_mapping_first_unused_offset;
+
+    if ((error = decoder->codec->run(io_state, finished, decoder->state)),
+        error.what) {
+      return error;
+    }
+
+    // before the pages that were read are unmapped
+    if (transcoder->maybe_numa) {
+      count_numa_accesses(
+          transcoder->maybe_numa,
+          (const char *)io_state->input_file.mapping + input_offset,
+          io_state->input_mapping_first_unused_offset - input_offset,
+          &transcoder->accesses);
+    }
+
+    // not the end of the world if we can't unmap unused pages
+    if ((error = unmap_unused_pages(
+             &io_state->input_file,
+             &io_state->input_mapping_first_unused_offset)),
+        error.what) {
+      print_warning(error);
+    }
+  }
+
+  *size = io_state->output_mapping_first_unused_offset;
+
+  return NULL_ERROR;
+}
+
+// compresses a slot, finishing the output if it holds the last of the input
+static Error drain_slot(Transcoder *transcoder, size_t index, size_t size,
+                        bool is_last) {
+  assert(transcoder);
+
+  Stage *const encoder = &transcoder->encoder;
+  AppIOState *const io_state = &encoder->io_state;
+
+  io_state->input_file = slot_view(transcoder, index, size);
+  io_state->input_mapping_first_unused_offset = 0;
+  io_state->input_is_partial = !is_last;
+
+  bool finished = false;
+  Error error;
+
+  for (;;) {
+    const size_t offset = io_state->input_mapping_first_unused_offset;
+
+    if (offset == size && !is_last) {
+      break;
+    }
+
+    // codecs size their output for all of their input at once
+    FileAndMapping remaining = slot_view(transcoder, index, size);
+    remaining.mapping = (char *)remaining.mapping + offset;
+    remaining.file_size -= offset;
+    remaining.mapping_size -= offset;
+
+    if ((error = reserve_output_space(
+             &io_state->output_file,
+             io_state->output_mapping_first_unused_offset,
+             encoder->codec->size(&remaining, encoder->state))),
+        error.what) {
+      return error;
+    }
+
+    if ((error = encoder->codec->run(io_state, &finished, encoder->state)),
+        error.what) {
+      return error;
+    }
+
+    if ((error = unmap_unused_pages(
+             &io_state->output_file,
+             &io_state->output_mapping_first_unused_offset)),
+        error.what) {
+      print_warning(error);
+    }
+
+    if (finished) {
+      break;
+    }
+  }
+
+  return NULL_ERROR;
+}
+
+static Error transcode(Transcoder *transcoder) {
+  assert(transcoder);
+
+  // LZ4 refers back to the previous slot, so consecutive slots must differ
+  for (size_t i = 0;; ++i) {
+    const size_t index = i % NUM_SLOTS;
+    size_t size;
+    bool finished;
+    Error error;
+
+    if ((error = fill_slot(transcoder, index, &size, &finished)), error.what) {
+      return error;
+    }
+
+    if ((error = drain_slot(transcoder, index, size, finished)), error.what) {
+      return error;
+    }
+
+    if (finished) {
+      return NULL_ERROR;
+    }
+  }
+}
+
+static void *decode_slots(void *transcoder_v);
+
+static Error transcode_in_parallel(Transcoder *transcoder) {
+  assert(transcoder);
+
+  int errc = pthread_mutex_init(&transcoder->mutex, NULL);
+
+  if (errc != 0) {
+    return eformat("couldn't initialize window mutex: %s (%d)",
+                   strerror(errc), errc);
+  }
+
+  Error error = NULL_ERROR;
+
+  if ((errc = pthread_cond_init(&transcoder->condition, NULL)) != 0) {
+    error = eformat("couldn't initialize window condition variable: %s (%d)",
+                    strerror(errc), errc);
+
+    goto cleanup_mutex;
+  }
+
+  pthread_t decoder_thread;
+
+  if ((errc = pthread_create(&decoder_thread, NULL, decode_slots,
+                             transcoder)) != 0) {
+    error = eformat("couldn't create decompression thread: %s (%d)",
+                    strerror(errc), errc);
+
+    goto cleanup_condition;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&transcoder->mutex);
+
+    while (transcoder->num_drained == transcoder->num_filled &&
+           !transcoder->decoder_finished) {
+      pthread_cond_wait(&transcoder->condition, &transcoder->mutex);
+    }
+
+    // nothing more is drained once decompression fails
+    const bool has_slot = !transcoder->decoder_error.what &&
+                          transcoder->num_drained < transcoder->num_filled;
+    const size_t index = transcoder->num_drained % NUM_SLOTS;
+    const size_t size = transcoder->slot_sizes[index];
+    // the decoder can't finish again, so this is the last slot
+    const bool is_last = transcoder->decoder_finished &&
+                         transcoder->num_drained + 1 == transcoder->num_filled;
+
+    pthread_mutex_unlock(&transcoder->mutex);
+
+    if (!has_slot) {
+      break;
+    }
+
+    if ((error = drain_slot(transcoder, index, size, is_last)), error.what) {
+      break;
+    }
+
+    pthread_mutex_lock(&transcoder->mutex);
+    ++transcoder->num_drained;
+    pthread_cond_signal(&transcoder->condition);
+    pthread_mutex_unlock(&transcoder->mutex);
+
+    if (is_last) {
+      break;
+    }
+  }
+
+  if (error.what) {
+    pthread_mutex_lock(&transcoder->mutex);
+    transcoder->is_cancelled = true;
+    pthread_cond_signal(&transcoder->condition);
+    pthread_mutex_unlock(&transcoder->mutex);
+  }
+
+  pthread_join(decoder_thread, NULL);
+
+  if (!error.what) {
+    error = transcoder->decoder_error;
+  } else {
+    discard_error(transcoder->decoder_error);
+  }
+
+cleanup_condition:
+  pthread_cond_destroy(&transcoder->condition);
+
+cleanup_mutex:
+  pthread_mutex_destroy(&transcoder->mutex);
+
+  return error;
+}
+
+static void *decode_slots(void *transcoder_v) {
+  assert(transcoder_v);
+
+  Transcoder *const transcoder = (Transcoder *)transcoder_v;
+
+  for (;;) {
+    pthread_mutex_lock(&transcoder->mutex);
+
+    while (transcoder->num_filled - transcoder->num_drained == NUM_SLOTS &&
+           !transcoder->is_cancelled) {
+      pthread_cond_wait(&transcoder->condition, &transcoder->mutex);
+    }
+
+    const bool is_cancelled = transcoder->is_cancelled;
+    const size_t index = transcoder->num_filled % NUM_SLOTS;
+
+    pthread_mutex_unlock(&transcoder->mutex);
+
+    if (is_cancelled) {
+      return NULL;
+    }
+
+    // only this thread writes to free slots
+    size_t size = 0;
+    bool finished;
+    const Error error = fill_slot(transcoder, index, &size, &finished);
+
+    pthread_mutex_lock(&transcoder->mutex);
+
+    if (error.what) {
+      transcoder->decoder_error = error;
+      transcoder->decoder_finished = true;
+    } else {
+      transcoder->slot_sizes[index] = size;
+      ++transcoder->num_filled;
+      transcoder->decoder_finished = finished;
+    }
+
+    pthread_cond_signal(&transcoder->condition);
+    pthread_mutex_unlock(&transcoder->mutex);
+
+    if (transcoder->decoder_finished) {
+      return NULL;
+    }
+  }
+}
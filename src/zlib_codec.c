@@ -0,0 +1,1283 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <common/zlib_codec.h>
+
+#include <common/checksum.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MIN(X, Y) (((Y) < (X)) ? (Y) : (X))
+
+const char *const ZLIB_FORMAT_NAMES[3] = {"zlib", "gzip", "raw"};
+const char *const ZLIB_DECODER_NAMES[2] = {"fast", "zlib"};
+
+// header + trailer bytes written around the DEFLATE data
+static const size_t FORMAT_WRAPPER_SIZE[] = {2 + 4, 10 + 8, 0};
+
+// even the largest windows need less than this, about 48KiB. deflate's arena
+// is sized by its window and hash table instead
+#define ZLIB_ARENA_SIZE ((size_t)2 << 20)
+
+// every full flush discards the history window, so rsyncable chunks are kept
+// a few windows long to limit the cost to ratio
+#define RSYNCABLE_AVERAGE_CHUNK_SIZE ((size_t)64 << 10)
+
+static size_t max_compressed_size(size_t uncompressed_size,
+                                  size_t wrapper_size);
+static int format_window_bits(ZlibFormat format, int window_bits);
+static bool limit_to_chunk(DeflateState *state, bool input_is_partial);
+static void apply_adapted_level(AppIOState *io_state, DeflateState *state);
+static voidpf arena_zalloc(voidpf opaque, uInt items, uInt size);
+static void arena_zfree(voidpf opaque, voidpf address);
+static Error check_zlib_header(const FileAndMapping *input_file,
+                               int max_window_bits);
+static Error fast_inflate_run(AppIOState *io_state, bool *finished,
+                              InflateState *state);
+static Error make_inflate_error(const z_stream *stream, int errc);
+
+DeflateOptions make_deflate_options(void) {
+  return (DeflateOptions){
+      .level = Z_DEFAULT_COMPRESSION,
+      .strategy = Z_DEFAULT_STRATEGY,
+      .format = ZLIB_FORMAT_ZLIB,
+      .window_bits = MAX_WBITS,
+      .mem_level = DEFLATE_DEFAULT_MEM_LEVEL,
+      .rsyncable = false,
+      .adapt = false,
+      .adapt_min_level = 1,
+      .adapt_max_level = Z_BEST_COMPRESSION,
+  };
+}
+
+InflateOptions make_inflate_options(void) {
+  return (InflateOptions){
+      .format = ZLIB_FORMAT_ZLIB,
+      .window_bits = MAX_WBITS,
+      .decoder = ZLIB_DECODER_FAST,
+  };
+}
+
+size_t deflate_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  const DeflateState *const state = (const DeflateState *)state_v;
+
+  return max_compressed_size(input_file->file_size,
+                             FORMAT_WRAPPER_SIZE[state->options.format]);
+}
+
+static size_t estimate_deflate_memory(const DeflateOptions *options);
+static size_t get_deflate_allocation_size(const DeflateOptions *options);
+
+CodecMemoryPlan deflate_fit_memory(const FileAndMapping *input_file,
+                                   size_t budget, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)input_file;
+
+  DeflateOptions *const options = &((DeflateState *)state_v)->options;
+  size_t size = estimate_deflate_memory(options);
+
+  // shrink whichever of the window and the hash table is larger
+  while (size > budget) {
+    const bool window_is_larger =
+        options->window_bits + 2 >= options->mem_level + 9;
+
+    if (window_is_larger && options->window_bits > DEFLATE_MIN_WINDOW_BITS) {
+      --options->window_bits;
+    } else if (options->mem_level > 1) {
+      --options->mem_level;
+    } else if (options->window_bits > DEFLATE_MIN_WINDOW_BITS) {
+      --options->window_bits;
+    } else {
+      break;
+    }
+
+    size = estimate_deflate_memory(options);
+  }
+
+  CodecMemoryPlan plan = {.size = size};
+  snprintf(plan.parameters, sizeof(plan.parameters),
+           "window_bits=%d mem_level=%d", options->window_bits,
+           options->mem_level);
+
+  return plan;
+}
+
+Error deflate_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+  (void)io_state;
+
+  DeflateState *const state = (DeflateState *)state_v;
+  DeflateOptions *const options = &state->options;
+
+  if (options->adapt) {
+    // Z_DEFAULT_COMPRESSION is level 6
+    state->adapter = make_level_adapter(
+        options->adapt_min_level, options->adapt_max_level,
+        options->level == Z_DEFAULT_COMPRESSION ? 6 : options->level, false);
+    options->level = state->adapter.level;
+  }
+
+  // just big enough, so that estimate_deflate_memory holds
+  Error error =
+      create_arena(get_deflate_allocation_size(options), &state->arena);
+
+  if (error.what) {
+    return error;
+  }
+
+  state->stream = (z_stream){
+      .zalloc = arena_zalloc, .zfree = arena_zfree, .opaque = &state->arena};
+  state->is_finishing = false;
+  state->chunk_sizes = make_chunk_sizes(RSYNCABLE_AVERAGE_CHUNK_SIZE);
+  state->chunk_remaining = 0;
+  state->chunk_is_cut = false;
+  state->is_flushing = false;
+
+  const int init_errc = deflateInit2(
+      &state->stream, options->level, Z_DEFLATED,
+      format_window_bits(options->format, options->window_bits),
+      options->mem_level, options->strategy);
+
+  if (init_errc != Z_OK) {
+    assert(init_errc != Z_STREAM_ERROR);
+
+    const char *what;
+    switch (init_errc) {
+    case Z_MEM_ERROR:
+      what = "out of memory";
+
+      break;
+
+    case Z_VERSION_ERROR:
+      what = "zlib library version mismatch";
+
+      break;
+    default:
+      assert(false);
+      what = "unknown error";
+    }
+
+    if (state->stream.msg) {
+      error = eformat("couldn't initialize deflate stream: %s (%d): %s", what,
+                      init_errc, state->stream.msg);
+    } else {
+      error = eformat("couldn't initialize deflate stream: %s (%d)", what,
+                      init_errc);
+    }
+
+    free_arena(state->arena);
+
+    return error;
+  }
+
+  return NULL_ERROR;
+}
+
+Error deflate_run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  DeflateState *const state = (DeflateState *)state_v;
+
+  z_stream *const stream = &state->stream;
+
+  if (state->options.adapt && state->adapter.level != state->options.level) {
+    apply_adapted_level(io_state, state);
+  }
+
+  const size_t input_remaining = io_state->input_file.mapping_size -
+                                 io_state->input_mapping_first_unused_offset;
+
+  stream->next_in = (z_const Bytef *)io_state->input_file.mapping +
+                    io_state->input_mapping_first_unused_offset;
+  stream->avail_in = (uInt)MIN(input_remaining, CODEC_SLICE_SIZE);
+
+  stream->next_out = (Bytef *)io_state->output_file.mapping +
+                     io_state->output_mapping_first_unused_offset;
+  stream->avail_out =
+      (uInt)MIN(io_state->output_file.mapping_size -
+                    io_state->output_mapping_first_unused_offset,
+                (size_t)UINT_MAX);
+
+  bool ends_at_cut = false;
+
+  if (state->is_flushing) {
+    stream->avail_in = 0;
+  } else if (state->options.rsyncable && !state->is_finishing) {
+    // the end of a slice is no more a cut point than the end of partial input
+    const bool is_sliced = (size_t)stream->avail_in < input_remaining;
+
+    ends_at_cut =
+        limit_to_chunk(state, io_state->input_is_partial || is_sliced);
+  }
+
+  if (state->options.adapt && !state->is_flushing && !state->is_finishing) {
+    const size_t limit =
+        begin_adapter_chunk(&state->adapter, (size_t)stream->avail_in);
+
+    if (limit < (size_t)stream->avail_in) {
+      stream->avail_in = (uInt)limit;
+      ends_at_cut = false;
+    }
+  }
+
+  // total_in is left alone because the gzip trailer records it
+  const uInt avail_in = stream->avail_in;
+  const uInt avail_out = stream->avail_out;
+
+  int flag;
+
+  if (state->is_flushing || ends_at_cut) {
+    flag = Z_FULL_FLUSH;
+  } else if (io_state->input_is_partial) {
+    flag = Z_NO_FLUSH;
+  } else if (state->is_finishing ||
+             ((size_t)stream->avail_in == input_remaining &&
+              (size_t)stream->avail_out >=
+                  max_compressed_size(
+                      (size_t)stream->avail_in,
+                      FORMAT_WRAPPER_SIZE[state->options.format]))) {
+    flag = Z_FINISH;
+    state->is_finishing = true;
+  } else {
+    flag = Z_NO_FLUSH;
+  }
+
+  const int errc = deflate(stream, flag);
+
+  if (errc == Z_OK || errc == Z_STREAM_END) {
+    const size_t bytes_read = (size_t)(avail_in - stream->avail_in);
+    const size_t bytes_written = (size_t)(avail_out - stream->avail_out);
+
+    io_state->input_mapping_first_unused_offset += bytes_read;
+    io_state->output_mapping_first_unused_offset += bytes_written;
+    io_state->output_bytes_written += bytes_written;
+
+    if (state->options.rsyncable) {
+      state->chunk_remaining -= bytes_read;
+    }
+
+    if (state->options.adapt && state->adapter.is_in_chunk) {
+      state->adapter.chunk_remaining -= bytes_read;
+    }
+
+    // the flush marker may not have been written out yet
+    state->is_flushing = flag == Z_FULL_FLUSH && stream->avail_in == 0 &&
+                         stream->avail_out == 0;
+  }
+
+  if (errc == Z_OK && state->options.adapt && state->adapter.is_in_chunk &&
+      state->adapter.chunk_remaining == 0) {
+    const Error error =
+        end_adapter_chunk(&state->adapter, &io_state->output_file,
+                          io_state->output_mapping_first_unused_offset);
+
+    if (error.what) {
+      return error;
+    }
+  }
+
+  if (errc != Z_OK) {
+    assert(errc != Z_STREAM_ERROR);
+    assert(errc != Z_BUF_ERROR);
+
+    const char *what;
+    switch (errc) {
+    case Z_STREAM_END: {
+      *finished = true;
+
+      return NULL_ERROR;
+    }
+    case Z_NEED_DICT:
+      what = "dictionary needed";
+
+      break;
+
+    case Z_DATA_ERROR:
+      what = "input data corrupted";
+
+      break;
+
+    case Z_MEM_ERROR:
+      what = "out of memory";
+
+      break;
+
+    default:
+      assert(false);
+      what = "unknown error";
+    }
+
+    if (stream->msg) {
+      return eformat("couldn't deflate stream: %s (%d): %s", what, errc,
+                     stream->msg);
+    }
+
+    return eformat("couldn't deflate stream: %s (%d)", what, errc);
+  }
+
+  *finished = false;
+
+  return NULL_ERROR;
+}
+
+Error deflate_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  DeflateState *const state = (DeflateState *)state_v;
+
+  // keeps the level, strategy, window, and memory level
+  const int reset_errc = deflateReset(&state->stream);
+  assert(reset_errc == Z_OK);
+  (void)reset_errc;
+
+  state->is_finishing = false;
+  state->chunk_remaining = 0;
+  state->chunk_is_cut = false;
+  state->is_flushing = false;
+
+  if (state->options.adapt) {
+    // the next stream starts at the level this one ended with
+    state->adapter = make_level_adapter(state->adapter.min_level,
+                                        state->adapter.max_level,
+                                        state->options.level, false);
+  }
+
+  return NULL_ERROR;
+}
+
+void deflate_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  DeflateState *const state = (DeflateState *)state_v;
+  deflateEnd(&state->stream);
+  free_arena(state->arena);
+}
+
+size_t inflate_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  static const size_t GZIP_MIN_MEMBER_SIZE = 10 + 2 + 8;
+
+  const InflateState *const state = (const InflateState *)state_v;
+
+  if (state->options.format != ZLIB_FORMAT_GZIP ||
+      input_file->file_size < GZIP_MIN_MEMBER_SIZE) {
+    return input_file->file_size;
+  }
+
+  // the last four bytes of a gzip member hold the uncompressed size modulo
+  // 2^32. for a single member file that is the exact output size; otherwise
+  // it is a lower bound and the output mapping is grown as usual
+  const unsigned char *const trailer =
+      (const unsigned char *)input_file->mapping + input_file->mapping_size - 4;
+  const size_t isize = (size_t)trailer[0] | (size_t)trailer[1] << 8 |
+                       (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+
+  if (isize == 0) {
+    return input_file->file_size;
+  }
+
+  return isize;
+}
+
+Error inflate_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  InflateState *const state = (InflateState *)state_v;
+  const InflateOptions *const options = &state->options;
+  z_stream *const stream = &state->stream;
+
+  Error error;
+
+  if (options->format == ZLIB_FORMAT_ZLIB) {
+    if ((error = check_zlib_header(&io_state->input_file,
+                                   options->window_bits)),
+        error.what) {
+      return error;
+    }
+  }
+
+  if ((error = create_arena(ZLIB_ARENA_SIZE, &state->arena)), error.what) {
+    return error;
+  }
+
+  int window_bits = format_window_bits(options->format, options->window_bits);
+
+  if (options->decoder == ZLIB_DECODER_FAST) {
+    if (!(state->fast = arena_allocate(&state->arena, sizeof(FastInflater)))) {
+      free_arena(state->arena);
+
+      return ERROR_OUT_OF_MEMORY;
+    }
+
+    init_fast_inflater(state->fast, (size_t)1 << options->window_bits);
+    state->phase = FAST_INFLATE_PHASE_HEADER;
+    // zlib is only given blocks
+    window_bits = -options->window_bits;
+  }
+
+  *stream = (z_stream){.next_in = NULL,
+                       .avail_in = 0,
+                       .zalloc = arena_zalloc,
+                       .zfree = arena_zfree,
+                       .opaque = &state->arena};
+
+  const int init_errc = inflateInit2(stream, window_bits);
+
+  if (init_errc != Z_OK) {
+    assert(init_errc != Z_STREAM_ERROR);
+
+    const char *what;
+    switch (init_errc) {
+    case Z_MEM_ERROR:
+      what = "out of memory";
+
+      break;
+
+    case Z_VERSION_ERROR:
+      what = "zlib library version mismatch";
+
+      break;
+    default:
+      assert(false);
+      what = "unknown error";
+    }
+
+    if (stream->msg) {
+      error = eformat("couldn't initialize inflate stream: %s (%d): %s", what,
+                      init_errc, stream->msg);
+    } else {
+      error = eformat("couldn't initialize inflate stream: %s (%d)", what,
+                      init_errc);
+    }
+
+    free_arena(state->arena);
+
+    return error;
+  }
+
+  return NULL_ERROR;
+}
+
+Error inflate_run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  InflateState *const state = (InflateState *)state_v;
+  z_stream *const stream = &state->stream;
+
+  if (state->options.decoder == ZLIB_DECODER_FAST) {
+    return fast_inflate_run(io_state, finished, state);
+  }
+
+  stream->next_in = (z_const Bytef *)io_state->input_file.mapping +
+                    io_state->input_mapping_first_unused_offset;
+  stream->avail_in = (uInt)MIN(io_state->input_file.mapping_size -
+                                   io_state->input_mapping_first_unused_offset,
+                               (size_t)UINT_MAX);
+  stream->total_in = 0;
+
+  stream->next_out = (Bytef *)io_state->output_file.mapping +
+                     io_state->output_mapping_first_unused_offset;
+  stream->avail_out =
+      (uInt)MIN(io_state->output_file.mapping_size -
+                    io_state->output_mapping_first_unused_offset,
+                (size_t)UINT_MAX);
+  stream->total_out = 0;
+
+  int flag;
+
+  if ((size_t)stream->avail_out / 1032 > (size_t)stream->avail_in) {
+    flag = Z_FINISH;
+  } else {
+    flag = Z_NO_FLUSH;
+  }
+
+  const int errc = inflate(stream, flag);
+
+  if (errc == Z_OK || errc == Z_STREAM_END || errc == Z_BUF_ERROR) {
+    io_state->input_mapping_first_unused_offset += (size_t)stream->total_in;
+    io_state->output_mapping_first_unused_offset += (size_t)stream->total_out;
+    io_state->output_bytes_written += (size_t)stream->total_out;
+  }
+
+  if (errc != Z_OK) {
+    assert(errc != Z_STREAM_ERROR);
+
+    switch (errc) {
+    case Z_STREAM_END: {
+      const size_t input_remaining =
+          io_state->input_mapping_first_unused_offset <
+                  io_state->input_file.mapping_size
+              ? io_state->input_file.mapping_size -
+                    io_state->input_mapping_first_unused_offset
+              : 0;
+
+      // gzip files may hold several concatenated members, see RFC 1952
+      if (state->options.format == ZLIB_FORMAT_GZIP && input_remaining > 0) {
+        const int reset_errc = inflateReset(stream);
+        assert(reset_errc == Z_OK);
+        (void)reset_errc;
+
+        *finished = false;
+
+        return NULL_ERROR;
+      }
+
+      *finished = true;
+
+      return NULL_ERROR;
+    }
+    case Z_BUF_ERROR:
+      if (stream->avail_out == 0) {
+        // Z_FINISH was requested but the output mapping is full; grow it
+        *finished = false;
+
+        return NULL_ERROR;
+      }
+
+      break;
+    default:
+      break;
+    }
+
+    return make_inflate_error(stream, errc);
+  }
+
+  *finished = false;
+
+  return NULL_ERROR;
+}
+
+Error inflate_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  InflateState *const state = (InflateState *)state_v;
+
+  if (state->options.format == ZLIB_FORMAT_ZLIB) {
+    const Error error =
+        check_zlib_header(&io_state->input_file, state->options.window_bits);
+
+    if (error.what) {
+      return error;
+    }
+  }
+
+  const int reset_errc = inflateReset(&state->stream);
+  assert(reset_errc == Z_OK);
+  (void)reset_errc;
+
+  if (state->options.decoder == ZLIB_DECODER_FAST) {
+    state->phase = FAST_INFLATE_PHASE_HEADER;
+  }
+
+  return NULL_ERROR;
+}
+
+void inflate_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  InflateState *const state = (InflateState *)state_v;
+  inflateEnd(&state->stream);
+  free_arena(state->arena);
+}
+
+bool inflate_has_checksum(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)input_file;
+
+  // Adler-32 in zlib trailers, CRC-32 in gzip trailers
+  return ((const InflateState *)state_v)->options.format != ZLIB_FORMAT_RAW;
+}
+
+size_t inflate_window_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  const InflateOptions *const options =
+      &((const InflateState *)state_v)->options;
+
+  // zlib headers declare the window, which check_zlib_header bounds later
+  if (options->format == ZLIB_FORMAT_ZLIB && input_file->mapping_size >= 2) {
+    const unsigned cmf = ((const unsigned char *)input_file->mapping)[0];
+    const int stream_window_bits = (int)(cmf >> 4) + 8;
+
+    if (stream_window_bits <= options->window_bits) {
+      return (size_t)1 << stream_window_bits;
+    }
+  }
+
+  return (size_t)1 << options->window_bits;
+}
+
+static Error find_gzip_data(const FileAndMapping *input_file,
+                            size_t *offset);
+
+Error inflate_stream_start(const FileAndMapping *input_file,
+                           const InflateOptions *options, size_t *offset) {
+  assert(input_file);
+  assert(options);
+  assert(offset);
+
+  switch (options->format) {
+  case ZLIB_FORMAT_ZLIB: {
+    const Error error = check_zlib_header(input_file, options->window_bits);
+
+    if (error.what) {
+      return error;
+    }
+
+    // FDICT, see RFC 1950 section 2.2
+    if (((const unsigned char *)input_file->mapping)[1] & 0x20) {
+      return eformat("couldn't inflate stream: dictionary needed (%d)",
+                     Z_NEED_DICT);
+    }
+
+    *offset = 2;
+
+    return NULL_ERROR;
+  }
+  case ZLIB_FORMAT_GZIP:
+    return find_gzip_data(input_file, offset);
+  case ZLIB_FORMAT_RAW:
+    *offset = 0;
+
+    return NULL_ERROR;
+  }
+
+  assert(false);
+
+  return NULL_ERROR;
+}
+
+static size_t max_compressed_size(size_t uncompressed_size,
+                                  size_t wrapper_size) {
+  static const size_t BLOCK_SIZE = 16000;
+  static const size_t BYTES_PER_BLOCK = 5;
+
+  size_t num_blocks = uncompressed_size / BLOCK_SIZE; // 16 KB
+
+  if (uncompressed_size % BLOCK_SIZE == 0) {
+    ++num_blocks;
+  }
+
+  return uncompressed_size + num_blocks * BYTES_PER_BLOCK + wrapper_size;
+}
+
+static int format_window_bits(ZlibFormat format, int window_bits) {
+  // the container is selected by offsetting windowBits, see deflateInit2
+  switch (format) {
+  case ZLIB_FORMAT_GZIP:
+    return window_bits + 16;
+  case ZLIB_FORMAT_RAW:
+    return -window_bits;
+  default:
+    return window_bits;
+  }
+}
+
+// restricts the input to the rest of the current chunk, starting a new one if
+// needed. returns true if this call can reach a cut point, which should be
+// marked by a full flush
+static bool limit_to_chunk(DeflateState *state, bool input_is_partial) {
+  assert(state);
+
+  z_stream *const stream = &state->stream;
+  const size_t avail_in = (size_t)stream->avail_in;
+
+  if (state->chunk_remaining == 0) {
+    const size_t chunk_size =
+        find_chunk_size(&state->chunk_sizes, stream->next_in, avail_in);
+
+    // a chunk that runs to the end of partial input may only have been cut
+    // short by it, so it is continued without a flush and the search for the
+    // next cut point starts over after it
+    state->chunk_remaining = chunk_size;
+    state->chunk_is_cut =
+        chunk_size < avail_in ||
+        (input_is_partial && chunk_size >= state->chunk_sizes.max_size);
+  }
+
+  if (avail_in < state->chunk_remaining) {
+    return false;
+  }
+
+  stream->avail_in = (uInt)state->chunk_remaining;
+
+  return state->chunk_is_cut;
+}
+
+// deflateParams compresses what has been buffered at the old level first,
+// which can need more output space than is left. in that case the change is
+// retried on the next call
+static void apply_adapted_level(AppIOState *io_state, DeflateState *state) {
+  assert(io_state);
+  assert(state);
+
+  z_stream *const stream = &state->stream;
+
+  stream->next_in = Z_NULL;
+  stream->avail_in = 0;
+  stream->next_out = (Bytef *)io_state->output_file.mapping +
+                     io_state->output_mapping_first_unused_offset;
+  stream->avail_out =
+      (uInt)MIN(io_state->output_file.mapping_size -
+                    io_state->output_mapping_first_unused_offset,
+                (size_t)UINT_MAX);
+
+  const uInt avail_out = stream->avail_out;
+  const int errc =
+      deflateParams(stream, state->adapter.level, state->options.strategy);
+  assert(errc == Z_OK || errc == Z_BUF_ERROR);
+
+  const size_t bytes_written = (size_t)(avail_out - stream->avail_out);
+  io_state->output_mapping_first_unused_offset += bytes_written;
+  io_state->output_bytes_written += bytes_written;
+
+  if (errc == Z_OK) {
+    state->options.level = state->adapter.level;
+  }
+}
+
+static Error check_zlib_header(const FileAndMapping *input_file,
+                               int max_window_bits) {
+  assert(input_file);
+
+  if (input_file->mapping_size < 2) {
+    return eformat("couldn't read zlib header of input file '%s': file is too "
+                   "short",
+                   input_file->filename);
+  }
+
+  // see RFC 1950 section 2.2
+  const unsigned char *const header =
+      (const unsigned char *)input_file->mapping;
+  const unsigned cmf = header[0];
+  const unsigned flg = header[1];
+
+  if ((cmf & 0x0f) != Z_DEFLATED || (cmf * 256 + flg) % 31 != 0) {
+    return eformat("couldn't read zlib header of input file '%s': not a zlib "
+                   "stream",
+                   input_file->filename);
+  }
+
+  const int stream_window_bits = (int)(cmf >> 4) + 8;
+
+  if (stream_window_bits > MAX_WBITS) {
+    return eformat("couldn't read zlib header of input file '%s': invalid "
+                   "window size of 2^%d bytes",
+                   input_file->filename, stream_window_bits);
+  }
+
+  if (stream_window_bits > max_window_bits) {
+    return eformat("input file '%s' requires a window of 2^%d bytes, but the "
+                   "window is limited to 2^%d bytes",
+                   input_file->filename, stream_window_bits, max_window_bits);
+  }
+
+  return NULL_ERROR;
+}
+
+// skips the header of the first gzip member, see RFC 1952 section 2.3
+static Error find_gzip_data(const FileAndMapping *input_file,
+                            size_t *offset) {
+  assert(input_file);
+  assert(offset);
+
+  static const unsigned char FHCRC = 0x02;
+  static const unsigned char FEXTRA = 0x04;
+  static const unsigned char FNAME = 0x08;
+  static const unsigned char FCOMMENT = 0x10;
+  static const unsigned char FRESERVED = 0xe0;
+
+  const unsigned char *const header =
+      (const unsigned char *)input_file->mapping;
+  const size_t size = input_file->mapping_size;
+  const char *what;
+
+  if (size < 10) {
+    what = "file is too short";
+
+    goto error;
+  } else if (header[0] != 0x1f || header[1] != 0x8b) {
+    what = "not a gzip member";
+
+    goto error;
+  } else if (header[2] != Z_DEFLATED) {
+    what = "unknown compression method";
+
+    goto error;
+  } else if (header[3] & FRESERVED) {
+    what = "unknown header flags set";
+
+    goto error;
+  }
+
+  const unsigned char flags = header[3];
+  // MTIME, XFL, and OS follow the flags
+  size_t next = 10;
+
+  if (flags & FEXTRA) {
+    if (size - next < 2) {
+      what = "file is too short";
+
+      goto error;
+    }
+
+    const size_t extra_size =
+        (size_t)header[next] | (size_t)header[next + 1] << 8;
+    next += 2;
+
+    if (size - next < extra_size) {
+      what = "file is too short";
+
+      goto error;
+    }
+
+    next += extra_size;
+  }
+
+  // the name and comment are both zero-terminated
+  for (unsigned char flag = FNAME; flag <= FCOMMENT; flag <<= 1) {
+    if (!(flags & flag)) {
+      continue;
+    }
+
+    const unsigned char *const end = memchr(header + next, 0, size - next);
+
+    if (!end) {
+      what = "file is too short";
+
+      goto error;
+    }
+
+    next = (size_t)(end - header) + 1;
+  }
+
+  if (flags & FHCRC) {
+    if (size - next < 2) {
+      what = "file is too short";
+
+      goto error;
+    }
+
+    next += 2;
+  }
+
+  *offset = next;
+
+  return NULL_ERROR;
+
+error:
+  return eformat("couldn't read gzip header of input file '%s': %s",
+                 input_file->filename, what);
+}
+
+// below this much room in the output, a block is unlikely to fit and is left
+// to zlib, which can stop partway through it
+#define FAST_BLOCK_MIN_OUTPUT ((size_t)256 << 10)
+
+static Error start_fast_stream(InflateState *state,
+                               const FileAndMapping *input_file,
+                               BitReader *reader);
+static void prime_zlib(InflateState *state, BitReader *reader);
+static Error inflate_zlib_block(InflateState *state, BitReader *reader,
+                                unsigned char **output,
+                                unsigned char *output_end, bool *is_full);
+static void update_stream_checksum(InflateState *state,
+                                   const unsigned char *data, size_t size);
+static Error finish_fast_stream(InflateState *state, BitReader *reader,
+                                bool *finished);
+
+// inflates each block with the fast decoder if it fits in the output, or
+// zlib otherwise, and checks the trailers against our own checksum of the
+// output. runs only end once zlib has filled the output, so that the input is
+// left at a byte boundary, or at the end of the input
+static Error fast_inflate_run(AppIOState *io_state, bool *finished,
+                              InflateState *state) {
+  assert(io_state);
+  assert(finished);
+  assert(state);
+
+  FastInflater *const fast = state->fast;
+  BitReader reader = {
+      .data = (const unsigned char *)io_state->input_file.mapping,
+      .size = io_state->input_file.mapping_size,
+      .position = io_state->input_mapping_first_unused_offset * 8};
+
+  unsigned char *const output_start =
+      (unsigned char *)io_state->output_file.mapping +
+      io_state->output_mapping_first_unused_offset;
+  unsigned char *const output_end =
+      (unsigned char *)io_state->output_file.mapping +
+      io_state->output_file.mapping_size;
+  unsigned char *output = output_start;
+  // output before these has been added to the history or checksum
+  unsigned char *history_end = output_start;
+  unsigned char *checksum_end = output_start;
+
+  Error error = NULL_ERROR;
+  bool is_full = false;
+  *finished = false;
+
+  while (!*finished && !is_full && !error.what) {
+    switch (state->phase) {
+    case FAST_INFLATE_PHASE_HEADER:
+      error = start_fast_stream(state, &io_state->input_file, &reader);
+      // nothing before a new stream is referred back to or checksummed
+      history_end = output;
+      checksum_end = output;
+
+      break;
+    case FAST_INFLATE_PHASE_BLOCK: {
+      bool is_final;
+
+      if ((size_t)(output_end - output) >= FAST_BLOCK_MIN_OUTPUT &&
+          fast_inflate_block(fast, &reader, history_end, &output, output_end,
+                             &is_final)) {
+        if (is_final) {
+          state->phase = FAST_INFLATE_PHASE_TRAILER;
+        }
+
+        break;
+      }
+
+      append_fast_inflater_history(fast, history_end,
+                                   (size_t)(output - history_end));
+      history_end = output;
+      prime_zlib(state, &reader);
+
+      break;
+    }
+    case FAST_INFLATE_PHASE_ZLIB_BLOCK:
+      error = inflate_zlib_block(state, &reader, &output, output_end,
+                                 &is_full);
+
+      break;
+    case FAST_INFLATE_PHASE_TRAILER:
+      update_stream_checksum(state, checksum_end,
+                             (size_t)(output - checksum_end));
+      checksum_end = output;
+      error = finish_fast_stream(state, &reader, finished);
+
+      break;
+    }
+  }
+
+  update_stream_checksum(state, checksum_end, (size_t)(output - checksum_end));
+  append_fast_inflater_history(fast, history_end,
+                               (size_t)(output - history_end));
+
+  const size_t bytes_written = (size_t)(output - output_start);
+  io_state->input_mapping_first_unused_offset =
+      MIN(reader.position / 8, reader.size);
+  io_state->output_mapping_first_unused_offset += bytes_written;
+  io_state->output_bytes_written += bytes_written;
+
+  return error;
+}
+
+static Error start_fast_stream(InflateState *state,
+                               const FileAndMapping *input_file,
+                               BitReader *reader) {
+  assert(state);
+  assert(input_file);
+  assert(reader);
+  assert(reader->position % 8 == 0);
+
+  const size_t offset = reader->position / 8;
+  // the header is read as if the stream started the input
+  const FileAndMapping rest = {
+      .filename = input_file->filename,
+      .fd = -1,
+      .file_size = reader->size - offset,
+      .mapping = (char *)input_file->mapping + offset,
+      .mapping_size = reader->size - offset,
+      .mapping_offset = 0,
+  };
+  size_t header_size;
+  const Error error =
+      inflate_stream_start(&rest, &state->options, &header_size);
+
+  if (error.what) {
+    return error;
+  }
+
+  reader->position = (offset + header_size) * 8;
+  reset_fast_inflater(state->fast, (size_t)1 << state->options.window_bits);
+  state->checksum = state->options.format == ZLIB_FORMAT_ZLIB ? 1 : 0;
+  state->stream_size = 0;
+  state->phase = FAST_INFLATE_PHASE_BLOCK;
+
+  return NULL_ERROR;
+}
+
+// picks zlib up from the block at the reader's position with the history so
+// far, leaving the reader at the next byte that zlib hasn't been given
+static void prime_zlib(InflateState *state, BitReader *reader) {
+  assert(state);
+  assert(reader);
+
+  z_stream *const stream = &state->stream;
+  const FastInflater *const fast = state->fast;
+
+  int errc = inflateReset(stream);
+  assert(errc == Z_OK);
+
+  if (fast->history_size > 0) {
+    errc = inflateSetDictionary(
+        stream, fast->history + DEFLATE_WINDOW_SIZE - fast->history_size,
+        (uInt)fast->history_size);
+    assert(errc == Z_OK);
+  }
+
+  const size_t next_byte = reader->position / 8;
+  const unsigned num_used_bits = (unsigned)(reader->position % 8);
+
+  if (num_used_bits > 0 && next_byte < reader->size) {
+    errc = inflatePrime(stream, (int)(8 - num_used_bits),
+                        reader->data[next_byte] >> num_used_bits);
+    assert(errc == Z_OK);
+  }
+
+  (void)errc;
+
+  reader->position = (reader->position + 7) / 8 * 8;
+  state->phase = FAST_INFLATE_PHASE_ZLIB_BLOCK;
+}
+
+static Error inflate_zlib_block(InflateState *state, BitReader *reader,
+                                unsigned char **output,
+                                unsigned char *output_end, bool *is_full) {
+  assert(state);
+  assert(reader);
+  assert(reader->position % 8 == 0);
+  assert(output);
+  assert(*output);
+  assert(output_end);
+  assert(is_full);
+
+  z_stream *const stream = &state->stream;
+  const size_t next_byte = MIN(reader->position / 8, reader->size);
+
+  stream->next_in = (z_const Bytef *)reader->data + next_byte;
+  stream->avail_in = (uInt)MIN(reader->size - next_byte, (size_t)UINT_MAX);
+  stream->next_out = *output;
+  stream->avail_out =
+      (uInt)MIN((size_t)(output_end - *output), (size_t)UINT_MAX);
+
+  // stops at the end of each block
+  const int errc = inflate(stream, Z_BLOCK);
+
+  *output = stream->next_out;
+  reader->position = (size_t)(stream->next_in - reader->data) * 8;
+
+  // data_type holds the bits left over in the last byte read, has 128 set at
+  // the end of a block, and 64 if that block was the last
+  if (errc == Z_STREAM_END ||
+      (errc == Z_OK && (stream->data_type & 128))) {
+    reader->position -= (size_t)(stream->data_type & 7);
+    state->phase = errc == Z_STREAM_END || (stream->data_type & 64)
+                       ? FAST_INFLATE_PHASE_TRAILER
+                       : FAST_INFLATE_PHASE_BLOCK;
+
+    return NULL_ERROR;
+  } else if ((errc == Z_OK || errc == Z_BUF_ERROR) && stream->avail_out == 0) {
+    *is_full = true;
+
+    return NULL_ERROR;
+  } else if (errc == Z_OK) {
+    return NULL_ERROR;
+  }
+
+  return make_inflate_error(stream, errc);
+}
+
+static void update_stream_checksum(InflateState *state,
+                                   const unsigned char *data, size_t size) {
+  assert(state);
+  assert(data || size == 0);
+
+  switch (state->options.format) {
+  case ZLIB_FORMAT_ZLIB:
+    state->checksum = checksum_adler32(state->checksum, data, size);
+
+    break;
+  case ZLIB_FORMAT_GZIP:
+    state->checksum = checksum_crc32(state->checksum, data, size);
+
+    break;
+  case ZLIB_FORMAT_RAW:
+    break;
+  }
+
+  state->stream_size += size;
+}
+
+// checks the trailer after the last block, see RFC 1950 section 2.2 and RFC
+// 1952 section 2.2
+static Error finish_fast_stream(InflateState *state, BitReader *reader,
+                                bool *finished) {
+  assert(state);
+  assert(reader);
+  assert(finished);
+
+  static const size_t TRAILER_SIZES[] = {4, 8, 0};
+
+  const ZlibFormat format = state->options.format;
+  const size_t offset = (reader->position + 7) / 8;
+
+  if (offset > reader->size ||
+      reader->size - offset < TRAILER_SIZES[format]) {
+    return eformat("couldn't inflate stream: unexpected end of input (%d)",
+                   Z_BUF_ERROR);
+  }
+
+  const unsigned char *const trailer = reader->data + offset;
+  bool is_checksum_valid = true;
+  bool is_length_valid = true;
+
+  if (format == ZLIB_FORMAT_ZLIB) {
+    const uint32_t expected = (uint32_t)trailer[0] << 24 |
+                              (uint32_t)trailer[1] << 16 |
+                              (uint32_t)trailer[2] << 8 | (uint32_t)trailer[3];
+    is_checksum_valid = expected == state->checksum;
+  } else if (format == ZLIB_FORMAT_GZIP) {
+    const uint32_t expected = (uint32_t)trailer[0] |
+                              (uint32_t)trailer[1] << 8 |
+                              (uint32_t)trailer[2] << 16 |
+                              (uint32_t)trailer[3] << 24;
+    const uint32_t length = (uint32_t)trailer[4] | (uint32_t)trailer[5] << 8 |
+                            (uint32_t)trailer[6] << 16 |
+                            (uint32_t)trailer[7] << 24;
+    is_checksum_valid = expected == state->checksum;
+    is_length_valid = length == (uint32_t)state->stream_size;
+  }
+
+  if (!is_checksum_valid) {
+    return eformat("couldn't inflate stream: input data corrupted (%d): "
+                   "incorrect data check",
+                   Z_DATA_ERROR);
+  } else if (!is_length_valid) {
+    return eformat("couldn't inflate stream: input data corrupted (%d): "
+                   "incorrect length check",
+                   Z_DATA_ERROR);
+  }
+
+  const size_t end = offset + TRAILER_SIZES[format];
+  reader->position = end * 8;
+
+  // gzip files may hold several concatenated members, see RFC 1952
+  if (format == ZLIB_FORMAT_GZIP && end < reader->size) {
+    state->phase = FAST_INFLATE_PHASE_HEADER;
+  } else {
+    *finished = true;
+  }
+
+  return NULL_ERROR;
+}
+
+static Error make_inflate_error(const z_stream *stream, int errc) {
+  assert(stream);
+
+  const char *what;
+  switch (errc) {
+  case Z_BUF_ERROR:
+    what = "unexpected end of input";
+
+    break;
+  case Z_NEED_DICT:
+    what = "dictionary needed";
+
+    break;
+  case Z_DATA_ERROR:
+    what = "input data corrupted";
+
+    break;
+  case Z_MEM_ERROR:
+    what = "out of memory";
+
+    break;
+  default:
+    assert(false);
+    what = "unknown error";
+  }
+
+  if (stream->msg) {
+    return eformat("couldn't inflate stream: %s (%d): %s", what, errc,
+                   stream->msg);
+  }
+
+  return eformat("couldn't inflate stream: %s (%d)", what, errc);
+}
+
+static voidpf arena_zalloc(voidpf opaque, uInt items, uInt size) {
+  assert(opaque);
+
+  // zlib checks for Z_NULL, which is the same as NULL
+  return arena_allocate((Arena *)opaque, (size_t)items * (size_t)size);
+}
+
+static void arena_zfree(voidpf opaque, voidpf address) {
+  assert(opaque);
+
+  arena_free((Arena *)opaque, address);
+}
+
+// from zconf.h, plus a few kilobytes for the state itself and alignment,
+// which comes to just under 6KiB with zlib 1.2.13
+static size_t get_deflate_allocation_size(const DeflateOptions *options) {
+  assert(options);
+
+  return ((size_t)1 << (options->window_bits + 2)) +
+         ((size_t)1 << (options->mem_level + 9)) + ((size_t)6 << 10);
+}
+
+static size_t estimate_deflate_memory(const DeflateOptions *options) {
+  assert(options);
+
+  return arena_resident_size(get_deflate_allocation_size(options));
+}
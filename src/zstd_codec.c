@@ -0,0 +1,665 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// for ZSTD_initStaticCCtx, ZSTD_createDStream_advanced, and the ZSTD_estimate*
+// family
+#define ZSTD_STATIC_LINKING_ONLY
+
+#include <common/zstd_codec.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+const char *const ZSTD_STRATEGY_NAMES[9] = {
+    "fast",    "dfast", "greedy",  "lazy",    "lazy2",
+    "btlazy2", "btopt", "btultra", "btultra2"};
+const ZSTD_strategy ZSTD_STRATEGY_VALUES[9] = {
+    ZSTD_fast,    ZSTD_dfast, ZSTD_greedy,  ZSTD_lazy,    ZSTD_lazy2,
+    ZSTD_btlazy2, ZSTD_btopt, ZSTD_btultra, ZSTD_btultra2};
+
+size_t zstd_compress_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  return ZSTD_compressBound(input_file->file_size);
+}
+
+static Error estimate_workspace_size(const ZstdCompressOptions *options,
+                                     size_t *size);
+
+static size_t estimate_compress_memory(const ZstdCompressOptions *options);
+
+CodecMemoryPlan zstd_compress_fit_memory(const FileAndMapping *input_file,
+                                         size_t budget, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  ZstdCompressOptions *const options = &((ZstdCompressState *)state_v)->options;
+  const int level =
+      options->adapt ? options->adapt_max_level
+                     : (options->level != 0 ? options->level
+                                            : ZSTD_CLEVEL_DEFAULT);
+
+  // pinned explicitly, since windows after the first don't pledge their size
+  const ZSTD_compressionParameters parameters =
+      ZSTD_getCParams(level, (unsigned long long)input_file->file_size, 0);
+  options->window_log = (int)parameters.windowLog;
+  options->hash_log = (int)parameters.hashLog;
+  options->chain_log = (int)parameters.chainLog;
+
+  const ZSTD_strategy strategy =
+      (options->strategy != 0) ? options->strategy : parameters.strategy;
+  size_t size = estimate_compress_memory(options);
+
+  // the window goes first, since the tables are bounded by it. dropping the
+  // worker thread goes last, since it takes --rsyncable and --adapt with it
+  while (size > budget) {
+    if (options->window_log > ZSTD_WINDOWLOG_MIN) {
+      --options->window_log;
+      // as ZSTD_adjustCParams does for small inputs, since tables larger than
+      // the window can't find more matches. binary trees need two entries
+      // per position
+      const int max_chain_log =
+          options->window_log + (strategy >= ZSTD_btlazy2 ? 1 : 0);
+
+      if (options->hash_log > options->window_log + 1) {
+        options->hash_log = options->window_log + 1;
+      }
+
+      if (options->chain_log > max_chain_log) {
+        options->chain_log = max_chain_log;
+      }
+    } else if (options->rsyncable || options->adapt) {
+      options->rsyncable = false;
+      options->adapt = false;
+    } else {
+      break;
+    }
+
+    size = estimate_compress_memory(options);
+  }
+
+  CodecMemoryPlan plan = {.size = size};
+  snprintf(plan.parameters, sizeof(plan.parameters),
+           "window_log=%d hash_log=%d chain_log=%d workers=%d",
+           options->window_log, options->hash_log, options->chain_log,
+           (options->rsyncable || options->adapt) ? 1 : 0);
+
+  return plan;
+}
+
+static void *arena_zstd_alloc(void *opaque, size_t size);
+static void arena_zstd_free(void *opaque, void *address);
+static Error adapt_level(AppIOState *io_state, ZstdCompressState *state);
+static Error init_threaded_context(ZstdCompressState *state);
+static void set_parameters(ZSTD_CCtx *context,
+                           const ZstdCompressOptions *options);
+
+Error zstd_compress_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  ZstdCompressState *const state = state_v;
+
+  if (state->options.adapt) {
+    // level 0 selects the default, ZSTD_CLEVEL_DEFAULT
+    state->adapter = make_level_adapter(
+        state->options.adapt_min_level, state->options.adapt_max_level,
+        state->options.level == 0 ? ZSTD_CLEVEL_DEFAULT : state->options.level,
+        true);
+    state->options.level = state->adapter.level;
+  }
+
+  if (state->options.rsyncable || state->options.adapt) {
+    return init_threaded_context(state);
+  }
+
+  size_t workspace_size;
+  Error error = estimate_workspace_size(&state->options, &workspace_size);
+
+  if (error.what) {
+    return error;
+  }
+
+  // one allocation up front instead of one per table, and none on reuse
+  if ((error = create_arena(workspace_size, &state->arena)), error.what) {
+    return error;
+  }
+
+  void *const workspace = arena_allocate(&state->arena, workspace_size);
+  ZSTD_CCtx *const compression_context =
+      ZSTD_initStaticCCtx(workspace, workspace_size);
+
+  if (!compression_context) {
+    error = STATIC_ERROR("couldn't initialize compression context");
+
+    goto cleanup_arena;
+  }
+
+  set_parameters(compression_context, &state->options);
+
+  state->context = compression_context;
+  state->is_streaming = false;
+
+  return NULL_ERROR;
+
+cleanup_arena:
+  free_arena(state->arena);
+
+  return error;
+}
+
+Error zstd_compress_run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  ZstdCompressState *const state = state_v;
+
+  ZSTD_inBuffer in_buffer = {
+      .src = io_state->input_file.mapping,
+      .size = io_state->input_file.mapping_size,
+      .pos = io_state->input_mapping_first_unused_offset,
+  };
+
+  ZSTD_outBuffer out_buffer = {
+      .dst = io_state->output_file.mapping,
+      .size = io_state->output_file.mapping_size,
+      .pos = io_state->output_mapping_first_unused_offset,
+  };
+
+  const size_t available = in_buffer.size - in_buffer.pos;
+
+  // the frame header records the size, and libzstd sizes its tables for it
+  if (!state->is_streaming && !io_state->input_is_partial) {
+    const size_t result = ZSTD_CCtx_setPledgedSrcSize(
+        state->context, (unsigned long long)available);
+    assert(!ZSTD_isError(result));
+    (void)result;
+  }
+
+  size_t limit = (available < CODEC_SLICE_SIZE) ? available : CODEC_SLICE_SIZE;
+
+  if (state->options.adapt) {
+    limit = begin_adapter_chunk(&state->adapter, limit);
+  }
+
+  ZSTD_EndDirective directive =
+      (io_state->input_is_partial || limit < available) ? ZSTD_e_continue
+                                                        : ZSTD_e_end;
+
+  // a flush ends the current job, after which a new level takes effect
+  if (state->options.adapt && directive != ZSTD_e_end &&
+      limit == state->adapter.chunk_remaining) {
+    directive = ZSTD_e_flush;
+  }
+
+  in_buffer.size = in_buffer.pos + limit;
+
+  const size_t input_first_unused_offset = in_buffer.pos;
+  const size_t bytes_to_flush_or_error = ZSTD_compressStream2(
+      state->context, &out_buffer, &in_buffer, directive);
+
+  if (ZSTD_isError(bytes_to_flush_or_error)) {
+    const char *const what = ZSTD_getErrorName(bytes_to_flush_or_error);
+
+    return eformat("couldn't compress input file '%s': %s (%zu)",
+                   io_state->input_file.filename, what,
+                   bytes_to_flush_or_error);
+  }
+
+  const size_t output_bytes_written =
+      out_buffer.pos - io_state->output_mapping_first_unused_offset;
+
+  io_state->input_mapping_first_unused_offset = in_buffer.pos;
+  io_state->output_mapping_first_unused_offset = out_buffer.pos;
+  io_state->output_bytes_written += output_bytes_written;
+
+  *finished = directive == ZSTD_e_end && bytes_to_flush_or_error == 0;
+  state->is_streaming = !*finished;
+
+  if (state->options.adapt) {
+    state->adapter.chunk_remaining -= in_buffer.pos - input_first_unused_offset;
+
+    if (directive == ZSTD_e_flush && bytes_to_flush_or_error == 0) {
+      return adapt_level(io_state, state);
+    }
+  }
+
+  return NULL_ERROR;
+}
+
+Error zstd_compress_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  ZstdCompressState *const state = state_v;
+
+  assert(state->context);
+
+  // keeps the parameters and the tables, which are already sized for them
+  const size_t result =
+      ZSTD_CCtx_reset(state->context, ZSTD_reset_session_only);
+  assert(!ZSTD_isError(result));
+  (void)result;
+
+  state->is_streaming = false;
+
+  if (state->options.adapt) {
+    // the next frame starts at the level this one ended with
+    state->adapter = make_level_adapter(state->adapter.min_level,
+                                        state->adapter.max_level,
+                                        state->options.level, true);
+  }
+
+  return NULL_ERROR;
+}
+
+void zstd_compress_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  ZstdCompressState *const state = state_v;
+
+  assert(state->context);
+
+  if (state->options.rsyncable || state->options.adapt) {
+    ZSTD_freeCCtx(state->context);
+
+    return;
+  }
+
+  // static contexts are freed along with their workspace, not ZSTD_freeCCtx
+  free_arena(state->arena);
+}
+
+size_t zstd_decompress_size(const FileAndMapping *input_file, void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  return input_file->file_size;
+}
+
+Error zstd_decompress_init(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  ZstdDecompressState *const state = state_v;
+  const Error error = create_arena(ARENA_DEFAULT_RESERVE_SIZE, &state->arena);
+
+  if (error.what) {
+    return error;
+  }
+
+  const ZSTD_customMem memory = {.customAlloc = arena_zstd_alloc,
+                                 .customFree = arena_zstd_free,
+                                 .opaque = &state->arena};
+  ZSTD_DStream *const decompression_stream =
+      ZSTD_createDStream_advanced(memory);
+
+  if (!decompression_stream) {
+    free_arena(state->arena);
+
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  state->stream = decompression_stream;
+
+  return NULL_ERROR;
+}
+
+Error zstd_decompress_run(AppIOState *io_state, bool *finished,
+                          void *state_v) {
+  assert(io_state);
+  assert(finished);
+  assert(state_v);
+
+  ZSTD_DStream *const decompression_stream =
+      ((ZstdDecompressState *)state_v)->stream;
+
+  assert(decompression_stream);
+
+  ZSTD_inBuffer in_buffer = {
+      .src = io_state->input_file.mapping,
+      .size = io_state->input_file.mapping_size,
+      .pos = io_state->input_mapping_first_unused_offset,
+  };
+
+  ZSTD_outBuffer out_buffer = {
+      .dst = io_state->output_file.mapping,
+      .size = io_state->output_file.mapping_size,
+      .pos = io_state->output_mapping_first_unused_offset,
+  };
+
+  const size_t output_bytes_written_or_error =
+      ZSTD_decompressStream(decompression_stream, &out_buffer, &in_buffer);
+
+  if (ZSTD_isError(output_bytes_written_or_error)) {
+    const char *const what = ZSTD_getErrorName(output_bytes_written_or_error);
+
+    return eformat("couldn't decompress input file '%s': %s (%zu)",
+                   io_state->input_file.filename, what,
+                   output_bytes_written_or_error);
+  }
+
+  const size_t input_bytes_read =
+      in_buffer.pos - io_state->input_mapping_first_unused_offset;
+  const size_t output_bytes_written =
+      out_buffer.pos - io_state->output_mapping_first_unused_offset;
+
+  io_state->input_mapping_first_unused_offset += input_bytes_read;
+  io_state->output_mapping_first_unused_offset += output_bytes_written;
+  io_state->output_bytes_written += output_bytes_written;
+
+  // unless the frame is complete, a full output mapping may mean that decoded
+  // data is still buffered
+  *finished = (in_buffer.pos == in_buffer.size) &&
+              (output_bytes_written_or_error == 0 ||
+               out_buffer.pos < out_buffer.size);
+
+  return NULL_ERROR;
+}
+
+Error zstd_decompress_reset(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  ZSTD_DStream *const decompression_stream =
+      ((ZstdDecompressState *)state_v)->stream;
+
+  assert(decompression_stream);
+
+  const size_t result =
+      ZSTD_DCtx_reset(decompression_stream, ZSTD_reset_session_only);
+  assert(!ZSTD_isError(result));
+  (void)result;
+
+  return NULL_ERROR;
+}
+
+void zstd_decompress_cleanup(AppIOState *io_state, void *state_v) {
+  assert(io_state);
+  assert(state_v);
+
+  (void)io_state;
+
+  ZstdDecompressState *const state = state_v;
+
+  assert(state->stream);
+
+  const size_t result = ZSTD_freeDStream(state->stream);
+  assert(!ZSTD_isError(result));
+  (void)result;
+
+  free_arena(state->arena);
+}
+
+// only the first frame is checked
+bool zstd_decompress_has_checksum(const FileAndMapping *input_file,
+                                  void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  ZSTD_frameHeader header;
+
+  if (ZSTD_getFrameHeader(&header, input_file->mapping,
+                          input_file->mapping_size) != 0) {
+    return false;
+  }
+
+  return header.frameType == ZSTD_frame && header.checksumFlag;
+}
+
+// only the first frame is checked
+size_t zstd_decompress_window_size(const FileAndMapping *input_file,
+                                   void *state_v) {
+  assert(input_file);
+  assert(state_v);
+
+  (void)state_v;
+
+  ZSTD_frameHeader header;
+
+  if (ZSTD_getFrameHeader(&header, input_file->mapping,
+                          input_file->mapping_size) != 0 ||
+      header.frameType != ZSTD_frame || header.windowSize == 0) {
+    return ZSTD_BLOCKSIZE_MAX;
+  }
+
+  return (size_t)header.windowSize;
+}
+
+static Error init_threaded_context(ZstdCompressState *state) {
+  assert(state);
+
+  // ZSTD_c_rsyncable and changing the level mid-frame only work in
+  // multithreaded mode, whose worker pool can't be carved out of a static
+  // context
+  ZSTD_CCtx *const compression_context = ZSTD_createCCtx();
+
+  if (!compression_context) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  Error error;
+  const size_t workers_result =
+      ZSTD_CCtx_setParameter(compression_context, ZSTD_c_nbWorkers, 1);
+
+  if (ZSTD_isError(workers_result)) {
+    error = eformat("--rsyncable and --adapt need a multithreaded libzstd: "
+                    "%s (%zu)",
+                    ZSTD_getErrorName(workers_result), workers_result);
+
+    goto cleanup_context;
+  }
+
+  const size_t rsyncable_result =
+      state->options.rsyncable
+          ? ZSTD_CCtx_setParameter(compression_context, ZSTD_c_rsyncable, 1)
+          : 0;
+
+  if (ZSTD_isError(rsyncable_result)) {
+    error = eformat("couldn't enable rsyncable mode: %s (%zu)",
+                    ZSTD_getErrorName(rsyncable_result), rsyncable_result);
+
+    goto cleanup_context;
+  }
+
+  set_parameters(compression_context, &state->options);
+
+  state->context = compression_context;
+  state->is_streaming = false;
+
+  return NULL_ERROR;
+
+cleanup_context:
+  ZSTD_freeCCtx(compression_context);
+
+  return error;
+}
+
+static void set_parameters(ZSTD_CCtx *context,
+                           const ZstdCompressOptions *options) {
+  assert(context);
+  assert(options);
+
+  if (options->level != 0) {
+    const size_t result = ZSTD_CCtx_setParameter(
+        context, ZSTD_c_compressionLevel, options->level);
+    assert(!ZSTD_isError(result));
+    (void)result;
+  }
+
+  if (options->strategy != 0) {
+    const size_t result = ZSTD_CCtx_setParameter(context, ZSTD_c_strategy,
+                                                 (int)options->strategy);
+    assert(!ZSTD_isError(result));
+    (void)result;
+  }
+
+  if (options->checksum) {
+    const size_t result =
+        ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+    assert(!ZSTD_isError(result));
+    (void)result;
+  }
+
+  if (options->window_log != 0) {
+    size_t result =
+        ZSTD_CCtx_setParameter(context, ZSTD_c_windowLog, options->window_log);
+    assert(!ZSTD_isError(result));
+    result = ZSTD_CCtx_setParameter(context, ZSTD_c_hashLog, options->hash_log);
+    assert(!ZSTD_isError(result));
+    result =
+        ZSTD_CCtx_setParameter(context, ZSTD_c_chainLog, options->chain_log);
+    assert(!ZSTD_isError(result));
+    (void)result;
+  }
+}
+
+// large enough for any input size, since libzstd only ever shrinks the
+// parameters to fit a smaller input
+static Error estimate_workspace_size(const ZstdCompressOptions *options,
+                                     size_t *size) {
+  assert(options);
+  assert(size);
+
+  ZSTD_CCtx_params *const params = ZSTD_createCCtxParams();
+
+  if (!params) {
+    return ERROR_OUT_OF_MEMORY;
+  }
+
+  const int level =
+      (options->level != 0) ? options->level : ZSTD_CLEVEL_DEFAULT;
+  size_t result =
+      ZSTD_CCtxParams_setParameter(params, ZSTD_c_compressionLevel, level);
+  assert(!ZSTD_isError(result));
+
+  if (options->strategy != 0) {
+    result = ZSTD_CCtxParams_setParameter(params, ZSTD_c_strategy,
+                                          (int)options->strategy);
+    assert(!ZSTD_isError(result));
+  }
+
+  if (options->window_log != 0) {
+    result = ZSTD_CCtxParams_setParameter(params, ZSTD_c_windowLog,
+                                          options->window_log);
+    assert(!ZSTD_isError(result));
+    result =
+        ZSTD_CCtxParams_setParameter(params, ZSTD_c_hashLog, options->hash_log);
+    assert(!ZSTD_isError(result));
+    result = ZSTD_CCtxParams_setParameter(params, ZSTD_c_chainLog,
+                                          options->chain_log);
+    assert(!ZSTD_isError(result));
+  }
+
+  (void)result;
+
+  // streaming needs buffers on top of what one-shot compression does
+  const size_t params_size = ZSTD_estimateCStreamSize_usingCCtxParams(params);
+  ZSTD_freeCCtxParams(params);
+
+  // covers the per-input-size parameter tables that a level maps onto, unless
+  // they have been pinned
+  const size_t level_size =
+      (options->window_log == 0) ? ZSTD_estimateCStreamSize(level) : 0;
+
+  *size = (params_size > level_size) ? params_size : level_size;
+
+  return NULL_ERROR;
+}
+
+static void *arena_zstd_alloc(void *opaque, size_t size) {
+  assert(opaque);
+
+  return arena_allocate((Arena *)opaque, size);
+}
+
+static void arena_zstd_free(void *opaque, void *address) {
+  assert(opaque);
+
+  arena_free((Arena *)opaque, address);
+}
+
+static Error adapt_level(AppIOState *io_state, ZstdCompressState *state) {
+  assert(io_state);
+  assert(state);
+
+  const Error error =
+      end_adapter_chunk(&state->adapter, &io_state->output_file,
+                        io_state->output_mapping_first_unused_offset);
+
+  if (error.what || state->adapter.level == state->options.level) {
+    return error;
+  }
+
+  const size_t result = ZSTD_CCtx_setParameter(
+      state->context, ZSTD_c_compressionLevel, state->adapter.level);
+
+  if (ZSTD_isError(result)) {
+    return eformat("couldn't change compression level to %d: %s (%zu)",
+                   state->adapter.level, ZSTD_getErrorName(result), result);
+  }
+
+  state->options.level = state->adapter.level;
+
+  return NULL_ERROR;
+}
+
+static size_t estimate_compress_memory(const ZstdCompressOptions *options) {
+  assert(options);
+
+  ZstdCompressOptions largest_options = *options;
+
+  if (options->adapt) {
+    largest_options.level = options->adapt_max_level;
+  }
+
+  size_t size;
+  const Error error = estimate_workspace_size(&largest_options, &size);
+
+  if (error.what) {
+    discard_error(error);
+
+    size = ZSTD_estimateCStreamSize(largest_options.level != 0
+                                        ? largest_options.level
+                                        : ZSTD_CLEVEL_DEFAULT);
+  }
+
+  // the worker thread gets its own copy of the tables and buffers, all of
+  // which libzstd allocates outside of the arena
+  return (options->rsyncable || options->adapt) ? 2 * size
+                                                : arena_resident_size(size);
+}
@@ -22,6 +22,7 @@
 #include <common/argparse.h>
 #include <common/error.h>
 #include <common/mmc.h>
+#include <common/zstd_codec.h>
 
 #include <assert.h>
 #include <stddef.h>
@@ -29,6 +30,10 @@
 
 #include <zstd.h>
 
+// levels above this use windows of 8MiB and more, and are only reached by
+// asking for them
+#define DEFAULT_ADAPT_MAX_LEVEL 19
+
 typedef struct State {
   IntegerArgumentParser level_parser;
   KeywordArgument level;
@@ -36,21 +41,23 @@ typedef struct State {
   StringArgumentParser strategy_parser;
   KeywordArgument strategy;
 
-  ZSTD_CCtx *compression_context;
+  KeywordArgument checksum;
+  KeywordArgument rsyncable;
+
+  RangeArgumentParser adapt_parser;
+  KeywordArgument adapt;
+
+  ZstdCompressState codec;
 } State;
 
-size_t size(size_t input_file_size, void *state_v);
+size_t size(const FileAndMapping *input_file, void *state_v);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v);
+Error chunk_codec(AppChunkCodec *codec, void *state_v);
 Error init(AppIOState *io_state, void *state_v);
 Error run(AppIOState *io_state, bool *finished, void *state_v);
 void cleanup(AppIOState *io_state, void *state_v);
 
-static const char *const STRATEGY_VALUES[] = {"fast",  "dfast",   "greedy",
-                                              "lazy",  "lazy2",   "btlazy2",
-                                              "btopt", "btultra", "btultra2"};
-static const ZSTD_strategy STRATEGY_MAPPING[] = {
-    ZSTD_fast,    ZSTD_dfast, ZSTD_greedy,  ZSTD_lazy,    ZSTD_lazy2,
-    ZSTD_btlazy2, ZSTD_btopt, ZSTD_btultra, ZSTD_btultra2};
-
 int main(int argc, const char *const argv[]) {
   const int min_level = ZSTD_minCLevel();
   const int max_level = ZSTD_maxCLevel();
@@ -60,6 +67,16 @@ int main(int argc, const char *const argv[]) {
           "Compression level to use. An integer in the range [%d, %d].",
           min_level, max_level);
 
+  char adapt_help_text[512];
+  sprintf(adapt_help_text,
+          "Adjust the compression level between blocks as the file is "
+          "compressed, raising it while writing the output back to disk is "
+          "the bottleneck and lowering it while compression is. The level "
+          "starts at --level and stays within MIN:MAX, defaulting to 1:%d. "
+          "Compresses on a worker thread, which libzstd must be built to "
+          "support.",
+          DEFAULT_ADAPT_MAX_LEVEL);
+
   State state = {
       .level_parser = make_integer_parser(
           "-l, --level", "LEVEL", (long long)min_level, (long long)max_level),
@@ -72,9 +89,9 @@ int main(int argc, const char *const argv[]) {
           },
 
       .strategy_parser = make_string_parser("-s, --strategy", "STRATEGY",
-                                            sizeof(STRATEGY_VALUES) /
-                                                sizeof(STRATEGY_VALUES[0]),
-                                            STRATEGY_VALUES),
+                                            sizeof(ZSTD_STRATEGY_NAMES) /
+                                                sizeof(ZSTD_STRATEGY_NAMES[0]),
+                                            ZSTD_STRATEGY_NAMES),
       .strategy =
           {
               .short_name = 's',
@@ -86,9 +103,56 @@ int main(int argc, const char *const argv[]) {
                            "order of compression ratio and time.",
               .parser = &state.strategy_parser.argument_parser,
           },
+
+      .checksum =
+          {
+              .short_name = 'c',
+              .long_name = "checksum",
+              .help_text = "Append the low 32 bits of an xxHash-64 checksum "
+                           "of the uncompressed contents to the frame, which "
+                           "decompressors verify.",
+              .parser = NULL,
+          },
+
+      .rsyncable =
+          {
+              .short_name = 'r',
+              .long_name = "rsyncable",
+              .help_text = "Cut the frame at content-defined boundaries so "
+                           "that a local change to the input only changes "
+                           "the output around it, which lets rsync(1) and "
+                           "deduplicating backups transfer or store only "
+                           "that part. Compresses on a worker thread, which "
+                           "libzstd must be built to support.",
+              .parser = NULL,
+          },
+
+      .adapt_parser =
+          make_range_parser("-a, --adapt", "MIN:MAX", (long long)min_level,
+                            (long long)max_level),
+      .adapt =
+          {
+              .short_name = 'a',
+              .long_name = "adapt",
+              .help_text = adapt_help_text,
+              .parser = &state.adapt_parser.argument_parser,
+              .has_optional_value = true,
+          },
+
+      .codec = {.options = {.level = 0,
+                            .strategy = 0,
+                            .adapt_min_level = 1,
+                            .adapt_max_level = DEFAULT_ADAPT_MAX_LEVEL},
+                .context = NULL},
   };
 
-  KeywordArgument *keyword_args[] = {&state.level, &state.strategy};
+  // used when --adapt is given without a range
+  state.adapt_parser.low = state.codec.options.adapt_min_level;
+  state.adapt_parser.high = state.codec.options.adapt_max_level;
+
+  KeywordArgument *keyword_args[] = {&state.level, &state.strategy,
+                                     &state.checksum, &state.rsyncable,
+                                     &state.adapt};
 
   return run_compression_app(
       argc, argv,
@@ -108,93 +172,90 @@ int main(int argc, const char *const argv[]) {
           .init = init,
           .run = run,
           .cleanup = cleanup,
+          .fit_memory = fit_memory,
+          .chunk_codec = chunk_codec,
           .arg = &state,
       });
 }
 
-size_t size(size_t input_file_size, void *state_v) {
-  assert(state_v);
-
-  (void)state_v;
-
-  return ZSTD_compressBound(input_file_size);
-}
-
-Error init(AppIOState *io_state, void *state_v) {
-  assert(io_state);
+size_t size(const FileAndMapping *input_file, void *state_v) {
   assert(state_v);
 
   State *const state = state_v;
-  ZSTD_CCtx *const compression_context = ZSTD_createCCtx();
-
-  if (!compression_context) {
-    return ERROR_OUT_OF_MEMORY;
-  }
+  ZstdCompressOptions *const options = &state->codec.options;
 
   if (state->level.was_found) {
-    const size_t result =
-        ZSTD_CCtx_setParameter(compression_context, ZSTD_c_compressionLevel,
-                               (int)state->level_parser.value);
-    assert(!ZSTD_isError(result));
-    (void)result;
+    options->level = (int)state->level_parser.value;
   }
 
   if (state->strategy.was_found) {
-    const size_t result = ZSTD_CCtx_setParameter(
-        compression_context, ZSTD_c_strategy,
-        (int)STRATEGY_MAPPING[state->strategy_parser.value_index]);
-    assert(!ZSTD_isError(result));
-    (void)result;
+    options->strategy =
+        ZSTD_STRATEGY_VALUES[state->strategy_parser.value_index];
+  }
+
+  if (state->checksum.was_found) {
+    options->checksum = true;
   }
 
-  // no need to call ZSTD_CCtx_setPledgedSize, as ZSTD_compress2 overwrites it
+  if (state->rsyncable.was_found) {
+    options->rsyncable = true;
+  }
 
-  state->compression_context = compression_context;
+  if (state->adapt.was_found) {
+    options->adapt = true;
+    options->adapt_min_level = (int)state->adapt_parser.low;
+    options->adapt_max_level = (int)state->adapt_parser.high;
+  }
 
-  return NULL_ERROR;
+  return zstd_compress_size(input_file, &state->codec);
 }
 
-Error run(AppIOState *io_state, bool *finished, void *state_v) {
-  assert(io_state);
-  assert(finished);
+CodecMemoryPlan fit_memory(const FileAndMapping *input_file, size_t budget,
+                           void *state_v) {
   assert(state_v);
 
-  State *const state = state_v;
+  return zstd_compress_fit_memory(input_file, budget,
+                                  &((State *)state_v)->codec);
+}
 
-  const size_t output_final_size_or_error = ZSTD_compress2(
-      state->compression_context, io_state->output_file.mapping,
-      io_state->output_file.mapping_size, io_state->input_file.mapping,
-      io_state->input_file.mapping_size);
+Error chunk_codec(AppChunkCodec *codec, void *state_v) {
+  assert(codec);
+  assert(state_v);
 
-  if (ZSTD_isError(output_final_size_or_error)) {
-    const char *const what = ZSTD_getErrorName(output_final_size_or_error);
+  State *const state = state_v;
+  const ZstdCompressOptions *const options = &state->codec.options;
 
-    return eformat("couldn't compress input file '%s': %s (%zu)",
-                   io_state->input_file.filename, what,
-                   output_final_size_or_error);
+  // both run libzstd's own worker threads over the whole input
+  if (options->rsyncable || options->adapt) {
+    return STATIC_ERROR("--threads can't be combined with --rsyncable or "
+                        "--adapt");
   }
 
-  io_state->input_mapping_first_unused_offset =
-      io_state->input_file.mapping_size;
-  io_state->output_mapping_first_unused_offset = output_final_size_or_error;
-  io_state->output_bytes_written = output_final_size_or_error;
-
-  *finished = true;
+  *codec = (AppChunkCodec){.state = &state->codec,
+                           .state_size = sizeof(ZstdCompressState),
+                           .size = zstd_compress_size,
+                           .init = zstd_compress_init,
+                           .run = zstd_compress_run,
+                           .reset = zstd_compress_reset,
+                           .cleanup = zstd_compress_cleanup};
 
   return NULL_ERROR;
 }
 
-void cleanup(AppIOState *io_state, void *state_v) {
-  assert(io_state);
+Error init(AppIOState *io_state, void *state_v) {
   assert(state_v);
 
-  (void)io_state;
+  return zstd_compress_init(io_state, &((State *)state_v)->codec);
+}
 
-  State *const state = state_v;
+Error run(AppIOState *io_state, bool *finished, void *state_v) {
+  assert(state_v);
+
+  return zstd_compress_run(io_state, finished, &((State *)state_v)->codec);
+}
 
-  assert(state->compression_context);
+void cleanup(AppIOState *io_state, void *state_v) {
+  assert(state_v);
 
-  const size_t result = ZSTD_freeCCtx(state->compression_context);
-  assert(!ZSTD_isError(result));
-  (void)result;
+  zstd_compress_cleanup(io_state, &((State *)state_v)->codec);
 }
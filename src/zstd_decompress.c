@@ -19,23 +19,14 @@
 // SOFTWARE.
 
 #include <common/app.h>
-#include <common/argparse.h>
 #include <common/error.h>
 #include <common/mmc.h>
+#include <common/zstd_codec.h>
 
-#include <assert.h>
 #include <stddef.h>
 
-#include <zstd.h>
-
-size_t size(size_t input_file_size, void *decompression_stream_ptr_v);
-Error init(AppIOState *io_state, void *decompression_stream_ptr_v);
-Error run(AppIOState *io_state, bool *finished,
-          void *decompression_stream_ptr_v);
-void cleanup(AppIOState *io_state, void *decompression_stream_ptr_v);
-
 int main(int argc, const char *const argv[]) {
-  ZSTD_DStream *decompression_stream;
+  ZstdDecompressState state = {.stream = NULL};
 
   return run_decompression_app(
       argc, argv,
@@ -48,98 +39,12 @@ int main(int argc, const char *const argv[]) {
                          "for decompression and memory-mapped files are used "
                          "to read and write data to disk.",
 
-          .size = size,
-          .init = init,
-          .run = run,
-          .cleanup = cleanup,
-          .arg = &decompression_stream,
+          .size = zstd_decompress_size,
+          .init = zstd_decompress_init,
+          .run = zstd_decompress_run,
+          .cleanup = zstd_decompress_cleanup,
+          .has_checksum = zstd_decompress_has_checksum,
+          .window_size = zstd_decompress_window_size,
+          .arg = &state,
       });
 }
-
-size_t size(size_t input_file_size, void *decompression_stream_ptr_v) {
-  assert(decompression_stream_ptr_v);
-
-  (void)decompression_stream_ptr_v;
-
-  return input_file_size;
-}
-
-Error init(AppIOState *io_state, void *decompression_stream_ptr_v) {
-  assert(io_state);
-  assert(decompression_stream_ptr_v);
-
-  ZSTD_DStream **const decompression_stream_ptr = decompression_stream_ptr_v;
-  ZSTD_DStream *const decompression_stream = ZSTD_createDStream();
-
-  if (!decompression_stream) {
-    return ERROR_OUT_OF_MEMORY;
-  }
-
-  *decompression_stream_ptr = decompression_stream;
-
-  return NULL_ERROR;
-}
-
-Error run(AppIOState *io_state, bool *finished,
-          void *decompression_stream_ptr_v) {
-  assert(io_state);
-  assert(finished);
-  assert(decompression_stream_ptr_v);
-
-  ZSTD_DStream *const decompression_stream =
-      *(ZSTD_DStream *const *)decompression_stream_ptr_v;
-
-  assert(decompression_stream);
-
-  ZSTD_inBuffer in_buffer = {
-      .src = io_state->input_file.mapping,
-      .size = io_state->input_file.mapping_size,
-      .pos = io_state->input_mapping_first_unused_offset,
-  };
-
-  ZSTD_outBuffer out_buffer = {
-      .dst = io_state->output_file.mapping,
-      .size = io_state->output_file.mapping_size,
-      .pos = io_state->output_mapping_first_unused_offset,
-  };
-
-  const size_t output_bytes_written_or_error =
-      ZSTD_decompressStream(decompression_stream, &out_buffer, &in_buffer);
-
-  if (ZSTD_isError(output_bytes_written_or_error)) {
-    const char *const what = ZSTD_getErrorName(output_bytes_written_or_error);
-
-    return eformat("couldn't decompress input file '%s': %s (%zu)",
-                   io_state->input_file.filename, what,
-                   output_bytes_written_or_error);
-  }
-
-  const size_t input_bytes_read =
-      in_buffer.pos - io_state->input_mapping_first_unused_offset;
-  const size_t output_bytes_written =
-      out_buffer.pos - io_state->output_mapping_first_unused_offset;
-
-  io_state->input_mapping_first_unused_offset += input_bytes_read;
-  io_state->output_mapping_first_unused_offset += output_bytes_written;
-  io_state->output_bytes_written += output_bytes_written;
-
-  *finished = (in_buffer.pos == in_buffer.size);
-
-  return NULL_ERROR;
-}
-
-void cleanup(AppIOState *io_state, void *decompression_stream_ptr_v) {
-  assert(io_state);
-  assert(decompression_stream_ptr_v);
-
-  (void)io_state;
-
-  ZSTD_DStream *const decompression_stream =
-      *(ZSTD_DStream *const *)decompression_stream_ptr_v;
-
-  assert(decompression_stream);
-
-  const size_t result = ZSTD_freeDStream(decompression_stream);
-  assert(!ZSTD_isError(result));
-  (void)result;
-}
@@ -0,0 +1,604 @@
+// Copyright (c) 2019 Gregory Meyer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// differential tests of mmc's DEFLATE decoders against zlib. streams that zlib
+// writes with a spread of formats, levels, strategies, windows, and flushes
+// are inflated by libmmc's fast decoder and compared with the data they were
+// made from. given the path to mi, they are also inflated by mi's zlib and
+// parallel decoders. libmmc's own output is inflated by zlib
+
+#include <mmc/mmc.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define NUM_RANDOM_CASES 48
+
+typedef enum DataKind {
+  DATA_KIND_TEXT,
+  DATA_KIND_RANDOM,
+  DATA_KIND_RUNS,
+  DATA_KIND_MIXED,
+} DataKind;
+
+typedef struct Case {
+  MmcCodecId codec;
+  int level;
+  int strategy;
+  int window_bits;
+  // 0 never flushes, otherwise every flush_interval bytes of input
+  int flush;
+  size_t flush_interval;
+} Case;
+
+typedef struct Buffer {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+static const char *const DATA_KIND_NAMES[] = {"text", "random", "runs",
+                                              "mixed"};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15u;
+static const char *mi_path = NULL;
+static char temporary_directory[] = "/tmp/mmc-inflate-test-XXXXXX";
+static size_t num_failures = 0;
+
+// xorshift64*, so every run tests the same streams
+static uint64_t next_random(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+
+  return rng_state * 0x2545f4914f6cdd1du;
+}
+
+static size_t random_below(size_t bound) {
+  return (size_t)(next_random() % bound);
+}
+
+static void fill_data(DataKind kind, unsigned char *data, size_t size);
+static bool compress_with_zlib(const Case *test_case,
+                               const unsigned char *data, size_t size,
+                               Buffer *output);
+static void check_stream(const char *name, MmcCodecId codec,
+                         const Buffer *compressed, const unsigned char *data,
+                         size_t size);
+static void check_mmc_compression(MmcCodecId codec, int level,
+                                  const unsigned char *data, size_t size);
+static void describe_case(const Case *test_case, DataKind kind, size_t size,
+                          char *name, size_t name_size);
+
+int main(int argc, const char *const argv[]) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [MI]\n", argv[0]);
+
+    return EXIT_FAILURE;
+  }
+
+  if (argc == 2) {
+    mi_path = argv[1];
+
+    if (!mkdtemp(temporary_directory)) {
+      perror("mkdtemp");
+
+      return EXIT_FAILURE;
+    }
+  }
+
+  static const MmcCodecId CODECS[] = {MMC_CODEC_ZLIB, MMC_CODEC_GZIP,
+                                      MMC_CODEC_RAW_DEFLATE};
+  static const int LEVELS[] = {0, 1, 6, 9};
+  static const int STRATEGIES[] = {Z_DEFAULT_STRATEGY, Z_FILTERED,
+                                   Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+  static const int WINDOW_BITS[] = {9, 12, 15};
+  static const int FLUSHES[] = {0, Z_SYNC_FLUSH, Z_FULL_FLUSH};
+  static const size_t SIZES[] = {0, 1, 1000, 100000, 1500000};
+
+  const size_t max_size = (size_t)3 << 20;
+  unsigned char *const data = malloc(max_size);
+  Buffer compressed = {.data = NULL, .size = 0, .capacity = 0};
+
+  if (!data) {
+    fputs("out of memory\n", stderr);
+
+    return EXIT_FAILURE;
+  }
+
+  char name[256];
+
+  for (size_t i = 0; i < NUM_RANDOM_CASES; ++i) {
+    const Case test_case = {
+        .codec = CODECS[random_below(3)],
+        .level = LEVELS[random_below(4)],
+        .strategy = STRATEGIES[random_below(5)],
+        .window_bits = WINDOW_BITS[random_below(3)],
+        .flush = FLUSHES[random_below(3)],
+        .flush_interval = 1000 + random_below(100000),
+    };
+    const DataKind kind = (DataKind)random_below(4);
+    const size_t size = SIZES[random_below(5)];
+
+    fill_data(kind, data, size);
+    describe_case(&test_case, kind, size, name, sizeof(name));
+
+    if (!compress_with_zlib(&test_case, data, size, &compressed)) {
+      fprintf(stderr, "%s: zlib couldn't compress\n", name);
+      ++num_failures;
+
+      continue;
+    }
+
+    check_stream(name, test_case.codec, &compressed, data, size);
+  }
+
+  // a gzip member that starts less than a window into a run of the fast
+  // decoder, whose back-references have to reach into its history
+  const Case first_member = {
+      .codec = MMC_CODEC_GZIP,
+      .level = 6,
+      .strategy = Z_DEFAULT_STRATEGY,
+      .window_bits = 15,
+      .flush = 0,
+  };
+  const Case second_member = {
+      .codec = MMC_CODEC_GZIP,
+      .level = 6,
+      .strategy = Z_DEFAULT_STRATEGY,
+      .window_bits = 15,
+      .flush = Z_SYNC_FLUSH,
+      .flush_interval = 4000,
+  };
+  const size_t first_size = 990000;
+  const size_t second_size = 1000000;
+  Buffer second = {.data = NULL, .size = 0, .capacity = 0};
+
+  fill_data(DATA_KIND_TEXT, data, first_size + second_size);
+
+  if (!compress_with_zlib(&first_member, data, first_size, &compressed) ||
+      !compress_with_zlib(&second_member, data + first_size, second_size,
+                          &second)) {
+    fputs("two members: zlib couldn't compress\n", stderr);
+    ++num_failures;
+  } else {
+    unsigned char *const grown =
+        realloc(compressed.data, compressed.size + second.size);
+
+    if (!grown) {
+      fputs("out of memory\n", stderr);
+
+      return EXIT_FAILURE;
+    }
+
+    memcpy(grown + compressed.size, second.data, second.size);
+    compressed.data = grown;
+    compressed.size += second.size;
+    compressed.capacity = compressed.size;
+
+    check_stream("two gzip members", MMC_CODEC_GZIP, &compressed, data,
+                 first_size + second_size);
+  }
+
+  // big enough to be split into several chunks by mi --threads
+  fill_data(DATA_KIND_MIXED, data, max_size);
+
+  for (size_t i = 0; i < sizeof(LEVELS) / sizeof(LEVELS[0]); ++i) {
+    const Case test_case = {
+        .codec = MMC_CODEC_GZIP,
+        .level = LEVELS[i],
+        .strategy = Z_DEFAULT_STRATEGY,
+        .window_bits = 15,
+        .flush = 0,
+    };
+
+    describe_case(&test_case, DATA_KIND_MIXED, max_size, name, sizeof(name));
+
+    if (!compress_with_zlib(&test_case, data, max_size, &compressed)) {
+      fprintf(stderr, "%s: zlib couldn't compress\n", name);
+      ++num_failures;
+
+      continue;
+    }
+
+    check_stream(name, test_case.codec, &compressed, data, max_size);
+  }
+
+  for (size_t i = 0; i < sizeof(CODECS) / sizeof(CODECS[0]); ++i) {
+    check_mmc_compression(CODECS[i], 1, data, max_size);
+    check_mmc_compression(CODECS[i], 9, data, SIZES[3]);
+  }
+
+  free(second.data);
+  free(compressed.data);
+  free(data);
+
+  if (mi_path) {
+    rmdir(temporary_directory);
+  }
+
+  if (num_failures > 0) {
+    fprintf(stderr, "%zu checks failed\n", num_failures);
+
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// text is words from a small vocabulary, runs are short sequences repeated at
+// distances under 16, and mixed switches between all three every few KiB
+static void fill_data(DataKind kind, unsigned char *data, size_t size) {
+  static const char *const WORDS[] = {
+      "the ",   "mapped ", "file ",   "is ",    "compressed ", "window ",
+      "block ", "of ",     "and ",    "zlib ",  "deflate ",    "stream ",
+      "a ",     "to ",     "chunk\n", "history ", "inflate ",  "output "};
+
+  size_t i = 0;
+
+  while (i < size) {
+    DataKind this_kind = kind;
+    size_t piece = size - i;
+
+    if (kind == DATA_KIND_MIXED) {
+      this_kind = (DataKind)random_below(3);
+      piece = piece < 4096 ? piece : 1 + random_below(8192);
+      piece = piece < size - i ? piece : size - i;
+    }
+
+    const size_t end = i + piece;
+
+    switch (this_kind) {
+    case DATA_KIND_TEXT:
+      while (i < end) {
+        const char *const word =
+            WORDS[random_below(sizeof(WORDS) / sizeof(WORDS[0]))];
+
+        for (size_t j = 0; word[j] && i < end; ++j) {
+          data[i++] = (unsigned char)word[j];
+        }
+      }
+
+      break;
+    case DATA_KIND_RANDOM:
+      for (; i < end; ++i) {
+        data[i] = (unsigned char)next_random();
+      }
+
+      break;
+    default:
+      while (i < end) {
+        const size_t period = 1 + random_below(15);
+        const size_t length = period + random_below(300);
+
+        for (size_t j = 0; j < length && i < end; ++j, ++i) {
+          data[i] = j < period ? (unsigned char)next_random()
+                               : data[i - period];
+        }
+      }
+
+      break;
+    }
+  }
+}
+
+static bool reserve(Buffer *buffer, size_t capacity) {
+  if (buffer->capacity >= capacity) {
+    return true;
+  }
+
+  unsigned char *const data = realloc(buffer->data, capacity);
+
+  if (!data) {
+    return false;
+  }
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+
+  return true;
+}
+
+static bool compress_with_zlib(const Case *test_case,
+                               const unsigned char *data, size_t size,
+                               Buffer *output) {
+  int window_bits = test_case->window_bits;
+
+  if (test_case->codec == MMC_CODEC_GZIP) {
+    window_bits += 16;
+  } else if (test_case->codec == MMC_CODEC_RAW_DEFLATE) {
+    window_bits = -window_bits;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  if (deflateInit2(&stream, test_case->level, Z_DEFLATED, window_bits, 8,
+                   test_case->strategy) != Z_OK) {
+    return false;
+  }
+
+  // every flush adds at most an empty stored block and a few bits
+  const size_t num_flushes =
+      test_case->flush ? size / test_case->flush_interval + 1 : 0;
+  const size_t bound = deflateBound(&stream, (uLong)size) + num_flushes * 16;
+
+  if (!reserve(output, bound + 1)) {
+    deflateEnd(&stream);
+
+    return false;
+  }
+
+  stream.next_in = (Bytef *)data;
+  stream.next_out = output->data;
+  stream.avail_out = (uInt)output->capacity;
+
+  int errc = Z_OK;
+
+  while (errc == Z_OK) {
+    const size_t remaining = size - (size_t)stream.total_in;
+    int flush = Z_FINISH;
+
+    if (test_case->flush && remaining > test_case->flush_interval) {
+      stream.avail_in = (uInt)test_case->flush_interval;
+      flush = test_case->flush;
+    } else {
+      stream.avail_in = (uInt)remaining;
+    }
+
+    errc = deflate(&stream, flush);
+
+    if (errc == Z_OK && flush == Z_FINISH) {
+      // ran out of output
+      break;
+    }
+  }
+
+  output->size = (size_t)stream.total_out;
+  deflateEnd(&stream);
+
+  return errc == Z_STREAM_END;
+}
+
+static bool equals(const char *name, const char *decoder,
+                   const unsigned char *actual, size_t actual_size,
+                   const unsigned char *expected, size_t expected_size) {
+  if (actual_size != expected_size) {
+    fprintf(stderr, "%s: %s inflated %zu bytes, expected %zu\n", name,
+            decoder, actual_size, expected_size);
+    ++num_failures;
+
+    return false;
+  }
+
+  for (size_t i = 0; i < expected_size; ++i) {
+    if (actual[i] != expected[i]) {
+      fprintf(stderr, "%s: %s differs first at byte %zu\n", name, decoder, i);
+      ++num_failures;
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void check_with_mi(const char *name, MmcCodecId codec,
+                          const Buffer *compressed, const unsigned char *data,
+                          size_t size);
+
+static void check_stream(const char *name, MmcCodecId codec,
+                         const Buffer *compressed, const unsigned char *data,
+                         size_t size) {
+  const MmcOptions options = mmc_make_options(codec);
+  MmcBuffer output;
+  Error error =
+      mmc_decompress_buffer(compressed->data, compressed->size, &output,
+                            &options);
+
+  if (error.what) {
+    fprintf(stderr, "%s: libmmc couldn't inflate: %s\n", name, error.what);
+    discard_error(error);
+    ++num_failures;
+  } else {
+    equals(name, "libmmc", output.data, output.size, data, size);
+    discard_error(mmc_free_buffer(output));
+  }
+
+  if (mi_path) {
+    check_with_mi(name, codec, compressed, data, size);
+  }
+}
+
+static bool write_file(const char *filename, const void *data, size_t size) {
+  FILE *const file = fopen(filename, "wb");
+
+  if (!file) {
+    return false;
+  }
+
+  const bool is_written = fwrite(data, 1, size, file) == size;
+
+  return (fclose(file) == 0) && is_written;
+}
+
+static bool read_file(const char *filename, Buffer *buffer) {
+  FILE *const file = fopen(filename, "rb");
+
+  if (!file) {
+    return false;
+  }
+
+  buffer->size = 0;
+  bool is_read = true;
+
+  while (is_read) {
+    if (!reserve(buffer, buffer->size + 65536)) {
+      is_read = false;
+
+      break;
+    }
+
+    const size_t num_read = fread(buffer->data + buffer->size, 1,
+                                  buffer->capacity - buffer->size, file);
+    buffer->size += num_read;
+
+    if (num_read == 0) {
+      is_read = !ferror(file);
+
+      break;
+    }
+  }
+
+  fclose(file);
+
+  return is_read;
+}
+
+static bool run_mi(const char *const arguments[]) {
+  const pid_t child = fork();
+
+  if (child == 0) {
+    execv(mi_path, (char *const *)arguments);
+    _exit(127);
+  } else if (child < 0) {
+    return false;
+  }
+
+  int status;
+
+  return waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+// mi --decoder=zlib, then mi --threads=4
+static void check_with_mi(const char *name, MmcCodecId codec,
+                          const Buffer *compressed, const unsigned char *data,
+                          size_t size) {
+  static const char *const FORMATS[] = {"--format=zlib", "--format=gzip",
+                                        "--format=raw"};
+  static const char *const MODES[] = {"--decoder=zlib", "--threads=4"};
+
+  char input_filename[sizeof(temporary_directory) + 16];
+  char output_filename[sizeof(temporary_directory) + 16];
+  sprintf(input_filename, "%s/input", temporary_directory);
+  sprintf(output_filename, "%s/output", temporary_directory);
+
+  if (!write_file(input_filename, compressed->data, compressed->size)) {
+    fprintf(stderr, "%s: couldn't write %s\n", name, input_filename);
+    ++num_failures;
+
+    return;
+  }
+
+  Buffer output = {.data = NULL, .size = 0, .capacity = 0};
+
+  for (size_t i = 0; i < sizeof(MODES) / sizeof(MODES[0]); ++i) {
+    const char *const arguments[] = {mi_path,        FORMATS[codec],
+                                     MODES[i],       input_filename,
+                                     output_filename, NULL};
+    char decoder[32];
+    sprintf(decoder, "mi %s", MODES[i]);
+
+    if (!run_mi(arguments)) {
+      fprintf(stderr, "%s: %s failed\n", name, decoder);
+      ++num_failures;
+    } else if (!read_file(output_filename, &output)) {
+      fprintf(stderr, "%s: couldn't read %s\n", name, output_filename);
+      ++num_failures;
+    } else {
+      equals(name, decoder, output.data, output.size, data, size);
+    }
+
+    unlink(output_filename);
+  }
+
+  free(output.data);
+  unlink(input_filename);
+}
+
+static void check_mmc_compression(MmcCodecId codec, int level,
+                                  const unsigned char *data, size_t size) {
+  char name[64];
+  sprintf(name, "libmmc %s level %d", MMC_CODEC_NAMES[codec], level);
+
+  MmcOptions options = mmc_make_options(codec);
+  options.level = level;
+  MmcBuffer compressed;
+  Error error = mmc_compress_buffer(data, size, &compressed, &options);
+
+  if (error.what) {
+    fprintf(stderr, "%s: couldn't compress: %s\n", name, error.what);
+    discard_error(error);
+    ++num_failures;
+
+    return;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  const int window_bits = codec == MMC_CODEC_ZLIB   ? 15
+                          : codec == MMC_CODEC_GZIP ? 15 + 16
+                                                    : -15;
+  unsigned char *const output = malloc(size + 1);
+
+  if (!output || inflateInit2(&stream, window_bits) != Z_OK) {
+    fprintf(stderr, "%s: couldn't start zlib\n", name);
+    ++num_failures;
+  } else {
+    stream.next_in = compressed.data;
+    stream.avail_in = (uInt)compressed.size;
+    stream.next_out = output;
+    stream.avail_out = (uInt)(size + 1);
+
+    const int errc = inflate(&stream, Z_FINISH);
+
+    if (errc != Z_STREAM_END) {
+      fprintf(stderr, "%s: zlib couldn't inflate: %d\n", name, errc);
+      ++num_failures;
+    } else {
+      equals(name, "zlib", output, (size_t)stream.total_out, data, size);
+    }
+
+    inflateEnd(&stream);
+  }
+
+  free(output);
+  discard_error(mmc_free_buffer(compressed));
+}
+
+static void describe_case(const Case *test_case, DataKind kind, size_t size,
+                          char *name, size_t name_size) {
+  static const char *const FLUSH_NAMES[] = {"none", "", "sync", "full"};
+
+  snprintf(name, name_size,
+           "%s %s size=%zu level=%d strategy=%d window-bits=%d flush=%s/%zu",
+           MMC_CODEC_NAMES[test_case->codec], DATA_KIND_NAMES[kind], size,
+           test_case->level, test_case->strategy, test_case->window_bits,
+           FLUSH_NAMES[test_case->flush], test_case->flush_interval);
+}